@@ -25,6 +25,7 @@ SOFTWARE.
 #ifndef __ACORNFS_H
 #define __ACORNFS_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 typedef enum {
@@ -52,11 +53,27 @@ typedef struct _tag_ACORN_DIRECTORY {
 extern "C" {
 #endif
 
+/**
+ * \brief Allocates an Acorn directory
+ *
+ * The directory, its files and storage for all of the names are allocated
+ * in one zeroed block.  The name pointers of the directory and of each
+ * file point into the block so a name of up to the given size, including
+ * the terminator, can be copied straight into it.  The whole directory is
+ * freed with a single call to acornfs_free_directory().
+ *
+ * \param num_of_files the number of files in the directory
+ * \param dir_name_size the size of the directory name storage
+ * \param file_name_size the size of the storage for each file name
+ * \return the directory or NULL if it could not be allocated
+ */
+ACORN_DIRECTORY * acornfs_alloc_directory(int num_of_files, size_t dir_name_size, size_t file_name_size);
+
 /**
  * \brief Frees the memory of an Acorn directory
  *
  * This frees all the dynamic memory used by an Acorn directory
- * structure.
+ * structure allocated with acornfs_alloc_directory().
  *
  * \param acorn_dirp pointer to the directory
  * \return 0 on success or an error
@@ -25,13 +25,66 @@ SOFTWARE.
 #ifndef __DEBUG_H
 #define __DEBUG_H
 
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define DEBUG_LEVEL_ERROR 1
 #define DEBUG_LEVEL_WARNING 2
 #define DEBUG_LEVEL_INFO 3
 #define DEBUG_LEVEL_DEBUG 4
 
+/* Events above this level are compiled out, along with their messages */
+#ifndef DEBUG_MAX_LEVEL
+#define DEBUG_MAX_LEVEL DEBUG_LEVEL_DEBUG
+#endif
+
 extern int verbosity;
 
-#define DEBUG_LEVEL(L) (verbosity >= (L))
+/* Errors are always recorded so they can be reported when something fails */
+#define DEBUG_LEVEL(L) ((L) <= DEBUG_MAX_LEVEL && ((L) <= DEBUG_LEVEL_ERROR || verbosity >= (L)))
+
+/* Records an event in the calling thread's trace, the message is only
+   formatted when the level is enabled */
+#define DEBUG_LOG(L, ...) do { if (DEBUG_LEVEL(L)) debug_log((L), __VA_ARGS__); } while (0)
+
+/**
+ * \brief Records an event in the calling thread's trace
+ *
+ * Each thread has its own ring of the most recent events so recording never
+ * takes a lock or touches stdio.  Use DEBUG_LOG() rather than calling this.
+ *
+ * \param level one of the DEBUG_LEVEL_ levels
+ * \param format printf style format of the message
+ */
+void debug_log(int level, const char * format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * \brief Writes the recorded events of every thread, oldest first
+ *
+ * \param stream where to write the events
+ * \return the number of events written
+ */
+int debug_dump(FILE * stream);
+
+/**
+ * \brief Writes the recorded events of every thread up to a level, oldest first
+ *
+ * \param stream where to write the events
+ * \param max_level the least important DEBUG_LEVEL_ level to write
+ * \return the number of events written
+ */
+int debug_dump_level(FILE * stream, int max_level);
+
+/**
+ * \brief Forgets every event recorded so far
+ */
+void debug_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
 
-#endif
\ No newline at end of file
+#endif
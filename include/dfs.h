@@ -25,9 +25,13 @@ SOFTWARE.
 #ifndef __DFS_H
 #define __DFS_H
 
+#include <stdio.h>
 #include <stdint.h>
+#include <sys/types.h>
 #include "acornfs.h"
 #include "dfserr.h"
+#include "dfsgeom.h"
+#include "dfsio.h"
 
 #define DFS_SECTOR_SIZE 256
 #define DFS_SECTORS_PER_TRACK 10
@@ -90,6 +94,11 @@ typedef struct {
 #define DFS_MAX_FILE_NAME_LEN 7
 #define DFS_LOCK_BIT          0x80
 
+/* Storage for names including the terminator.  A file name has a '.'
+   and the directory character after it */
+#define DFS_DISK_NAME_SIZE    (DFS_MAX_DISK_NAME_LEN + 1)
+#define DFS_FILE_NAME_SIZE    (DFS_MAX_FILE_NAME_LEN + 3)
+
 #define DFS_START_SECTOR_HIGH_MASK      0x03
 #define DFS_START_SECTOR_HIGH_SHIFT     0
 #define DFS_LOAD_ADDRESS_BIT_17_18_MASK 0x0c
@@ -99,15 +108,36 @@ typedef struct {
 #define DFS_EXEC_ADDRESS_BIT_17_18_MASK 0xc0
 #define DFS_EXEC_ADDRESS_SHIFT          6
 
+typedef struct {
+  int files_moved;       /* Files whose start sector changed */
+  int num_of_moves;      /* Read and write pairs used to move them */
+  uint32_t bytes_moved;  /* Bytes of sector data moved */
+  int free_sectors;      /* Size of the single free extent afterwards */
+} DFS_COMPACT_STATS;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * \brief Decodes a DFS catalogue
+ *
+ * This function decodes the catalogue held in the first two sectors of a
+ * DFS disk, which may be anywhere in memory, for example in a memory mapped
+ * disk image.
+ *
+ * \param sector0 pointer to the contents of sector 0
+ * \param sector1 pointer to the contents of sector 1
+ * \param acorn_dirpp pointer in which to return the acorn directory
+ * \return 0 on success or an error
+ */
+int dfs_parse_catalogue(const uint8_t * sector0, const uint8_t * sector1, ACORN_DIRECTORY ** acorn_dirpp);
+
 /**
  * \brief reads the catalogue from a DFS disk
  *
- * This function reads the catalogue from a DFS disk. It assumes the file
- * pointer is set to the start of the disk image file.
+ * This function reads the catalogue from a DFS disk which starts at the
+ * current position of the disk image file.  The position is not changed.
  *
  * \param diskfile the disk image file reference
  * \param acorn_dirpp pointer in which to return the acorn directory
@@ -115,9 +145,22 @@ extern "C" {
  */
 int dfs_read_catalogue(FILE * diskfile, ACORN_DIRECTORY ** acorn_dirpp);
 
+/**
+ * \brief Reads the catalogue from a DFS disk through an I/O backend
+ *
+ * \param iop pointer to the I/O
+ * \param geometryp where the disk's sectors are in the image
+ * \param acorn_dirpp pointer in which to return the acorn directory
+ * \return 0 on success or an error
+ */
+int dfs_read_catalogue_io(DFS_IO * iop, const DFS_GEOMETRY * geometryp, ACORN_DIRECTORY ** acorn_dirpp);
+
 /**
  * \brief Creates an empty DFS disk file
  *
+ * Only the catalogue is written.  The rest of the disk is created as a
+ * hole in the file, which reads back as zeros, where the file allows it.
+ *
  * \param num_of_sectors this should be 400 or 800 for 40 or 80 track disks
  * \param name the disk name
  * \param diskfile the disk image file reference
@@ -126,9 +169,43 @@ int dfs_read_catalogue(FILE * diskfile, ACORN_DIRECTORY ** acorn_dirpp);
  */
 int dfs_format_diskfile(int num_of_sectors, const char * name, FILE * diskfile);
 
+/**
+ * \brief Creates an empty DFS disk through an I/O backend
+ *
+ * A whole single sided image is resized to the disk, which leaves a hole
+ * in a file.  Other images, or ones that cannot be resized, have the data
+ * sectors written as zeros.
+ *
+ * \param iop pointer to the I/O
+ * \param geometryp where the disk's sectors are in the image
+ * \param num_of_sectors this should be 400 or 800 for 40 or 80 track disks
+ * \param name the disk name
+ *
+ * \return 0 on success or an error
+ */
+int dfs_format_io(DFS_IO * iop, const DFS_GEOMETRY * geometryp, int num_of_sectors, const char * name);
+
+/**
+ * \brief Creates a DFS disk file by cloning a template disk image
+ *
+ * Uses a reflink clone where the file system supports it and a kernel
+ * copy otherwise, then sets the disk name.
+ *
+ * \param template_file the template disk image file reference
+ * \param name the disk name
+ * \param diskfile the disk image file reference
+ *
+ * \return 0 on success or an error
+ */
+int dfs_format_from_template(FILE * template_file, const char * name, FILE * diskfile);
+
 /**
  * \brief Extracts a file from a DFS disk image
  *
+ * The disk is taken to start at the current position of the disk image
+ * file, as for all the functions here, so a disk held in a container such
+ * as an MMB file can be used in place.
+ *
  * \param diskfile the disk image file reference
  * \param start_sector the start sector
  * \param file_length the file length
@@ -138,6 +215,84 @@ int dfs_format_diskfile(int num_of_sectors, const char * name, FILE * diskfile);
  */
 int dfs_extract_file(FILE * diskfile, const ACORN_FILE *acorn_filep, FILE * file);
 
+/**
+ * \brief Extracts a file from a DFS disk with a given geometry
+ *
+ * Only positional reads are made on the disk image file, so any number of
+ * threads can extract from the same file at once.
+ *
+ * \param diskfile the disk image file reference
+ * \param geometryp where the disk's sectors are in the disk image file
+ * \param acorn_filep pointer to the file meta data
+ * \param file the local file reference
+ *
+ * \return 0 on success or an error
+ */
+int dfs_extract_file_at(FILE * diskfile, const DFS_GEOMETRY * geometryp, const ACORN_FILE * acorn_filep, FILE * file);
+
+/**
+ * \brief Extracts a file from a DFS disk through an I/O backend
+ *
+ * Only positional reads are made, so any number of threads can extract
+ * from the same image at once.
+ *
+ * \param iop pointer to the I/O
+ * \param geometryp where the disk's sectors are in the image
+ * \param acorn_filep pointer to the file meta data
+ * \param file the local file reference
+ *
+ * \return 0 on success or an error
+ */
+int dfs_extract_file_io(DFS_IO * iop, const DFS_GEOMETRY * geometryp, const ACORN_FILE * acorn_filep, FILE * file);
+
+/**
+ * \brief Checks that a file's contents are all in a DFS disk image
+ *
+ * Only the last sector of the file may be cut short, as it is at the end
+ * of many images.  This is the check that extraction makes, so files can
+ * be checked before anything is written for them.
+ *
+ * \param iop pointer to the I/O
+ * \param geometryp where the disk's sectors are in the image
+ * \param acorn_filep pointer to the file meta data
+ *
+ * \return 0 if the file is all there, DFS_ERROR_BAD_EXTENT if not, or an error
+ */
+int dfs_check_file_io(DFS_IO * iop, const DFS_GEOMETRY * geometryp, const ACORN_FILE * acorn_filep);
+
+/**
+ * \brief Extracts a number of files from a DFS disk with a given geometry
+ *
+ * The files are read in start sector order, whatever order they are given
+ * in, and files close together on the disk are read with a single read, so
+ * the disk image is read in one forward sweep.  The kernel is told the
+ * whole span to be read up front so it can read ahead.
+ *
+ * \param diskfile the disk image file reference
+ * \param geometryp where the disk's sectors are in the disk image file
+ * \param acorn_files array of pointers to the file meta data
+ * \param files array of local file references
+ * \param num_of_files the number of files to extract
+ *
+ * \return 0 on success or an error
+ */
+int dfs_extract_files_at(FILE * diskfile, const DFS_GEOMETRY * geometryp, const ACORN_FILE ** acorn_files, FILE ** files, int num_of_files);
+
+/**
+ * \brief Extracts a number of files from a DFS disk through an I/O backend
+ *
+ * As dfs_extract_files_at().
+ *
+ * \param iop pointer to the I/O
+ * \param geometryp where the disk's sectors are in the image
+ * \param acorn_files array of pointers to the file meta data
+ * \param files array of local file references
+ * \param num_of_files the number of files to extract
+ *
+ * \return 0 on success or an error
+ */
+int dfs_extract_files_io(DFS_IO * iop, const DFS_GEOMETRY * geometryp, const ACORN_FILE ** acorn_files, FILE ** files, int num_of_files);
+
 /**
  * \brief Adds a file to the DFS disk image
  *
@@ -149,6 +304,154 @@ int dfs_extract_file(FILE * diskfile, const ACORN_FILE *acorn_filep, FILE * file
  */
 int dfs_add_file(FILE * diskfile, ACORN_FILE * acorn_filep, FILE * file);
 
+/**
+ * \brief Adds a number of files to the DFS disk image
+ *
+ * All placements are planned up front, the file data is written in one
+ * ascending pass and the catalogue is written once.
+ *
+ * \param diskfile the disk image file reference
+ * \param acorn_files array of file meta data, the start sectors are filled in
+ * \param files array of local file references
+ * \param num_of_new_files the number of files to add
+ * \param alloc_policy one of the DFS_ALLOC_ policies from dfsalloc.h
+ *
+ * \return 0 on success or an error
+ */
+int dfs_add_files(FILE * diskfile, ACORN_FILE * acorn_files, FILE ** files, int num_of_new_files, int alloc_policy);
+
+/**
+ * \brief Adds a number of files to a DFS disk with a given geometry
+ *
+ * As dfs_add_files() but for a disk that need not be held in order, such
+ * as one side of a double sided interleaved image.
+ *
+ * \param diskfile the disk image file reference
+ * \param geometryp where the disk's sectors are in the disk image file
+ * \param acorn_files array of file meta data, the start sectors are filled in
+ * \param files array of local file references
+ * \param num_of_new_files the number of files to add
+ * \param alloc_policy one of the DFS_ALLOC_ policies
+ *
+ * \return 0 on success or an error
+ */
+int dfs_add_files_at(FILE * diskfile, const DFS_GEOMETRY * geometryp, ACORN_FILE * acorn_files, FILE ** files, int num_of_new_files, int alloc_policy);
+
+/**
+ * \brief Adds a number of files to a DFS disk through an I/O backend
+ *
+ * As dfs_add_files().  The local files are read at an offset so their
+ * positions are not used or changed.
+ *
+ * \param iop pointer to the I/O
+ * \param geometryp where the disk's sectors are in the image
+ * \param acorn_files array of file meta data, the start sectors are filled in
+ * \param files array of local file references
+ * \param num_of_new_files the number of files to add
+ * \param alloc_policy one of the DFS_ALLOC_ policies
+ *
+ * \return 0 on success or an error
+ */
+int dfs_add_files_io(DFS_IO * iop, const DFS_GEOMETRY * geometryp, ACORN_FILE * acorn_files, FILE ** files, int num_of_new_files, int alloc_policy);
+
+/**
+ * \brief Removes files from a DFS disk image
+ *
+ * Only the two catalogue sectors are rewritten, the file data is not
+ * touched.  If any of the files cannot be removed then none are.
+ *
+ * \param diskfile the disk image file reference
+ * \param names array of the names of the files to remove
+ * \param num_of_names the number of names
+ *
+ * \return 0 on success or an error
+ */
+int dfs_remove_files(FILE * diskfile, const char ** names, int num_of_names);
+
+/**
+ * \brief Removes files from a DFS disk through an I/O backend
+ *
+ * \param iop pointer to the I/O
+ * \param geometryp where the disk's sectors are in the image
+ * \param names array of the names of the files to remove
+ * \param num_of_names the number of names
+ *
+ * \return 0 on success or an error
+ */
+int dfs_remove_files_io(DFS_IO * iop, const DFS_GEOMETRY * geometryp, const char ** names, int num_of_names);
+
+/**
+ * \brief Removes a file from a DFS disk image
+ *
+ * \param diskfile the disk image file reference
+ * \param name the name of the file to remove
+ *
+ * \return 0 on success or an error
+ */
+int dfs_remove_file(FILE * diskfile, const char * name);
+
+/**
+ * \brief Updates the meta data of a file in a DFS disk image
+ *
+ * Replaces the load address, execution address and locked attribute of
+ * the named file.  Only the two catalogue sectors are rewritten.
+ *
+ * \param diskfile the disk image file reference
+ * \param acorn_filep pointer to the file name and new meta data
+ *
+ * \return 0 on success or an error
+ */
+int dfs_update_file(FILE * diskfile, const ACORN_FILE * acorn_filep);
+
+/**
+ * \brief Updates the meta data of a file in a DFS disk through an I/O backend
+ *
+ * \param iop pointer to the I/O
+ * \param geometryp where the disk's sectors are in the image
+ * \param acorn_filep pointer to the file name and new meta data
+ *
+ * \return 0 on success or an error
+ */
+int dfs_update_file_io(DFS_IO * iop, const DFS_GEOMETRY * geometryp, const ACORN_FILE * acorn_filep);
+
+/**
+ * \brief Compacts a DFS disk image
+ *
+ * Slides files down the disk so that all of the free space is in one
+ * extent at the end.  Each sector is moved at most once and files already
+ * in place are left alone.
+ *
+ * \param diskfile the disk image file reference
+ * \param statsp pointer in which to return what was moved, may be NULL
+ *
+ * \return 0 on success or an error
+ */
+int dfs_compact(FILE * diskfile, DFS_COMPACT_STATS * statsp);
+
+/**
+ * \brief Compacts a DFS disk with a given geometry
+ *
+ * As dfs_compact() but for a disk that need not be held in order.
+ *
+ * \param diskfile the disk image file reference
+ * \param geometryp where the disk's sectors are in the disk image file
+ * \param statsp pointer in which to return what was moved, may be NULL
+ *
+ * \return 0 on success or an error
+ */
+int dfs_compact_at(FILE * diskfile, const DFS_GEOMETRY * geometryp, DFS_COMPACT_STATS * statsp);
+
+/**
+ * \brief Compacts a DFS disk through an I/O backend
+ *
+ * \param iop pointer to the I/O
+ * \param geometryp where the disk's sectors are in the image
+ * \param statsp pointer in which to return what was moved, may be NULL
+ *
+ * \return 0 on success or an error
+ */
+int dfs_compact_io(DFS_IO * iop, const DFS_GEOMETRY * geometryp, DFS_COMPACT_STATS * statsp);
+
 #ifdef __cplusplus
 }
 #endif
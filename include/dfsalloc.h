@@ -0,0 +1,80 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __DFSALLOC_H
+#define __DFSALLOC_H
+
+#include <stdint.h>
+#include "dfs.h"
+
+/* Sector allocation policies */
+#define DFS_ALLOC_FIRST_FIT 0 /* Lowest free extent that is big enough */
+#define DFS_ALLOC_BEST_FIT  1 /* Smallest free extent that is big enough */
+#define DFS_ALLOC_APPEND    2 /* After the last file on the disk */
+
+typedef struct {
+  int start_sector;
+  int num_of_sectors;
+} DFS_EXTENT;
+
+/* A DFS disk has at most one more free extent than it has files */
+#define DFS_MAX_FREE_EXTENTS (DFS_MAX_FILES + 1)
+
+typedef struct {
+  int num_of_sectors;  /* Size of the disk */
+  int num_of_extents;
+  DFS_EXTENT extents[DFS_MAX_FREE_EXTENTS]; /* Sorted by start sector, never adjacent */
+} DFS_FREE_MAP;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief Builds the free space map of a disk
+ *
+ * \param used array of the extents used by files, in any order
+ * \param num_of_used the number of used extents
+ * \param num_of_sectors the number of sectors on the disk
+ * \param mapp pointer to the map to fill in
+ * \return 0 on success or an error
+ */
+int dfs_free_map_build(const DFS_EXTENT * used, int num_of_used, int num_of_sectors, DFS_FREE_MAP * mapp);
+
+/**
+ * \brief Allocates a run of sectors
+ *
+ * \param mapp pointer to the map
+ * \param num_of_sectors the number of sectors required
+ * \param policy one of the DFS_ALLOC_ policies
+ * \param start_sectorp pointer in which to return the first allocated sector
+ * \return 0 on success, DFS_ERROR_DISK_FULL if there is no space or an error
+ */
+int dfs_free_map_allocate(DFS_FREE_MAP * mapp, int num_of_sectors, int policy, int * start_sectorp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DFSALLOC_H */
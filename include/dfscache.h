@@ -0,0 +1,132 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __DFSCACHE_H
+#define __DFSCACHE_H
+
+#include <stdint.h>
+#include "acornfs.h"
+
+/* A cache of decoded catalogues, so that a corpus of disk images can be
+   listed without reading any image that has not changed since it was last
+   listed.  Each catalogue is keyed by the image path together with the size
+   and modification time of the file holding it.
+
+   The cache file is a header, a table of fixed size disk records sorted by
+   path, a table of fixed size file records and a table of paths.  It is
+   mapped as it is and searched in place, so opening even a large cache only
+   reads it from front to back */
+#define DFS_CACHE_MAGIC   "DFSCACHE"
+#define DFS_CACHE_VERSION 1
+
+typedef struct {
+  uint64_t size;        /* Size of the file holding the image */
+  int64_t mtime_sec;    /* Modification time of the file holding the image */
+  uint32_t mtime_nsec;
+  uint8_t cycle_number; /* Catalogue cycle number, filled in when stored */
+} DFS_CACHE_KEY;
+
+/* An open catalogue cache */
+typedef struct _tag_DFS_CACHE DFS_CACHE;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief Opens a catalogue cache
+ *
+ * A cache file that does not exist yet, or that cannot be used, is treated
+ * as empty and is written afresh by dfs_cache_save().
+ *
+ * \param path the cache file name
+ * \param cachepp pointer in which to return the cache handle
+ * \return 0 on success or an error
+ */
+int dfs_cache_open(const char * path, DFS_CACHE ** cachepp);
+
+/**
+ * \brief Closes a catalogue cache without saving it
+ *
+ * \param cachep the cache handle
+ * \return 0 on success or an error
+ */
+int dfs_cache_close(DFS_CACHE * cachep);
+
+/**
+ * \brief Gets the key of a disk image as it is now
+ *
+ * For a disk in a container, such as file.mmb:12 or file.dsd:1, the key is
+ * that of the container.
+ *
+ * \param image_path the disk image name
+ * \param keyp pointer to the key to fill in
+ * \return 0 on success or an error
+ */
+int dfs_cache_get_key(const char * image_path, DFS_CACHE_KEY * keyp);
+
+/**
+ * \brief Looks up the catalogue of a disk image
+ *
+ * \param cachep the cache handle
+ * \param image_path the disk image name
+ * \param keyp the key of the image as it is now
+ * \param acorn_dirpp pointer in which to return a copy of the catalogue,
+ *        which must be freed with acornfs_free_directory()
+ * \return 0 on success, DFS_ERROR_FILE_NOT_FOUND if the image is not in the
+ *         cache or has changed, or another error
+ */
+int dfs_cache_lookup(DFS_CACHE * cachep, const char * image_path, const DFS_CACHE_KEY * keyp, ACORN_DIRECTORY ** acorn_dirpp);
+
+/**
+ * \brief Stores the catalogue of a disk image
+ *
+ * The key should be taken before the catalogue is read so that a change
+ * made while reading it is seen next time.
+ *
+ * \param cachep the cache handle
+ * \param image_path the disk image name
+ * \param keyp the key of the image, including the catalogue cycle number
+ * \param acorn_dirp the catalogue
+ * \return 0 on success or an error
+ */
+int dfs_cache_store(DFS_CACHE * cachep, const char * image_path, const DFS_CACHE_KEY * keyp, const ACORN_DIRECTORY * acorn_dirp);
+
+/**
+ * \brief Writes the cache file if anything has been stored
+ *
+ * Catalogues already in the cache that were not replaced are kept.  The new
+ * file is written alongside the old and renamed over it, so a reader never
+ * sees a part written cache.
+ *
+ * \param cachep the cache handle
+ * \return 0 on success or an error
+ */
+int dfs_cache_save(DFS_CACHE * cachep);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DFSCACHE_H */
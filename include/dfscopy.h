@@ -0,0 +1,60 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __DFSCOPY_H
+#define __DFSCOPY_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Pass as the output offset to write at, and advance, the current file position */
+#define DFS_COPY_CURRENT_OFFSET ((off_t)-1)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief Copies a range of bytes from one file to another
+ *
+ * The copy is done in the kernel where possible, using copy_file_range()
+ * and then, when writing at the current output position, sendfile(),
+ * falling back to a large buffered copy when neither is supported for the
+ * pair of files.  The input file position is never used or changed, nor is
+ * the output file position when an output offset is given.
+ *
+ * \param in_fd the source file descriptor
+ * \param in_offset the offset in the source file
+ * \param out_fd the destination file descriptor
+ * \param out_offset the offset in the destination file or DFS_COPY_CURRENT_OFFSET
+ * \param length the number of bytes to copy
+ * \return 0 on success or an error
+ */
+int dfs_copy_range(int in_fd, off_t in_offset, int out_fd, off_t out_offset, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DFSCOPY_H */
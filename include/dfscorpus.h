@@ -0,0 +1,168 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __DFSCORPUS_H
+#define __DFSCORPUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "acornfs.h"
+#include "dfsindex.h"
+
+/* An index of the files on many disk images, for answering questions about
+   a whole corpus without reading any of its images.  Each property of a file
+   is stored as a separate column, so a query only reads the columns it
+   tests, and only for the files that passed the tests before it.
+
+   The index file is a header, the columns in turn and a table of image
+   paths.  It is mapped as it is and scanned in place */
+#define DFS_CORPUS_MAGIC   "DFSCORPS"
+#define DFS_CORPUS_VERSION 1
+
+/* The columns that can be tested */
+typedef enum {
+  DFS_CORPUS_NAME,
+  DFS_CORPUS_LOAD,
+  DFS_CORPUS_EXEC,
+  DFS_CORPUS_LENGTH,
+  DFS_CORPUS_START,
+  DFS_CORPUS_LOCKED,
+  DFS_CORPUS_IMAGE
+} DFS_CORPUS_COLUMN;
+
+typedef enum {
+  DFS_CORPUS_EQ,
+  DFS_CORPUS_NE,
+  DFS_CORPUS_LT,
+  DFS_CORPUS_LE,
+  DFS_CORPUS_GT,
+  DFS_CORPUS_GE
+} DFS_CORPUS_OP;
+
+/* A test of one column, such as load=0x1900 or length>10K.  Names and
+   image paths are compared for equality, or matched against a wildcard
+   pattern, names without regard to case */
+typedef struct {
+  DFS_CORPUS_COLUMN column;
+  DFS_CORPUS_OP op;
+  uint32_t value;            /* Numeric columns */
+  DFS_NAME_KEY key;          /* Name without wildcards */
+  const char * pattern;      /* Name with wildcards or image path */
+} DFS_CORPUS_PREDICATE;
+
+/* An open corpus index */
+typedef struct _tag_DFS_CORPUS DFS_CORPUS;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief Writes a corpus index
+ *
+ * \param path the index file name
+ * \param image_paths the disk image names
+ * \param acorn_dirps the catalogue of each image, NULL for an image that
+ *        could not be read, which is left out
+ * \param num_of_images the number of images
+ * \return 0 on success or an error
+ */
+int dfs_corpus_write(const char * path, const char * const * image_paths, const ACORN_DIRECTORY * const * acorn_dirps, size_t num_of_images);
+
+/**
+ * \brief Opens a corpus index
+ *
+ * \param path the index file name
+ * \param corpuspp pointer in which to return the corpus handle
+ * \return 0 on success or an error
+ */
+int dfs_corpus_open(const char * path, DFS_CORPUS ** corpuspp);
+
+/**
+ * \brief Closes a corpus index
+ *
+ * \param corpusp the corpus handle
+ * \return 0 on success or an error
+ */
+int dfs_corpus_close(DFS_CORPUS * corpusp);
+
+/**
+ * \brief Gets the number of images and files in a corpus index
+ *
+ * \param corpusp the corpus handle
+ * \param num_of_imagesp pointer in which to return the number of images
+ * \param num_of_filesp pointer in which to return the number of files
+ * \return 0 on success or an error
+ */
+int dfs_corpus_get_size(const DFS_CORPUS * corpusp, size_t * num_of_imagesp, size_t * num_of_filesp);
+
+/**
+ * \brief Parses a predicate such as load=1900, length>10K or name=!BOOT
+ *
+ * Numbers are hexadecimal when they start with 0x and may end in K for
+ * kilobytes.  Locked is tested against 0 or 1.  The predicate refers to the
+ * text, which must outlive it.
+ *
+ * \param text the predicate
+ * \param predicatep pointer to the predicate to fill in
+ * \return 0 on success or an error
+ */
+int dfs_corpus_parse_predicate(const char * text, DFS_CORPUS_PREDICATE * predicatep);
+
+/**
+ * \brief Finds the files that pass every one of a set of predicates
+ *
+ * The files are split into blocks that are scanned in parallel.  Within a
+ * block each predicate is tested only for the files that passed the ones
+ * before it, cheapest first, and image paths are tested once per image
+ * rather than once per file.
+ *
+ * \param corpusp the corpus handle
+ * \param predicates the predicates
+ * \param num_of_predicates the number of predicates, 0 for every file
+ * \param num_of_threads the number of threads to scan with
+ * \param rowsp pointer in which to return the matching files in index
+ *        order, which must be freed
+ * \param num_of_rowsp pointer in which to return the number of matches
+ * \return 0 on success or an error
+ */
+int dfs_corpus_query(const DFS_CORPUS * corpusp, const DFS_CORPUS_PREDICATE * predicates, int num_of_predicates, int num_of_threads, uint32_t ** rowsp, size_t * num_of_rowsp);
+
+/**
+ * \brief Gets a file from a corpus index
+ *
+ * \param corpusp the corpus handle
+ * \param row the file, as returned by dfs_corpus_query()
+ * \param image_pathp pointer in which to return the path of its image
+ * \param acorn_filep pointer to the file meta data to fill in.  The name
+ *        points into the index
+ * \return 0 on success or an error
+ */
+int dfs_corpus_get_file(const DFS_CORPUS * corpusp, uint32_t row, const char ** image_pathp, ACORN_FILE * acorn_filep);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DFSCORPUS_H */
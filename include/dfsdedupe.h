@@ -0,0 +1,96 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __DFSDEDUPE_H
+#define __DFSDEDUPE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Files with the same hash and length, so very likely the same contents */
+typedef struct {
+  uint64_t hash;
+  uint32_t length;
+  size_t num_of_copies;
+  const uint64_t * tags;     /* The tag of each copy, in ascending order */
+} DFS_DEDUPE_GROUP;
+
+/* A table of file hashes that any number of threads can add to at once */
+typedef struct _tag_DFS_DEDUPE DFS_DEDUPE;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief Creates an empty table of file hashes
+ *
+ * \param dedupepp pointer in which to return the table
+ * \return 0 on success or an error
+ */
+int dfs_dedupe_create(DFS_DEDUPE ** dedupepp);
+
+/**
+ * \brief Frees a table of file hashes
+ *
+ * \param dedupep the table
+ * \return 0 on success or an error
+ */
+int dfs_dedupe_free(DFS_DEDUPE * dedupep);
+
+/**
+ * \brief Adds a file to a table of file hashes
+ *
+ * The table is split into shards by hash, each with its own lock, so
+ * threads adding different files rarely wait for each other.
+ *
+ * \param dedupep the table
+ * \param hash the hash of the file's contents
+ * \param length the length of the file
+ * \param tag a value identifying the file to the caller
+ * \return 0 on success or an error
+ */
+int dfs_dedupe_add(DFS_DEDUPE * dedupep, uint64_t hash, uint32_t length, uint64_t tag);
+
+/**
+ * \brief Gets the groups of files with the same hash and length
+ *
+ * Only groups of two or more files are returned, those that would reclaim
+ * the most space first.  No files should be added while this is called.
+ * The table holds only hashes, so the caller must compare the contents of
+ * the files in a group to be sure they are the same.
+ *
+ * \param dedupep the table
+ * \param groupsp pointer in which to return the groups, which must be
+ *        freed.  Their tags belong to the table
+ * \param num_of_groupsp pointer in which to return the number of groups
+ * \return 0 on success or an error
+ */
+int dfs_dedupe_get_groups(DFS_DEDUPE * dedupep, DFS_DEDUPE_GROUP ** groupsp, size_t * num_of_groupsp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DFSDEDUPE_H */
@@ -32,5 +32,14 @@ SOFTWARE.
 #define DFS_ERROR_INVALID_FILE_NAME         0x10004
 #define DFS_ERROR_DISK_FULL                 0x10005
 #define DFS_ERROR_FILE_EXISTS               0x10006
+#define DFS_ERROR_IMAGE_NOT_FOUND           0x10007
+#define DFS_ERROR_OPEN_FAILED               0x10008
+#define DFS_ERROR_FILE_NOT_FOUND            0x10009
+#define DFS_ERROR_READ_ONLY                 0x1000a
+#define DFS_ERROR_NOT_MAPPED                0x1000b
+#define DFS_ERROR_BAD_EXTENT                0x1000c
+#define DFS_ERROR_FILE_LOCKED               0x1000d
+#define DFS_ERROR_NOT_AN_MMB                0x1000e
+#define DFS_ERROR_INVALID_SLOT              0x1000f
 
 #endif
\ No newline at end of file
@@ -0,0 +1,102 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __DFSGEOM_H
+#define __DFSGEOM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/* Where the sectors of a disk are in its image file.  A single sided image
+   holds the sectors in order.  A double sided image (.dsd) interleaves the
+   two sides a track at a time: track 0 of side 0, track 0 of side 1, track
+   1 of side 0 and so on */
+typedef struct {
+  off_t disk_offset;   /* Where the first track of the image starts in the file */
+  int num_of_sides;    /* Sides interleaved in the image, 1 if not interleaved */
+  int side;            /* The side holding the disk */
+} DFS_GEOMETRY;
+
+#define DFS_DSD_NUM_OF_SIDES 2
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief Sets up a disk geometry
+ *
+ * \param geometryp pointer to the geometry
+ * \param disk_offset where the first track of the image starts in the file
+ * \param num_of_sides 1 for a single sided image or 2 for an interleaved one
+ * \param side the side holding the disk
+ * \return 0 on success or an error
+ */
+int dfs_geometry_init(DFS_GEOMETRY * geometryp, off_t disk_offset, int num_of_sides, int side);
+
+/**
+ * \brief Gets the position of a sector in the image file
+ *
+ * \param geometryp pointer to the geometry
+ * \param sector the logical sector on the disk
+ * \return the offset of the sector in the file
+ */
+off_t dfs_geometry_sector_offset(const DFS_GEOMETRY * geometryp, int sector);
+
+/**
+ * \brief Gets how many sectors from a sector follow it in the image file
+ *
+ * \param geometryp pointer to the geometry
+ * \param sector the logical sector on the disk
+ * \param num_of_sectors the most sectors wanted
+ * \return the number of sectors, at least 1, that can be read in one go
+ */
+int dfs_geometry_run_length(const DFS_GEOMETRY * geometryp, int sector, int num_of_sectors);
+
+/**
+ * \brief Splits a double sided interleaved image into two single sided images
+ *
+ * \param dsdfile the double sided image file reference
+ * \param side0file the file reference for side 0
+ * \param side1file the file reference for side 1
+ * \return 0 on success or an error
+ */
+int dfs_dsd_split(FILE * dsdfile, FILE * side0file, FILE * side1file);
+
+/**
+ * \brief Joins two single sided images into a double sided interleaved image
+ *
+ * \param side0file the file reference for side 0
+ * \param side1file the file reference for side 1
+ * \param dsdfile the double sided image file reference
+ * \return 0 on success or an error
+ */
+int dfs_dsd_join(FILE * side0file, FILE * side1file, FILE * dsdfile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DFSGEOM_H */
@@ -0,0 +1,323 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __DFSIMAGE_H
+#define __DFSIMAGE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "acornfs.h"
+#include "dfs.h"
+#include "dfserr.h"
+
+#define DFS_IMAGE_READ   0x01
+#define DFS_IMAGE_WRITE  0x02
+#define DFS_IMAGE_CREATE 0x04
+#define DFS_IMAGE_MMAP   0x08
+
+/* Opaque handle to an open DFS disk image */
+typedef struct _tag_DFS_IMAGE DFS_IMAGE;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief Opens a DFS disk image
+ *
+ * The image stays open until dfs_image_close() is called so that any
+ * number of catalogue, extract and add operations can be performed on it
+ * without reopening the file.  DFS_IMAGE_CREATE creates (or truncates) the
+ * image file, which must then be formatted with dfs_image_format().
+ *
+ * DFS_IMAGE_MMAP maps the whole image into memory.  The catalogue is then
+ * decoded straight out of the mapping and file contents can be accessed in
+ * place with dfs_image_get_file_data().  The image must not be truncated by
+ * another process while it is mapped.
+ *
+ * A path of the form file.mmb:slot opens a slot of an MMB file, as
+ * dfs_image_open_slot() does.  A double sided interleaved image, file.dsd,
+ * opens side 0 and file.dsd:1 opens side 1, as dfs_image_open_side() does.
+ * A path is only split like this when no file has the whole path as its
+ * name, and the part before the colon is a double sided image or an MMB
+ * file, by its name or its index.
+ * A double sided image cannot be opened with DFS_IMAGE_CREATE.
+ *
+ * \param path the disk image file name
+ * \param flags combination of DFS_IMAGE_READ, DFS_IMAGE_WRITE and DFS_IMAGE_CREATE
+ * \param imagepp pointer in which to return the image handle
+ * \return 0 on success or an error
+ */
+int dfs_image_open(const char * path, int flags, DFS_IMAGE ** imagepp);
+
+/**
+ * \brief Opens one side of a double sided interleaved DFS disk image
+ *
+ * The side is used in place.  Its sectors are not contiguous in the file
+ * so it is never mapped and dfs_image_get_file_data() is not available.
+ *
+ * \param path the disk image file name
+ * \param side the side, 0 or 1
+ * \param flags combination of DFS_IMAGE_READ, DFS_IMAGE_WRITE and DFS_IMAGE_MMAP
+ * \param imagepp pointer in which to return the image handle
+ * \return 0 on success or an error
+ */
+int dfs_image_open_side(const char * path, int side, int flags, DFS_IMAGE ** imagepp);
+
+/**
+ * \brief Opens a DFS disk image held in a slot of an MMB file
+ *
+ * The slot is used in place, without copying it out of the MMB file.
+ * Locked slots can only be opened for reading.
+ *
+ * \param path the MMB file name
+ * \param slot the slot number, from 0
+ * \param flags combination of DFS_IMAGE_READ, DFS_IMAGE_WRITE and DFS_IMAGE_MMAP
+ * \param imagepp pointer in which to return the image handle
+ * \return 0 on success or an error
+ */
+int dfs_image_open_slot(const char * path, int slot, int flags, DFS_IMAGE ** imagepp);
+
+/**
+ * \brief Opens a DFS disk image through an I/O backend
+ *
+ * This opens an image held somewhere other than a file, such as a memory
+ * buffer set up with dfs_io_init_memory().  The image is a single sided
+ * disk at the start of the I/O and is never mapped, so DFS_IMAGE_MMAP is
+ * ignored and dfs_image_format_from_template() is not available.
+ *
+ * \param iop pointer to the I/O, which must outlive the image handle
+ * \param flags combination of DFS_IMAGE_READ, DFS_IMAGE_WRITE and DFS_IMAGE_CREATE
+ * \param imagepp pointer in which to return the image handle
+ * \return 0 on success or an error
+ */
+int dfs_image_open_io(DFS_IO * iop, int flags, DFS_IMAGE ** imagepp);
+
+/**
+ * \brief Closes a DFS disk image and frees the handle
+ *
+ * \param imagep the image handle
+ * \return 0 on success or an error
+ */
+int dfs_image_close(DFS_IMAGE * imagep);
+
+/**
+ * \brief Sets how space is allocated for files added to an open DFS disk image
+ *
+ * The default is DFS_ALLOC_FIRST_FIT.
+ *
+ * \param imagep the image handle
+ * \param alloc_policy one of the DFS_ALLOC_ policies from dfsalloc.h
+ * \return 0 on success or an error
+ */
+int dfs_image_set_alloc_policy(DFS_IMAGE * imagep, int alloc_policy);
+
+/**
+ * \brief Formats an open DFS disk image
+ *
+ * \param imagep the image handle
+ * \param num_of_sectors this should be 400 or 800 for 40 or 80 track disks
+ * \param name the disk name
+ * \return 0 on success or an error
+ */
+int dfs_image_format(DFS_IMAGE * imagep, int num_of_sectors, const char * name);
+
+/**
+ * \brief Formats an open DFS disk image by cloning a template disk image
+ *
+ * The template is cloned with a reflink where the file system supports it,
+ * so creating many disks from one template costs almost nothing.
+ *
+ * \param imagep the image handle
+ * \param template_path the path of the template disk image
+ * \param name the disk name
+ * \return 0 on success or an error
+ */
+int dfs_image_format_from_template(DFS_IMAGE * imagep, const char * template_path, const char * name);
+
+/**
+ * \brief Gets the catalogue of an open DFS disk image
+ *
+ * The catalogue is read on first use and cached in the handle.  The returned
+ * directory is owned by the handle and remains valid until the image is
+ * modified or closed.
+ *
+ * \param imagep the image handle
+ * \param acorn_dirpp pointer in which to return the acorn directory
+ * \return 0 on success or an error
+ */
+int dfs_image_get_catalogue(DFS_IMAGE * imagep, const ACORN_DIRECTORY ** acorn_dirpp);
+
+/**
+ * \brief Gets the catalogue cycle number of an open DFS disk image
+ *
+ * DFS increments the cycle number each time it writes the catalogue.
+ *
+ * \param imagep the image handle
+ * \param cycle_numberp pointer in which to return the cycle number
+ * \return 0 on success or an error
+ */
+int dfs_image_get_cycle_number(DFS_IMAGE * imagep, uint8_t * cycle_numberp);
+
+/**
+ * \brief Finds a file in the catalogue of an open DFS disk image
+ *
+ * Names are compared without regard to case, as DFS does.
+ *
+ * \param imagep the image handle
+ * \param name the file name as listed in the catalogue
+ * \param acorn_filepp pointer in which to return the file meta data
+ * \return 0 on success or an error
+ */
+int dfs_image_find_file(DFS_IMAGE * imagep, const char * name, const ACORN_FILE ** acorn_filepp);
+
+/**
+ * \brief Gets a view of a file's contents in a memory mapped DFS disk image
+ *
+ * No data is copied.  The returned pointer refers into the mapping and is
+ * valid until the image is closed.  The image must have been opened with
+ * DFS_IMAGE_MMAP.
+ *
+ * \param imagep the image handle
+ * \param acorn_filep pointer to the file meta data
+ * \param datap pointer in which to return the start of the file's data
+ * \param lengthp pointer in which to return the length of the file's data
+ * \return 0 on success or an error
+ */
+int dfs_image_get_file_data(DFS_IMAGE * imagep, const ACORN_FILE * acorn_filep, const uint8_t ** datap, size_t * lengthp);
+
+/**
+ * \brief Reads a file's contents from an open DFS disk image into memory
+ *
+ * Unlike dfs_image_get_file_data() this works whether or not the image is
+ * mapped, at the cost of a copy.
+ *
+ * \param imagep the image handle
+ * \param acorn_filep pointer to the file meta data
+ * \param datap pointer in which to return the contents, which must be freed
+ * \return 0 on success or an error
+ */
+int dfs_image_read_file_data(DFS_IMAGE * imagep, const ACORN_FILE * acorn_filep, uint8_t ** datap);
+
+/**
+ * \brief Checks that a file's contents are all in an open DFS disk image
+ *
+ * This is the check that extraction makes, including that a disk held in
+ * a container does not run out of it, so files can be checked before
+ * anything is written for them.
+ *
+ * \param imagep the image handle
+ * \param acorn_filep pointer to the file meta data
+ * \return 0 if the file is all there, DFS_ERROR_BAD_EXTENT if not, or an error
+ */
+int dfs_image_check_file(DFS_IMAGE * imagep, const ACORN_FILE * acorn_filep);
+
+/**
+ * \brief Extracts a file from an open DFS disk image
+ *
+ * \param imagep the image handle
+ * \param acorn_filep pointer to the file meta data
+ * \param file the local file reference
+ * \return 0 on success or an error
+ */
+int dfs_image_extract_file(DFS_IMAGE * imagep, const ACORN_FILE * acorn_filep, FILE * file);
+
+/**
+ * \brief Extracts a number of files from an open DFS disk image
+ *
+ * The files are read in one forward sweep over the disk, see
+ * dfs_extract_files_at().
+ *
+ * \param imagep the image handle
+ * \param acorn_files array of pointers to the file meta data
+ * \param files array of local file references
+ * \param num_of_files the number of files to extract
+ * \return 0 on success or an error
+ */
+int dfs_image_extract_files(DFS_IMAGE * imagep, const ACORN_FILE ** acorn_files, FILE ** files, int num_of_files);
+
+/**
+ * \brief Adds a file to an open DFS disk image
+ *
+ * \param imagep the image handle
+ * \param acorn_filep pointer to the file meta data
+ * \param file the local file reference
+ * \return 0 on success or an error
+ */
+int dfs_image_add_file(DFS_IMAGE * imagep, ACORN_FILE * acorn_filep, FILE * file);
+
+/**
+ * \brief Adds a number of files to an open DFS disk image
+ *
+ * The files are added with a single catalogue update, see dfs_add_files().
+ *
+ * \param imagep the image handle
+ * \param acorn_files array of file meta data, the start sectors are filled in
+ * \param files array of local file references
+ * \param num_of_files the number of files to add
+ * \return 0 on success or an error
+ */
+int dfs_image_add_files(DFS_IMAGE * imagep, ACORN_FILE * acorn_files, FILE ** files, int num_of_files);
+
+/**
+ * \brief Compacts an open DFS disk image
+ *
+ * Moves files down the disk so that all the free space is in a single
+ * extent at the end, see dfs_compact().
+ *
+ * \param imagep the image handle
+ * \param statsp pointer in which to return what was moved, may be NULL
+ * \return 0 on success or an error
+ */
+int dfs_image_compact(DFS_IMAGE * imagep, DFS_COMPACT_STATS * statsp);
+
+/**
+ * \brief Removes files from an open DFS disk image
+ *
+ * Only the catalogue is rewritten, see dfs_remove_files().
+ *
+ * \param imagep the image handle
+ * \param names array of the names of the files to remove
+ * \param num_of_names the number of names
+ * \return 0 on success or an error
+ */
+int dfs_image_remove_files(DFS_IMAGE * imagep, const char ** names, int num_of_names);
+
+/**
+ * \brief Updates the meta data of a file in an open DFS disk image
+ *
+ * Only the catalogue is rewritten, see dfs_update_file().
+ *
+ * \param imagep the image handle
+ * \param acorn_filep pointer to the file name and new meta data
+ * \return 0 on success or an error
+ */
+int dfs_image_update_file(DFS_IMAGE * imagep, const ACORN_FILE * acorn_filep);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DFSIMAGE_H */
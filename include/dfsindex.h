@@ -0,0 +1,110 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __DFSINDEX_H
+#define __DFSINDEX_H
+
+#include <stdint.h>
+#include "dfs.h"
+
+/* Open addressed so the table is kept at most half full */
+#define DFS_NAME_INDEX_SIZE 64
+
+/* A file name and directory packed into 8 bytes, upper case, without the lock bit */
+typedef uint64_t DFS_NAME_KEY;
+
+typedef struct {
+  DFS_NAME_KEY keys[DFS_NAME_INDEX_SIZE];
+  int8_t entries[DFS_NAME_INDEX_SIZE];      /* Catalogue index plus one, 0 if empty */
+} DFS_NAME_INDEX;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief Gets the key of a catalogue file name
+ *
+ * \param filenamep pointer to the catalogue file name
+ * \return the key
+ */
+DFS_NAME_KEY dfs_name_key(const DFS_FILE_NAME * filenamep);
+
+/**
+ * \brief Gets the key of a host file name
+ *
+ * The name is of the form NAME or NAME.D where D is the directory.  If
+ * there is no directory then $ is assumed.
+ *
+ * \param file_name the file name
+ * \param keyp pointer in which to return the key
+ * \return 0 on success or an error
+ */
+int dfs_name_key_from_string(const char * file_name, DFS_NAME_KEY * keyp);
+
+/**
+ * \brief Empties a name index
+ *
+ * \param indexp pointer to the index
+ */
+void dfs_name_index_init(DFS_NAME_INDEX * indexp);
+
+/**
+ * \brief Adds a name to a name index
+ *
+ * \param indexp pointer to the index
+ * \param key the key of the name
+ * \param entry the catalogue index of the file
+ * \return 0 on success or an error
+ */
+int dfs_name_index_insert(DFS_NAME_INDEX * indexp, DFS_NAME_KEY key, int entry);
+
+/**
+ * \brief Looks up a name in a name index
+ *
+ * \param indexp pointer to the index
+ * \param key the key of the name
+ * \param entryp pointer in which to return the catalogue index of the file
+ * \return 0 on success or an error
+ */
+int dfs_name_index_find(const DFS_NAME_INDEX * indexp, DFS_NAME_KEY key, int * entryp);
+
+/**
+ * \brief Builds a name index over the names in a catalogue
+ *
+ * If the catalogue holds the same name more than once then only the first
+ * is indexed.
+ *
+ * \param indexp pointer to the index
+ * \param filenames the catalogue file names
+ * \param num_of_files the number of files in the catalogue
+ * \return 0 on success or an error
+ */
+int dfs_name_index_build(DFS_NAME_INDEX * indexp, const DFS_FILE_NAME * filenames, int num_of_files);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DFSINDEX_H */
@@ -0,0 +1,194 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __DFSIO_H
+#define __DFSIO_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include "dfsgeom.h"
+
+typedef struct _tag_DFS_IO DFS_IO;
+
+/* A backend.  The calls behave as pread(), pwrite() and ftruncate() do,
+   returning -1 and setting errno on error.  set_size may be NULL if the
+   backend cannot change its size */
+typedef struct {
+  ssize_t (*read)(DFS_IO * iop, void * buffer, size_t length, off_t offset);
+  ssize_t (*write)(DFS_IO * iop, const void * buffer, size_t length, off_t offset);
+  int (*get_size)(DFS_IO * iop, off_t * sizep);
+  int (*set_size)(DFS_IO * iop, off_t size);
+} DFS_IO_OPS;
+
+/* Where a disk image is read from and written to.  Every access is made at
+   an offset, so there is no position to share and any number of threads
+   can read through the same DFS_IO at once */
+struct _tag_DFS_IO {
+  const DFS_IO_OPS * opsp;
+  int fd;              /* The file descriptor of a file, otherwise -1 */
+  uint8_t * data;      /* The buffer of a memory image */
+  size_t size;         /* The size of a memory image */
+  size_t capacity;     /* How far a memory image can grow */
+  void * context;      /* For other backends */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief Sets up I/O on a file descriptor
+ *
+ * The descriptor is not closed by the library.
+ *
+ * \param iop pointer to the I/O
+ * \param fd the file descriptor
+ */
+void dfs_io_init_fd(DFS_IO * iop, int fd);
+
+/**
+ * \brief Sets up I/O on a memory buffer
+ *
+ * Writes past the end of the image grow it, up to the capacity of the
+ * buffer.  The buffer is not freed by the library.  Reads may be made from
+ * any number of threads, but writes must not be made at the same time as
+ * any other access.
+ *
+ * \param iop pointer to the I/O
+ * \param data the buffer
+ * \param size the size of the image in the buffer
+ * \param capacity the size of the buffer
+ */
+void dfs_io_init_memory(DFS_IO * iop, uint8_t * data, size_t size, size_t capacity);
+
+/**
+ * \brief Sets up I/O on another backend
+ *
+ * \param iop pointer to the I/O
+ * \param opsp the backend's calls, which must outlive the I/O
+ * \param context passed to the backend's calls in iop->context
+ */
+void dfs_io_init(DFS_IO * iop, const DFS_IO_OPS * opsp, void * context);
+
+/**
+ * \brief Reads from an image, stopping early only at its end
+ *
+ * \param iop pointer to the I/O
+ * \param offset where to read from
+ * \param buffer where to put the data
+ * \param length the number of bytes wanted
+ * \param countp pointer in which to return the number of bytes read
+ * \return 0 on success or an error
+ */
+int dfs_io_read(DFS_IO * iop, off_t offset, void * buffer, size_t length, size_t * countp);
+
+/**
+ * \brief Writes all of a buffer to an image
+ *
+ * \param iop pointer to the I/O
+ * \param offset where to write to
+ * \param buffer the data
+ * \param length the number of bytes
+ * \return 0 on success or an error
+ */
+int dfs_io_write(DFS_IO * iop, off_t offset, const void * buffer, size_t length);
+
+/**
+ * \brief Gets the size of an image
+ *
+ * \param iop pointer to the I/O
+ * \param sizep pointer in which to return the size
+ * \return 0 on success or an error
+ */
+int dfs_io_get_size(DFS_IO * iop, off_t * sizep);
+
+/**
+ * \brief Cuts back or extends an image, new space reading as zeros
+ *
+ * \param iop pointer to the I/O
+ * \param size the new size
+ * \return 0 on success or an error, DFS_ERROR_FAILED if the backend cannot
+ *         be resized
+ */
+int dfs_io_set_size(DFS_IO * iop, off_t size);
+
+/**
+ * \brief Reads sectors of a disk
+ *
+ * Sectors past the end of the image read as zeros.
+ *
+ * \param iop pointer to the I/O
+ * \param geometryp pointer to the geometry
+ * \param sector the first logical sector
+ * \param num_of_sectors the number of sectors
+ * \param buffer where to put the sectors
+ * \return 0 on success or an error
+ */
+int dfs_io_read_sectors(DFS_IO * iop, const DFS_GEOMETRY * geometryp, int sector, int num_of_sectors, uint8_t * buffer);
+
+/**
+ * \brief Writes sectors of a disk
+ *
+ * \param iop pointer to the I/O
+ * \param geometryp pointer to the geometry
+ * \param sector the first logical sector
+ * \param num_of_sectors the number of sectors
+ * \param buffer the sectors
+ * \return 0 on success or an error
+ */
+int dfs_io_write_sectors(DFS_IO * iop, const DFS_GEOMETRY * geometryp, int sector, int num_of_sectors, const uint8_t * buffer);
+
+/**
+ * \brief Copies data from an image to the current position of a local file
+ *
+ * A file descriptor backend copies in the kernel where it can.
+ *
+ * \param iop pointer to the I/O
+ * \param offset where the data is in the image
+ * \param length the number of bytes
+ * \param file the local file reference
+ * \return 0 on success or an error
+ */
+int dfs_io_copy_to_file(DFS_IO * iop, off_t offset, size_t length, FILE * file);
+
+/**
+ * \brief Copies data from a local file into an image
+ *
+ * The local file's position is not used or changed.
+ *
+ * \param iop pointer to the I/O
+ * \param offset where the data goes in the image
+ * \param file the local file reference
+ * \param file_offset where the data is in the local file
+ * \param length the number of bytes
+ * \return 0 on success or an error
+ */
+int dfs_io_copy_from_file(DFS_IO * iop, off_t offset, FILE * file, off_t file_offset, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,199 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __DFSMMB_H
+#define __DFSMMB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include "acornfs.h"
+#include "dfs.h"
+
+/* An MMB file is an index followed by fixed size slots, each holding an
+   80 track single sided DFS disk */
+#define DFS_MMB_INDEX_SIZE   8192
+#define DFS_MMB_ENTRY_SIZE   16
+#define DFS_MMB_MAX_SLOTS    511
+#define DFS_MMB_SLOT_SIZE    (DFS_80_TRACK_NUM_OF_SECTORS * DFS_SECTOR_SIZE)
+#define DFS_MMB_TITLE_LEN    12
+#define DFS_MMB_BOOT_DRIVES  4
+
+/* The last byte of each index entry */
+#define DFS_MMB_STATUS_LOCKED      0x00
+#define DFS_MMB_STATUS_UNLOCKED    0x0f
+#define DFS_MMB_STATUS_UNFORMATTED 0xf0
+#define DFS_MMB_STATUS_INVALID     0xff
+
+typedef struct {
+  char title[DFS_MMB_TITLE_LEN + 1];
+  uint8_t status;
+} DFS_MMB_SLOT;
+
+typedef struct {
+  int num_of_slots;                          /* Slots actually present in the file */
+  uint16_t boot_slots[DFS_MMB_BOOT_DRIVES];  /* Slot in each drive at power on */
+  DFS_MMB_SLOT slots[DFS_MMB_MAX_SLOTS];
+} DFS_MMB_INDEX;
+
+/* An MMB file opened for reading many slots at once */
+typedef struct _tag_DFS_MMB DFS_MMB;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief Decodes an MMB index
+ *
+ * \param index pointer to the DFS_MMB_INDEX_SIZE bytes of the index
+ * \param file_size the size of the MMB file, used to tell which slots exist
+ * \param mmbp pointer to the index to fill in
+ * \return 0 on success or an error
+ */
+int dfs_mmb_parse_index(const uint8_t * index, off_t file_size, DFS_MMB_INDEX * mmbp);
+
+/**
+ * \brief Reads the index of an MMB file
+ *
+ * \param mmbfile the MMB file reference
+ * \param mmbp pointer to the index to fill in
+ * \return 0 on success or an error
+ */
+int dfs_mmb_read_index(FILE * mmbfile, DFS_MMB_INDEX * mmbp);
+
+/**
+ * \brief Gets the position of a slot in an MMB file
+ *
+ * \param slot the slot number, from 0
+ * \return the offset of the slot's first sector
+ */
+off_t dfs_mmb_slot_offset(int slot);
+
+/**
+ * \brief Checks whether a slot of an MMB file holds a disk
+ *
+ * \param mmbp pointer to the index
+ * \param slot the slot number
+ * \return true if the slot exists and is formatted
+ */
+bool dfs_mmb_slot_is_formatted(const DFS_MMB_INDEX * mmbp, int slot);
+
+/**
+ * \brief Splits a path of the form file.mmb:slot
+ *
+ * \param path the path
+ * \param container_pathp pointer in which to return the container path,
+ *        which must be freed
+ * \param slotp pointer in which to return the slot number
+ * \return true if the path names a slot
+ */
+bool dfs_mmb_split_path(const char * path, char ** container_pathp, int * slotp);
+
+/**
+ * \brief Opens an MMB file for reading
+ *
+ * The whole file is mapped and the index decoded once.  The catalogue and
+ * file functions below only read the mapping or make positional reads, so
+ * they can be used from any number of threads at once.
+ *
+ * \param path the MMB file name
+ * \param mmbpp pointer in which to return the MMB handle
+ * \return 0 on success or an error
+ */
+int dfs_mmb_open(const char * path, DFS_MMB ** mmbpp);
+
+/**
+ * \brief Closes an MMB file and frees the handle
+ *
+ * \param mmbp the MMB handle
+ * \return 0 on success or an error
+ */
+int dfs_mmb_close(DFS_MMB * mmbp);
+
+/**
+ * \brief Gets the index of an open MMB file
+ *
+ * \param mmbp the MMB handle
+ * \return the index, owned by the handle
+ */
+const DFS_MMB_INDEX * dfs_mmb_get_index(const DFS_MMB * mmbp);
+
+/**
+ * \brief Decodes the catalogue of a slot of an open MMB file
+ *
+ * The returned directory must be freed with acornfs_free_directory().
+ *
+ * \param mmbp the MMB handle
+ * \param slot the slot number
+ * \param acorn_dirpp pointer in which to return the acorn directory
+ * \return 0 on success or an error
+ */
+int dfs_mmb_get_catalogue(const DFS_MMB * mmbp, int slot, ACORN_DIRECTORY ** acorn_dirpp);
+
+/**
+ * \brief Checks that a file's contents are all in a slot of an open MMB file
+ *
+ * This is the check that extraction makes, so files can be checked before
+ * anything is written for them.
+ *
+ * \param mmbp the MMB handle
+ * \param slot the slot number
+ * \param acorn_filep pointer to the file meta data
+ * \return 0 if the file is all there, DFS_ERROR_BAD_EXTENT if not, or an error
+ */
+int dfs_mmb_check_file(const DFS_MMB * mmbp, int slot, const ACORN_FILE * acorn_filep);
+
+/**
+ * \brief Extracts a file from a slot of an open MMB file
+ *
+ * \param mmbp the MMB handle
+ * \param slot the slot number
+ * \param acorn_filep pointer to the file meta data
+ * \param file the local file reference
+ * \return 0 on success or an error
+ */
+int dfs_mmb_extract_file(const DFS_MMB * mmbp, int slot, const ACORN_FILE * acorn_filep, FILE * file);
+
+/**
+ * \brief Extracts a number of files from a slot of an open MMB file
+ *
+ * The files are read in one forward sweep over the slot, see
+ * dfs_extract_files_at().
+ *
+ * \param mmbp the MMB handle
+ * \param slot the slot number
+ * \param acorn_files array of pointers to the file meta data
+ * \param files array of local file references
+ * \param num_of_files the number of files to extract
+ * \return 0 on success or an error
+ */
+int dfs_mmb_extract_files(const DFS_MMB * mmbp, int slot, const ACORN_FILE ** acorn_files, FILE ** files, int num_of_files);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DFSMMB_H */
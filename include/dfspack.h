@@ -0,0 +1,183 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __DFSPACK_H
+#define __DFSPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* A store of many disk images in which each distinct sector is kept once.
+   Every image is a list of block numbers, one per sector, so an image can
+   be read anywhere or rebuilt without unpacking the others.  Sectors that
+   are all zeros, such as the unused space on most disks, take no space at
+   all.
+
+   The pack file is a header, the distinct sectors, a table of images
+   sorted by path, the block lists and a table of image paths.  It is
+   mapped as it is and read in place */
+#define DFS_PACK_MAGIC   "DFSPACKS"
+#define DFS_PACK_VERSION 1
+
+/* Block number of an all zero sector, which is not stored */
+#define DFS_PACK_ZERO_BLOCK 0
+
+/* A pack file being written */
+typedef struct _tag_DFS_PACK_WRITER DFS_PACK_WRITER;
+
+/* An open pack file */
+typedef struct _tag_DFS_PACK DFS_PACK;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief Starts writing a pack file
+ *
+ * The pack is written to a temporary file that only replaces any old pack
+ * when it is finished.
+ *
+ * \param path the pack file name
+ * \param writerpp pointer in which to return the writer
+ * \return 0 on success or an error
+ */
+int dfs_pack_create(const char * path, DFS_PACK_WRITER ** writerpp);
+
+/**
+ * \brief Adds a disk image to a pack file
+ *
+ * The image is read to its end a sector at a time.  Any size of image can
+ * be added, including MMB files and double sided images.
+ *
+ * \param writerp the writer
+ * \param image_path the path to record for the image
+ * \param imagefile the image, read from its current position
+ * \return 0 on success or an error
+ */
+int dfs_pack_add_image(DFS_PACK_WRITER * writerp, const char * image_path, FILE * imagefile);
+
+/**
+ * \brief Finishes writing a pack file and frees the writer
+ *
+ * \param writerp the writer
+ * \return 0 on success or an error
+ */
+int dfs_pack_finish(DFS_PACK_WRITER * writerp);
+
+/**
+ * \brief Abandons writing a pack file and frees the writer
+ *
+ * Any old pack file is left as it was.
+ *
+ * \param writerp the writer
+ * \return 0 on success or an error
+ */
+int dfs_pack_abort(DFS_PACK_WRITER * writerp);
+
+/**
+ * \brief Opens a pack file
+ *
+ * \param path the pack file name
+ * \param packpp pointer in which to return the pack handle
+ * \return 0 on success or an error
+ */
+int dfs_pack_open(const char * path, DFS_PACK ** packpp);
+
+/**
+ * \brief Closes a pack file
+ *
+ * \param packp the pack handle
+ * \return 0 on success or an error
+ */
+int dfs_pack_close(DFS_PACK * packp);
+
+/**
+ * \brief Gets the number of images, sectors and distinct blocks in a pack
+ *
+ * \param packp the pack handle
+ * \param num_of_imagesp pointer in which to return the number of images
+ * \param num_of_sectorsp pointer in which to return the number of sectors
+ *        in all of the images
+ * \param num_of_blocksp pointer in which to return the number of blocks
+ *        stored, not counting the zero block
+ * \return 0 on success or an error
+ */
+int dfs_pack_get_size(const DFS_PACK * packp, size_t * num_of_imagesp, size_t * num_of_sectorsp, size_t * num_of_blocksp);
+
+/**
+ * \brief Gets an image in a pack
+ *
+ * \param packp the pack handle
+ * \param index the image, from 0, in path order
+ * \param image_pathp pointer in which to return the path of the image,
+ *        which points into the pack
+ * \param sizep pointer in which to return the size of the image in bytes
+ * \return 0 on success or an error
+ */
+int dfs_pack_get_image(const DFS_PACK * packp, size_t index, const char ** image_pathp, uint64_t * sizep);
+
+/**
+ * \brief Finds an image in a pack by its path
+ *
+ * \param packp the pack handle
+ * \param image_path the path recorded for the image
+ * \param indexp pointer in which to return the image
+ * \return 0 on success or an error
+ */
+int dfs_pack_find_image(const DFS_PACK * packp, const char * image_path, size_t * indexp);
+
+/**
+ * \brief Reads part of an image in a pack
+ *
+ * Only the blocks holding the range are touched.
+ *
+ * \param packp the pack handle
+ * \param index the image
+ * \param offset the offset in the image
+ * \param buffer the buffer to read into
+ * \param length the number of bytes to read, which must lie in the image
+ * \return 0 on success or an error
+ */
+int dfs_pack_read(const DFS_PACK * packp, size_t index, uint64_t offset, void * buffer, size_t length);
+
+/**
+ * \brief Writes out a whole image in a pack
+ *
+ * Runs of zero sectors are skipped rather than written, leaving holes in
+ * the output file where the file system supports them.
+ *
+ * \param packp the pack handle
+ * \param index the image
+ * \param outfile the file to write to, from its start
+ * \return 0 on success or an error
+ */
+int dfs_pack_write_image(const DFS_PACK * packp, size_t index, FILE * outfile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DFSPACK_H */
@@ -0,0 +1,86 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __DFSPARAMS_H
+#define __DFSPARAMS_H
+
+#include <stdint.h>
+#include "dfs.h"
+
+/* The file parameters of a whole catalogue decoded a field at a time.  The
+   top bits of the load and exec addresses, the length and the start sector
+   are packed together into one byte of each entry, so they are unpacked
+   for every entry at once rather than entry by entry */
+typedef struct {
+  uint32_t load_addresses[DFS_MAX_FILES];
+  uint32_t exec_addresses[DFS_MAX_FILES];
+  uint32_t lengths[DFS_MAX_FILES];
+  uint32_t start_sectors[DFS_MAX_FILES];
+} DFS_FILE_PARAMS_TABLE;
+
+/* The ways of decoding the table.  The vector kernels are only available
+   on x86 processors that support them */
+typedef enum {
+  DFS_PARAMS_KERNEL_AUTO,
+  DFS_PARAMS_KERNEL_SCALAR,
+  DFS_PARAMS_KERNEL_SSE2,
+  DFS_PARAMS_KERNEL_AVX2
+} DFS_PARAMS_KERNEL;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief Decodes the file parameters of a catalogue
+ *
+ * The fastest kernel that the processor supports is used.
+ *
+ * \param fileparams the file parameters in sector 1 of the catalogue
+ * \param num_of_files the number of files in the catalogue
+ * \param tablep pointer to the table to fill in
+ * \return 0 on success or an error
+ */
+int dfs_decode_file_params(const DFS_FILE_PARAMS * fileparams, int num_of_files, DFS_FILE_PARAMS_TABLE * tablep);
+
+/**
+ * \brief Decodes the file parameters of a catalogue with a given kernel
+ *
+ * Every kernel gives the same result, so this is for checking one against
+ * another and for measuring them.
+ *
+ * \param kernel the kernel
+ * \param fileparams the file parameters in sector 1 of the catalogue
+ * \param num_of_files the number of files in the catalogue
+ * \param tablep pointer to the table to fill in
+ * \return 0 on success, DFS_ERROR_FAILED if the kernel is not supported,
+ *         or another error
+ */
+int dfs_decode_file_params_with(DFS_PARAMS_KERNEL kernel, const DFS_FILE_PARAMS * fileparams, int num_of_files, DFS_FILE_PARAMS_TABLE * tablep);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DFSPARAMS_H */
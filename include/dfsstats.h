@@ -0,0 +1,165 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __DFSSTATS_H
+#define __DFSSTATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Counters and latency histograms for the disk operations of the library,
+   for seeing where the time in a run goes.  Collection is off until it is
+   enabled, and then costs an atomic add per count.  Counts made while an
+   operation runs are charged to it, and others to DFS_STATS_OTHER */
+typedef enum {
+  DFS_STATS_CATALOGUE,       /* Reading or decoding a catalogue */
+  DFS_STATS_EXTRACT,
+  DFS_STATS_ADD,
+  DFS_STATS_FORMAT,
+  DFS_STATS_OTHER,
+  DFS_STATS_NUM_OF_OPS
+} DFS_STATS_OP;
+
+typedef enum {
+  DFS_STATS_SYSCALLS,        /* File system calls, each stdio call as one */
+  DFS_STATS_BYTES_READ,
+  DFS_STATS_BYTES_WRITTEN,
+  DFS_STATS_SEEKS,
+  DFS_STATS_SECTORS_READ,
+  DFS_STATS_SECTORS_WRITTEN,
+  DFS_STATS_ALLOCS,
+  DFS_STATS_NUM_OF_COUNTERS
+} DFS_STATS_COUNTER;
+
+/* Bucket n counts the operations that took from 2^n to 2^(n+1) ns, and the
+   last bucket any longer */
+#define DFS_STATS_NUM_OF_BUCKETS 40
+
+typedef struct {
+  uint64_t count;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  uint64_t buckets[DFS_STATS_NUM_OF_BUCKETS];
+  uint64_t counters[DFS_STATS_NUM_OF_COUNTERS];
+} DFS_STATS_OP_STATS;
+
+typedef struct {
+  DFS_STATS_OP_STATS ops[DFS_STATS_NUM_OF_OPS];
+} DFS_STATS;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief Turns collection on or off
+ *
+ * \param enable true to collect
+ */
+void dfs_stats_enable(bool enable);
+
+/**
+ * \brief Sets every counter and histogram back to zero
+ */
+void dfs_stats_reset(void);
+
+/**
+ * \brief Gets a copy of the counters and histograms
+ *
+ * Operations that are running on other threads may be partly counted.
+ *
+ * \param statsp pointer to the stats to fill in
+ * \return 0 on success or an error
+ */
+int dfs_stats_get(DFS_STATS * statsp);
+
+/**
+ * \brief Gets an upper bound on a percentile of the latency of an operation
+ *
+ * \param op_statsp the stats of the operation
+ * \param fraction the percentile as a fraction, for example 0.99
+ * \return the top of the histogram bucket holding the percentile in ns, or
+ *         0 if the operation was never run
+ */
+uint64_t dfs_stats_percentile(const DFS_STATS_OP_STATS * op_statsp, double fraction);
+
+/**
+ * \brief Gets the name of an operation
+ *
+ * \param op the operation
+ * \return the name
+ */
+const char * dfs_stats_op_name(DFS_STATS_OP op);
+
+/**
+ * \brief Gets the name of a counter
+ *
+ * \param counter the counter
+ * \return the name
+ */
+const char * dfs_stats_counter_name(DFS_STATS_COUNTER counter);
+
+/**
+ * \brief Marks the start of an operation, for the library's own use
+ *
+ * \param op the operation
+ * \return the start time to give to dfs_stats_end(), 0 if not timed
+ */
+uint64_t dfs_stats_begin(DFS_STATS_OP op);
+
+/**
+ * \brief Marks the end of an operation, for the library's own use
+ *
+ * \param op the operation
+ * \param start the time returned by dfs_stats_begin()
+ */
+void dfs_stats_end(DFS_STATS_OP op, uint64_t start);
+
+/**
+ * \brief Adds to a counter, for the library's own use
+ *
+ * \param counter the counter
+ * \param n the amount to add
+ */
+void dfs_stats_count(DFS_STATS_COUNTER counter, uint64_t n);
+
+/**
+ * \brief Counts a system call that read data, for the library's own use
+ *
+ * \param bytes the number of bytes read
+ */
+void dfs_stats_count_read(uint64_t bytes);
+
+/**
+ * \brief Counts a system call that wrote data, for the library's own use
+ *
+ * \param bytes the number of bytes written
+ */
+void dfs_stats_count_write(uint64_t bytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DFSSTATS_H */
@@ -0,0 +1,71 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __DFSTAR_H
+#define __DFSTAR_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "acornfs.h"
+
+/* Writes DFS files to a tar archive as it goes, so that the archive can be
+   streamed down a pipe.  The archive is in POSIX pax format.  The load and
+   exec addresses and the locked attribute of each file, which a host file
+   has no place for, are kept in its extended header */
+#define DFS_TAR_LOAD_KEYWORD   "DFS.load"
+#define DFS_TAR_EXEC_KEYWORD   "DFS.exec"
+#define DFS_TAR_LOCKED_KEYWORD "DFS.locked"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief Writes a file to a tar archive
+ *
+ * Locked files are given read only permissions.
+ *
+ * \param tarfile the archive
+ * \param name the name of the file in the archive
+ * \param acorn_filep the file meta data
+ * \param data the contents of the file, of its length
+ * \param mtime the modification time to give the file
+ * \return 0 on success or an error
+ */
+int dfs_tar_write_file(FILE * tarfile, const char * name, const ACORN_FILE * acorn_filep, const uint8_t * data, time_t mtime);
+
+/**
+ * \brief Ends a tar archive
+ *
+ * \param tarfile the archive
+ * \return 0 on success or an error
+ */
+int dfs_tar_finish(FILE * tarfile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DFSTAR_H */
@@ -0,0 +1,64 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __THREADPOOL_H
+#define __THREADPOOL_H
+
+#include <stddef.h>
+
+/* Work function, called once for each item index */
+typedef void (*THREADPOOL_FN)(void * context, size_t index);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief Gets the default number of worker threads
+ *
+ * \return the number of online processors, or 1 if that is not known
+ */
+int threadpool_default_threads(void);
+
+/**
+ * \brief Runs a function over a range of items on a pool of threads
+ *
+ * Items are handed out in ascending index order to whichever thread is
+ * free next, and the call returns once every item has been processed.  The
+ * calling thread takes part in the work, so a pool of one thread runs
+ * everything inline.
+ *
+ * \param num_of_threads the number of threads to use
+ * \param num_of_items the number of items
+ * \param fn the work function
+ * \param context pointer passed to the work function
+ * \return 0 on success or an error
+ */
+int threadpool_run(int num_of_threads, size_t num_of_items, THREADPOOL_FN fn, void * context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __THREADPOOL_H */
@@ -26,32 +26,73 @@ SOFTWARE.
 #include <stdio.h>
 #include "acornfs.h"
 #include "acnfserr.h"
+#include "dfsstats.h"
 #include "debug.h"
 
+/**
+ * \brief Allocates an Acorn directory
+ *
+ * The directory, its files and storage for all of the names are allocated
+ * in one zeroed block with the names following the array of files.
+ *
+ * \param num_of_files the number of files in the directory
+ * \param dir_name_size the size of the directory name storage
+ * \param file_name_size the size of the storage for each file name
+ * \return the directory or NULL if it could not be allocated
+ */
+ACORN_DIRECTORY * acornfs_alloc_directory(int num_of_files, size_t dir_name_size, size_t file_name_size) {
+  ACORN_DIRECTORY * acorn_dirp;
+  char * names;
+  size_t size;
+
+  if (num_of_files < 0) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Invalid number of files: %d", num_of_files);
+    return NULL;
+  }
+
+  size =
+    sizeof(ACORN_DIRECTORY) +
+    (sizeof(ACORN_FILE) * (size_t)num_of_files) +
+    dir_name_size +
+    (file_name_size * (size_t)num_of_files);
+
+  acorn_dirp = (ACORN_DIRECTORY *)calloc(1, size);
+  dfs_stats_count(DFS_STATS_ALLOCS, 1);
+  if (acorn_dirp == NULL) {
+    return NULL;
+  }
+
+  /* The names live after the last file */
+  names = (char *)&(acorn_dirp->files[num_of_files]);
+
+  acorn_dirp->name = names;
+  names += dir_name_size;
+
+  for (int i = 0; i < num_of_files; i++) {
+    acorn_dirp->files[i].name = names;
+    names += file_name_size;
+  }
+
+  acorn_dirp->num_of_files = num_of_files;
+
+  return acorn_dirp;
+}
+
 /**
  * \brief Frees the memory of an Acorn directory
  *
- * This frees all the dynamic memory used by an Acorn directory
- * structure.
+ * As the directory was allocated in one block by acornfs_alloc_directory()
+ * this is a single free.
  *
  * \param acorn_dirp pointer to the directory
  * \return 0 on success or an error
  */
 int acornfs_free_directory(ACORN_DIRECTORY * acorn_dirp) {
-  ACORN_FILE * acorn_filep;
-
   if (acorn_dirp == NULL) {
-    if (DEBUG_LEVEL(DEBUG_LEVEL_ERROR)) fprintf(stdout, "Invalid directory pointer!\n");
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Invalid directory pointer!");
     return ACORNFS_ERROR_FAILED;
   }
 
-  acorn_filep = acorn_dirp->files;
-  for (int i = 0; i < acorn_dirp->num_of_files; i++) {
-    free(acorn_filep->name);
-    acorn_filep++;
-  }
-
-  free(acorn_dirp->name);
   free(acorn_dirp);
 
   return ACORNFS_ERROR_NONE;
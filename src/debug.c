@@ -22,6 +22,244 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
 #include "debug.h"
 
+/* Events kept for each thread, a power of two */
+#define DEBUG_RING_SIZE 256
+#define DEBUG_MESSAGE_SIZE 116
+
 int verbosity = 0;
+
+/* The sequence number is odd while the event is being written so a dump
+   made at the same time can skip it */
+typedef struct {
+  atomic_uint_least64_t seq;
+  uint64_t time_ns;
+  int level;
+  char message[DEBUG_MESSAGE_SIZE];
+} DEBUG_EVENT;
+
+/* An event copied out of a ring for a dump */
+typedef struct {
+  uint64_t time_ns;
+  int ring;
+  int level;
+  char message[DEBUG_MESSAGE_SIZE];
+} DEBUG_RECORD;
+
+/* A ring is written only by the thread that holds it.  Rings are never
+   freed, so the events of finished threads can still be dumped, and are
+   handed on to new threads when theirs finish */
+typedef struct _tag_DEBUG_RING {
+  struct _tag_DEBUG_RING * next;
+  atomic_bool in_use;
+  int number;
+  atomic_uint_least64_t head;
+  DEBUG_EVENT events[DEBUG_RING_SIZE];
+} DEBUG_RING;
+
+static _Atomic(DEBUG_RING *) rings;
+static atomic_int num_of_rings;
+static atomic_uint_least64_t cleared_ns;
+static _Thread_local DEBUG_RING * thread_ring;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+}
+
+static void release_ring(void * ringp) {
+  atomic_store(&(((DEBUG_RING *)ringp)->in_use), false);
+}
+
+static void create_ring_key(void) {
+  pthread_key_create(&ring_key, release_ring);
+}
+
+static DEBUG_RING * get_ring(void) {
+  DEBUG_RING * ringp;
+
+  if (thread_ring != NULL) {
+    return thread_ring;
+  }
+
+  pthread_once(&ring_key_once, create_ring_key);
+
+  /* Take over the ring of a finished thread if there is one */
+  for (ringp = atomic_load(&rings); ringp != NULL; ringp = ringp->next) {
+    bool expected = false;
+
+    if (atomic_compare_exchange_strong(&(ringp->in_use), &expected, true)) {
+      break;
+    }
+  }
+
+  if (ringp == NULL) {
+    ringp = (DEBUG_RING *)calloc(1, sizeof(DEBUG_RING));
+    if (ringp == NULL) {
+      return NULL;
+    }
+
+    atomic_init(&(ringp->in_use), true);
+    ringp->number = atomic_fetch_add(&num_of_rings, 1);
+    ringp->next = atomic_load(&rings);
+    while (!atomic_compare_exchange_weak(&rings, &(ringp->next), ringp)) {
+    }
+  }
+
+  pthread_setspecific(ring_key, ringp);
+  thread_ring = ringp;
+  return ringp;
+}
+
+/**
+ * \brief Records an event in the calling thread's trace
+ *
+ * \param level one of the DEBUG_LEVEL_ levels
+ * \param format printf style format of the message
+ */
+void debug_log(int level, const char * format, ...) {
+  DEBUG_RING * ringp = get_ring();
+  DEBUG_EVENT * eventp;
+  uint64_t head;
+  size_t length;
+  va_list args;
+
+  /* Nowhere to put it */
+  if (ringp == NULL) {
+    return;
+  }
+
+  head = atomic_load_explicit(&(ringp->head), memory_order_relaxed);
+  eventp = &(ringp->events[head & (DEBUG_RING_SIZE - 1)]);
+
+  atomic_store_explicit(&(eventp->seq), (2 * head) + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  eventp->time_ns = now_ns();
+  eventp->level = level;
+
+  va_start(args, format);
+  vsnprintf(eventp->message, sizeof(eventp->message), format, args);
+  va_end(args);
+
+  /* The dump puts each event on its own line */
+  length = strlen(eventp->message);
+  if (length > 0 && eventp->message[length - 1] == '\n') {
+    eventp->message[length - 1] = '\0';
+  }
+
+  atomic_store_explicit(&(eventp->seq), (2 * head) + 2, memory_order_release);
+  atomic_store_explicit(&(ringp->head), head + 1, memory_order_release);
+}
+
+static int compare_records(const void * a, const void * b) {
+  const DEBUG_RECORD * recorda = (const DEBUG_RECORD *)a;
+  const DEBUG_RECORD * recordb = (const DEBUG_RECORD *)b;
+
+  return (recorda->time_ns > recordb->time_ns) - (recorda->time_ns < recordb->time_ns);
+}
+
+static const char * level_name(int level) {
+  switch (level) {
+    case DEBUG_LEVEL_ERROR:
+      return "error";
+    case DEBUG_LEVEL_WARNING:
+      return "warning";
+    case DEBUG_LEVEL_INFO:
+      return "info";
+    default:
+      return "debug";
+  }
+}
+
+/**
+ * \brief Writes the recorded events of every thread up to a level, oldest first
+ *
+ * Events being recorded while the dump is made may be left out.
+ *
+ * \param stream where to write the events
+ * \param max_level the least important DEBUG_LEVEL_ level to write
+ * \return the number of events written
+ */
+int debug_dump_level(FILE * stream, int max_level) {
+  int max_records = atomic_load(&num_of_rings) * DEBUG_RING_SIZE;
+  uint64_t since = atomic_load(&cleared_ns);
+  DEBUG_RECORD * records;
+  int num_of_records = 0;
+
+  if (stream == NULL || max_records == 0) {
+    return 0;
+  }
+
+  records = (DEBUG_RECORD *)malloc((size_t)max_records * sizeof(DEBUG_RECORD));
+  if (records == NULL) {
+    return 0;
+  }
+
+  /* Each event is copied, then kept only if it did not change meanwhile */
+  for (DEBUG_RING * ringp = atomic_load(&rings); ringp != NULL; ringp = ringp->next) {
+    uint64_t head = atomic_load_explicit(&(ringp->head), memory_order_acquire);
+    uint64_t first = (head > DEBUG_RING_SIZE) ? head - DEBUG_RING_SIZE : 0;
+
+    for (uint64_t n = first; n < head && num_of_records < max_records; n++) {
+      DEBUG_EVENT * eventp = &(ringp->events[n & (DEBUG_RING_SIZE - 1)]);
+      DEBUG_RECORD * recordp = &(records[num_of_records]);
+      uint64_t seq = atomic_load_explicit(&(eventp->seq), memory_order_acquire);
+
+      if (seq != (2 * n) + 2) {
+        continue;
+      }
+
+      recordp->time_ns = eventp->time_ns;
+      recordp->ring = ringp->number;
+      recordp->level = eventp->level;
+      memcpy(recordp->message, eventp->message, sizeof(recordp->message));
+      recordp->message[sizeof(recordp->message) - 1] = '\0';
+
+      atomic_thread_fence(memory_order_acquire);
+      if (atomic_load_explicit(&(eventp->seq), memory_order_relaxed) == seq && recordp->time_ns >= since &&
+          recordp->level <= max_level) {
+        num_of_records++;
+      }
+    }
+  }
+
+  qsort(records, (size_t)num_of_records, sizeof(DEBUG_RECORD), compare_records);
+
+  for (int i = 0; i < num_of_records; i++) {
+    fprintf(stream, "[%d] %s: %s\n", records[i].ring, level_name(records[i].level), records[i].message);
+  }
+
+  free(records);
+  return num_of_records;
+}
+
+/**
+ * \brief Writes the recorded events of every thread, oldest first
+ *
+ * \param stream where to write the events
+ * \return the number of events written
+ */
+int debug_dump(FILE * stream) {
+  return debug_dump_level(stream, DEBUG_LEVEL_DEBUG);
+}
+
+/**
+ * \brief Forgets every event recorded so far
+ */
+void debug_clear(void) {
+  atomic_store(&cleared_ns, now_ns());
+}
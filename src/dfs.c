@@ -22,12 +22,25 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
 #include "acornfs.h"
 #include "dfs.h"
+#include "dfsalloc.h"
+#include "dfscopy.h"
+#include "dfsindex.h"
+#include "dfsio.h"
+#include "dfsparams.h"
+#include "dfsstats.h"
 #include "debug.h"
 
 #define min(a,b) \
@@ -59,7 +72,7 @@ static void set_number_of_files(DFS_SECTOR_1 * sector1p, int num_of_files) {
     (num_of_files << DFS_NUM_OF_FILES_SHIFT);
 }
 
-void increment_cycle_number(DFS_SECTOR_1 * sector1p) {
+static void increment_cycle_number(DFS_SECTOR_1 * sector1p) {
   sector1p->disk_name_1.cycle_number ++;
   if ((sector1p->disk_name_1.cycle_number & 0x0f) == 0x0a) {
     sector1p->disk_name_1.cycle_number += 6;
@@ -69,10 +82,26 @@ void increment_cycle_number(DFS_SECTOR_1 * sector1p) {
   }
 }
 
-static char * get_disk_name(const DFS_SECTOR_0 * sector0p, const DFS_SECTOR_1 * sector1p) {
-  char diskname[DFS_MAX_DISK_NAME_LEN + 1];
+static void set_disk_name(DFS_SECTOR_0 * sector0p, DFS_SECTOR_1 * sector1p, const char * name) {
+  size_t namelen = strlen(name);
+
+  memset(sector0p->disk_name_0.diskname_0, 0, sizeof(sector0p->disk_name_0.diskname_0));
+  memset(sector1p->disk_name_1.diskname_1, 0, sizeof(sector1p->disk_name_1.diskname_1));
+
+  memcpy(
+    sector0p->disk_name_0.diskname_0,
+    name,
+    min(sizeof(sector0p->disk_name_0.diskname_0), namelen));
+  if (namelen > sizeof(sector0p->disk_name_0.diskname_0)) {
+    memcpy(
+      sector1p->disk_name_1.diskname_1,
+      name + sizeof(sector0p->disk_name_0.diskname_0),
+      min(sizeof(sector1p->disk_name_1.diskname_1), namelen - sizeof(sector0p->disk_name_0.diskname_0)));
+  }
+}
 
-  memset(diskname, 0, sizeof(diskname));
+static void get_disk_name(const DFS_SECTOR_0 * sector0p, const DFS_SECTOR_1 * sector1p, char * diskname) {
+  memset(diskname, 0, DFS_DISK_NAME_SIZE);
   memcpy(
     diskname,
     sector0p->disk_name_0.diskname_0,
@@ -88,14 +117,14 @@ static char * get_disk_name(const DFS_SECTOR_0 * sector0p, const DFS_SECTOR_1 *
       break;
     }
   }
-
-  return strdup(diskname);
 }
 
 static int dfs_get_file_name_and_dir(const char * file_name, char ** namepp, char * dirp) {
   char * name = strdup(file_name);
   char * separator = strchr(name, '.'); /* First '.' */
 
+  dfs_stats_count(DFS_STATS_ALLOCS, 1);
+
   if (namepp == NULL || dirp == NULL) {
     return DFS_ERROR_FAILED;
   }
@@ -104,7 +133,7 @@ static int dfs_get_file_name_and_dir(const char * file_name, char ** namepp, cha
   if (separator && strlen(separator + 1) > DFS_MAX_DIR_NAME_LEN) {
     free(name);
 
-    if (DEBUG_LEVEL_ERROR) fprintf(stderr, "Directory name too long!\n");
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Directory name too long!");
     return DFS_ERROR_INVALID_FILE_NAME;
   }
 
@@ -116,7 +145,7 @@ static int dfs_get_file_name_and_dir(const char * file_name, char ** namepp, cha
         (separator[1] == '*') || (separator[1] == '.') || (separator[1] == ' ')) {
       free(name);
 
-      if (DEBUG_LEVEL_ERROR) fprintf(stderr, "Invalid char in dir name!\n");
+      DEBUG_LOG(DEBUG_LEVEL_ERROR, "Invalid char in dir name!");
       return DFS_ERROR_INVALID_FILE_NAME;
     }
   }
@@ -125,7 +154,7 @@ static int dfs_get_file_name_and_dir(const char * file_name, char ** namepp, cha
   if (strlen(name) > DFS_MAX_FILE_NAME_LEN) {
     free(name);
 
-    if (DEBUG_LEVEL_ERROR) fprintf(stderr, "File name too long!\n");
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "File name too long!");
     return DFS_ERROR_INVALID_FILE_NAME;
   }
 
@@ -134,7 +163,7 @@ static int dfs_get_file_name_and_dir(const char * file_name, char ** namepp, cha
     if ((*p == ':') || (*p == '\"') || (*p == '#') || (*p == '*') || (*p == ' ')) {
       free(name);
 
-      if (DEBUG_LEVEL_ERROR) fprintf(stderr, "Invalid char in file name: \'%c\'\n", *p);
+      DEBUG_LOG(DEBUG_LEVEL_ERROR, "Invalid char in file name: \'%c\'", *p);
       return DFS_ERROR_INVALID_FILE_NAME;
     }
   }
@@ -155,62 +184,38 @@ static int dfs_get_file_name_and_dir(const char * file_name, char ** namepp, cha
   return 0;
 }
 
-static char * get_file_name(const DFS_FILE_NAME * filenamep) {
-  /* Filename size plus '.' plus directory character */
-  char filename[DFS_MAX_FILE_NAME_LEN + 3];
+static void get_file_name(const DFS_FILE_NAME * filenamep, char * filename) {
+  /* The directory byte carries the lock bit */
+  char directory = (char)(filenamep->directory & DFS_DIR_NAME_MASK);
 
-  memset(filename, 0, sizeof(filename));
+  memset(filename, 0, DFS_FILE_NAME_SIZE);
   memcpy(filename, filenamep->filename, DFS_MAX_FILE_NAME_LEN);
 
   for (int i = 0; i <= DFS_MAX_FILE_NAME_LEN; i++) {
     if (filename[i] == '\0' || filename[i] == ' ') {
-      if (filenamep->directory != '$') {
+      if (directory != '$') {
         filename[i++] = '.';
-        filename[i++] = (filenamep->directory) % DFS_DIR_NAME_MASK;
+        filename[i++] = directory;
       }
       filename[i] = '\0';
       break;
     }
   }
-
-  return strdup(filename);
 }
 
-static void get_file_info(const DFS_FILE_NAME * filenamep, const DFS_FILE_PARAMS * fileparamsp, ACORN_FILE * acorn_filep) {
-  acorn_filep->name = get_file_name(filenamep);
+static void get_file_info(const DFS_FILE_NAME * filenamep, const DFS_FILE_PARAMS_TABLE * tablep, int i, ACORN_FILE * acorn_filep) {
+  get_file_name(filenamep, acorn_filep->name);
 
   if ((filenamep->directory & DFS_LOCK_BIT) == DFS_LOCK_BIT) {
     acorn_filep->attributes = LOCKED;
+  } else {
+    acorn_filep->attributes = 0;
   }
 
-  acorn_filep->load_address =
-    (uint32_t)fileparamsp->load_address_low +
-    ((uint32_t)fileparamsp->load_address_high * 0x100) +
-    ((uint32_t)((fileparamsp->start_sector_high & DFS_LOAD_ADDRESS_BIT_17_18_MASK) >> DFS_LOAD_ADDRESS_SHIFT) * 0x10000);
-
-  /* If load address has bits 17 and 18 set then OR with 0xffff0000 (IO memory) */
-  if ((fileparamsp->start_sector_high & DFS_LOAD_ADDRESS_BIT_17_18_MASK) == DFS_LOAD_ADDRESS_BIT_17_18_MASK) {
-    acorn_filep->load_address |= 0xffff0000;
-  }
-
-  acorn_filep->exec_address =
-    (uint32_t)fileparamsp->exec_address_low +
-    ((uint32_t)fileparamsp->exec_address_high * 0x100) +
-    ((uint32_t)((fileparamsp->start_sector_high & DFS_EXEC_ADDRESS_BIT_17_18_MASK) >> DFS_LOAD_ADDRESS_SHIFT) * 0x10000);
-
-  /* If exec address has bits 17 and 18 set then OR with 0xffff0000 (IO memory) */
-  if ((fileparamsp->start_sector_high & DFS_EXEC_ADDRESS_BIT_17_18_MASK) == DFS_EXEC_ADDRESS_BIT_17_18_MASK) {
-    acorn_filep->exec_address |= 0xffff0000;
-  }
-
-  acorn_filep->length =
-    (uint32_t)fileparamsp->length_low +
-    ((uint32_t)fileparamsp->length_high * 0x100) +
-    ((uint32_t)((fileparamsp->start_sector_high & DFS_FILE_LENGTH_BIT_17_18_MASK) >> DFS_FILE_LENGTH_SHIFT) * 0x10000);
-
-  acorn_filep->start_sector =
-    (uint32_t)fileparamsp->start_sector_low +
-    (((uint32_t)fileparamsp->start_sector_high & DFS_START_SECTOR_HIGH_MASK) * 0x100);
+  acorn_filep->load_address = tablep->load_addresses[i];
+  acorn_filep->exec_address = tablep->exec_addresses[i];
+  acorn_filep->length = tablep->lengths[i];
+  acorn_filep->start_sector = tablep->start_sectors[i];
 }
 
 static int set_file_params(const ACORN_FILE * acorn_filep, DFS_FILE_NAME * filenamep, DFS_FILE_PARAMS * fileparamsp) {
@@ -238,121 +243,192 @@ static int set_file_params(const ACORN_FILE * acorn_filep, DFS_FILE_NAME * filen
   return DFS_ERROR_NONE;
 }
 
-static int read_catalogue_sectors(FILE * diskfile, uint8_t * sector0p, uint8_t * sector1p, int * num_of_sectorsp) {
-  size_t count = fread(sector0p, DFS_SECTOR_SIZE, 1, diskfile);
-  if (count == 0) {
-    if (DEBUG_LEVEL(DEBUG_LEVEL_ERROR)) fprintf(stdout, "Could not read sector 0\n");
+static int check_catalogue_sectors(const uint8_t * sector1p, int * num_of_sectorsp) {
+  *num_of_sectorsp = get_number_of_sectors((const DFS_SECTOR_1 *)sector1p);
+
+  if (*num_of_sectorsp != DFS_40_TRACK_NUM_OF_SECTORS && *num_of_sectorsp != DFS_80_TRACK_NUM_OF_SECTORS) {
+    DEBUG_LOG(DEBUG_LEVEL_WARNING, "Invalid number of sectors in disk: %u", *num_of_sectorsp);
     return DFS_ERROR_NOT_A_DFS_DISK;
   }
 
-  count = fread(sector1p, DFS_SECTOR_SIZE, 1, diskfile);
-  if (count == 0) {
-    if (DEBUG_LEVEL(DEBUG_LEVEL_ERROR)) fprintf(stdout, "Could not read sector 0\n");
+  return 0;
+}
+
+/* Reads the two catalogue sectors, which are always contiguous */
+static int read_catalogue_sectors(DFS_IO * iop, const DFS_GEOMETRY * geometryp, uint8_t * sector0p, uint8_t * sector1p, int * num_of_sectorsp) {
+  uint8_t buffer[2 * DFS_SECTOR_SIZE];
+  size_t count;
+  int ret;
+
+  ret = dfs_io_read(iop, dfs_geometry_sector_offset(geometryp, 0), buffer, sizeof(buffer), &count);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  if (count != sizeof(buffer)) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not read catalogue");
     return DFS_ERROR_NOT_A_DFS_DISK;
   }
 
-  *num_of_sectorsp = get_number_of_sectors((DFS_SECTOR_1 *)sector1p);
+  dfs_stats_count(DFS_STATS_SECTORS_READ, 2);
 
-  if (*num_of_sectorsp != DFS_40_TRACK_NUM_OF_SECTORS && *num_of_sectorsp != DFS_80_TRACK_NUM_OF_SECTORS) {
-    if (DEBUG_LEVEL(DEBUG_LEVEL_WARNING)) fprintf(stdout, "Invalid number of sectors in disk: %u\n", *num_of_sectorsp);
-    return DFS_ERROR_NOT_A_DFS_DISK;
+  memcpy(sector0p, buffer, DFS_SECTOR_SIZE);
+  memcpy(sector1p, buffer + DFS_SECTOR_SIZE, DFS_SECTOR_SIZE);
+
+  return check_catalogue_sectors(sector1p, num_of_sectorsp);
+}
+
+/* Writes both catalogue sectors in a single write */
+static int write_catalogue_sectors(DFS_IO * iop, const DFS_GEOMETRY * geometryp, const uint8_t * sector0p, const uint8_t * sector1p) {
+  uint8_t buffer[2 * DFS_SECTOR_SIZE];
+  int ret;
+
+  memcpy(buffer, sector0p, DFS_SECTOR_SIZE);
+  memcpy(buffer + DFS_SECTOR_SIZE, sector1p, DFS_SECTOR_SIZE);
+
+  ret = dfs_io_write(iop, dfs_geometry_sector_offset(geometryp, 0), buffer, sizeof(buffer));
+  if (ret != DFS_ERROR_NONE) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not write catalogue");
+    return ret;
   }
 
-  return 0;
+  dfs_stats_count(DFS_STATS_SECTORS_WRITTEN, 2);
+
+  return DFS_ERROR_NONE;
 }
 
-static int get_first_free_sector(DFS_SECTOR_1 * sector1p, int * free_sectorp) {
-  DFS_FILE_PARAMS * file_params = &(sector1p->file_params[0]);
-  int free_sector = 2; /* Empty disk is sector 2 */
-  int file_length = 0;
+/* Sets up positional I/O on a disk image file.  The file's position is
+   neither used nor changed, but anything stdio has buffered must reach the
+   file first */
+static int init_file_io(FILE * diskfile, DFS_IO * iop) {
+  if (fflush(diskfile) != 0) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not update disk image: %s", strerror(errno));
+    return DFS_ERROR_FAILED;
+  }
+
+  dfs_io_init_fd(iop, fileno(diskfile));
+  return DFS_ERROR_NONE;
+}
 
-  /* Find last file on the disk */
-  for (int i = 0; i < sector1p->disk_name_1.num_of_files; i++) {
-    int start_sector =
-      ((uint32_t)sector1p->file_params[i].start_sector_low) +
-      (((uint32_t)sector1p->file_params[i].start_sector_high & DFS_START_SECTOR_HIGH_MASK) * 0x100);
+/* A disk starts wherever its file is positioned, so it can live inside a
+   container such as an MMB file.  All other access is relative to this */
+static int init_disk_io(FILE * diskfile, DFS_IO * iop, DFS_GEOMETRY * geometryp) {
+  off_t offset = ftello(diskfile);
 
-    if (start_sector > free_sector) {
-      free_sector = start_sector;
-      file_params = &(sector1p->file_params[i]);
-    }
+  dfs_stats_count(DFS_STATS_SEEKS, 1);
+  if (offset == -1) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not get disk image position: %s", strerror(errno));
+    return DFS_ERROR_FAILED;
   }
 
-  /* Find first free sector after this file */
-  file_length =
-    (uint32_t)file_params->length_low +
-    ((uint32_t)file_params->length_high * 0x100) +
-    ((uint32_t)((file_params->start_sector_high & DFS_FILE_LENGTH_BIT_17_18_MASK) / 16) * 0x10000);
+  dfs_geometry_init(geometryp, offset, 1, 0);
 
-  /* Free sector */
-  *free_sectorp = free_sector + (file_length / DFS_SECTOR_SIZE) + 1;
+  return init_file_io(diskfile, iop);
+}
 
-  return 0;
+static int get_start_sector(const DFS_FILE_PARAMS * fileparamsp) {
+  return
+    (int)fileparamsp->start_sector_low +
+    ((int)(fileparamsp->start_sector_high & DFS_START_SECTOR_HIGH_MASK) * 0x100);
 }
 
-/**
- * \brief reads the catalogue from a DFS disk
- *
- * This function reads the catalogue from a DFS disk. It assumes the file
- * pointer is set to the start of the disk image file.  The function returns
- * a pointer to an ACORN_DIRECTORY. This needs to be freed with
- * acornfs_free_directory() when no longer required.
- *
- * \param diskfile the disk image file reference
- * \param acorn_dirpp pointer in which to return the acorn directory
- * \return 0 on success or an error
- */
-int dfs_read_catalogue(FILE * diskfile, ACORN_DIRECTORY ** acorn_dirpp) {
-  uint8_t sector0[DFS_SECTOR_SIZE];
-  uint8_t sector1[DFS_SECTOR_SIZE];
-  DFS_SECTOR_0 * sector0p;
-  DFS_SECTOR_1 * sector1p;
+static void set_start_sector(DFS_FILE_PARAMS * fileparamsp, int start_sector) {
+  fileparamsp->start_sector_low = (uint8_t)(start_sector & 0xff);
+  fileparamsp->start_sector_high =
+    (fileparamsp->start_sector_high & ~DFS_START_SECTOR_HIGH_MASK) |
+    ((start_sector / 0x100) & DFS_START_SECTOR_HIGH_MASK);
+}
+
+static uint32_t get_file_length(const DFS_FILE_PARAMS * fileparamsp) {
+  return
+    (uint32_t)fileparamsp->length_low +
+    ((uint32_t)fileparamsp->length_high * 0x100) +
+    ((uint32_t)((fileparamsp->start_sector_high & DFS_FILE_LENGTH_BIT_17_18_MASK) >> DFS_FILE_LENGTH_SHIFT) * 0x10000);
+}
+
+static int get_file_sectors(uint32_t length) {
+  return (int)((length + DFS_SECTOR_SIZE - 1) / DFS_SECTOR_SIZE);
+}
+
+static int build_free_map(const DFS_SECTOR_1 * sector1p, int num_of_sectors, DFS_FREE_MAP * mapp) {
+  DFS_EXTENT used[DFS_MAX_FILES];
+  int num_of_files = get_number_of_files(sector1p);
+
+  for (int i = 0; i < num_of_files; i++) {
+    used[i].start_sector = get_start_sector(&(sector1p->file_params[i]));
+    used[i].num_of_sectors = get_file_sectors(get_file_length(&(sector1p->file_params[i])));
+  }
+
+  return dfs_free_map_build(used, num_of_files, num_of_sectors, mapp);
+}
+
+/* Acorn DFS keeps the catalogue in descending order of start sector */
+static void sort_catalogue(DFS_SECTOR_0 * sector0p, DFS_SECTOR_1 * sector1p, int num_of_files) {
+  for (int i = 1; i < num_of_files; i++) {
+    DFS_FILE_NAME filename = sector0p->file_names[i];
+    DFS_FILE_PARAMS fileparams = sector1p->file_params[i];
+    int start_sector = get_start_sector(&fileparams);
+    int j = i;
+
+    while (j > 0 && get_start_sector(&(sector1p->file_params[j - 1])) < start_sector) {
+      sector0p->file_names[j] = sector0p->file_names[j - 1];
+      sector1p->file_params[j] = sector1p->file_params[j - 1];
+      j--;
+    }
+
+    sector0p->file_names[j] = filename;
+    sector1p->file_params[j] = fileparams;
+  }
+}
+
+/* Decodes a catalogue */
+static int parse_catalogue(const uint8_t * sector0, const uint8_t * sector1, ACORN_DIRECTORY ** acorn_dirpp) {
+  const DFS_SECTOR_0 * sector0p;
+  const DFS_SECTOR_1 * sector1p;
   int num_of_sectors;
-  int boot_options;
   int num_of_files;
   ACORN_DIRECTORY * acorn_dirp;
-  DFS_FILE_NAME * filenamep;
-  DFS_FILE_PARAMS * fileparamsp;
+  const DFS_FILE_NAME * filenamep;
+  DFS_FILE_PARAMS_TABLE table;
   ACORN_FILE * acorn_filep;
   int ret;
 
-  if (acorn_dirpp == NULL) {
+  if (sector0 == NULL || sector1 == NULL || acorn_dirpp == NULL) {
     return DFS_ERROR_FAILED;
   }
 
-  ret = read_catalogue_sectors(diskfile, sector0, sector1, &num_of_sectors);
+  ret = check_catalogue_sectors(sector1, &num_of_sectors);
   if (ret != DFS_ERROR_NONE) {
     return ret;
   }
 
-  sector0p = (DFS_SECTOR_0*)sector0;
-  sector1p = (DFS_SECTOR_1*)sector1;
+  sector0p = (const DFS_SECTOR_0*)sector0;
+  sector1p = (const DFS_SECTOR_1*)sector1;
 
   num_of_files = get_number_of_files(sector1p);
-  if (DEBUG_LEVEL(DEBUG_LEVEL_INFO)) fprintf(stderr, "Number of files: %u\n", num_of_files);
+  DEBUG_LOG(DEBUG_LEVEL_INFO, "Number of files: %u", num_of_files);
 
-  acorn_dirp =
-    (ACORN_DIRECTORY*)malloc(sizeof(ACORN_DIRECTORY) + (sizeof(ACORN_FILE) * (size_t)num_of_sectors));
+  /* One block holds the directory, the files and all the names */
+  acorn_dirp = acornfs_alloc_directory(num_of_files, DFS_DISK_NAME_SIZE, DFS_FILE_NAME_SIZE);
   if (acorn_dirp == NULL) {
-    perror("dfsutils");
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not allocate directory: %s", strerror(errno));
     return DFS_ERROR_FAILED;
   }
 
-  acorn_dirp->parent = NULL;
-  acorn_dirp->num_of_files = num_of_files;
-
-  acorn_dirp->name = get_disk_name(sector0p, sector1p);
-  if (DEBUG_LEVEL(DEBUG_LEVEL_INFO)) fprintf(stderr, "Disk name: %s\n", acorn_dirp->name);
+  get_disk_name(sector0p, sector1p, acorn_dirp->name);
+  DEBUG_LOG(DEBUG_LEVEL_INFO, "Disk name: %s", acorn_dirp->name);
 
   acorn_dirp->options = get_boot_options(sector1p);
-  if (DEBUG_LEVEL(DEBUG_LEVEL_INFO)) fprintf(stderr, "Boot options: 0x%02x\n", acorn_dirp->options);
+  DEBUG_LOG(DEBUG_LEVEL_INFO, "Boot options: 0x%02x", acorn_dirp->options);
+
+  /* The parameters of every file are decoded together */
+  dfs_decode_file_params(sector1p->file_params, num_of_files, &table);
 
   filenamep = sector0p->file_names;
-  fileparamsp = sector1p->file_params;
   acorn_filep = acorn_dirp->files;
 
   for(int i = 0; i < num_of_files; i++) {
-    get_file_info(filenamep++, fileparamsp++, acorn_filep++);
+    get_file_info(filenamep++, &table, i, acorn_filep++);
   }
 
   *acorn_dirpp = acorn_dirp;
@@ -360,23 +436,98 @@ int dfs_read_catalogue(FILE * diskfile, ACORN_DIRECTORY ** acorn_dirpp) {
 }
 
 /**
- * \brief Creates an empty DFS disk file
+ * \brief Decodes a DFS catalogue
+ *
+ * This function decodes the catalogue held in the first two sectors of a
+ * DFS disk, which may be anywhere in memory, for example in a memory mapped
+ * disk image.  The function returns a pointer to an ACORN_DIRECTORY. This
+ * needs to be freed with acornfs_free_directory() when no longer required.
+ *
+ * \param sector0 pointer to the contents of sector 0
+ * \param sector1 pointer to the contents of sector 1
+ * \param acorn_dirpp pointer in which to return the acorn directory
+ * \return 0 on success or an error
+ */
+int dfs_parse_catalogue(const uint8_t * sector0, const uint8_t * sector1, ACORN_DIRECTORY ** acorn_dirpp) {
+  uint64_t start = dfs_stats_begin(DFS_STATS_CATALOGUE);
+  int ret = parse_catalogue(sector0, sector1, acorn_dirpp);
+
+  dfs_stats_end(DFS_STATS_CATALOGUE, start);
+  return ret;
+}
+
+/* Reads and decodes a catalogue */
+static int read_catalogue(DFS_IO * iop, const DFS_GEOMETRY * geometryp, ACORN_DIRECTORY ** acorn_dirpp) {
+  uint8_t sector0[DFS_SECTOR_SIZE];
+  uint8_t sector1[DFS_SECTOR_SIZE];
+  int num_of_sectors;
+  int ret;
+
+  if (acorn_dirpp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  ret = read_catalogue_sectors(iop, geometryp, sector0, sector1, &num_of_sectors);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  return parse_catalogue(sector0, sector1, acorn_dirpp);
+}
+
+/**
+ * \brief reads the catalogue from a DFS disk
+ *
+ * This function reads the catalogue from a DFS disk which starts at the
+ * current position of the disk image file.  The position is left where it
+ * is.  The function returns a pointer to an ACORN_DIRECTORY. This needs to
+ * be freed with acornfs_free_directory() when no longer required.
  *
- * \param num_of_sectors this should be 400 or 800 for 40 or 80 track disks
- * \param name the disk name
  * \param diskfile the disk image file reference
+ * \param acorn_dirpp pointer in which to return the acorn directory
+ * \return 0 on success or an error
+ */
+int dfs_read_catalogue(FILE * diskfile, ACORN_DIRECTORY ** acorn_dirpp) {
+  uint64_t start = dfs_stats_begin(DFS_STATS_CATALOGUE);
+  DFS_GEOMETRY geometry;
+  DFS_IO io;
+  int ret;
+
+  ret = init_disk_io(diskfile, &io, &geometry);
+  if (ret == DFS_ERROR_NONE) {
+    ret = read_catalogue(&io, &geometry, acorn_dirpp);
+  }
+
+  dfs_stats_end(DFS_STATS_CATALOGUE, start);
+  return ret;
+}
+
+/**
+ * \brief Reads the catalogue from a DFS disk through an I/O backend
  *
+ * \param iop pointer to the I/O
+ * \param geometryp where the disk's sectors are in the image
+ * \param acorn_dirpp pointer in which to return the acorn directory
  * \return 0 on success or an error
  */
-int dfs_format_diskfile(int num_of_sectors, const char * name, FILE * diskfile) {
+int dfs_read_catalogue_io(DFS_IO * iop, const DFS_GEOMETRY * geometryp, ACORN_DIRECTORY ** acorn_dirpp) {
+  uint64_t start = dfs_stats_begin(DFS_STATS_CATALOGUE);
+  int ret = read_catalogue(iop, geometryp, acorn_dirpp);
+
+  dfs_stats_end(DFS_STATS_CATALOGUE, start);
+  return ret;
+}
+
+/* Writes an empty catalogue, leaving the data sectors as a hole where possible */
+static int format_io(DFS_IO * iop, const DFS_GEOMETRY * geometryp, int num_of_sectors, const char * name) {
+  static const uint8_t zeros[DFS_SECTORS_PER_TRACK * DFS_SECTOR_SIZE];
   DFS_SECTOR_0 sector0;
   DFS_SECTOR_1 sector1;
-  uint8_t sector2[DFS_SECTOR_SIZE];
-  size_t namelen = strlen(name);
-  size_t count = 0;
+  int sector = 2;
+  int ret;
 
   if (num_of_sectors != DFS_40_TRACK_NUM_OF_SECTORS && num_of_sectors != DFS_80_TRACK_NUM_OF_SECTORS) {
-    if (DEBUG_LEVEL(DEBUG_LEVEL_ERROR)) fprintf(stderr, "Invalid number of sectors: %u\n", num_of_sectors);
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Invalid number of sectors: %u", num_of_sectors);
     return DFS_ERROR_INVALID_NUMBER_OF_SECTORS;
   }
 
@@ -384,17 +535,7 @@ int dfs_format_diskfile(int num_of_sectors, const char * name, FILE * diskfile)
   memset(&sector0, 0, sizeof(sector0));
   memset(&sector1, 0, sizeof(sector1));
 
-  /* Set the disk name */
-  memcpy(
-    sector0.disk_name_0.diskname_0,
-    name,
-    min(sizeof(sector0.disk_name_0.diskname_0), namelen));
-  if (namelen > sizeof(sector0.disk_name_0.diskname_0)) {
-    memcpy(
-      sector1.disk_name_1.diskname_1,
-      name + sizeof(sector0.disk_name_0.diskname_0),
-      min(sizeof(sector1.disk_name_1.diskname_1), namelen - sizeof(sector0.disk_name_0.diskname_0)));
-  }
+  set_disk_name(&sector0, &sector1, name);
 
   /* Set the disk params:
        Cycle number 1
@@ -406,206 +547,1144 @@ int dfs_format_diskfile(int num_of_sectors, const char * name, FILE * diskfile)
   sector1.disk_name_1.num_of_sectors_high = num_of_sectors / 0x100;
   sector1.disk_name_1.num_of_sectors_low  = (uint8_t)(num_of_sectors & 0xff);
 
-  memset(sector2, 0, sizeof(sector2));
-
-  /* Write the DFS catalogue */
-  count = fwrite(&sector0, sizeof(sector0), 1, diskfile);
-  if (count == 0) {
-    if (DEBUG_LEVEL(DEBUG_LEVEL_ERROR)) fprintf(stdout, "Could not write sector 0\n");
-    return DFS_ERROR_FAILED;
+  ret = write_catalogue_sectors(iop, geometryp, (const uint8_t *)&sector0, (const uint8_t *)&sector1);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
   }
 
-  count = fwrite(&sector1, sizeof(sector1), 1, diskfile);
-  if (count == 0) {
-    if (DEBUG_LEVEL(DEBUG_LEVEL_ERROR)) fprintf(stderr, "Could not write sector 1\n");
-    return DFS_ERROR_FAILED;
+  /* Cut the image back to the catalogue, dropping any old contents, then
+     extend it.  The data sectors are left as a hole which reads as zeros.
+     A disk inside a container or sharing its image with another side is
+     never resized */
+  if (geometryp->disk_offset == 0 && geometryp->num_of_sides == 1) {
+    if (dfs_io_set_size(iop, 2 * DFS_SECTOR_SIZE) == DFS_ERROR_NONE &&
+        dfs_io_set_size(iop, (off_t)num_of_sectors * DFS_SECTOR_SIZE) == DFS_ERROR_NONE) {
+      return DFS_ERROR_NONE;
+    }
+
+    DEBUG_LOG(DEBUG_LEVEL_INFO, "Could not extend disk image (%s), writing sectors", strerror(errno));
   }
 
-  /* Pad out to the number of sectors */
-  for (int i = 2; i < num_of_sectors; i++) {
-    count = fwrite(sector2, sizeof(sector2), 1, diskfile);
-    if (count == 0) {
-      if (DEBUG_LEVEL(DEBUG_LEVEL_ERROR)) fprintf(stderr, "Could not write data sector: %u\n", i);
-      return DFS_ERROR_FAILED;
+  /* Otherwise pad out to the number of sectors, up to a track at a time */
+  while (sector < num_of_sectors) {
+    int run = min(DFS_SECTORS_PER_TRACK - sector % DFS_SECTORS_PER_TRACK, num_of_sectors - sector);
+
+    ret = dfs_io_write_sectors(iop, geometryp, sector, run, zeros);
+    if (ret != DFS_ERROR_NONE) {
+      DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not write data sector: %u", sector);
+      return ret;
     }
+
+    sector += run;
   }
 
   return DFS_ERROR_NONE;
 }
 
 /**
- * \brief Extracts a file from a DFS disk image
+ * \brief Creates an empty DFS disk file
  *
+ * Only the catalogue is written.  The rest of the disk is created as a
+ * hole in the file, which reads back as zeros, where the file allows it.
+ *
+ * \param num_of_sectors this should be 400 or 800 for 40 or 80 track disks
+ * \param name the disk name
  * \param diskfile the disk image file reference
- * \param start_sector the start sector
- * \param file_length the file length
- * \param file the local file reference
  *
  * \return 0 on success or an error
  */
-int dfs_extract_file(FILE * diskfile, const ACORN_FILE *acorn_filep, FILE * file) {
-  uint8_t sector[DFS_SECTOR_SIZE];
-  int len = (int)acorn_filep->length;
-  size_t count = 0;
-
-  int ret = fseek(diskfile, (long)((acorn_filep->start_sector) * DFS_SECTOR_SIZE), SEEK_SET);
-  if (ret == -1) {
-    if (DEBUG_LEVEL(DEBUG_LEVEL_ERROR)) fprintf(stderr, "Could not open target file!\n");
-    return DFS_ERROR_FAILED;
-  }
-
-  while (len > 0) {
-    count = fread(sector, min(sizeof(sector), (size_t)len), 1, diskfile);
-    if (count == 0) {
-      if (DEBUG_LEVEL(DEBUG_LEVEL_ERROR)) fprintf(stderr, "Could not read sector!\n");
-      return DFS_ERROR_FAILED;
-    }
-
-    fwrite(sector, min(sizeof(sector), len), 1, file);
-    len -= sizeof(sector);
-  }
-
-  return DFS_ERROR_NONE;
-}
-
-static int dfs_add_file_data(FILE * diskfile, FILE * file, int start_sector) {
-  uint8_t sector[DFS_SECTOR_SIZE];
-  size_t count;
-
-  int ret = fseek(file, 0, SEEK_SET);
-  if (ret == -1) {
-    if (DEBUG_LEVEL(DEBUG_LEVEL_ERROR)) fprintf(stderr, "Could not update disk image: %s\n", strerror(errno));
-    return DFS_ERROR_FAILED;
-  }
-
-  ret = fseek(diskfile, start_sector * DFS_SECTOR_SIZE, SEEK_SET);
-  if (ret == -1) {
-    if (DEBUG_LEVEL(DEBUG_LEVEL_ERROR)) fprintf(stderr, "Could not update disk image: %s\n", strerror(errno));
-    return DFS_ERROR_FAILED;
-  }
-
-  while (!feof(file)) {
-    count = fread(sector, sizeof(uint8_t), DFS_SECTOR_SIZE, file);
-    if (count < 0) {
-      if (DEBUG_LEVEL(DEBUG_LEVEL_ERROR)) fprintf(stderr, "Could not update disk image: %s\n", strerror(errno));
-      return DFS_ERROR_FAILED;
-    }
+int dfs_format_diskfile(int num_of_sectors, const char * name, FILE * diskfile) {
+  uint64_t start = dfs_stats_begin(DFS_STATS_FORMAT);
+  DFS_GEOMETRY geometry;
+  DFS_IO io;
+  int ret;
 
-    if (count > 0) {
-      count = fwrite(sector, sizeof(uint8_t), count, diskfile);
-      if (count < 0) {
-        if (DEBUG_LEVEL(DEBUG_LEVEL_ERROR)) fprintf(stderr, "Could not update disk image: %s\n", strerror(errno));
-        return DFS_ERROR_FAILED;
-      }
-    }
+  ret = init_disk_io(diskfile, &io, &geometry);
+  if (ret == DFS_ERROR_NONE) {
+    ret = format_io(&io, &geometry, num_of_sectors, name);
   }
 
-  return 0;
+  dfs_stats_end(DFS_STATS_FORMAT, start);
+  return ret;
 }
 
 /**
- * \brief Adds a file to the DFS disk image
+ * \brief Creates an empty DFS disk through an I/O backend
  *
- * \param diskfile the disk image file reference
- * \param acorn_filep pointer to the file meta data
- * \param file the local file reference
+ * \param iop pointer to the I/O
+ * \param geometryp where the disk's sectors are in the image
+ * \param num_of_sectors this should be 400 or 800 for 40 or 80 track disks
+ * \param name the disk name
  *
  * \return 0 on success or an error
  */
-int dfs_add_file(FILE * diskfile, ACORN_FILE * acorn_filep, FILE * file) {
-  char dfs_name[DFS_MAX_FILE_NAME_LEN];
+int dfs_format_io(DFS_IO * iop, const DFS_GEOMETRY * geometryp, int num_of_sectors, const char * name) {
+  uint64_t start = dfs_stats_begin(DFS_STATS_FORMAT);
+  int ret = format_io(iop, geometryp, num_of_sectors, name);
+
+  dfs_stats_end(DFS_STATS_FORMAT, start);
+  return ret;
+}
+
+/* Clones a template disk then names it */
+static int format_from_template(FILE * template_file, const char * name, FILE * diskfile) {
   uint8_t sector0[DFS_SECTOR_SIZE];
   uint8_t sector1[DFS_SECTOR_SIZE];
-  DFS_SECTOR_0 * sector0p;
-  DFS_SECTOR_1 * sector1p;
-  size_t count;
-  char * name;
-  char dir;
-  int name_len;
+  DFS_GEOMETRY geometry;
+  DFS_IO template_io;
+  DFS_IO io;
+  off_t template_size;
+  int template_fd = fileno(template_file);
+  int fd = fileno(diskfile);
   int num_of_sectors;
-  int first_free_sector;
-  int free_space;
-  int num_of_files;
   int ret;
 
-  ret = read_catalogue_sectors(diskfile, sector0, sector1, &num_of_sectors);
+  /* Only a whole file can be cloned */
+  ret = init_disk_io(diskfile, &io, &geometry);
   if (ret != DFS_ERROR_NONE) {
     return ret;
   }
 
-  sector0p = (DFS_SECTOR_0*)sector0;
-  sector1p = (DFS_SECTOR_1*)sector1;
-
-  num_of_files = get_number_of_files(sector1p);
-  if (num_of_files >= DFS_MAX_FILES) {
-    if (DEBUG_LEVEL(DEBUG_LEVEL_INFO)) fprintf(stderr, "Number of files: %u\n", num_of_files);
-    return DFS_ERROR_DISK_FULL;
+  if (geometry.disk_offset != 0) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Can only clone a template to a whole file");
+    return DFS_ERROR_FAILED;
   }
 
-  ret = dfs_get_file_name_and_dir(acorn_filep->name, &name, &dir);
+  dfs_io_init_fd(&template_io, template_fd);
+
+  ret = dfs_io_get_size(&template_io, &template_size);
   if (ret != DFS_ERROR_NONE) {
     return ret;
   }
 
-  memset(dfs_name, ' ', sizeof(dfs_name));
-  memcpy(dfs_name, name, strlen(name));
-  free(name);
+  /* The template must itself be a DFS disk */
+  ret = read_catalogue_sectors(&template_io, &geometry, sector0, sector1, &num_of_sectors);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
 
-  for (int i = 0; i < num_of_files; i++) {
-    if (dir != (sector0p->file_names[i].directory & DFS_DIR_NAME_MASK)) {
-      continue;
-    }
+  ret = dfs_io_set_size(&io, 0);
+  if (ret != DFS_ERROR_NONE) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not truncate disk image: %s", strerror(errno));
+    return ret;
+  }
 
-    if (memcmp(dfs_name, sector0p->file_names[i].filename, sizeof(dfs_name)) == 0) {
-      if (DEBUG_LEVEL(DEBUG_LEVEL_ERROR)) fprintf(stderr, "File exists!\n");
-      return DFS_ERROR_FILE_EXISTS;
+#if defined(__linux__) && defined(FICLONE)
+  dfs_stats_count(DFS_STATS_SYSCALLS, 1);
+  if (ioctl(fd, FICLONE, template_fd) == 0) {
+    DEBUG_LOG(DEBUG_LEVEL_INFO, "Cloned template with reflink");
+  } else
+#endif
+  {
+    ret = dfs_copy_range(template_fd, 0, fd, 0, (size_t)template_size);
+    if (ret != DFS_ERROR_NONE) {
+      return ret;
     }
   }
 
-  get_first_free_sector(sector1p, &first_free_sector);
-
-  free_space = (num_of_sectors - first_free_sector) * DFS_SECTOR_SIZE;
-  if (free_space < acorn_filep->length) {
-    if (DEBUG_LEVEL(DEBUG_LEVEL_ERROR)) fprintf(stderr, "Disk image full!\n");
-    return DFS_ERROR_DISK_FULL;
-  }
+  set_disk_name((DFS_SECTOR_0 *)sector0, (DFS_SECTOR_1 *)sector1, name);
 
-  memcpy(&(sector0p->file_names[num_of_files].filename), dfs_name, sizeof(dfs_name));
-  sector0p->file_names[num_of_files].directory = dir;
+  return write_catalogue_sectors(&io, &geometry, sector0, sector1);
+}
 
-  acorn_filep->start_sector = first_free_sector;
+/**
+ * \brief Creates a DFS disk file by cloning a template disk image
+ *
+ * The template, typically a freshly formatted disk image, is cloned with
+ * a reflink where the file system supports it so that no data is copied
+ * at all.  Otherwise the template is copied in the kernel.  The disk name
+ * in the copy is then set.
+ *
+ * \param template_file the template disk image file reference
+ * \param name the disk name
+ * \param diskfile the disk image file reference
+ *
+ * \return 0 on success or an error
+ */
+int dfs_format_from_template(FILE * template_file, const char * name, FILE * diskfile) {
+  uint64_t start = dfs_stats_begin(DFS_STATS_FORMAT);
+  int ret = format_from_template(template_file, name, diskfile);
 
-  ret = set_file_params(acorn_filep, &(sector0p->file_names[num_of_files]), &(sector1p->file_params[num_of_files]));
-  if (ret != DFS_ERROR_NONE) {
-    return ret;
-  }
+  dfs_stats_end(DFS_STATS_FORMAT, start);
+  return ret;
+}
 
-  /* Write file first before updating catalogue in case of error */
-  ret = dfs_add_file_data(diskfile, file, first_free_sector);
-  if (ret != DFS_ERROR_NONE) {
-    return ret;
-  }
+/* Copies a file out a contiguous run of sectors at a time */
+static int extract_file_io(DFS_IO * iop, const DFS_GEOMETRY * geometryp, const ACORN_FILE * acorn_filep, FILE * file) {
+  int sector = (int)acorn_filep->start_sector;
+  uint32_t remaining = acorn_filep->length;
+  int ret;
 
-  ret = fseek(diskfile, 0, SEEK_SET);
-  if (ret == -1) {
-    if (DEBUG_LEVEL(DEBUG_LEVEL_ERROR)) fprintf(stderr, "Could not update disk image: %s\n", strerror(errno));
-    return DFS_ERROR_FAILED;
-  }
+  while (remaining > 0) {
+    int run = dfs_geometry_run_length(geometryp, sector, get_file_sectors(remaining));
+    uint32_t length = (uint32_t)run * DFS_SECTOR_SIZE;
 
-  set_number_of_files(sector1p, num_of_files + 1);
-  increment_cycle_number(sector1p);
+    if (length > remaining) {
+      length = remaining;
+    }
 
-  count = fwrite(&sector0, sizeof(sector0), 1, diskfile);
-  if (count == 0) {
-    if (DEBUG_LEVEL(DEBUG_LEVEL_ERROR)) fprintf(stderr, "Could not write sector 0\n");
-    return DFS_ERROR_FAILED;
-  }
+    ret = dfs_io_copy_to_file(iop, dfs_geometry_sector_offset(geometryp, sector), length, file);
+    if (ret != DFS_ERROR_NONE) {
+      DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not read file data!");
+      return ret;
+    }
 
-  count = fwrite(&sector1, sizeof(sector1), 1, diskfile);
-  if (count == 0) {
-    if (DEBUG_LEVEL(DEBUG_LEVEL_ERROR)) fprintf(stderr, "Could not write sector 1\n");
-    return DFS_ERROR_FAILED;
+    dfs_stats_count(DFS_STATS_SECTORS_READ, (uint64_t)get_file_sectors(length));
+    sector += run;
+    remaining -= length;
   }
 
   return DFS_ERROR_NONE;
 }
+
+/**
+ * \brief Extracts a file from a DFS disk image
+ *
+ * The disk is taken to start at the current position of the disk image
+ * file, as for all the functions here, so a disk held in a container such
+ * as an MMB file can be used in place.
+ *
+ * \param diskfile the disk image file reference
+ * \param start_sector the start sector
+ * \param file_length the file length
+ * \param file the local file reference
+ *
+ * \return 0 on success or an error
+ */
+int dfs_extract_file(FILE * diskfile, const ACORN_FILE *acorn_filep, FILE * file) {
+  uint64_t start = dfs_stats_begin(DFS_STATS_EXTRACT);
+  DFS_GEOMETRY geometry;
+  DFS_IO io;
+  int ret;
+
+  ret = init_disk_io(diskfile, &io, &geometry);
+  if (ret == DFS_ERROR_NONE) {
+    ret = extract_file_io(&io, &geometry, acorn_filep, file);
+  }
+
+  dfs_stats_end(DFS_STATS_EXTRACT, start);
+  return ret;
+}
+
+/**
+ * \brief Extracts a file from a DFS disk with a given geometry
+ *
+ * Only positional reads are made on the disk image file, so any number of
+ * threads can extract from the same file at once.  The data is copied a
+ * contiguous run of sectors at a time.
+ *
+ * \param diskfile the disk image file reference
+ * \param geometryp where the disk's sectors are in the disk image file
+ * \param acorn_filep pointer to the file meta data
+ * \param file the local file reference
+ *
+ * \return 0 on success or an error
+ */
+int dfs_extract_file_at(FILE * diskfile, const DFS_GEOMETRY * geometryp, const ACORN_FILE * acorn_filep, FILE * file) {
+  uint64_t start = dfs_stats_begin(DFS_STATS_EXTRACT);
+  DFS_IO io;
+  int ret;
+
+  ret = init_file_io(diskfile, &io);
+  if (ret == DFS_ERROR_NONE) {
+    ret = extract_file_io(&io, geometryp, acorn_filep, file);
+  }
+
+  dfs_stats_end(DFS_STATS_EXTRACT, start);
+  return ret;
+}
+
+/**
+ * \brief Extracts a file from a DFS disk through an I/O backend
+ *
+ * Only positional reads are made, so any number of threads can extract
+ * from the same image at once.
+ *
+ * \param iop pointer to the I/O
+ * \param geometryp where the disk's sectors are in the image
+ * \param acorn_filep pointer to the file meta data
+ * \param file the local file reference
+ *
+ * \return 0 on success or an error
+ */
+int dfs_extract_file_io(DFS_IO * iop, const DFS_GEOMETRY * geometryp, const ACORN_FILE * acorn_filep, FILE * file) {
+  uint64_t start = dfs_stats_begin(DFS_STATS_EXTRACT);
+  int ret = extract_file_io(iop, geometryp, acorn_filep, file);
+
+  dfs_stats_end(DFS_STATS_EXTRACT, start);
+  return ret;
+}
+
+/* Files no more than this many sectors apart are read together, as reading
+   the gap costs less than a seek */
+#define DFS_EXTRACT_MAX_GAP 4
+
+static int get_end_sector(const ACORN_FILE * acorn_filep) {
+  return (int)acorn_filep->start_sector + get_file_sectors(acorn_filep->length);
+}
+
+/* Checks a file's data is all in the disk image file.  Only its last sector
+   may be cut short, as it is at the end of many images */
+static int check_file_extent(const DFS_GEOMETRY * geometryp, const ACORN_FILE * acorn_filep, off_t file_size) {
+  int last_sector;
+
+  if (acorn_filep->length == 0) {
+    return DFS_ERROR_NONE;
+  }
+
+  last_sector = get_end_sector(acorn_filep) - 1;
+  if (last_sector >= DFS_80_TRACK_NUM_OF_SECTORS ||
+      dfs_geometry_sector_offset(geometryp, last_sector) + (off_t)((acorn_filep->length - 1) % DFS_SECTOR_SIZE) >= file_size) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "File extends beyond the disk image: %s", acorn_filep->name);
+    return DFS_ERROR_BAD_EXTENT;
+  }
+
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Checks that a file's contents are all in a DFS disk image
+ *
+ * \param iop pointer to the I/O
+ * \param geometryp where the disk's sectors are in the image
+ * \param acorn_filep pointer to the file meta data
+ *
+ * \return 0 if the file is all there, DFS_ERROR_BAD_EXTENT if not, or an error
+ */
+int dfs_check_file_io(DFS_IO * iop, const DFS_GEOMETRY * geometryp, const ACORN_FILE * acorn_filep) {
+  off_t image_size;
+  int ret;
+
+  if (iop == NULL || geometryp == NULL || acorn_filep == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  ret = dfs_io_get_size(iop, &image_size);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  return check_file_extent(geometryp, acorn_filep, image_size);
+}
+
+/* Plans and makes the reads for a number of files, then writes them out */
+static int extract_files_io(DFS_IO * iop, const DFS_GEOMETRY * geometryp, const ACORN_FILE ** acorn_files, FILE ** files, int num_of_files) {
+  off_t image_size;
+  int * order;
+  uint8_t * buffer;
+  int first_sector;
+  int end_sector = 0;
+  int ret = DFS_ERROR_NONE;
+
+  if (acorn_files == NULL || files == NULL || num_of_files < 0) {
+    return DFS_ERROR_FAILED;
+  }
+
+  if (num_of_files == 0) {
+    return DFS_ERROR_NONE;
+  }
+
+  ret = dfs_io_get_size(iop, &image_size);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  order = (int *)malloc((size_t)num_of_files * sizeof(int));
+  dfs_stats_count(DFS_STATS_ALLOCS, 1);
+  if (order == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  /* Start sector order, keeping the given order for files that share one */
+  for (int n = 0; n < num_of_files; n++) {
+    int j = n;
+
+    while (j > 0 && acorn_files[order[j - 1]]->start_sector > acorn_files[n]->start_sector) {
+      order[j] = order[j - 1];
+      j--;
+    }
+
+    order[j] = n;
+  }
+
+  /* Nothing is written unless every file can be read */
+  for (int n = 0; n < num_of_files && ret == DFS_ERROR_NONE; n++) {
+    const ACORN_FILE * acorn_filep = acorn_files[order[n]];
+
+    ret = check_file_extent(geometryp, acorn_filep, image_size);
+    if (get_end_sector(acorn_filep) > end_sector) {
+      end_sector = get_end_sector(acorn_filep);
+    }
+  }
+
+  first_sector = (int)acorn_files[order[0]]->start_sector;
+  if (ret != DFS_ERROR_NONE || end_sector <= first_sector) {
+    free(order);
+    return ret;
+  }
+
+  /* One hint for the whole sweep, which for an interleaved image takes in
+     the other side too */
+  if (iop->fd != -1) {
+    posix_fadvise(
+      iop->fd,
+      dfs_geometry_sector_offset(geometryp, first_sector),
+      dfs_geometry_sector_offset(geometryp, end_sector - 1) + DFS_SECTOR_SIZE - dfs_geometry_sector_offset(geometryp, first_sector),
+      POSIX_FADV_WILLNEED);
+    dfs_stats_count(DFS_STATS_SYSCALLS, 1);
+  }
+
+  /* Big enough for the widest span, which is at most the whole sweep */
+  buffer = (uint8_t *)malloc((size_t)(end_sector - first_sector) * DFS_SECTOR_SIZE);
+  dfs_stats_count(DFS_STATS_ALLOCS, 1);
+  if (buffer == NULL) {
+    free(order);
+    return DFS_ERROR_FAILED;
+  }
+
+  for (int n = 0; n < num_of_files && ret == DFS_ERROR_NONE;) {
+    int span_start = (int)acorn_files[order[n]]->start_sector;
+    int span_end = get_end_sector(acorn_files[order[n]]);
+    int next = n + 1;
+
+    /* Files that overlap, touch or nearly touch make one span */
+    while (next < num_of_files && (int)acorn_files[order[next]]->start_sector <= span_end + DFS_EXTRACT_MAX_GAP) {
+      if (get_end_sector(acorn_files[order[next]]) > span_end) {
+        span_end = get_end_sector(acorn_files[order[next]]);
+      }
+      next++;
+    }
+
+    if (span_end > span_start) {
+      ret = dfs_io_read_sectors(iop, geometryp, span_start, span_end - span_start, buffer);
+    }
+
+    for (; n < next && ret == DFS_ERROR_NONE; n++) {
+      const ACORN_FILE * acorn_filep = acorn_files[order[n]];
+      const uint8_t * data = buffer + ((size_t)((int)acorn_filep->start_sector - span_start) * DFS_SECTOR_SIZE);
+
+      if (fwrite(data, 1, acorn_filep->length, files[order[n]]) != acorn_filep->length) {
+        DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not write target file: %s", strerror(errno));
+        ret = DFS_ERROR_FAILED;
+      }
+    }
+
+    n = next;
+  }
+
+  free(buffer);
+  free(order);
+  return ret;
+}
+
+/**
+ * \brief Extracts a number of files from a DFS disk with a given geometry
+ *
+ * The files are sorted by start sector and gathered into spans of files
+ * that are close together.  Each span is read with as few reads as the
+ * geometry allows and then each of its files is written out.
+ *
+ * \param diskfile the disk image file reference
+ * \param geometryp where the disk's sectors are in the disk image file
+ * \param acorn_files array of pointers to the file meta data
+ * \param files array of local file references
+ * \param num_of_files the number of files to extract
+ *
+ * \return 0 on success or an error
+ */
+int dfs_extract_files_at(FILE * diskfile, const DFS_GEOMETRY * geometryp, const ACORN_FILE ** acorn_files, FILE ** files, int num_of_files) {
+  uint64_t start = dfs_stats_begin(DFS_STATS_EXTRACT);
+  DFS_IO io;
+  int ret;
+
+  ret = init_file_io(diskfile, &io);
+  if (ret == DFS_ERROR_NONE) {
+    ret = extract_files_io(&io, geometryp, acorn_files, files, num_of_files);
+  }
+
+  dfs_stats_end(DFS_STATS_EXTRACT, start);
+  return ret;
+}
+
+/**
+ * \brief Extracts a number of files from a DFS disk through an I/O backend
+ *
+ * \param iop pointer to the I/O
+ * \param geometryp where the disk's sectors are in the image
+ * \param acorn_files array of pointers to the file meta data
+ * \param files array of local file references
+ * \param num_of_files the number of files to extract
+ *
+ * \return 0 on success or an error
+ */
+int dfs_extract_files_io(DFS_IO * iop, const DFS_GEOMETRY * geometryp, const ACORN_FILE ** acorn_files, FILE ** files, int num_of_files) {
+  uint64_t start = dfs_stats_begin(DFS_STATS_EXTRACT);
+  int ret = extract_files_io(iop, geometryp, acorn_files, files, num_of_files);
+
+  dfs_stats_end(DFS_STATS_EXTRACT, start);
+  return ret;
+}
+
+static int dfs_add_file_data(DFS_IO * iop, const DFS_GEOMETRY * geometryp, FILE * file, int start_sector, uint32_t length) {
+  int sector = start_sector;
+  off_t file_offset = 0;
+
+  /* A contiguous run of sectors at a time */
+  while ((uint32_t)file_offset < length) {
+    uint32_t remaining = length - (uint32_t)file_offset;
+    int run = dfs_geometry_run_length(geometryp, sector, get_file_sectors(remaining));
+    uint32_t run_length = (uint32_t)run * DFS_SECTOR_SIZE;
+    int ret;
+
+    if (run_length > remaining) {
+      run_length = remaining;
+    }
+
+    ret = dfs_io_copy_from_file(iop, dfs_geometry_sector_offset(geometryp, sector), file, file_offset, run_length);
+    if (ret != DFS_ERROR_NONE) {
+      DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not update disk image: %s", strerror(errno));
+      return ret;
+    }
+
+    dfs_stats_count(DFS_STATS_SECTORS_WRITTEN, (uint64_t)get_file_sectors(run_length));
+    sector += run;
+    file_offset += run_length;
+  }
+
+  return 0;
+}
+
+/* Finds a file in the catalogue by name, ignoring case and the lock bit */
+static int find_catalogue_entry(const DFS_NAME_INDEX * name_indexp, const char * file_name, int * indexp) {
+  DFS_NAME_KEY key;
+  int ret;
+
+  ret = dfs_name_key_from_string(file_name, &key);
+  if (ret != DFS_ERROR_NONE) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Invalid file name: %s", file_name);
+    return ret;
+  }
+
+  ret = dfs_name_index_find(name_indexp, key, indexp);
+  if (ret != DFS_ERROR_NONE) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "File not found: %s", file_name);
+    return ret;
+  }
+
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Adds a file to the DFS disk image
+ *
+ * \param diskfile the disk image file reference
+ * \param acorn_filep pointer to the file meta data
+ * \param file the local file reference
+ *
+ * \return 0 on success or an error
+ */
+int dfs_add_file(FILE * diskfile, ACORN_FILE * acorn_filep, FILE * file) {
+  return dfs_add_files(diskfile, acorn_filep, &file, 1, DFS_ALLOC_FIRST_FIT);
+}
+
+/* Plans, writes and catalogues a batch of files */
+static int add_files_io(DFS_IO * iop, const DFS_GEOMETRY * geometryp, ACORN_FILE * acorn_files, FILE ** files, int num_of_new_files, int alloc_policy) {
+  uint8_t sector0[DFS_SECTOR_SIZE];
+  uint8_t sector1[DFS_SECTOR_SIZE];
+  DFS_SECTOR_0 * sector0p;
+  DFS_SECTOR_1 * sector1p;
+  DFS_FILE_NAME * filenamep;
+  DFS_FREE_MAP free_map;
+  DFS_NAME_INDEX name_index;
+  int write_order[DFS_MAX_FILES];
+  char * name;
+  char dir;
+  int num_of_sectors;
+  int num_of_files;
+  int ret;
+
+  if (acorn_files == NULL || files == NULL || num_of_new_files < 0) {
+    return DFS_ERROR_FAILED;
+  }
+
+  ret = read_catalogue_sectors(iop, geometryp, sector0, sector1, &num_of_sectors);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  sector0p = (DFS_SECTOR_0*)sector0;
+  sector1p = (DFS_SECTOR_1*)sector1;
+
+  num_of_files = get_number_of_files(sector1p);
+  if (num_of_files + num_of_new_files > DFS_MAX_FILES) {
+    DEBUG_LOG(DEBUG_LEVEL_INFO, "Number of files: %u", num_of_files);
+    return DFS_ERROR_DISK_FULL;
+  }
+
+  ret = build_free_map(sector1p, num_of_sectors, &free_map);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  ret = dfs_name_index_build(&name_index, sector0p->file_names, num_of_files);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  /* Plan every placement in the in-memory catalogue before writing anything */
+  for (int n = 0; n < num_of_new_files; n++) {
+    ACORN_FILE * acorn_filep = &(acorn_files[n]);
+    int index = num_of_files + n;
+    int start_sector;
+
+    ret = dfs_get_file_name_and_dir(acorn_filep->name, &name, &dir);
+    if (ret != DFS_ERROR_NONE) {
+      return ret;
+    }
+
+    filenamep = &(sector0p->file_names[index]);
+    memset(filenamep->filename, ' ', sizeof(filenamep->filename));
+    memcpy(filenamep->filename, name, strlen(name));
+    filenamep->directory = dir;
+    free(name);
+
+    /* The index holds existing files and those earlier in the batch */
+    ret = dfs_name_index_insert(&name_index, dfs_name_key(filenamep), index);
+    if (ret != DFS_ERROR_NONE) {
+      DEBUG_LOG(DEBUG_LEVEL_ERROR, "File exists: %s", acorn_filep->name);
+      return ret;
+    }
+
+    ret = dfs_free_map_allocate(&free_map, get_file_sectors(acorn_filep->length), alloc_policy, &start_sector);
+    if (ret != DFS_ERROR_NONE) {
+      DEBUG_LOG(DEBUG_LEVEL_ERROR, "Disk image full!");
+      return ret;
+    }
+
+    acorn_filep->start_sector = (uint32_t)start_sector;
+
+    ret = set_file_params(acorn_filep, filenamep, &(sector1p->file_params[index]));
+    if (ret != DFS_ERROR_NONE) {
+      return ret;
+    }
+  }
+
+  /* Write the files first, in disk order, before updating the catalogue in case of error */
+  for (int n = 0; n < num_of_new_files; n++) {
+    int j = n;
+
+    while (j > 0 && acorn_files[write_order[j - 1]].start_sector > acorn_files[n].start_sector) {
+      write_order[j] = write_order[j - 1];
+      j--;
+    }
+
+    write_order[j] = n;
+  }
+
+  for (int n = 0; n < num_of_new_files; n++) {
+    int i = write_order[n];
+
+    ret = dfs_add_file_data(iop, geometryp, files[i], acorn_files[i].start_sector, acorn_files[i].length);
+    if (ret != DFS_ERROR_NONE) {
+      return ret;
+    }
+  }
+
+  sort_catalogue(sector0p, sector1p, num_of_files + num_of_new_files);
+  set_number_of_files(sector1p, num_of_files + num_of_new_files);
+  increment_cycle_number(sector1p);
+
+  return write_catalogue_sectors(iop, geometryp, sector0, sector1);
+}
+
+/**
+ * \brief Adds a number of files to the DFS disk image
+ *
+ * The catalogue is read once and placements for all of the files are
+ * planned before anything is written, allocating from a free space map so
+ * that gaps left by removed files are reused.  The file data is then
+ * written in a single ascending pass over the disk and the catalogue is
+ * written back once, with a single increment of the cycle number.  Either
+ * all of the files are added to the catalogue or none are.
+ *
+ * \param diskfile the disk image file reference
+ * \param acorn_files array of file meta data, the start sectors are filled in
+ * \param files array of local file references
+ * \param num_of_new_files the number of files to add
+ * \param alloc_policy one of the DFS_ALLOC_ policies
+ *
+ * \return 0 on success or an error
+ */
+int dfs_add_files(FILE * diskfile, ACORN_FILE * acorn_files, FILE ** files, int num_of_new_files, int alloc_policy) {
+  uint64_t start = dfs_stats_begin(DFS_STATS_ADD);
+  DFS_GEOMETRY geometry;
+  DFS_IO io;
+  int ret;
+
+  ret = init_disk_io(diskfile, &io, &geometry);
+  if (ret == DFS_ERROR_NONE) {
+    ret = add_files_io(&io, &geometry, acorn_files, files, num_of_new_files, alloc_policy);
+  }
+
+  dfs_stats_end(DFS_STATS_ADD, start);
+  return ret;
+}
+
+/**
+ * \brief Adds a number of files to a DFS disk with a given geometry
+ *
+ * \param diskfile the disk image file reference
+ * \param geometryp where the disk's sectors are in the disk image file
+ * \param acorn_files array of file meta data, the start sectors are filled in
+ * \param files array of local file references
+ * \param num_of_new_files the number of files to add
+ * \param alloc_policy one of the DFS_ALLOC_ policies
+ *
+ * \return 0 on success or an error
+ */
+int dfs_add_files_at(FILE * diskfile, const DFS_GEOMETRY * geometryp, ACORN_FILE * acorn_files, FILE ** files, int num_of_new_files, int alloc_policy) {
+  uint64_t start = dfs_stats_begin(DFS_STATS_ADD);
+  DFS_IO io;
+  int ret;
+
+  ret = init_file_io(diskfile, &io);
+  if (ret == DFS_ERROR_NONE) {
+    ret = add_files_io(&io, geometryp, acorn_files, files, num_of_new_files, alloc_policy);
+  }
+
+  dfs_stats_end(DFS_STATS_ADD, start);
+  return ret;
+}
+
+/**
+ * \brief Adds a number of files to a DFS disk through an I/O backend
+ *
+ * \param iop pointer to the I/O
+ * \param geometryp where the disk's sectors are in the image
+ * \param acorn_files array of file meta data, the start sectors are filled in
+ * \param files array of local file references
+ * \param num_of_new_files the number of files to add
+ * \param alloc_policy one of the DFS_ALLOC_ policies
+ *
+ * \return 0 on success or an error
+ */
+int dfs_add_files_io(DFS_IO * iop, const DFS_GEOMETRY * geometryp, ACORN_FILE * acorn_files, FILE ** files, int num_of_new_files, int alloc_policy) {
+  uint64_t start = dfs_stats_begin(DFS_STATS_ADD);
+  int ret = add_files_io(iop, geometryp, acorn_files, files, num_of_new_files, alloc_policy);
+
+  dfs_stats_end(DFS_STATS_ADD, start);
+  return ret;
+}
+
+/* Moves a run of sectors to a lower position on the disk, reading all of it
+   before writing any */
+static int move_sectors(DFS_IO * iop, const DFS_GEOMETRY * geometryp, int from_sector, int to_sector, int num_of_sectors) {
+  size_t length = (size_t)num_of_sectors * DFS_SECTOR_SIZE;
+  uint8_t * buffer;
+  int ret;
+
+  if (length == 0) {
+    return DFS_ERROR_NONE;
+  }
+
+  buffer = (uint8_t *)malloc(length);
+  dfs_stats_count(DFS_STATS_ALLOCS, 1);
+  if (buffer == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  /* The whole run is read before any of it is written so overlap is safe */
+  ret = dfs_io_read_sectors(iop, geometryp, from_sector, num_of_sectors, buffer);
+  if (ret == DFS_ERROR_NONE) {
+    ret = dfs_io_write_sectors(iop, geometryp, to_sector, num_of_sectors, buffer);
+  }
+
+  free(buffer);
+  return ret;
+}
+
+/**
+ * \brief Compacts a DFS disk image
+ *
+ * Files are slid down towards the catalogue, in start sector order, so
+ * that all of the free space ends up in a single extent at the end of the
+ * disk.  Files that are already in place are not touched, neighbouring
+ * files that move by the same distance are moved together as a single run
+ * and no sector is moved more than once.  The catalogue is written back
+ * once at the end.
+ *
+ * \param diskfile the disk image file reference
+ * \param statsp pointer in which to return what was moved, may be NULL
+ *
+ * \return 0 on success or an error
+ */
+int dfs_compact(FILE * diskfile, DFS_COMPACT_STATS * statsp) {
+  DFS_GEOMETRY geometry;
+  DFS_IO io;
+  int ret;
+
+  ret = init_disk_io(diskfile, &io, &geometry);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  return dfs_compact_io(&io, &geometry, statsp);
+}
+
+/**
+ * \brief Compacts a DFS disk with a given geometry
+ *
+ * \param diskfile the disk image file reference
+ * \param geometryp where the disk's sectors are in the disk image file
+ * \param statsp pointer in which to return what was moved, may be NULL
+ *
+ * \return 0 on success or an error
+ */
+int dfs_compact_at(FILE * diskfile, const DFS_GEOMETRY * geometryp, DFS_COMPACT_STATS * statsp) {
+  DFS_IO io;
+  int ret;
+
+  ret = init_file_io(diskfile, &io);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  return dfs_compact_io(&io, geometryp, statsp);
+}
+
+/**
+ * \brief Compacts a DFS disk through an I/O backend
+ *
+ * \param iop pointer to the I/O
+ * \param geometryp where the disk's sectors are in the image
+ * \param statsp pointer in which to return what was moved, may be NULL
+ *
+ * \return 0 on success or an error
+ */
+int dfs_compact_io(DFS_IO * iop, const DFS_GEOMETRY * geometryp, DFS_COMPACT_STATS * statsp) {
+  uint8_t sector0[DFS_SECTOR_SIZE];
+  uint8_t sector1[DFS_SECTOR_SIZE];
+  DFS_SECTOR_0 * sector0p;
+  DFS_SECTOR_1 * sector1p;
+  DFS_COMPACT_STATS stats;
+  int order[DFS_MAX_FILES];
+  int new_start[DFS_MAX_FILES];
+  int num_of_sectors;
+  int num_of_files;
+  int next_sector = 2;
+  int ret;
+
+  memset(&stats, 0, sizeof(stats));
+
+  ret = read_catalogue_sectors(iop, geometryp, sector0, sector1, &num_of_sectors);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  sector0p = (DFS_SECTOR_0*)sector0;
+  sector1p = (DFS_SECTOR_1*)sector1;
+  num_of_files = get_number_of_files(sector1p);
+
+  /* Plan: files in ascending start sector order, each packed after the last */
+  for (int n = 0; n < num_of_files; n++) {
+    int j = n;
+
+    while (j > 0 && get_start_sector(&(sector1p->file_params[order[j - 1]])) > get_start_sector(&(sector1p->file_params[n]))) {
+      order[j] = order[j - 1];
+      j--;
+    }
+
+    order[j] = n;
+  }
+
+  for (int n = 0; n < num_of_files; n++) {
+    const DFS_FILE_PARAMS * fileparamsp = &(sector1p->file_params[order[n]]);
+    int start_sector = get_start_sector(fileparamsp);
+
+    if (start_sector < next_sector) {
+      DEBUG_LOG(DEBUG_LEVEL_ERROR, "Files overlap at sector %d, not compacting", start_sector);
+      return DFS_ERROR_BAD_EXTENT;
+    }
+
+    new_start[order[n]] = next_sector;
+    next_sector += get_file_sectors(get_file_length(fileparamsp));
+  }
+
+  if (next_sector > num_of_sectors) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Files extend beyond the end of the disk");
+    return DFS_ERROR_BAD_EXTENT;
+  }
+
+  /* Move the data, coalescing touching files that move the same distance */
+  for (int n = 0; n < num_of_files; ) {
+    int first = order[n];
+    int from_sector = get_start_sector(&(sector1p->file_params[first]));
+    int distance = from_sector - new_start[first];
+    int run_sectors = get_file_sectors(get_file_length(&(sector1p->file_params[first])));
+    int run_files = 1;
+
+    while (n + run_files < num_of_files) {
+      int next = order[n + run_files];
+
+      if (get_start_sector(&(sector1p->file_params[next])) != from_sector + run_sectors ||
+          get_start_sector(&(sector1p->file_params[next])) - new_start[next] != distance) {
+        break;
+      }
+
+      run_sectors += get_file_sectors(get_file_length(&(sector1p->file_params[next])));
+      run_files++;
+    }
+
+    if (distance > 0 && run_sectors > 0) {
+      ret = move_sectors(iop, geometryp, from_sector, from_sector - distance, run_sectors);
+      if (ret != DFS_ERROR_NONE) {
+        return ret;
+      }
+
+      stats.bytes_moved += (uint32_t)run_sectors * DFS_SECTOR_SIZE;
+      stats.num_of_moves++;
+    }
+
+    if (distance > 0) {
+      for (int i = 0; i < run_files; i++) {
+        set_start_sector(&(sector1p->file_params[order[n + i]]), new_start[order[n + i]]);
+      }
+
+      stats.files_moved += run_files;
+    }
+
+    n += run_files;
+  }
+
+  stats.free_sectors = num_of_sectors - next_sector;
+
+  if (stats.files_moved > 0) {
+    sort_catalogue(sector0p, sector1p, num_of_files);
+    increment_cycle_number(sector1p);
+
+    ret = write_catalogue_sectors(iop, geometryp, sector0, sector1);
+    if (ret != DFS_ERROR_NONE) {
+      return ret;
+    }
+  }
+
+  if (statsp != NULL) {
+    *statsp = stats;
+  }
+
+  return DFS_ERROR_NONE;
+}
+
+/* Removes entries from a catalogue */
+static int remove_files_io(DFS_IO * iop, const DFS_GEOMETRY * geometryp, const char ** names, int num_of_names) {
+  uint8_t sector0[DFS_SECTOR_SIZE];
+  uint8_t sector1[DFS_SECTOR_SIZE];
+  DFS_SECTOR_0 * sector0p;
+  DFS_SECTOR_1 * sector1p;
+  DFS_NAME_INDEX name_index;
+  bool removed[DFS_MAX_FILES];
+  int num_of_sectors;
+  int num_of_files;
+  int num_kept = 0;
+  int index;
+  int ret;
+
+  if (names == NULL || num_of_names < 0) {
+    return DFS_ERROR_FAILED;
+  }
+
+  ret = read_catalogue_sectors(iop, geometryp, sector0, sector1, &num_of_sectors);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  sector0p = (DFS_SECTOR_0*)sector0;
+  sector1p = (DFS_SECTOR_1*)sector1;
+  num_of_files = get_number_of_files(sector1p);
+
+  ret = dfs_name_index_build(&name_index, sector0p->file_names, num_of_files);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  /* Find all of the files before changing anything */
+  memset(removed, 0, sizeof(removed));
+
+  for (int n = 0; n < num_of_names; n++) {
+    ret = find_catalogue_entry(&name_index, names[n], &index);
+    if (ret != DFS_ERROR_NONE) {
+      return ret;
+    }
+
+    /* A name given twice has already gone by the second time */
+    if (removed[index]) {
+      DEBUG_LOG(DEBUG_LEVEL_ERROR, "File not found: %s", names[n]);
+      return DFS_ERROR_FILE_NOT_FOUND;
+    }
+
+    if (sector0p->file_names[index].directory & DFS_LOCK_BIT) {
+      DEBUG_LOG(DEBUG_LEVEL_ERROR, "File locked: %s", names[n]);
+      return DFS_ERROR_FILE_LOCKED;
+    }
+
+    removed[index] = true;
+  }
+
+  /* Close up the name and parameter tables in one pass */
+  for (int i = 0; i < num_of_files; i++) {
+    if (!removed[i]) {
+      sector0p->file_names[num_kept] = sector0p->file_names[i];
+      sector1p->file_params[num_kept] = sector1p->file_params[i];
+      num_kept++;
+    }
+  }
+
+  memset(&(sector0p->file_names[num_kept]), 0, sizeof(DFS_FILE_NAME) * (size_t)(num_of_files - num_kept));
+  memset(&(sector1p->file_params[num_kept]), 0, sizeof(DFS_FILE_PARAMS) * (size_t)(num_of_files - num_kept));
+
+  set_number_of_files(sector1p, num_kept);
+  increment_cycle_number(sector1p);
+
+  return write_catalogue_sectors(iop, geometryp, sector0, sector1);
+}
+
+/**
+ * \brief Removes files from a DFS disk image
+ *
+ * Only the catalogue is changed.  The entries are removed and the rest of
+ * the catalogue is closed up, then both catalogue sectors are written back
+ * in a single write.  The file data is not touched.  If any of the files
+ * cannot be removed then none are.
+ *
+ * \param diskfile the disk image file reference
+ * \param names array of the names of the files to remove
+ * \param num_of_names the number of names
+ *
+ * \return 0 on success or an error
+ */
+int dfs_remove_files(FILE * diskfile, const char ** names, int num_of_names) {
+  DFS_GEOMETRY geometry;
+  DFS_IO io;
+  int ret;
+
+  ret = init_disk_io(diskfile, &io, &geometry);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  return remove_files_io(&io, &geometry, names, num_of_names);
+}
+
+/**
+ * \brief Removes files from a DFS disk through an I/O backend
+ *
+ * \param iop pointer to the I/O
+ * \param geometryp where the disk's sectors are in the image
+ * \param names array of the names of the files to remove
+ * \param num_of_names the number of names
+ *
+ * \return 0 on success or an error
+ */
+int dfs_remove_files_io(DFS_IO * iop, const DFS_GEOMETRY * geometryp, const char ** names, int num_of_names) {
+  return remove_files_io(iop, geometryp, names, num_of_names);
+}
+
+/**
+ * \brief Removes a file from a DFS disk image
+ *
+ * \param diskfile the disk image file reference
+ * \param name the name of the file to remove
+ *
+ * \return 0 on success or an error
+ */
+int dfs_remove_file(FILE * diskfile, const char * name) {
+  return dfs_remove_files(diskfile, &name, 1);
+}
+
+/* Rewrites a catalogue entry */
+static int update_file_io(DFS_IO * iop, const DFS_GEOMETRY * geometryp, const ACORN_FILE * acorn_filep) {
+  uint8_t sector0[DFS_SECTOR_SIZE];
+  uint8_t sector1[DFS_SECTOR_SIZE];
+  DFS_SECTOR_0 * sector0p;
+  DFS_SECTOR_1 * sector1p;
+  ACORN_FILE updated;
+  DFS_NAME_INDEX name_index;
+  int num_of_sectors;
+  int index;
+  int ret;
+
+  if (acorn_filep == NULL || acorn_filep->name == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  ret = read_catalogue_sectors(iop, geometryp, sector0, sector1, &num_of_sectors);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  sector0p = (DFS_SECTOR_0*)sector0;
+  sector1p = (DFS_SECTOR_1*)sector1;
+
+  ret = dfs_name_index_build(&name_index, sector0p->file_names, get_number_of_files(sector1p));
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  ret = find_catalogue_entry(&name_index, acorn_filep->name, &index);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  updated = *acorn_filep;
+  updated.length = get_file_length(&(sector1p->file_params[index]));
+  updated.start_sector = (uint32_t)get_start_sector(&(sector1p->file_params[index]));
+
+  sector0p->file_names[index].directory &= DFS_DIR_NAME_MASK;
+
+  ret = set_file_params(&updated, &(sector0p->file_names[index]), &(sector1p->file_params[index]));
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  increment_cycle_number(sector1p);
+
+  return write_catalogue_sectors(iop, geometryp, sector0, sector1);
+}
+
+/**
+ * \brief Updates the meta data of a file in a DFS disk image
+ *
+ * The load address, execution address and locked attribute of the named
+ * file are replaced.  Its length and position on the disk are unchanged.
+ * Only the catalogue is written.
+ *
+ * \param diskfile the disk image file reference
+ * \param acorn_filep pointer to the file name and new meta data
+ *
+ * \return 0 on success or an error
+ */
+int dfs_update_file(FILE * diskfile, const ACORN_FILE * acorn_filep) {
+  DFS_GEOMETRY geometry;
+  DFS_IO io;
+  int ret;
+
+  ret = init_disk_io(diskfile, &io, &geometry);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  return update_file_io(&io, &geometry, acorn_filep);
+}
+
+/**
+ * \brief Updates the meta data of a file in a DFS disk through an I/O backend
+ *
+ * \param iop pointer to the I/O
+ * \param geometryp where the disk's sectors are in the image
+ * \param acorn_filep pointer to the file name and new meta data
+ *
+ * \return 0 on success or an error
+ */
+int dfs_update_file_io(DFS_IO * iop, const DFS_GEOMETRY * geometryp, const ACORN_FILE * acorn_filep) {
+  return update_file_io(iop, geometryp, acorn_filep);
+}
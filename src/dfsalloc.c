@@ -0,0 +1,164 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "dfs.h"
+#include "dfsalloc.h"
+#include "debug.h"
+
+/* Sectors 0 and 1 hold the catalogue */
+#define DFS_FIRST_DATA_SECTOR 2
+
+static void remove_extent(DFS_FREE_MAP * mapp, int index) {
+  memmove(
+    &(mapp->extents[index]),
+    &(mapp->extents[index + 1]),
+    sizeof(DFS_EXTENT) * (size_t)(mapp->num_of_extents - index - 1));
+  mapp->num_of_extents--;
+}
+
+/**
+ * \brief Builds the free space map of a disk
+ *
+ * \param used array of the extents used by files, in any order
+ * \param num_of_used the number of used extents
+ * \param num_of_sectors the number of sectors on the disk
+ * \param mapp pointer to the map to fill in
+ * \return 0 on success or an error
+ */
+int dfs_free_map_build(const DFS_EXTENT * used, int num_of_used, int num_of_sectors, DFS_FREE_MAP * mapp) {
+  DFS_EXTENT sorted[DFS_MAX_FILES];
+  int next_sector = DFS_FIRST_DATA_SECTOR;
+
+  if (mapp == NULL || (used == NULL && num_of_used > 0) || num_of_used < 0 || num_of_used > DFS_MAX_FILES) {
+    return DFS_ERROR_FAILED;
+  }
+
+  /* Insertion sort by start sector, there are never more than 31 files */
+  for (int i = 0; i < num_of_used; i++) {
+    int j = i;
+
+    while (j > 0 && sorted[j - 1].start_sector > used[i].start_sector) {
+      sorted[j] = sorted[j - 1];
+      j--;
+    }
+
+    sorted[j] = used[i];
+  }
+
+  mapp->num_of_sectors = num_of_sectors;
+  mapp->num_of_extents = 0;
+
+  /* The gaps between files are free.  Overlapping files are tolerated */
+  for (int i = 0; i < num_of_used; i++) {
+    int end_sector = sorted[i].start_sector + sorted[i].num_of_sectors;
+
+    if (sorted[i].start_sector > next_sector) {
+      mapp->extents[mapp->num_of_extents].start_sector = next_sector;
+      mapp->extents[mapp->num_of_extents].num_of_sectors = sorted[i].start_sector - next_sector;
+      mapp->num_of_extents++;
+    }
+
+    if (end_sector > next_sector) {
+      next_sector = end_sector;
+    }
+  }
+
+  if (next_sector < num_of_sectors) {
+    mapp->extents[mapp->num_of_extents].start_sector = next_sector;
+    mapp->extents[mapp->num_of_extents].num_of_sectors = num_of_sectors - next_sector;
+    mapp->num_of_extents++;
+  }
+
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Allocates a run of sectors
+ *
+ * \param mapp pointer to the map
+ * \param num_of_sectors the number of sectors required
+ * \param policy one of the DFS_ALLOC_ policies
+ * \param start_sectorp pointer in which to return the first allocated sector
+ * \return 0 on success, DFS_ERROR_DISK_FULL if there is no space or an error
+ */
+int dfs_free_map_allocate(DFS_FREE_MAP * mapp, int num_of_sectors, int policy, int * start_sectorp) {
+  int index = -1;
+
+  if (mapp == NULL || start_sectorp == NULL || num_of_sectors < 0) {
+    return DFS_ERROR_FAILED;
+  }
+
+  switch (policy) {
+    case DFS_ALLOC_FIRST_FIT:
+      for (int i = 0; i < mapp->num_of_extents; i++) {
+        if (mapp->extents[i].num_of_sectors >= num_of_sectors) {
+          index = i;
+          break;
+        }
+      }
+      break;
+
+    case DFS_ALLOC_BEST_FIT:
+      for (int i = 0; i < mapp->num_of_extents; i++) {
+        if (mapp->extents[i].num_of_sectors >= num_of_sectors &&
+            (index == -1 || mapp->extents[i].num_of_sectors < mapp->extents[index].num_of_sectors)) {
+          index = i;
+        }
+      }
+      break;
+
+    case DFS_ALLOC_APPEND:
+      /* Only the free space running to the end of the disk can be used */
+      if (mapp->num_of_extents > 0) {
+        DFS_EXTENT * lastp = &(mapp->extents[mapp->num_of_extents - 1]);
+
+        if (lastp->start_sector + lastp->num_of_sectors == mapp->num_of_sectors &&
+            lastp->num_of_sectors >= num_of_sectors) {
+          index = mapp->num_of_extents - 1;
+        }
+      }
+      break;
+
+    default:
+      return DFS_ERROR_FAILED;
+  }
+
+  if (index == -1) {
+    DEBUG_LOG(DEBUG_LEVEL_INFO, "No free extent of %d sectors", num_of_sectors);
+    return DFS_ERROR_DISK_FULL;
+  }
+
+  *start_sectorp = mapp->extents[index].start_sector;
+
+  mapp->extents[index].start_sector += num_of_sectors;
+  mapp->extents[index].num_of_sectors -= num_of_sectors;
+  if (mapp->extents[index].num_of_sectors == 0) {
+    remove_extent(mapp, index);
+  }
+
+  return DFS_ERROR_NONE;
+}
@@ -0,0 +1,733 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Microbenchmarks of libdfs on synthetic disk images.  The images are made
+   from a seeded random number generator, so the same options always give
+   the same images and results can be compared between releases */
+
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "dfs.h"
+#include "dfserr.h"
+#include "acornfs.h"
+
+#define DFS_BENCH_VERSION 1
+
+#define DFS_BENCH_ERROR_FAILED  EXIT_FAILURE
+#define DFS_BENCH_INVALID_VALUE 2
+
+/* Space in the catalogue left for the add benchmark */
+#define DFS_BENCH_MAX_FILES (DFS_MAX_FILES - 1)
+
+/* The longest name of a file in the work directory */
+#define DFS_BENCH_LONGEST_NAME "/format.ssd"
+
+typedef enum {
+  DIST_UNIFORM,
+  DIST_LOG
+} SIZE_DIST;
+
+typedef struct {
+  int tracks;
+  int num_of_files;
+  uint32_t min_size;
+  uint32_t max_size;
+  SIZE_DIST dist;
+  int fragment;             /* Percentage of the files removed again */
+  uint64_t seed;
+  long min_time_ms;         /* Each benchmark runs for at least this long */
+  const char * dir;
+  const char * data_dir;    /* For the contents of the files that are added */
+} BENCH_CONFIG;
+
+/* The state of the benchmarks, shared by all of them */
+typedef struct {
+  const BENCH_CONFIG * configp;
+  char work_dir[PATH_MAX + 2 - sizeof(DFS_BENCH_LONGEST_NAME)];  /* Leaves room for the files in it */
+  char image_path[PATH_MAX + 1];
+  char data_path[PATH_MAX + 1];
+  char out_path[PATH_MAX + 1];
+  char format_path[PATH_MAX + 1];
+  FILE * imagefile;
+  FILE * datafile;          /* Contents for the files that are added */
+  FILE * outfile;
+  FILE * formatfile;
+  uint8_t catalogue[2 * DFS_SECTOR_SIZE];
+  ACORN_DIRECTORY * acorn_dirp;
+  int next_file;            /* The file the next extract takes */
+  ACORN_FILE add_file;
+  char add_name[DFS_FILE_NAME_SIZE];
+  uint64_t bytes;           /* Moved by the last operation */
+} BENCH;
+
+typedef struct {
+  const char * name;
+  int (*reset)(BENCH * benchp);  /* Before each operation, not timed */
+  int (*run)(BENCH * benchp);    /* One operation */
+} BENCHMARK;
+
+typedef struct {
+  const char * name;
+  uint64_t ops;
+  double ns_per_op;
+  double mb_per_s;
+  double allocs_per_op;
+} BENCH_RESULT;
+
+/* libdfs is linked with its calls to the allocator wrapped, so that the
+   allocations it makes can be counted */
+static uint64_t num_of_allocs = 0;
+
+void * __real_malloc(size_t size);
+void * __real_calloc(size_t num, size_t size);
+void * __real_realloc(void * ptr, size_t size);
+char * __real_strdup(const char * s);
+char * __real_strndup(const char * s, size_t n);
+
+void * __wrap_malloc(size_t size) {
+  num_of_allocs++;
+  return __real_malloc(size);
+}
+
+void * __wrap_calloc(size_t num, size_t size) {
+  num_of_allocs++;
+  return __real_calloc(num, size);
+}
+
+void * __wrap_realloc(void * ptr, size_t size) {
+  num_of_allocs++;
+  return __real_realloc(ptr, size);
+}
+
+char * __wrap_strdup(const char * s) {
+  num_of_allocs++;
+  return __real_strdup(s);
+}
+
+char * __wrap_strndup(const char * s, size_t n) {
+  num_of_allocs++;
+  return __real_strndup(s, n);
+}
+
+static void short_help(void) {
+  fprintf(stderr,
+    "dfs_bench - libdfs microbenchmarks\n\n"
+    "Usage: dfs_bench [option]... [benchmark]...\n"
+  );
+}
+
+static void help(void) {
+  short_help();
+  fprintf(stderr,
+    "\nBenchmarks: parse, read, extract, add, format (default all)\n"
+    "\nOptions:\n"
+    "       --40           40 track disk images\n"
+    "       --80           80 track disk images (default)\n"
+    "   -d, --dir          Directory for the images (default $TMPDIR or /tmp)\n"
+    "   -D, --data-dir     Directory for the contents of added files (default as --dir)\n"
+    "   -f, --files        Number of files on each image, up to 30 (default 20)\n"
+    "   -F, --fragment     Percentage of the files removed to leave gaps (default 0)\n"
+    "   -h, --help         Display help\n"
+    "   -j, --json         Write the results as JSON\n"
+    "   -l, --dist         File size distribution: uniform or log (default log)\n"
+    "   -s, --size         File sizes, min-max in bytes (default 256-16384)\n"
+    "   -S, --seed         Random number seed (default 1)\n"
+    "   -t, --time         Minimum time for each benchmark in ms (default 200)\n"
+  );
+}
+
+/* xorshift64* */
+static uint64_t next_random(uint64_t * statep) {
+  *statep ^= *statep >> 12;
+  *statep ^= *statep << 25;
+  *statep ^= *statep >> 27;
+  return *statep * 0x2545f4914f6cdd1dULL;
+}
+
+static uint32_t random_size(const BENCH_CONFIG * configp, uint64_t * statep) {
+  double u = (double)(next_random(statep) >> 11) / (double)(1ULL << 53);
+
+  if (configp->dist == DIST_LOG) {
+    return (uint32_t)exp(log((double)configp->min_size) + (u * (log((double)configp->max_size) - log((double)configp->min_size))));
+  }
+
+  return configp->min_size + (uint32_t)(u * (double)(configp->max_size - configp->min_size + 1));
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+}
+
+static FILE * create_file(const char * path) {
+  FILE * file = fopen(path, "wb+");
+
+  if (file == NULL) {
+    fprintf(stderr, "Could not create: %s (%s)\n", path, strerror(errno));
+  }
+
+  return file;
+}
+
+/* Makes the image the benchmarks work on.  Files of random sizes are added
+   until there are enough or the disk is full, leaving room for the add
+   benchmark, then some are removed again to leave the free space in gaps
+   between the others */
+static int generate_image(BENCH * benchp) {
+  const BENCH_CONFIG * configp = benchp->configp;
+  uint64_t state = configp->seed ? configp->seed : 1;
+  char names[DFS_BENCH_MAX_FILES][DFS_FILE_NAME_SIZE];
+  const char * removed[DFS_BENCH_MAX_FILES];
+  int free_sectors = (configp->tracks * DFS_SECTORS_PER_TRACK) - 2 - (int)((benchp->add_file.length + DFS_SECTOR_SIZE - 1) / DFS_SECTOR_SIZE);
+  int num_of_added = 0;
+  int num_of_removed = 0;
+  uint8_t * data;
+  int ret;
+
+  /* The data is random, so it is no use to anything that spots repeats */
+  data = (uint8_t *)malloc(configp->max_size);
+  if (data == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  for (uint32_t i = 0; i < configp->max_size; i++) {
+    data[i] = (uint8_t)next_random(&state);
+  }
+
+  if (fwrite(data, 1, configp->max_size, benchp->datafile) != configp->max_size || fflush(benchp->datafile) != 0) {
+    free(data);
+    return DFS_ERROR_FAILED;
+  }
+  free(data);
+
+  ret = dfs_format_diskfile(configp->tracks * DFS_SECTORS_PER_TRACK, "BENCH", benchp->imagefile);
+
+  for (int i = 0; i < configp->num_of_files && ret == DFS_ERROR_NONE && free_sectors > 0; i++) {
+    ACORN_FILE acorn_file;
+    uint32_t length = random_size(configp, &state);
+
+    if (length > (uint32_t)free_sectors * DFS_SECTOR_SIZE) {
+      length = (uint32_t)free_sectors * DFS_SECTOR_SIZE;
+    }
+
+    /* There are fewer than 100 files, so the names need two digits */
+    snprintf(names[i], sizeof(names[i]), "FILE%02u", (unsigned)i % 100);
+    memset(&acorn_file, 0, sizeof(acorn_file));
+    acorn_file.name = names[i];
+    acorn_file.load_address = 0x1900;
+    acorn_file.exec_address = 0x8023;
+    acorn_file.length = length;
+
+    rewind(benchp->imagefile);
+    ret = dfs_add_file(benchp->imagefile, &acorn_file, benchp->datafile);
+    free_sectors -= (int)((length + DFS_SECTOR_SIZE - 1) / DFS_SECTOR_SIZE);
+    num_of_added++;
+  }
+
+  for (int i = 0; i < num_of_added && ret == DFS_ERROR_NONE; i++) {
+    if ((int)(next_random(&state) % 100) < configp->fragment) {
+      removed[num_of_removed++] = names[i];
+    }
+  }
+
+  if (ret == DFS_ERROR_NONE && num_of_removed > 0) {
+    rewind(benchp->imagefile);
+    ret = dfs_remove_files(benchp->imagefile, removed, num_of_removed);
+  }
+
+  if (ret == DFS_ERROR_NONE) {
+    rewind(benchp->imagefile);
+    ret = (fread(benchp->catalogue, 1, sizeof(benchp->catalogue), benchp->imagefile) == sizeof(benchp->catalogue)) ? DFS_ERROR_NONE : DFS_ERROR_FAILED;
+  }
+
+  if (ret == DFS_ERROR_NONE) {
+    rewind(benchp->imagefile);
+    ret = dfs_read_catalogue(benchp->imagefile, &(benchp->acorn_dirp));
+  }
+
+  return ret;
+}
+
+static int bench_parse(BENCH * benchp) {
+  ACORN_DIRECTORY * acorn_dirp;
+  int ret = dfs_parse_catalogue(benchp->catalogue, benchp->catalogue + DFS_SECTOR_SIZE, &acorn_dirp);
+
+  if (ret == DFS_ERROR_NONE) {
+    acornfs_free_directory(acorn_dirp);
+  }
+
+  benchp->bytes = sizeof(benchp->catalogue);
+  return ret;
+}
+
+static int bench_read(BENCH * benchp) {
+  ACORN_DIRECTORY * acorn_dirp;
+  int ret;
+
+  rewind(benchp->imagefile);
+  ret = dfs_read_catalogue(benchp->imagefile, &acorn_dirp);
+  if (ret == DFS_ERROR_NONE) {
+    acornfs_free_directory(acorn_dirp);
+  }
+
+  benchp->bytes = sizeof(benchp->catalogue);
+  return ret;
+}
+
+/* Each operation extracts the next file on the disk, round and round */
+static int bench_extract(BENCH * benchp) {
+  const ACORN_FILE * acorn_filep = &(benchp->acorn_dirp->files[benchp->next_file]);
+
+  benchp->next_file = (benchp->next_file + 1) % benchp->acorn_dirp->num_of_files;
+
+  rewind(benchp->imagefile);
+  if (fseeko(benchp->outfile, 0, SEEK_SET) != 0) {
+    return DFS_ERROR_FAILED;
+  }
+
+  benchp->bytes = acorn_filep->length;
+  return dfs_extract_file(benchp->imagefile, acorn_filep, benchp->outfile);
+}
+
+/* Puts the catalogue back as it was, so each add goes onto the same disk.
+   Adding reads and writes at given offsets, so it must have left the image
+   where it was rewound to and the data where it was written up to */
+static int reset_add(BENCH * benchp) {
+  if (ftello(benchp->imagefile) != 0 || ftello(benchp->datafile) != (off_t)benchp->configp->max_size) {
+    fprintf(stderr, "Adding moved the file position of: %s\n",
+      (ftello(benchp->imagefile) != 0) ? benchp->image_path : benchp->data_path);
+    return DFS_ERROR_FAILED;
+  }
+
+  if (pwrite(fileno(benchp->imagefile), benchp->catalogue, sizeof(benchp->catalogue), 0) != (ssize_t)sizeof(benchp->catalogue)) {
+    return DFS_ERROR_FAILED;
+  }
+
+  return DFS_ERROR_NONE;
+}
+
+static int bench_add(BENCH * benchp) {
+  benchp->add_file.name = benchp->add_name;
+  benchp->add_file.start_sector = 0;
+
+  rewind(benchp->imagefile);
+  benchp->bytes = benchp->add_file.length;
+  return dfs_add_file(benchp->imagefile, &(benchp->add_file), benchp->datafile);
+}
+
+static int bench_format(BENCH * benchp) {
+  rewind(benchp->formatfile);
+  benchp->bytes = 2 * DFS_SECTOR_SIZE;
+  return dfs_format_diskfile(benchp->configp->tracks * DFS_SECTORS_PER_TRACK, "BENCH", benchp->formatfile);
+}
+
+static const BENCHMARK benchmarks[] = {
+  { "parse",   NULL,      bench_parse },
+  { "read",    NULL,      bench_read },
+  { "extract", NULL,      bench_extract },
+  { "add",     reset_add, bench_add },
+  { "format",  NULL,      bench_format }
+};
+
+#define NUM_OF_BENCHMARKS (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+/* Runs a benchmark in ever larger batches until a batch takes the minimum
+   time.  Resets are made between operations but left out of the time */
+static int run_benchmark(BENCH * benchp, const BENCHMARK * benchmarkp, BENCH_RESULT * resultp) {
+  uint64_t min_time_ns = (uint64_t)benchp->configp->min_time_ms * 1000000ULL;
+  uint64_t ops = 1;
+
+  for (;;) {
+    uint64_t elapsed = 0;
+    uint64_t bytes = 0;
+    uint64_t allocs = 0;
+    uint64_t start = now_ns();
+
+    for (uint64_t i = 0; i < ops; i++) {
+      uint64_t allocs_before;
+
+      if (benchmarkp->reset != NULL) {
+        elapsed += now_ns() - start;
+        if (benchmarkp->reset(benchp) != DFS_ERROR_NONE) {
+          return DFS_ERROR_FAILED;
+        }
+        start = now_ns();
+      }
+
+      allocs_before = num_of_allocs;
+      if (benchmarkp->run(benchp) != DFS_ERROR_NONE) {
+        return DFS_ERROR_FAILED;
+      }
+      allocs += num_of_allocs - allocs_before;
+      bytes += benchp->bytes;
+    }
+
+    elapsed += now_ns() - start;
+
+    if (elapsed >= min_time_ns || ops >= (UINT64_MAX / 2)) {
+      resultp->name = benchmarkp->name;
+      resultp->ops = ops;
+      resultp->ns_per_op = (double)elapsed / (double)ops;
+      resultp->mb_per_s = (elapsed > 0) ? ((double)bytes * 1000.0) / (double)elapsed : 0.0;
+      resultp->allocs_per_op = (double)allocs / (double)ops;
+      return DFS_ERROR_NONE;
+    }
+
+    ops *= 2;
+  }
+}
+
+static bool is_selected(const char * name, int argc, char * argv[]) {
+  if (argc == 0) {
+    return true;
+  }
+
+  for (int i = 0; i < argc; i++) {
+    if (strcmp(argv[i], name) == 0) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/* The data is kept with the images unless it has a directory of its own,
+   which may be on another file system */
+static FILE * create_data_file(BENCH * benchp) {
+  const char * data_dir = benchp->configp->data_dir;
+  FILE * file;
+  int fd;
+
+  if (data_dir == NULL) {
+    snprintf(benchp->data_path, sizeof(benchp->data_path), "%s/data", benchp->work_dir);
+    return create_file(benchp->data_path);
+  }
+
+  if ((size_t)snprintf(benchp->data_path, sizeof(benchp->data_path), "%s/dfs_bench.XXXXXX", data_dir) >= sizeof(benchp->data_path)) {
+    fprintf(stderr, "Path too long: %s\n", data_dir);
+    benchp->data_path[0] = '\0';
+    return NULL;
+  }
+
+  fd = mkstemp(benchp->data_path);
+  if (fd < 0) {
+    fprintf(stderr, "Could not create: %s (%s)\n", benchp->data_path, strerror(errno));
+    return NULL;
+  }
+
+  file = fdopen(fd, "wb+");
+  if (file == NULL) {
+    fprintf(stderr, "Could not create: %s (%s)\n", benchp->data_path, strerror(errno));
+    close(fd);
+    unlink(benchp->data_path);
+  }
+
+  return file;
+}
+
+static int open_bench(BENCH * benchp) {
+  const char * dir = benchp->configp->dir;
+
+  if (dir == NULL) {
+    dir = getenv("TMPDIR");
+  }
+
+  if (dir == NULL) {
+    dir = "/tmp";
+  }
+
+  if ((size_t)snprintf(benchp->work_dir, sizeof(benchp->work_dir), "%s/dfs_bench.XXXXXX", dir) >= sizeof(benchp->work_dir)) {
+    fprintf(stderr, "Path too long: %s\n", dir);
+    benchp->work_dir[0] = '\0';
+    return DFS_ERROR_FAILED;
+  }
+
+  if (mkdtemp(benchp->work_dir) == NULL) {
+    fprintf(stderr, "Could not create: %s (%s)\n", benchp->work_dir, strerror(errno));
+    benchp->work_dir[0] = '\0';
+    return DFS_ERROR_FAILED;
+  }
+
+  snprintf(benchp->image_path, sizeof(benchp->image_path), "%s/image.ssd", benchp->work_dir);
+  snprintf(benchp->out_path, sizeof(benchp->out_path), "%s/out", benchp->work_dir);
+  snprintf(benchp->format_path, sizeof(benchp->format_path), "%s/format.ssd", benchp->work_dir);
+
+  benchp->imagefile = create_file(benchp->image_path);
+  benchp->datafile = create_data_file(benchp);
+  benchp->outfile = create_file(benchp->out_path);
+  benchp->formatfile = create_file(benchp->format_path);
+  if (benchp->imagefile == NULL || benchp->datafile == NULL || benchp->outfile == NULL || benchp->formatfile == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  return DFS_ERROR_NONE;
+}
+
+static void close_bench(BENCH * benchp) {
+  FILE * files[] = { benchp->imagefile, benchp->datafile, benchp->outfile, benchp->formatfile };
+  const char * paths[] = { benchp->image_path, benchp->data_path, benchp->out_path, benchp->format_path };
+
+  for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+    if (files[i] != NULL) {
+      fclose(files[i]);
+      unlink(paths[i]);
+    }
+  }
+
+  if (benchp->work_dir[0] != '\0') {
+    rmdir(benchp->work_dir);
+  }
+
+  if (benchp->acorn_dirp != NULL) {
+    acornfs_free_directory(benchp->acorn_dirp);
+  }
+}
+
+/* The add benchmark adds a file of the middle size, into the first gap if
+   the image has been fragmented */
+static void plan_add(BENCH * benchp) {
+  const BENCH_CONFIG * configp = benchp->configp;
+
+  snprintf(benchp->add_name, sizeof(benchp->add_name), "ADDED");
+  memset(&(benchp->add_file), 0, sizeof(benchp->add_file));
+  benchp->add_file.load_address = 0x1900;
+  benchp->add_file.exec_address = 0x8023;
+  benchp->add_file.length = configp->min_size + ((configp->max_size - configp->min_size) / 2);
+}
+
+static void print_json(const BENCH_CONFIG * configp, const BENCH * benchp, const BENCH_RESULT * results, int num_of_results) {
+  printf("{\n");
+  printf("  \"version\": %d,\n", DFS_BENCH_VERSION);
+  printf("  \"config\": {\"tracks\": %d, \"files\": %d, \"min_size\": %u, \"max_size\": %u, \"dist\": \"%s\", \"fragment\": %d, \"seed\": %llu, \"min_time_ms\": %ld},\n",
+    configp->tracks,
+    configp->num_of_files,
+    configp->min_size,
+    configp->max_size,
+    (configp->dist == DIST_LOG) ? "log" : "uniform",
+    configp->fragment,
+    (unsigned long long)configp->seed,
+    configp->min_time_ms);
+  printf("  \"image\": {\"files\": %d},\n", benchp->acorn_dirp->num_of_files);
+  printf("  \"results\": [\n");
+
+  for (int i = 0; i < num_of_results; i++) {
+    printf("    {\"name\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.1f, \"mb_per_s\": %.2f, \"allocs_per_op\": %.2f}%s\n",
+      results[i].name,
+      (unsigned long long)results[i].ops,
+      results[i].ns_per_op,
+      results[i].mb_per_s,
+      results[i].allocs_per_op,
+      (i < num_of_results - 1) ? "," : "");
+  }
+
+  printf("  ]\n");
+  printf("}\n");
+}
+
+static void print_table(const BENCH * benchp, const BENCH_RESULT * results, int num_of_results) {
+  printf("Image  : %d tracks, %d files\n", benchp->configp->tracks, benchp->acorn_dirp->num_of_files);
+  printf("----------------------------------------------------------------\n");
+  printf("  %-10s %12s %12s %12s %12s\n", "Benchmark", "ops", "ns/op", "MB/s", "allocs/op");
+
+  for (int i = 0; i < num_of_results; i++) {
+    printf("  %-10s %12llu %12.1f %12.2f %12.2f\n",
+      results[i].name,
+      (unsigned long long)results[i].ops,
+      results[i].ns_per_op,
+      results[i].mb_per_s,
+      results[i].allocs_per_op);
+  }
+
+  printf("----------------------------------------------------------------\n");
+}
+
+static long parse_number(const char * text, const char * what, long min, long max) {
+  char * endptr;
+  long value = strtol(text, &endptr, 0);
+
+  if (*text == '\0' || *endptr || value < min || value > max) {
+    fprintf(stderr, "Invalid %s: %s\n", what, text);
+    exit(DFS_BENCH_INVALID_VALUE);
+  }
+
+  return value;
+}
+
+int main(int argc, char * argv[]) {
+  BENCH_CONFIG config = { 80, 20, 256, 16384, DIST_LOG, 0, 1, 200, NULL, NULL };
+  BENCH_RESULT results[NUM_OF_BENCHMARKS];
+  BENCH bench;
+  bool json = false;
+  int num_of_results = 0;
+  char * endptr;
+  int ret;
+  int ch;
+
+  static struct option longopts[] = {
+    { "40",        no_argument,       NULL,       '4'},
+    { "80",        no_argument,       NULL,       '8'},
+    { "data-dir",  required_argument, NULL,       'D'},
+    { "dir",       required_argument, NULL,       'd'},
+    { "dist",      required_argument, NULL,       'l'},
+    { "files",     required_argument, NULL,       'f'},
+    { "fragment",  required_argument, NULL,       'F'},
+    { "help",      no_argument,       NULL,       'h'},
+    { "json",      no_argument,       NULL,       'j'},
+    { "seed",      required_argument, NULL,       'S'},
+    { "size",      required_argument, NULL,       's'},
+    { "time",      required_argument, NULL,       't'},
+    { NULL,        0,                 NULL,       0  }
+  };
+
+  while ((ch = getopt_long(argc, argv, "d:D:f:F:hjl:s:S:t:", longopts, NULL)) != -1) {
+    switch(ch) {
+      case '4': /* 40 track */
+        config.tracks = 40;
+        break;
+      case '8': /* 80 track */
+        config.tracks = 80;
+        break;
+      case 'd': /* Directory for the images */
+        config.dir = optarg;
+        break;
+      case 'D': /* Directory for the data */
+        config.data_dir = optarg;
+        break;
+      case 'f': /* Files per image */
+        config.num_of_files = (int)parse_number(optarg, "number of files", 1, DFS_BENCH_MAX_FILES);
+        break;
+      case 'F': /* Fragmentation */
+        config.fragment = (int)parse_number(optarg, "fragmentation", 0, 100);
+        break;
+      case 'h': /* Help */
+        help();
+        exit(EXIT_SUCCESS);
+        break;
+      case 'j': /* JSON output */
+        json = true;
+        break;
+      case 'l': /* Size distribution */
+        if (strcmp(optarg, "uniform") == 0) {
+          config.dist = DIST_UNIFORM;
+        } else if (strcmp(optarg, "log") == 0) {
+          config.dist = DIST_LOG;
+        } else {
+          fprintf(stderr, "Invalid size distribution: %s\n", optarg);
+          exit(DFS_BENCH_INVALID_VALUE);
+        }
+        break;
+      case 's': /* File sizes */
+        config.min_size = (uint32_t)strtoul(optarg, &endptr, 0);
+        config.max_size = (*endptr == '-') ? (uint32_t)strtoul(endptr + 1, &endptr, 0) : config.min_size;
+        if (*endptr || config.min_size < 1 || config.max_size < config.min_size || config.max_size > 200 * 1024) {
+          fprintf(stderr, "Invalid file sizes: %s\n", optarg);
+          exit(DFS_BENCH_INVALID_VALUE);
+        }
+        break;
+      case 'S': /* Seed */
+        config.seed = strtoull(optarg, &endptr, 0);
+        if (*optarg == '\0' || *endptr) {
+          fprintf(stderr, "Invalid seed: %s\n", optarg);
+          exit(DFS_BENCH_INVALID_VALUE);
+        }
+        break;
+      case 't': /* Minimum time */
+        config.min_time_ms = parse_number(optarg, "time", 1, 3600000);
+        break;
+      default:
+        help();
+        exit(DFS_BENCH_ERROR_FAILED);
+    }
+  }
+
+  argc -= optind;
+  argv += optind;
+
+  for (int i = 0; i < argc; i++) {
+    bool known = false;
+
+    for (size_t b = 0; b < NUM_OF_BENCHMARKS; b++) {
+      known = known || (strcmp(argv[i], benchmarks[b].name) == 0);
+    }
+
+    if (!known) {
+      fprintf(stderr, "Unknown benchmark: %s\n", argv[i]);
+      exit(DFS_BENCH_INVALID_VALUE);
+    }
+  }
+
+  memset(&bench, 0, sizeof(bench));
+  bench.configp = &config;
+
+  plan_add(&bench);
+
+  ret = open_bench(&bench);
+  if (ret == DFS_ERROR_NONE) {
+    ret = generate_image(&bench);
+    if (ret != DFS_ERROR_NONE) {
+      fprintf(stderr, "Could not generate image: %s\n", bench.image_path);
+    }
+  }
+
+  if (ret == DFS_ERROR_NONE && bench.acorn_dirp->num_of_files == 0 && is_selected("extract", argc, argv)) {
+    fprintf(stderr, "No files on the image to extract\n");
+    ret = DFS_ERROR_FAILED;
+  }
+
+  for (size_t b = 0; b < NUM_OF_BENCHMARKS && ret == DFS_ERROR_NONE; b++) {
+    if (!is_selected(benchmarks[b].name, argc, argv)) {
+      continue;
+    }
+
+    ret = run_benchmark(&bench, &(benchmarks[b]), &(results[num_of_results]));
+    if (ret != DFS_ERROR_NONE) {
+      fprintf(stderr, "Benchmark failed: %s\n", benchmarks[b].name);
+    } else {
+      num_of_results++;
+    }
+  }
+
+  if (ret == DFS_ERROR_NONE) {
+    if (json) {
+      print_json(&config, &bench, results, num_of_results);
+    } else {
+      print_table(&bench, results, num_of_results);
+    }
+  }
+
+  close_bench(&bench);
+
+  return (ret == DFS_ERROR_NONE) ? EXIT_SUCCESS : DFS_BENCH_ERROR_FAILED;
+}
@@ -0,0 +1,652 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "acornfs.h"
+#include "dfs.h"
+#include "dfscache.h"
+#include "dfsmmb.h"
+#include "debug.h"
+
+/* The records are in the byte order of the machine that wrote them.  A
+   cache written with the other byte order fails the version check */
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_of_disks;
+  uint32_t num_of_files;
+  uint32_t paths_size;
+  uint32_t reserved[2];
+} DFS_CACHE_HEADER;
+
+typedef struct {
+  uint64_t size;
+  int64_t mtime_sec;
+  uint32_t mtime_nsec;
+  uint32_t path_offset;        /* Into the path table */
+  uint32_t first_file;         /* Into the file table */
+  uint8_t num_of_files;
+  uint8_t options;
+  uint8_t cycle_number;
+  uint8_t reserved;
+  char name[16];
+} DFS_CACHE_DISK;
+
+typedef struct {
+  char name[12];
+  uint32_t load_address;
+  uint32_t exec_address;
+  uint32_t length;
+  uint32_t start_sector;
+  uint8_t attributes;
+  uint8_t reserved[3];
+} DFS_CACHE_FILE;
+
+/* A catalogue stored since the cache was opened */
+typedef struct {
+  char * path;
+  DFS_CACHE_KEY key;
+  ACORN_DIRECTORY * acorn_dirp;
+  size_t sequence;             /* Order stored, the last of a path wins */
+} DFS_CACHE_ENTRY;
+
+/* One disk of the cache being saved, either already in the file or new */
+typedef struct {
+  const DFS_CACHE_DISK * diskp;
+  const DFS_CACHE_ENTRY * entryp;
+} DFS_CACHE_ITEM;
+
+struct _tag_DFS_CACHE {
+  char * path;
+  const uint8_t * map;
+  size_t map_size;
+  const DFS_CACHE_DISK * disks;
+  const DFS_CACHE_FILE * files;
+  const char * paths;
+  uint32_t num_of_disks;
+  uint32_t num_of_files;
+  uint32_t paths_size;
+  DFS_CACHE_ENTRY * entries;
+  size_t num_of_entries;
+  size_t capacity;
+};
+
+/* Checks that a disk record only refers to data within the cache */
+static bool disk_is_valid(const DFS_CACHE * cachep, const DFS_CACHE_DISK * diskp) {
+  return diskp->path_offset < cachep->paths_size &&
+    diskp->first_file <= cachep->num_of_files &&
+    diskp->num_of_files <= cachep->num_of_files - diskp->first_file;
+}
+
+static const char * disk_path(const DFS_CACHE * cachep, const DFS_CACHE_DISK * diskp) {
+  return cachep->paths + diskp->path_offset;
+}
+
+/* Copies a fixed size name field, which need not be terminated */
+static void copy_name(char * dest, const char * src, size_t src_size, size_t dest_size) {
+  size_t len = strnlen(src, src_size);
+
+  if (len >= dest_size) {
+    len = dest_size - 1;
+  }
+
+  memcpy(dest, src, len);
+  dest[len] = '\0';
+}
+
+static int map_cache(DFS_CACHE * cachep) {
+  const DFS_CACHE_HEADER * headerp;
+  struct stat st;
+  size_t size;
+  void * map;
+  int fd;
+
+  fd = open(cachep->path, O_RDONLY);
+  if (fd == -1) {
+    if (errno == ENOENT) {
+      return DFS_ERROR_NONE;
+    }
+
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not open catalogue cache: %s", strerror(errno));
+    return DFS_ERROR_OPEN_FAILED;
+  }
+
+  if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(DFS_CACHE_HEADER)) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Ignoring catalogue cache: %s", cachep->path);
+    close(fd);
+    return DFS_ERROR_NONE;
+  }
+
+  map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not map catalogue cache: %s", strerror(errno));
+    return DFS_ERROR_FAILED;
+  }
+
+  /* The whole cache is searched, so read it in ahead of the lookups */
+  madvise(map, (size_t)st.st_size, MADV_WILLNEED);
+
+  headerp = (const DFS_CACHE_HEADER *)map;
+  size = sizeof(DFS_CACHE_HEADER) +
+    ((size_t)headerp->num_of_disks * sizeof(DFS_CACHE_DISK)) +
+    ((size_t)headerp->num_of_files * sizeof(DFS_CACHE_FILE)) +
+    headerp->paths_size;
+
+  /* A cache that does not hold together is ignored and written afresh */
+  if (memcmp(headerp->magic, DFS_CACHE_MAGIC, sizeof(headerp->magic)) != 0 ||
+      headerp->version != DFS_CACHE_VERSION ||
+      size != (size_t)st.st_size ||
+      (headerp->paths_size > 0 && ((const char *)map)[size - 1] != '\0')) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Ignoring catalogue cache: %s", cachep->path);
+    munmap(map, (size_t)st.st_size);
+    return DFS_ERROR_NONE;
+  }
+
+  cachep->map = (const uint8_t *)map;
+  cachep->map_size = (size_t)st.st_size;
+  cachep->num_of_disks = headerp->num_of_disks;
+  cachep->num_of_files = headerp->num_of_files;
+  cachep->paths_size = headerp->paths_size;
+  cachep->disks = (const DFS_CACHE_DISK *)(cachep->map + sizeof(DFS_CACHE_HEADER));
+  cachep->files = (const DFS_CACHE_FILE *)(cachep->disks + cachep->num_of_disks);
+  cachep->paths = (const char *)(cachep->files + cachep->num_of_files);
+
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Opens a catalogue cache
+ *
+ * A cache file that does not exist yet, or that cannot be used, is treated
+ * as empty and is written afresh by dfs_cache_save().
+ *
+ * \param path the cache file name
+ * \param cachepp pointer in which to return the cache handle
+ * \return 0 on success or an error
+ */
+int dfs_cache_open(const char * path, DFS_CACHE ** cachepp) {
+  DFS_CACHE * cachep;
+  int ret;
+
+  if (path == NULL || cachepp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  cachep = (DFS_CACHE *)calloc(1, sizeof(DFS_CACHE));
+  if (cachep == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  cachep->path = strdup(path);
+  if (cachep->path == NULL) {
+    free(cachep);
+    return DFS_ERROR_FAILED;
+  }
+
+  ret = map_cache(cachep);
+  if (ret != DFS_ERROR_NONE) {
+    dfs_cache_close(cachep);
+    return ret;
+  }
+
+  *cachepp = cachep;
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Closes a catalogue cache without saving it
+ *
+ * \param cachep the cache handle
+ * \return 0 on success or an error
+ */
+int dfs_cache_close(DFS_CACHE * cachep) {
+  if (cachep == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  for (size_t i = 0; i < cachep->num_of_entries; i++) {
+    free(cachep->entries[i].path);
+    acornfs_free_directory(cachep->entries[i].acorn_dirp);
+  }
+
+  free(cachep->entries);
+
+  if (cachep->map != NULL) {
+    munmap((void *)cachep->map, cachep->map_size);
+  }
+
+  free(cachep->path);
+  free(cachep);
+
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Gets the key of a disk image as it is now
+ *
+ * For a disk in a container, such as file.mmb:12 or file.dsd:1, the key is
+ * that of the container.
+ *
+ * \param image_path the disk image name
+ * \param keyp pointer to the key to fill in
+ * \return 0 on success or an error
+ */
+int dfs_cache_get_key(const char * image_path, DFS_CACHE_KEY * keyp) {
+  struct stat st;
+  char * container_path;
+  int slot;
+  int ret;
+
+  if (image_path == NULL || keyp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  ret = stat(image_path, &st);
+  if (ret == -1 && errno == ENOENT && dfs_mmb_split_path(image_path, &container_path, &slot)) {
+    ret = stat(container_path, &st);
+    free(container_path);
+  }
+
+  if (ret == -1) {
+    return (errno == ENOENT) ? DFS_ERROR_IMAGE_NOT_FOUND : DFS_ERROR_FAILED;
+  }
+
+  memset(keyp, 0, sizeof(DFS_CACHE_KEY));
+  keyp->size = (uint64_t)st.st_size;
+  keyp->mtime_sec = (int64_t)st.st_mtim.tv_sec;
+  keyp->mtime_nsec = (uint32_t)st.st_mtim.tv_nsec;
+
+  return DFS_ERROR_NONE;
+}
+
+/* Finds a disk in the cache file by a binary search on its path */
+static const DFS_CACHE_DISK * find_disk(const DFS_CACHE * cachep, const char * image_path) {
+  uint32_t low = 0;
+  uint32_t high = cachep->num_of_disks;
+
+  while (low < high) {
+    uint32_t mid = low + ((high - low) / 2);
+    const DFS_CACHE_DISK * diskp = &(cachep->disks[mid]);
+    int cmp;
+
+    if (!disk_is_valid(cachep, diskp)) {
+      return NULL;
+    }
+
+    cmp = strcmp(image_path, disk_path(cachep, diskp));
+    if (cmp == 0) {
+      return diskp;
+    }
+
+    if (cmp < 0) {
+      high = mid;
+    } else {
+      low = mid + 1;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * \brief Looks up the catalogue of a disk image
+ *
+ * \param cachep the cache handle
+ * \param image_path the disk image name
+ * \param keyp the key of the image as it is now
+ * \param acorn_dirpp pointer in which to return a copy of the catalogue,
+ *        which must be freed with acornfs_free_directory()
+ * \return 0 on success, DFS_ERROR_FILE_NOT_FOUND if the image is not in the
+ *         cache or has changed, or another error
+ */
+int dfs_cache_lookup(DFS_CACHE * cachep, const char * image_path, const DFS_CACHE_KEY * keyp, ACORN_DIRECTORY ** acorn_dirpp) {
+  const DFS_CACHE_DISK * diskp;
+  ACORN_DIRECTORY * acorn_dirp;
+
+  if (cachep == NULL || image_path == NULL || keyp == NULL || acorn_dirpp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  diskp = find_disk(cachep, image_path);
+  if (diskp == NULL ||
+      diskp->size != keyp->size ||
+      diskp->mtime_sec != keyp->mtime_sec ||
+      diskp->mtime_nsec != keyp->mtime_nsec) {
+    return DFS_ERROR_FILE_NOT_FOUND;
+  }
+
+  acorn_dirp = acornfs_alloc_directory(diskp->num_of_files, DFS_DISK_NAME_SIZE, DFS_FILE_NAME_SIZE);
+  if (acorn_dirp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  copy_name(acorn_dirp->name, diskp->name, sizeof(diskp->name), DFS_DISK_NAME_SIZE);
+  acorn_dirp->options = diskp->options;
+
+  for (int i = 0; i < diskp->num_of_files; i++) {
+    const DFS_CACHE_FILE * filep = &(cachep->files[diskp->first_file + i]);
+    ACORN_FILE * acorn_filep = &(acorn_dirp->files[i]);
+
+    copy_name(acorn_filep->name, filep->name, sizeof(filep->name), DFS_FILE_NAME_SIZE);
+    acorn_filep->load_address = filep->load_address;
+    acorn_filep->exec_address = filep->exec_address;
+    acorn_filep->length = filep->length;
+    acorn_filep->attributes = (ACORN_FILE_ATTRIBS)filep->attributes;
+    acorn_filep->start_sector = filep->start_sector;
+  }
+
+  *acorn_dirpp = acorn_dirp;
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Stores the catalogue of a disk image
+ *
+ * The key should be taken before the catalogue is read so that a change
+ * made while reading it is seen next time.
+ *
+ * \param cachep the cache handle
+ * \param image_path the disk image name
+ * \param keyp the key of the image, including the catalogue cycle number
+ * \param acorn_dirp the catalogue
+ * \return 0 on success or an error
+ */
+int dfs_cache_store(DFS_CACHE * cachep, const char * image_path, const DFS_CACHE_KEY * keyp, const ACORN_DIRECTORY * acorn_dirp) {
+  DFS_CACHE_ENTRY * entryp;
+
+  if (cachep == NULL || image_path == NULL || keyp == NULL || acorn_dirp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  if (acorn_dirp->num_of_files < 0 || acorn_dirp->num_of_files > DFS_MAX_FILES) {
+    return DFS_ERROR_FAILED;
+  }
+
+  if (cachep->num_of_entries == cachep->capacity) {
+    size_t capacity = cachep->capacity ? cachep->capacity * 2 : 64;
+    DFS_CACHE_ENTRY * entries = (DFS_CACHE_ENTRY *)realloc(cachep->entries, capacity * sizeof(DFS_CACHE_ENTRY));
+    if (entries == NULL) {
+      return DFS_ERROR_FAILED;
+    }
+
+    cachep->entries = entries;
+    cachep->capacity = capacity;
+  }
+
+  entryp = &(cachep->entries[cachep->num_of_entries]);
+  entryp->path = strdup(image_path);
+  entryp->acorn_dirp = acornfs_alloc_directory(acorn_dirp->num_of_files, DFS_DISK_NAME_SIZE, DFS_FILE_NAME_SIZE);
+  if (entryp->path == NULL || entryp->acorn_dirp == NULL) {
+    free(entryp->path);
+    if (entryp->acorn_dirp != NULL) {
+      acornfs_free_directory(entryp->acorn_dirp);
+    }
+    return DFS_ERROR_FAILED;
+  }
+
+  copy_name(entryp->acorn_dirp->name, acorn_dirp->name, DFS_DISK_NAME_SIZE, DFS_DISK_NAME_SIZE);
+  entryp->acorn_dirp->options = acorn_dirp->options;
+
+  for (int i = 0; i < acorn_dirp->num_of_files; i++) {
+    char * name = entryp->acorn_dirp->files[i].name;
+
+    entryp->acorn_dirp->files[i] = acorn_dirp->files[i];
+    entryp->acorn_dirp->files[i].name = name;
+    copy_name(name, acorn_dirp->files[i].name, DFS_FILE_NAME_SIZE, DFS_FILE_NAME_SIZE);
+  }
+
+  entryp->key = *keyp;
+  entryp->sequence = cachep->num_of_entries;
+  cachep->num_of_entries++;
+
+  return DFS_ERROR_NONE;
+}
+
+static int compare_entries(const void * a, const void * b) {
+  const DFS_CACHE_ENTRY * entryap = (const DFS_CACHE_ENTRY *)a;
+  const DFS_CACHE_ENTRY * entrybp = (const DFS_CACHE_ENTRY *)b;
+  int cmp = strcmp(entryap->path, entrybp->path);
+
+  if (cmp != 0) {
+    return cmp;
+  }
+
+  return (entryap->sequence < entrybp->sequence) ? -1 : (entryap->sequence > entrybp->sequence);
+}
+
+static const char * item_path(const DFS_CACHE * cachep, const DFS_CACHE_ITEM * itemp) {
+  return (itemp->entryp != NULL) ? itemp->entryp->path : disk_path(cachep, itemp->diskp);
+}
+
+static int item_num_of_files(const DFS_CACHE_ITEM * itemp) {
+  return (itemp->entryp != NULL) ? itemp->entryp->acorn_dirp->num_of_files : itemp->diskp->num_of_files;
+}
+
+/* Merges the new catalogues with those already in the file, in path order.
+   A new catalogue replaces an old one with the same path */
+static DFS_CACHE_ITEM * merge_items(DFS_CACHE * cachep, size_t * num_of_itemsp) {
+  DFS_CACHE_ITEM * items;
+  size_t num_of_items = 0;
+  size_t e = 0;
+  uint32_t d = 0;
+
+  items = (DFS_CACHE_ITEM *)calloc(cachep->num_of_disks + cachep->num_of_entries + 1, sizeof(DFS_CACHE_ITEM));
+  if (items == NULL) {
+    return NULL;
+  }
+
+  qsort(cachep->entries, cachep->num_of_entries, sizeof(DFS_CACHE_ENTRY), compare_entries);
+
+  while (e < cachep->num_of_entries || d < cachep->num_of_disks) {
+    int cmp;
+
+    if (d < cachep->num_of_disks && !disk_is_valid(cachep, &(cachep->disks[d]))) {
+      d++;
+      continue;
+    }
+
+    /* Only the last of several new catalogues for a path is kept */
+    if (e + 1 < cachep->num_of_entries && strcmp(cachep->entries[e].path, cachep->entries[e + 1].path) == 0) {
+      e++;
+      continue;
+    }
+
+    if (e == cachep->num_of_entries) {
+      cmp = 1;
+    } else if (d == cachep->num_of_disks) {
+      cmp = -1;
+    } else {
+      cmp = strcmp(cachep->entries[e].path, disk_path(cachep, &(cachep->disks[d])));
+    }
+
+    if (cmp <= 0) {
+      items[num_of_items++].entryp = &(cachep->entries[e++]);
+      if (cmp == 0) {
+        d++;
+      }
+    } else {
+      items[num_of_items++].diskp = &(cachep->disks[d++]);
+    }
+  }
+
+  *num_of_itemsp = num_of_items;
+  return items;
+}
+
+static int write_cache(DFS_CACHE * cachep, const DFS_CACHE_ITEM * items, size_t num_of_items, FILE * cachefile) {
+  DFS_CACHE_HEADER header;
+  uint32_t first_file = 0;
+  uint32_t path_offset = 0;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, DFS_CACHE_MAGIC, sizeof(header.magic));
+  header.version = DFS_CACHE_VERSION;
+  header.num_of_disks = (uint32_t)num_of_items;
+
+  for (size_t i = 0; i < num_of_items; i++) {
+    header.num_of_files += (uint32_t)item_num_of_files(&(items[i]));
+    header.paths_size += (uint32_t)(strlen(item_path(cachep, &(items[i]))) + 1);
+  }
+
+  if (fwrite(&header, sizeof(header), 1, cachefile) != 1) {
+    return DFS_ERROR_FAILED;
+  }
+
+  for (size_t i = 0; i < num_of_items; i++) {
+    const DFS_CACHE_ITEM * itemp = &(items[i]);
+    DFS_CACHE_DISK disk;
+
+    if (itemp->entryp != NULL) {
+      const DFS_CACHE_ENTRY * entryp = itemp->entryp;
+
+      memset(&disk, 0, sizeof(disk));
+      disk.size = entryp->key.size;
+      disk.mtime_sec = entryp->key.mtime_sec;
+      disk.mtime_nsec = entryp->key.mtime_nsec;
+      disk.cycle_number = entryp->key.cycle_number;
+      disk.num_of_files = (uint8_t)entryp->acorn_dirp->num_of_files;
+      disk.options = entryp->acorn_dirp->options;
+      strncpy(disk.name, entryp->acorn_dirp->name, sizeof(disk.name) - 1);
+    } else {
+      disk = *(itemp->diskp);
+    }
+
+    disk.path_offset = path_offset;
+    disk.first_file = first_file;
+    path_offset += (uint32_t)(strlen(item_path(cachep, itemp)) + 1);
+    first_file += disk.num_of_files;
+
+    if (fwrite(&disk, sizeof(disk), 1, cachefile) != 1) {
+      return DFS_ERROR_FAILED;
+    }
+  }
+
+  for (size_t i = 0; i < num_of_items; i++) {
+    const DFS_CACHE_ITEM * itemp = &(items[i]);
+
+    if (itemp->entryp != NULL) {
+      const ACORN_DIRECTORY * acorn_dirp = itemp->entryp->acorn_dirp;
+
+      for (int f = 0; f < acorn_dirp->num_of_files; f++) {
+        const ACORN_FILE * acorn_filep = &(acorn_dirp->files[f]);
+        DFS_CACHE_FILE file;
+
+        memset(&file, 0, sizeof(file));
+        strncpy(file.name, acorn_filep->name, sizeof(file.name) - 1);
+        file.load_address = acorn_filep->load_address;
+        file.exec_address = acorn_filep->exec_address;
+        file.length = acorn_filep->length;
+        file.start_sector = acorn_filep->start_sector;
+        file.attributes = (uint8_t)acorn_filep->attributes;
+
+        if (fwrite(&file, sizeof(file), 1, cachefile) != 1) {
+          return DFS_ERROR_FAILED;
+        }
+      }
+    } else if (itemp->diskp->num_of_files > 0 &&
+        fwrite(&(cachep->files[itemp->diskp->first_file]), sizeof(DFS_CACHE_FILE), itemp->diskp->num_of_files, cachefile) != itemp->diskp->num_of_files) {
+      return DFS_ERROR_FAILED;
+    }
+  }
+
+  for (size_t i = 0; i < num_of_items; i++) {
+    const char * path = item_path(cachep, &(items[i]));
+
+    if (fwrite(path, strlen(path) + 1, 1, cachefile) != 1) {
+      return DFS_ERROR_FAILED;
+    }
+  }
+
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Writes the cache file if anything has been stored
+ *
+ * Catalogues already in the cache that were not replaced are kept.  The new
+ * file is written alongside the old and renamed over it, so a reader never
+ * sees a part written cache.
+ *
+ * \param cachep the cache handle
+ * \return 0 on success or an error
+ */
+int dfs_cache_save(DFS_CACHE * cachep) {
+  char tmp_path[PATH_MAX + 1];
+  DFS_CACHE_ITEM * items;
+  size_t num_of_items;
+  FILE * cachefile;
+  int ret;
+
+  if (cachep == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  if (cachep->num_of_entries == 0) {
+    return DFS_ERROR_NONE;
+  }
+
+  if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cachep->path) >= (int)sizeof(tmp_path)) {
+    return DFS_ERROR_FAILED;
+  }
+
+  items = merge_items(cachep, &num_of_items);
+  if (items == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  cachefile = fopen(tmp_path, "wb");
+  if (cachefile == NULL) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not create catalogue cache: %s", strerror(errno));
+    free(items);
+    return DFS_ERROR_OPEN_FAILED;
+  }
+
+  ret = write_cache(cachep, items, num_of_items, cachefile);
+  free(items);
+
+  if (fclose(cachefile) != 0 && ret == DFS_ERROR_NONE) {
+    ret = DFS_ERROR_FAILED;
+  }
+
+  if (ret == DFS_ERROR_NONE && rename(tmp_path, cachep->path) == -1) {
+    ret = DFS_ERROR_FAILED;
+  }
+
+  if (ret != DFS_ERROR_NONE) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not write catalogue cache: %s", strerror(errno));
+    unlink(tmp_path);
+  }
+
+  return ret;
+}
@@ -0,0 +1,209 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#include "dfscopy.h"
+#include "dfserr.h"
+#include "dfsstats.h"
+#include "debug.h"
+
+#define DFS_COPY_BUFFER_SIZE (64 * 1024)
+
+/* Errors meaning a copy method is not available for these files, as opposed to an I/O error */
+static int copy_unsupported(int err) {
+  return (err == ENOSYS) || (err == EXDEV) || (err == EINVAL) ||
+         (err == EOPNOTSUPP) || (err == EBADF) || (err == ESPIPE);
+}
+
+#ifdef __linux__
+static int copy_with_copy_file_range(int in_fd, off_t * in_offsetp, int out_fd, off_t * out_offsetp, size_t * lengthp) {
+  loff_t in_off = *in_offsetp;
+  loff_t out_off = (out_offsetp != NULL) ? *out_offsetp : 0;
+
+  while (*lengthp > 0) {
+    ssize_t count = copy_file_range(in_fd, &in_off, out_fd, (out_offsetp != NULL) ? &out_off : NULL, *lengthp, 0);
+
+    /* One call both reads and writes */
+    dfs_stats_count_read((count > 0) ? (uint64_t)count : 0);
+    dfs_stats_count(DFS_STATS_BYTES_WRITTEN, (count > 0) ? (uint64_t)count : 0);
+    if (count == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+
+    if (count == 0) {
+      /* Source is shorter than the range */
+      errno = EIO;
+      return -1;
+    }
+
+    *lengthp -= (size_t)count;
+    *in_offsetp = in_off;
+    if (out_offsetp != NULL) {
+      *out_offsetp = out_off;
+    }
+  }
+
+  return 0;
+}
+
+/* sendfile() always writes at, and advances, the current output position
+   so is only used when that is what was asked for */
+static int copy_with_sendfile(int in_fd, off_t * in_offsetp, int out_fd, size_t * lengthp) {
+  while (*lengthp > 0) {
+    ssize_t count = sendfile(out_fd, in_fd, in_offsetp, *lengthp);
+
+    dfs_stats_count_read((count > 0) ? (uint64_t)count : 0);
+    dfs_stats_count(DFS_STATS_BYTES_WRITTEN, (count > 0) ? (uint64_t)count : 0);
+    if (count == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+
+    if (count == 0) {
+      errno = EIO;
+      return -1;
+    }
+
+    *lengthp -= (size_t)count;
+  }
+
+  return 0;
+}
+#endif
+
+static int copy_with_buffer(int in_fd, off_t * in_offsetp, int out_fd, off_t * out_offsetp, size_t * lengthp) {
+  uint8_t * buffer = (uint8_t *)malloc(DFS_COPY_BUFFER_SIZE);
+
+  dfs_stats_count(DFS_STATS_ALLOCS, 1);
+  if (buffer == NULL) {
+    return -1;
+  }
+
+  while (*lengthp > 0) {
+    size_t chunk = (*lengthp < DFS_COPY_BUFFER_SIZE) ? *lengthp : DFS_COPY_BUFFER_SIZE;
+    size_t done = 0;
+    ssize_t count = pread(in_fd, buffer, chunk, *in_offsetp);
+
+    dfs_stats_count_read((count > 0) ? (uint64_t)count : 0);
+    if (count == -1 && errno == EINTR) {
+      continue;
+    }
+
+    if (count <= 0) {
+      if (count == 0) {
+        errno = EIO;
+      }
+      free(buffer);
+      return -1;
+    }
+
+    while (done < (size_t)count) {
+      ssize_t written;
+
+      if (out_offsetp != NULL) {
+        written = pwrite(out_fd, buffer + done, (size_t)count - done, *out_offsetp + (off_t)done);
+      } else {
+        written = write(out_fd, buffer + done, (size_t)count - done);
+      }
+
+      dfs_stats_count_write((written > 0) ? (uint64_t)written : 0);
+
+      if (written == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        free(buffer);
+        return -1;
+      }
+
+      done += (size_t)written;
+    }
+
+    *lengthp -= (size_t)count;
+    *in_offsetp += count;
+    if (out_offsetp != NULL) {
+      *out_offsetp += count;
+    }
+  }
+
+  free(buffer);
+  return 0;
+}
+
+/**
+ * \brief Copies a range of bytes from one file to another
+ *
+ * \param in_fd the source file descriptor
+ * \param in_offset the offset in the source file
+ * \param out_fd the destination file descriptor
+ * \param out_offset the offset in the destination file or DFS_COPY_CURRENT_OFFSET
+ * \param length the number of bytes to copy
+ * \return 0 on success or an error
+ */
+int dfs_copy_range(int in_fd, off_t in_offset, int out_fd, off_t out_offset, size_t length) {
+  off_t * out_offsetp = (out_offset == DFS_COPY_CURRENT_OFFSET) ? NULL : &out_offset;
+
+#ifdef __linux__
+  /* Each method picks up from wherever the previous one got to */
+  if (copy_with_copy_file_range(in_fd, &in_offset, out_fd, out_offsetp, &length) == 0) {
+    return DFS_ERROR_NONE;
+  }
+
+  /* Moving the output position would disturb anyone else using the file */
+  if (copy_unsupported(errno) && out_offsetp == NULL) {
+    if (copy_with_sendfile(in_fd, &in_offset, out_fd, &length) == 0) {
+      return DFS_ERROR_NONE;
+    }
+  }
+
+  if (!copy_unsupported(errno)) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not copy data: %s", strerror(errno));
+    return DFS_ERROR_FAILED;
+  }
+#endif
+
+  if (copy_with_buffer(in_fd, &in_offset, out_fd, out_offsetp, &length) == -1) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not copy data: %s", strerror(errno));
+    return DFS_ERROR_FAILED;
+  }
+
+  return DFS_ERROR_NONE;
+}
@@ -0,0 +1,835 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* For FNM_CASEFOLD */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "acornfs.h"
+#include "dfs.h"
+#include "dfscorpus.h"
+#include "dfsindex.h"
+#include "threadpool.h"
+#include "debug.h"
+
+/* Files are scanned in blocks, each block by one thread */
+#define DFS_CORPUS_BLOCK_SIZE 65536
+
+/* Space for each name, a multiple of 4 to keep the columns after it aligned */
+#define DFS_CORPUS_NAME_SIZE 12
+
+#define ALIGN8(n) (((n) + 7) & ~(size_t)7)
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_of_images;
+  uint32_t num_of_files;
+  uint32_t paths_size;
+  uint32_t reserved[2];
+} DFS_CORPUS_HEADER;
+
+/* Where each column starts in the index file */
+typedef struct {
+  size_t keys;            /* DFS_NAME_KEY per file */
+  size_t loads;           /* uint32_t per file */
+  size_t execs;
+  size_t lengths;
+  size_t starts;
+  size_t images;          /* uint32_t image number per file */
+  size_t attributes;      /* uint8_t per file */
+  size_t names;           /* DFS_CORPUS_NAME_SIZE characters per file */
+  size_t path_offsets;    /* uint32_t per image, into the path table */
+  size_t paths;
+  size_t size;
+} DFS_CORPUS_LAYOUT;
+
+struct _tag_DFS_CORPUS {
+  const uint8_t * map;
+  size_t map_size;
+  uint32_t num_of_images;
+  uint32_t num_of_files;
+  uint32_t paths_size;
+  const DFS_NAME_KEY * keys;
+  const uint32_t * loads;
+  const uint32_t * execs;
+  const uint32_t * lengths;
+  const uint32_t * starts;
+  const uint32_t * images;
+  const uint8_t * attributes;
+  const char * names;
+  const uint32_t * path_offsets;
+  const char * paths;
+};
+
+/* The state of a query, shared by the threads scanning it */
+typedef struct {
+  const DFS_CORPUS * corpusp;
+  const DFS_CORPUS_PREDICATE * predicates;
+  int num_of_predicates;
+  const uint8_t * image_matches;  /* Per image, NULL if no image is tested */
+  uint32_t ** block_rows;
+  size_t * block_counts;
+  bool failed;
+} DFS_CORPUS_QUERY;
+
+static void get_layout(uint32_t num_of_images, uint32_t num_of_files, uint32_t paths_size, DFS_CORPUS_LAYOUT * layoutp) {
+  size_t offset = sizeof(DFS_CORPUS_HEADER);
+
+  layoutp->keys = offset;
+  offset += (size_t)num_of_files * sizeof(DFS_NAME_KEY);
+  layoutp->loads = offset;
+  offset += (size_t)num_of_files * sizeof(uint32_t);
+  layoutp->execs = offset;
+  offset += (size_t)num_of_files * sizeof(uint32_t);
+  layoutp->lengths = offset;
+  offset += (size_t)num_of_files * sizeof(uint32_t);
+  layoutp->starts = offset;
+  offset += (size_t)num_of_files * sizeof(uint32_t);
+  layoutp->images = offset;
+  offset += (size_t)num_of_files * sizeof(uint32_t);
+  layoutp->attributes = offset;
+  offset = ALIGN8(offset + num_of_files);
+  layoutp->names = offset;
+  offset = ALIGN8(offset + ((size_t)num_of_files * DFS_CORPUS_NAME_SIZE));
+  layoutp->path_offsets = offset;
+  offset = ALIGN8(offset + ((size_t)num_of_images * sizeof(uint32_t)));
+  layoutp->paths = offset;
+  layoutp->size = offset + paths_size;
+}
+
+/**
+ * \brief Writes a corpus index
+ *
+ * The index is built in memory then written to a temporary file that is
+ * renamed over any old index.
+ *
+ * \param path the index file name
+ * \param image_paths the disk image names
+ * \param acorn_dirps the catalogue of each image, NULL for an image that
+ *        could not be read, which is left out
+ * \param num_of_images the number of images
+ * \return 0 on success or an error
+ */
+int dfs_corpus_write(const char * path, const char * const * image_paths, const ACORN_DIRECTORY * const * acorn_dirps, size_t num_of_images) {
+  char tmp_path[PATH_MAX + 1];
+  DFS_CORPUS_HEADER * headerp;
+  DFS_CORPUS_LAYOUT layout;
+  uint32_t image = 0;
+  uint32_t row = 0;
+  uint32_t path_offset = 0;
+  size_t num_of_files = 0;
+  size_t paths_size = 0;
+  size_t num_of_indexed = 0;
+  uint8_t * buffer;
+  FILE * indexfile;
+  int ret = DFS_ERROR_NONE;
+
+  if (path == NULL || (num_of_images > 0 && (image_paths == NULL || acorn_dirps == NULL))) {
+    return DFS_ERROR_FAILED;
+  }
+
+  for (size_t i = 0; i < num_of_images; i++) {
+    if (acorn_dirps[i] != NULL) {
+      num_of_indexed++;
+      num_of_files += (size_t)acorn_dirps[i]->num_of_files;
+      paths_size += strlen(image_paths[i]) + 1;
+    }
+  }
+
+  if (num_of_files > UINT32_MAX || paths_size > UINT32_MAX) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Too many files for a corpus index");
+    return DFS_ERROR_FAILED;
+  }
+
+  if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) {
+    return DFS_ERROR_FAILED;
+  }
+
+  get_layout((uint32_t)num_of_indexed, (uint32_t)num_of_files, (uint32_t)paths_size, &layout);
+
+  buffer = (uint8_t *)calloc(1, layout.size);
+  if (buffer == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  headerp = (DFS_CORPUS_HEADER *)buffer;
+  memcpy(headerp->magic, DFS_CORPUS_MAGIC, sizeof(headerp->magic));
+  headerp->version = DFS_CORPUS_VERSION;
+  headerp->num_of_images = (uint32_t)num_of_indexed;
+  headerp->num_of_files = (uint32_t)num_of_files;
+  headerp->paths_size = (uint32_t)paths_size;
+
+  for (size_t i = 0; i < num_of_images; i++) {
+    const ACORN_DIRECTORY * acorn_dirp = acorn_dirps[i];
+    size_t path_len;
+
+    if (acorn_dirp == NULL) {
+      continue;
+    }
+
+    for (int f = 0; f < acorn_dirp->num_of_files; f++) {
+      const ACORN_FILE * acorn_filep = &(acorn_dirp->files[f]);
+      DFS_NAME_KEY key = 0;
+
+      /* A name that is not a valid DFS name cannot be looked up by key but
+         can still be matched with a wildcard */
+      dfs_name_key_from_string(acorn_filep->name, &key);
+
+      ((DFS_NAME_KEY *)(buffer + layout.keys))[row] = key;
+      ((uint32_t *)(buffer + layout.loads))[row] = acorn_filep->load_address;
+      ((uint32_t *)(buffer + layout.execs))[row] = acorn_filep->exec_address;
+      ((uint32_t *)(buffer + layout.lengths))[row] = acorn_filep->length;
+      ((uint32_t *)(buffer + layout.starts))[row] = acorn_filep->start_sector;
+      ((uint32_t *)(buffer + layout.images))[row] = image;
+      buffer[layout.attributes + row] = (uint8_t)acorn_filep->attributes;
+      strncpy((char *)(buffer + layout.names + ((size_t)row * DFS_CORPUS_NAME_SIZE)), acorn_filep->name, DFS_CORPUS_NAME_SIZE - 1);
+      row++;
+    }
+
+    path_len = strlen(image_paths[i]) + 1;
+    ((uint32_t *)(buffer + layout.path_offsets))[image] = path_offset;
+    memcpy(buffer + layout.paths + path_offset, image_paths[i], path_len);
+    path_offset += (uint32_t)path_len;
+    image++;
+  }
+
+  indexfile = fopen(tmp_path, "wb");
+  if (indexfile == NULL) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not create corpus index: %s", strerror(errno));
+    free(buffer);
+    return DFS_ERROR_OPEN_FAILED;
+  }
+
+  if (fwrite(buffer, layout.size, 1, indexfile) != 1) {
+    ret = DFS_ERROR_FAILED;
+  }
+
+  free(buffer);
+
+  if (fclose(indexfile) != 0 && ret == DFS_ERROR_NONE) {
+    ret = DFS_ERROR_FAILED;
+  }
+
+  if (ret == DFS_ERROR_NONE && rename(tmp_path, path) == -1) {
+    ret = DFS_ERROR_FAILED;
+  }
+
+  if (ret != DFS_ERROR_NONE) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not write corpus index: %s", strerror(errno));
+    unlink(tmp_path);
+  }
+
+  return ret;
+}
+
+/**
+ * \brief Opens a corpus index
+ *
+ * \param path the index file name
+ * \param corpuspp pointer in which to return the corpus handle
+ * \return 0 on success or an error
+ */
+int dfs_corpus_open(const char * path, DFS_CORPUS ** corpuspp) {
+  const DFS_CORPUS_HEADER * headerp;
+  DFS_CORPUS_LAYOUT layout;
+  DFS_CORPUS * corpusp;
+  struct stat st;
+  void * map;
+  int saved_errno;
+  int fd;
+
+  if (path == NULL || corpuspp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return (errno == ENOENT) ? DFS_ERROR_IMAGE_NOT_FOUND : DFS_ERROR_OPEN_FAILED;
+  }
+
+  if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(DFS_CORPUS_HEADER)) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Not a corpus index: %s", path);
+    close(fd);
+    return DFS_ERROR_FAILED;
+  }
+
+  map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  saved_errno = errno;
+  close(fd);
+  if (map == MAP_FAILED) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not map corpus index: %s", strerror(saved_errno));
+    return DFS_ERROR_FAILED;
+  }
+
+  headerp = (const DFS_CORPUS_HEADER *)map;
+  get_layout(headerp->num_of_images, headerp->num_of_files, headerp->paths_size, &layout);
+
+  if (memcmp(headerp->magic, DFS_CORPUS_MAGIC, sizeof(headerp->magic)) != 0 ||
+      headerp->version != DFS_CORPUS_VERSION ||
+      layout.size != (size_t)st.st_size ||
+      (headerp->paths_size > 0 && ((const char *)map)[layout.size - 1] != '\0')) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Not a corpus index: %s", path);
+    munmap(map, (size_t)st.st_size);
+    return DFS_ERROR_FAILED;
+  }
+
+  corpusp = (DFS_CORPUS *)calloc(1, sizeof(DFS_CORPUS));
+  if (corpusp == NULL) {
+    munmap(map, (size_t)st.st_size);
+    return DFS_ERROR_FAILED;
+  }
+
+  /* Queries scan whole columns, so read them in ahead */
+  madvise(map, (size_t)st.st_size, MADV_WILLNEED);
+
+  corpusp->map = (const uint8_t *)map;
+  corpusp->map_size = (size_t)st.st_size;
+  corpusp->num_of_images = headerp->num_of_images;
+  corpusp->num_of_files = headerp->num_of_files;
+  corpusp->paths_size = headerp->paths_size;
+  corpusp->keys = (const DFS_NAME_KEY *)(corpusp->map + layout.keys);
+  corpusp->loads = (const uint32_t *)(corpusp->map + layout.loads);
+  corpusp->execs = (const uint32_t *)(corpusp->map + layout.execs);
+  corpusp->lengths = (const uint32_t *)(corpusp->map + layout.lengths);
+  corpusp->starts = (const uint32_t *)(corpusp->map + layout.starts);
+  corpusp->images = (const uint32_t *)(corpusp->map + layout.images);
+  corpusp->attributes = corpusp->map + layout.attributes;
+  corpusp->names = (const char *)(corpusp->map + layout.names);
+  corpusp->path_offsets = (const uint32_t *)(corpusp->map + layout.path_offsets);
+  corpusp->paths = (const char *)(corpusp->map + layout.paths);
+
+  *corpuspp = corpusp;
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Closes a corpus index
+ *
+ * \param corpusp the corpus handle
+ * \return 0 on success or an error
+ */
+int dfs_corpus_close(DFS_CORPUS * corpusp) {
+  if (corpusp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  munmap((void *)corpusp->map, corpusp->map_size);
+  free(corpusp);
+
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Gets the number of images and files in a corpus index
+ *
+ * \param corpusp the corpus handle
+ * \param num_of_imagesp pointer in which to return the number of images
+ * \param num_of_filesp pointer in which to return the number of files
+ * \return 0 on success or an error
+ */
+int dfs_corpus_get_size(const DFS_CORPUS * corpusp, size_t * num_of_imagesp, size_t * num_of_filesp) {
+  if (corpusp == NULL || num_of_imagesp == NULL || num_of_filesp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  *num_of_imagesp = corpusp->num_of_images;
+  *num_of_filesp = corpusp->num_of_files;
+
+  return DFS_ERROR_NONE;
+}
+
+static bool has_wildcards(const char * text) {
+  return strpbrk(text, "*?[") != NULL;
+}
+
+/**
+ * \brief Parses a predicate such as load=1900, length>10K or name=!BOOT
+ *
+ * \param text the predicate
+ * \param predicatep pointer to the predicate to fill in
+ * \return 0 on success or an error
+ */
+int dfs_corpus_parse_predicate(const char * text, DFS_CORPUS_PREDICATE * predicatep) {
+  static const struct {
+    const char * name;
+    DFS_CORPUS_COLUMN column;
+  } columns[] = {
+    { "name",   DFS_CORPUS_NAME },
+    { "load",   DFS_CORPUS_LOAD },
+    { "exec",   DFS_CORPUS_EXEC },
+    { "length", DFS_CORPUS_LENGTH },
+    { "start",  DFS_CORPUS_START },
+    { "locked", DFS_CORPUS_LOCKED },
+    { "image",  DFS_CORPUS_IMAGE }
+  };
+  static const struct {
+    const char * text;
+    DFS_CORPUS_OP op;
+  } ops[] = {
+    /* Two character operators first so that <= is not taken as < */
+    { "==", DFS_CORPUS_EQ },
+    { "!=", DFS_CORPUS_NE },
+    { "<=", DFS_CORPUS_LE },
+    { ">=", DFS_CORPUS_GE },
+    { "=",  DFS_CORPUS_EQ },
+    { "<",  DFS_CORPUS_LT },
+    { ">",  DFS_CORPUS_GT }
+  };
+  const char * value;
+  size_t name_len;
+  size_t i;
+
+  if (text == NULL || predicatep == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  memset(predicatep, 0, sizeof(DFS_CORPUS_PREDICATE));
+
+  name_len = strcspn(text, "=!<>");
+  for (i = 0; i < sizeof(columns) / sizeof(columns[0]); i++) {
+    if (strlen(columns[i].name) == name_len && strncasecmp(text, columns[i].name, name_len) == 0) {
+      break;
+    }
+  }
+
+  if (i == sizeof(columns) / sizeof(columns[0])) {
+    return DFS_ERROR_FAILED;
+  }
+
+  predicatep->column = columns[i].column;
+
+  for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+    if (strncmp(text + name_len, ops[i].text, strlen(ops[i].text)) == 0) {
+      break;
+    }
+  }
+
+  if (i == sizeof(ops) / sizeof(ops[0])) {
+    return DFS_ERROR_FAILED;
+  }
+
+  predicatep->op = ops[i].op;
+  value = text + name_len + strlen(ops[i].text);
+
+  if (predicatep->column == DFS_CORPUS_NAME || predicatep->column == DFS_CORPUS_IMAGE) {
+    if (predicatep->op != DFS_CORPUS_EQ && predicatep->op != DFS_CORPUS_NE) {
+      return DFS_ERROR_FAILED;
+    }
+
+    if (predicatep->column == DFS_CORPUS_NAME && !has_wildcards(value)) {
+      return dfs_name_key_from_string(value, &(predicatep->key));
+    }
+
+    predicatep->pattern = value;
+  } else {
+    unsigned long number;
+    char * endptr;
+
+    errno = 0;
+    number = strtoul(value, &endptr, 0);
+    if (endptr == value || errno != 0) {
+      return DFS_ERROR_FAILED;
+    }
+
+    if (*endptr == 'K' || *endptr == 'k') {
+      number *= 1024;
+      endptr++;
+    }
+
+    if (*endptr != '\0' || number > UINT32_MAX) {
+      return DFS_ERROR_FAILED;
+    }
+
+    predicatep->value = (uint32_t)number;
+  }
+
+  return DFS_ERROR_NONE;
+}
+
+/* Keeps the rows whose value passes a test, in place */
+static size_t filter_u32(const uint32_t * column, DFS_CORPUS_OP op, uint32_t value, uint32_t * rows, size_t num_of_rows) {
+  size_t n = 0;
+
+#define FILTER(test) \
+  for (size_t i = 0; i < num_of_rows; i++) { \
+    uint32_t row = rows[i]; \
+    rows[n] = row; \
+    n += (column[row] test value); \
+  }
+
+  switch (op) {
+    case DFS_CORPUS_EQ: FILTER(==); break;
+    case DFS_CORPUS_NE: FILTER(!=); break;
+    case DFS_CORPUS_LT: FILTER(<); break;
+    case DFS_CORPUS_LE: FILTER(<=); break;
+    case DFS_CORPUS_GT: FILTER(>); break;
+    case DFS_CORPUS_GE: FILTER(>=); break;
+  }
+
+#undef FILTER
+
+  return n;
+}
+
+static size_t filter_keys(const DFS_NAME_KEY * column, bool equal, DFS_NAME_KEY key, uint32_t * rows, size_t num_of_rows) {
+  size_t n = 0;
+
+  for (size_t i = 0; i < num_of_rows; i++) {
+    uint32_t row = rows[i];
+
+    rows[n] = row;
+    n += ((column[row] == key) == equal);
+  }
+
+  return n;
+}
+
+static size_t filter_locked(const uint8_t * column, DFS_CORPUS_OP op, uint32_t value, uint32_t * rows, size_t num_of_rows) {
+  size_t n = 0;
+
+  for (size_t i = 0; i < num_of_rows; i++) {
+    uint32_t row = rows[i];
+    uint32_t locked = (column[row] & LOCKED) ? 1 : 0;
+    bool pass;
+
+    switch (op) {
+      case DFS_CORPUS_EQ: pass = (locked == value); break;
+      case DFS_CORPUS_NE: pass = (locked != value); break;
+      case DFS_CORPUS_LT: pass = (locked < value); break;
+      case DFS_CORPUS_LE: pass = (locked <= value); break;
+      case DFS_CORPUS_GT: pass = (locked > value); break;
+      default: pass = (locked >= value); break;
+    }
+
+    rows[n] = row;
+    n += pass;
+  }
+
+  return n;
+}
+
+static size_t filter_images(const DFS_CORPUS * corpusp, const uint8_t * image_matches, uint32_t * rows, size_t num_of_rows) {
+  size_t n = 0;
+
+  for (size_t i = 0; i < num_of_rows; i++) {
+    uint32_t row = rows[i];
+    uint32_t image = corpusp->images[row];
+
+    rows[n] = row;
+    n += (image < corpusp->num_of_images) && image_matches[image];
+  }
+
+  return n;
+}
+
+static size_t filter_names(const DFS_CORPUS * corpusp, bool equal, const char * pattern, uint32_t * rows, size_t num_of_rows) {
+  char name[DFS_CORPUS_NAME_SIZE + 1];
+  size_t n = 0;
+
+  for (size_t i = 0; i < num_of_rows; i++) {
+    uint32_t row = rows[i];
+
+    memcpy(name, corpusp->names + ((size_t)row * DFS_CORPUS_NAME_SIZE), DFS_CORPUS_NAME_SIZE);
+    name[DFS_CORPUS_NAME_SIZE] = '\0';
+
+    rows[n] = row;
+    n += ((fnmatch(pattern, name, FNM_CASEFOLD) == 0) == equal);
+  }
+
+  return n;
+}
+
+static void query_block_job(void * context, size_t index) {
+  DFS_CORPUS_QUERY * queryp = (DFS_CORPUS_QUERY *)context;
+  const DFS_CORPUS * corpusp = queryp->corpusp;
+  uint32_t first = (uint32_t)(index * DFS_CORPUS_BLOCK_SIZE);
+  uint32_t last = corpusp->num_of_files - first > DFS_CORPUS_BLOCK_SIZE ? first + DFS_CORPUS_BLOCK_SIZE : corpusp->num_of_files;
+  size_t num_of_rows = last - first;
+  uint32_t * rows;
+
+  rows = (uint32_t *)malloc(num_of_rows * sizeof(uint32_t));
+  if (rows == NULL) {
+    queryp->failed = true;
+    return;
+  }
+
+  for (size_t i = 0; i < num_of_rows; i++) {
+    rows[i] = first + (uint32_t)i;
+  }
+
+  /* The predicates come cheapest first so each one is tested on as few
+     rows as possible */
+  for (int p = 0; p < queryp->num_of_predicates && num_of_rows > 0; p++) {
+    const DFS_CORPUS_PREDICATE * predicatep = &(queryp->predicates[p]);
+    bool equal = (predicatep->op == DFS_CORPUS_EQ);
+
+    switch (predicatep->column) {
+      case DFS_CORPUS_NAME:
+        if (predicatep->pattern != NULL) {
+          num_of_rows = filter_names(corpusp, equal, predicatep->pattern, rows, num_of_rows);
+        } else {
+          num_of_rows = filter_keys(corpusp->keys, equal, predicatep->key, rows, num_of_rows);
+        }
+        break;
+      case DFS_CORPUS_LOAD:
+        num_of_rows = filter_u32(corpusp->loads, predicatep->op, predicatep->value, rows, num_of_rows);
+        break;
+      case DFS_CORPUS_EXEC:
+        num_of_rows = filter_u32(corpusp->execs, predicatep->op, predicatep->value, rows, num_of_rows);
+        break;
+      case DFS_CORPUS_LENGTH:
+        num_of_rows = filter_u32(corpusp->lengths, predicatep->op, predicatep->value, rows, num_of_rows);
+        break;
+      case DFS_CORPUS_START:
+        num_of_rows = filter_u32(corpusp->starts, predicatep->op, predicatep->value, rows, num_of_rows);
+        break;
+      case DFS_CORPUS_LOCKED:
+        num_of_rows = filter_locked(corpusp->attributes, predicatep->op, predicatep->value, rows, num_of_rows);
+        break;
+      case DFS_CORPUS_IMAGE:
+        /* Every image predicate was folded into one test up front */
+        num_of_rows = filter_images(corpusp, queryp->image_matches, rows, num_of_rows);
+        break;
+    }
+  }
+
+  queryp->block_rows[index] = rows;
+  queryp->block_counts[index] = num_of_rows;
+}
+
+/* Orders predicates by the cost of testing a row */
+static int predicate_cost(const DFS_CORPUS_PREDICATE * predicatep) {
+  if (predicatep->column == DFS_CORPUS_IMAGE) {
+    return 1;
+  }
+
+  if (predicatep->column == DFS_CORPUS_NAME && predicatep->pattern != NULL) {
+    return 2;
+  }
+
+  return 0;
+}
+
+/* Tests every image path once, against all of the image predicates */
+static uint8_t * match_images(const DFS_CORPUS * corpusp, const DFS_CORPUS_PREDICATE * predicates, int num_of_predicates) {
+  uint8_t * image_matches = (uint8_t *)malloc((size_t)corpusp->num_of_images + 1);
+
+  if (image_matches == NULL) {
+    return NULL;
+  }
+
+  for (uint32_t image = 0; image < corpusp->num_of_images; image++) {
+    uint32_t offset = corpusp->path_offsets[image];
+    const char * path = (offset < corpusp->paths_size) ? corpusp->paths + offset : "";
+
+    image_matches[image] = 1;
+    for (int p = 0; p < num_of_predicates; p++) {
+      const DFS_CORPUS_PREDICATE * predicatep = &(predicates[p]);
+      bool match;
+
+      if (predicatep->column != DFS_CORPUS_IMAGE) {
+        continue;
+      }
+
+      if (has_wildcards(predicatep->pattern)) {
+        match = (fnmatch(predicatep->pattern, path, 0) == 0);
+      } else {
+        match = (strcmp(predicatep->pattern, path) == 0);
+      }
+
+      if (match != (predicatep->op == DFS_CORPUS_EQ)) {
+        image_matches[image] = 0;
+        break;
+      }
+    }
+  }
+
+  return image_matches;
+}
+
+/**
+ * \brief Finds the files that pass every one of a set of predicates
+ *
+ * \param corpusp the corpus handle
+ * \param predicates the predicates
+ * \param num_of_predicates the number of predicates, 0 for every file
+ * \param num_of_threads the number of threads to scan with
+ * \param rowsp pointer in which to return the matching files in index
+ *        order, which must be freed
+ * \param num_of_rowsp pointer in which to return the number of matches
+ * \return 0 on success or an error
+ */
+int dfs_corpus_query(const DFS_CORPUS * corpusp, const DFS_CORPUS_PREDICATE * predicates, int num_of_predicates, int num_of_threads, uint32_t ** rowsp, size_t * num_of_rowsp) {
+  DFS_CORPUS_PREDICATE * ordered;
+  DFS_CORPUS_QUERY query;
+  size_t num_of_blocks;
+  size_t num_of_rows = 0;
+  uint32_t * rows;
+  int num_of_ordered = 0;
+  bool has_image = false;
+  int ret = DFS_ERROR_NONE;
+
+  if (corpusp == NULL || (num_of_predicates > 0 && predicates == NULL) || rowsp == NULL || num_of_rowsp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  ordered = (DFS_CORPUS_PREDICATE *)malloc(((size_t)num_of_predicates + 1) * sizeof(DFS_CORPUS_PREDICATE));
+  if (ordered == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  /* Cheapest first, keeping a single test for all of the image predicates */
+  for (int cost = 0; cost <= 2; cost++) {
+    for (int p = 0; p < num_of_predicates; p++) {
+      if (predicate_cost(&(predicates[p])) != cost) {
+        continue;
+      }
+
+      if (predicates[p].column == DFS_CORPUS_IMAGE) {
+        if (has_image) {
+          continue;
+        }
+        has_image = true;
+      }
+
+      ordered[num_of_ordered++] = predicates[p];
+    }
+  }
+
+  num_of_blocks = ((size_t)corpusp->num_of_files + DFS_CORPUS_BLOCK_SIZE - 1) / DFS_CORPUS_BLOCK_SIZE;
+
+  memset(&query, 0, sizeof(query));
+  query.corpusp = corpusp;
+  query.predicates = ordered;
+  query.num_of_predicates = num_of_ordered;
+  query.block_rows = (uint32_t **)calloc(num_of_blocks + 1, sizeof(uint32_t *));
+  query.block_counts = (size_t *)calloc(num_of_blocks + 1, sizeof(size_t));
+
+  if (has_image) {
+    query.image_matches = match_images(corpusp, predicates, num_of_predicates);
+  }
+
+  if (query.block_rows == NULL || query.block_counts == NULL || (has_image && query.image_matches == NULL)) {
+    ret = DFS_ERROR_FAILED;
+  } else {
+    threadpool_run(num_of_threads, num_of_blocks, query_block_job, &query);
+    if (query.failed) {
+      ret = DFS_ERROR_FAILED;
+    }
+  }
+
+  /* The blocks are joined in order, so the matches are in index order */
+  if (ret == DFS_ERROR_NONE) {
+    for (size_t b = 0; b < num_of_blocks; b++) {
+      num_of_rows += query.block_counts[b];
+    }
+
+    rows = (uint32_t *)malloc((num_of_rows + 1) * sizeof(uint32_t));
+    if (rows == NULL) {
+      ret = DFS_ERROR_FAILED;
+    } else {
+      num_of_rows = 0;
+      for (size_t b = 0; b < num_of_blocks; b++) {
+        memcpy(rows + num_of_rows, query.block_rows[b], query.block_counts[b] * sizeof(uint32_t));
+        num_of_rows += query.block_counts[b];
+      }
+
+      *rowsp = rows;
+      *num_of_rowsp = num_of_rows;
+    }
+  }
+
+  if (query.block_rows != NULL) {
+    for (size_t b = 0; b < num_of_blocks; b++) {
+      free(query.block_rows[b]);
+    }
+  }
+
+  free(query.block_rows);
+  free(query.block_counts);
+  free((void *)query.image_matches);
+  free(ordered);
+
+  return ret;
+}
+
+/**
+ * \brief Gets a file from a corpus index
+ *
+ * \param corpusp the corpus handle
+ * \param row the file, as returned by dfs_corpus_query()
+ * \param image_pathp pointer in which to return the path of its image
+ * \param acorn_filep pointer to the file meta data to fill in.  The name
+ *        points into the index
+ * \return 0 on success or an error
+ */
+int dfs_corpus_get_file(const DFS_CORPUS * corpusp, uint32_t row, const char ** image_pathp, ACORN_FILE * acorn_filep) {
+  uint32_t image;
+  uint32_t offset;
+  const char * name;
+
+  if (corpusp == NULL || image_pathp == NULL || acorn_filep == NULL || row >= corpusp->num_of_files) {
+    return DFS_ERROR_FAILED;
+  }
+
+  image = corpusp->images[row];
+  if (image >= corpusp->num_of_images) {
+    return DFS_ERROR_FAILED;
+  }
+
+  offset = corpusp->path_offsets[image];
+  if (offset >= corpusp->paths_size) {
+    return DFS_ERROR_FAILED;
+  }
+
+  /* Names are written terminated, which a damaged index may not be */
+  name = corpusp->names + ((size_t)row * DFS_CORPUS_NAME_SIZE);
+  if (memchr(name, '\0', DFS_CORPUS_NAME_SIZE) == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  *image_pathp = corpusp->paths + offset;
+  acorn_filep->name = (char *)name;
+  acorn_filep->load_address = corpusp->loads[row];
+  acorn_filep->exec_address = corpusp->execs[row];
+  acorn_filep->length = corpusp->lengths[row];
+  acorn_filep->start_sector = corpusp->starts[row];
+  acorn_filep->attributes = (ACORN_FILE_ATTRIBS)corpusp->attributes[row];
+
+  return DFS_ERROR_NONE;
+}
@@ -0,0 +1,324 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "dfsdedupe.h"
+#include "dfserr.h"
+
+/* The top bits of a hash pick the shard and the bottom bits the slot */
+#define DFS_DEDUPE_SHARD_BITS 6
+#define DFS_DEDUPE_NUM_OF_SHARDS (1 << DFS_DEDUPE_SHARD_BITS)
+#define DFS_DEDUPE_INITIAL_SLOTS 256
+
+#define END_OF_MEMBERS UINT32_MAX
+
+typedef struct {
+  uint64_t hash;
+  uint32_t length;
+  uint32_t num_of_copies;    /* 0 if the slot is empty */
+  uint32_t first_member;
+} DFS_DEDUPE_SLOT;
+
+typedef struct {
+  uint64_t tag;
+  uint32_t next_member;
+} DFS_DEDUPE_MEMBER;
+
+typedef struct {
+  pthread_mutex_t lock;
+  DFS_DEDUPE_SLOT * slots;
+  size_t num_of_slots;       /* A power of two */
+  size_t num_of_groups;
+  DFS_DEDUPE_MEMBER * members;
+  size_t num_of_members;
+  size_t members_capacity;
+} DFS_DEDUPE_SHARD;
+
+struct _tag_DFS_DEDUPE {
+  DFS_DEDUPE_SHARD shards[DFS_DEDUPE_NUM_OF_SHARDS];
+  uint64_t * tags;           /* Of the groups last returned */
+};
+
+/**
+ * \brief Creates an empty table of file hashes
+ *
+ * \param dedupepp pointer in which to return the table
+ * \return 0 on success or an error
+ */
+int dfs_dedupe_create(DFS_DEDUPE ** dedupepp) {
+  DFS_DEDUPE * dedupep;
+
+  if (dedupepp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  dedupep = (DFS_DEDUPE *)calloc(1, sizeof(DFS_DEDUPE));
+  if (dedupep == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  for (int s = 0; s < DFS_DEDUPE_NUM_OF_SHARDS; s++) {
+    pthread_mutex_init(&(dedupep->shards[s].lock), NULL);
+  }
+
+  *dedupepp = dedupep;
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Frees a table of file hashes
+ *
+ * \param dedupep the table
+ * \return 0 on success or an error
+ */
+int dfs_dedupe_free(DFS_DEDUPE * dedupep) {
+  if (dedupep == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  for (int s = 0; s < DFS_DEDUPE_NUM_OF_SHARDS; s++) {
+    pthread_mutex_destroy(&(dedupep->shards[s].lock));
+    free(dedupep->shards[s].slots);
+    free(dedupep->shards[s].members);
+  }
+
+  free(dedupep->tags);
+  free(dedupep);
+
+  return DFS_ERROR_NONE;
+}
+
+/* Finds the slot for a hash and length, either in use by them or empty */
+static DFS_DEDUPE_SLOT * find_slot(DFS_DEDUPE_SLOT * slots, size_t num_of_slots, uint64_t hash, uint32_t length) {
+  size_t mask = num_of_slots - 1;
+  size_t index = (size_t)hash & mask;
+
+  for (;;) {
+    DFS_DEDUPE_SLOT * slotp = &(slots[index]);
+
+    if (slotp->num_of_copies == 0 || (slotp->hash == hash && slotp->length == length)) {
+      return slotp;
+    }
+
+    index = (index + 1) & mask;
+  }
+}
+
+/* Doubles the slots of a shard, keeping it at most half full */
+static int grow_slots(DFS_DEDUPE_SHARD * shardp) {
+  size_t num_of_slots = shardp->num_of_slots ? shardp->num_of_slots * 2 : DFS_DEDUPE_INITIAL_SLOTS;
+  DFS_DEDUPE_SLOT * slots = (DFS_DEDUPE_SLOT *)calloc(num_of_slots, sizeof(DFS_DEDUPE_SLOT));
+
+  if (slots == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  for (size_t i = 0; i < shardp->num_of_slots; i++) {
+    const DFS_DEDUPE_SLOT * slotp = &(shardp->slots[i]);
+
+    if (slotp->num_of_copies != 0) {
+      *find_slot(slots, num_of_slots, slotp->hash, slotp->length) = *slotp;
+    }
+  }
+
+  free(shardp->slots);
+  shardp->slots = slots;
+  shardp->num_of_slots = num_of_slots;
+
+  return DFS_ERROR_NONE;
+}
+
+static int add_member(DFS_DEDUPE_SHARD * shardp, uint64_t tag, uint32_t next_member, uint32_t * indexp) {
+  if (shardp->num_of_members == shardp->members_capacity) {
+    size_t capacity = shardp->members_capacity ? shardp->members_capacity * 2 : DFS_DEDUPE_INITIAL_SLOTS;
+    DFS_DEDUPE_MEMBER * members;
+
+    if (capacity >= END_OF_MEMBERS) {
+      return DFS_ERROR_FAILED;
+    }
+
+    members = (DFS_DEDUPE_MEMBER *)realloc(shardp->members, capacity * sizeof(DFS_DEDUPE_MEMBER));
+    if (members == NULL) {
+      return DFS_ERROR_FAILED;
+    }
+
+    shardp->members = members;
+    shardp->members_capacity = capacity;
+  }
+
+  shardp->members[shardp->num_of_members].tag = tag;
+  shardp->members[shardp->num_of_members].next_member = next_member;
+  *indexp = (uint32_t)shardp->num_of_members++;
+
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Adds a file to a table of file hashes
+ *
+ * \param dedupep the table
+ * \param hash the hash of the file's contents
+ * \param length the length of the file
+ * \param tag a value identifying the file to the caller
+ * \return 0 on success or an error
+ */
+int dfs_dedupe_add(DFS_DEDUPE * dedupep, uint64_t hash, uint32_t length, uint64_t tag) {
+  DFS_DEDUPE_SHARD * shardp;
+  DFS_DEDUPE_SLOT * slotp;
+  uint32_t member;
+  int ret = DFS_ERROR_NONE;
+
+  if (dedupep == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  shardp = &(dedupep->shards[hash >> (64 - DFS_DEDUPE_SHARD_BITS)]);
+  pthread_mutex_lock(&(shardp->lock));
+
+  if ((shardp->num_of_groups + 1) * 2 > shardp->num_of_slots) {
+    ret = grow_slots(shardp);
+  }
+
+  if (ret == DFS_ERROR_NONE) {
+    slotp = find_slot(shardp->slots, shardp->num_of_slots, hash, length);
+
+    /* Members are chained newest first */
+    ret = add_member(shardp, tag, slotp->num_of_copies ? slotp->first_member : END_OF_MEMBERS, &member);
+    if (ret == DFS_ERROR_NONE) {
+      if (slotp->num_of_copies == 0) {
+        slotp->hash = hash;
+        slotp->length = length;
+        shardp->num_of_groups++;
+      }
+
+      slotp->first_member = member;
+      slotp->num_of_copies++;
+    }
+  }
+
+  pthread_mutex_unlock(&(shardp->lock));
+  return ret;
+}
+
+static int compare_tags(const void * a, const void * b) {
+  uint64_t taga = *(const uint64_t *)a;
+  uint64_t tagb = *(const uint64_t *)b;
+
+  return (taga < tagb) ? -1 : (taga > tagb);
+}
+
+/* Most space reclaimed first, then by the first copy so the order does not
+   depend on the order the files were added in */
+static int compare_groups(const void * a, const void * b) {
+  const DFS_DEDUPE_GROUP * groupap = (const DFS_DEDUPE_GROUP *)a;
+  const DFS_DEDUPE_GROUP * groupbp = (const DFS_DEDUPE_GROUP *)b;
+  uint64_t reclaima = (uint64_t)groupap->length * (groupap->num_of_copies - 1);
+  uint64_t reclaimb = (uint64_t)groupbp->length * (groupbp->num_of_copies - 1);
+
+  if (reclaima != reclaimb) {
+    return (reclaima > reclaimb) ? -1 : 1;
+  }
+
+  return compare_tags(groupap->tags, groupbp->tags);
+}
+
+/**
+ * \brief Gets the groups of files with the same hash and length
+ *
+ * \param dedupep the table
+ * \param groupsp pointer in which to return the groups, which must be
+ *        freed.  Their tags belong to the table
+ * \param num_of_groupsp pointer in which to return the number of groups
+ * \return 0 on success or an error
+ */
+int dfs_dedupe_get_groups(DFS_DEDUPE * dedupep, DFS_DEDUPE_GROUP ** groupsp, size_t * num_of_groupsp) {
+  DFS_DEDUPE_GROUP * groups;
+  size_t num_of_groups = 0;
+  size_t num_of_tags = 0;
+  uint64_t * tags;
+
+  if (dedupep == NULL || groupsp == NULL || num_of_groupsp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  for (int s = 0; s < DFS_DEDUPE_NUM_OF_SHARDS; s++) {
+    const DFS_DEDUPE_SHARD * shardp = &(dedupep->shards[s]);
+
+    for (size_t i = 0; i < shardp->num_of_slots; i++) {
+      if (shardp->slots[i].num_of_copies > 1) {
+        num_of_groups++;
+        num_of_tags += shardp->slots[i].num_of_copies;
+      }
+    }
+  }
+
+  groups = (DFS_DEDUPE_GROUP *)calloc(num_of_groups + 1, sizeof(DFS_DEDUPE_GROUP));
+  tags = (uint64_t *)malloc((num_of_tags + 1) * sizeof(uint64_t));
+  if (groups == NULL || tags == NULL) {
+    free(groups);
+    free(tags);
+    return DFS_ERROR_FAILED;
+  }
+
+  free(dedupep->tags);
+  dedupep->tags = tags;
+
+  num_of_groups = 0;
+  for (int s = 0; s < DFS_DEDUPE_NUM_OF_SHARDS; s++) {
+    const DFS_DEDUPE_SHARD * shardp = &(dedupep->shards[s]);
+
+    for (size_t i = 0; i < shardp->num_of_slots; i++) {
+      const DFS_DEDUPE_SLOT * slotp = &(shardp->slots[i]);
+      DFS_DEDUPE_GROUP * groupp;
+      size_t n = 0;
+
+      if (slotp->num_of_copies < 2) {
+        continue;
+      }
+
+      groupp = &(groups[num_of_groups++]);
+      groupp->hash = slotp->hash;
+      groupp->length = slotp->length;
+      groupp->num_of_copies = slotp->num_of_copies;
+      groupp->tags = tags;
+
+      for (uint32_t m = slotp->first_member; m != END_OF_MEMBERS; m = shardp->members[m].next_member) {
+        tags[n++] = shardp->members[m].tag;
+      }
+
+      qsort(tags, n, sizeof(uint64_t), compare_tags);
+      tags += n;
+    }
+  }
+
+  qsort(groups, num_of_groups, sizeof(DFS_DEDUPE_GROUP), compare_groups);
+
+  *groupsp = groups;
+  *num_of_groupsp = num_of_groups;
+  return DFS_ERROR_NONE;
+}
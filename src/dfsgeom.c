@@ -0,0 +1,288 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "dfs.h"
+#include "dfsgeom.h"
+#include "dfsstats.h"
+#include "debug.h"
+
+#define DFS_TRACK_SIZE (DFS_SECTORS_PER_TRACK * DFS_SECTOR_SIZE)
+
+/* Tracks of each side moved per read or write when splitting or joining */
+#define DFS_DSD_TRACKS_PER_CHUNK 40
+
+/**
+ * \brief Sets up a disk geometry
+ *
+ * \param geometryp pointer to the geometry
+ * \param disk_offset where the first track of the image starts in the file
+ * \param num_of_sides 1 for a single sided image or 2 for an interleaved one
+ * \param side the side holding the disk
+ * \return 0 on success or an error
+ */
+int dfs_geometry_init(DFS_GEOMETRY * geometryp, off_t disk_offset, int num_of_sides, int side) {
+  if (geometryp == NULL || num_of_sides < 1 || num_of_sides > DFS_DSD_NUM_OF_SIDES ||
+      side < 0 || side >= num_of_sides) {
+    return DFS_ERROR_FAILED;
+  }
+
+  geometryp->disk_offset = disk_offset;
+  geometryp->num_of_sides = num_of_sides;
+  geometryp->side = side;
+
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Gets the position of a sector in the image file
+ *
+ * \param geometryp pointer to the geometry
+ * \param sector the logical sector on the disk
+ * \return the offset of the sector in the file
+ */
+off_t dfs_geometry_sector_offset(const DFS_GEOMETRY * geometryp, int sector) {
+  off_t track = sector / DFS_SECTORS_PER_TRACK;
+
+  return
+    geometryp->disk_offset +
+    ((track * geometryp->num_of_sides) + geometryp->side) * DFS_TRACK_SIZE +
+    (off_t)(sector % DFS_SECTORS_PER_TRACK) * DFS_SECTOR_SIZE;
+}
+
+/**
+ * \brief Gets how many sectors from a sector follow it in the image file
+ *
+ * \param geometryp pointer to the geometry
+ * \param sector the logical sector on the disk
+ * \param num_of_sectors the most sectors wanted
+ * \return the number of sectors, at least 1, that can be read in one go
+ */
+int dfs_geometry_run_length(const DFS_GEOMETRY * geometryp, int sector, int num_of_sectors) {
+  int run;
+
+  if (geometryp->num_of_sides == 1) {
+    return num_of_sectors;
+  }
+
+  /* An interleaved image is contiguous to the end of the track */
+  run = DFS_SECTORS_PER_TRACK - (sector % DFS_SECTORS_PER_TRACK);
+  return (run < num_of_sectors) ? run : num_of_sectors;
+}
+
+static int get_num_of_tracks(int fd, int tracks_per_unit, int * num_of_tracksp) {
+  struct stat st;
+  off_t unit_size = (off_t)tracks_per_unit * DFS_TRACK_SIZE;
+
+  if (fstat(fd, &st) == -1) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not stat disk image: %s", strerror(errno));
+    return DFS_ERROR_FAILED;
+  }
+
+  /* Images often leave off unused tracks at the end */
+  *num_of_tracksp = (int)((st.st_size + unit_size - 1) / unit_size);
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Splits a double sided interleaved image into two single sided images
+ *
+ * The image is read a large chunk at a time and each chunk is scattered to
+ * the two sides with a single gathered write per side.
+ *
+ * \param dsdfile the double sided image file reference
+ * \param side0file the file reference for side 0
+ * \param side1file the file reference for side 1
+ * \return 0 on success or an error
+ */
+int dfs_dsd_split(FILE * dsdfile, FILE * side0file, FILE * side1file) {
+  struct iovec iov[DFS_DSD_NUM_OF_SIDES][DFS_DSD_TRACKS_PER_CHUNK];
+  int side_fds[DFS_DSD_NUM_OF_SIDES];
+  uint8_t * buffer;
+  int num_of_tracks;
+  int ret;
+
+  if (dsdfile == NULL || side0file == NULL || side1file == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  if (fflush(side0file) != 0 || fflush(side1file) != 0) {
+    return DFS_ERROR_FAILED;
+  }
+
+  ret = get_num_of_tracks(fileno(dsdfile), DFS_DSD_NUM_OF_SIDES, &num_of_tracks);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  buffer = (uint8_t *)malloc((size_t)DFS_DSD_TRACKS_PER_CHUNK * DFS_DSD_NUM_OF_SIDES * DFS_TRACK_SIZE);
+  dfs_stats_count(DFS_STATS_ALLOCS, 1);
+  if (buffer == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  side_fds[0] = fileno(side0file);
+  side_fds[1] = fileno(side1file);
+
+  for (int track = 0; track < num_of_tracks && ret == DFS_ERROR_NONE; track += DFS_DSD_TRACKS_PER_CHUNK) {
+    int chunk_tracks = num_of_tracks - track;
+    size_t length;
+    ssize_t count;
+
+    if (chunk_tracks > DFS_DSD_TRACKS_PER_CHUNK) {
+      chunk_tracks = DFS_DSD_TRACKS_PER_CHUNK;
+    }
+
+    length = (size_t)chunk_tracks * DFS_DSD_NUM_OF_SIDES * DFS_TRACK_SIZE;
+    count = pread(fileno(dsdfile), buffer, length, (off_t)track * DFS_DSD_NUM_OF_SIDES * DFS_TRACK_SIZE);
+    dfs_stats_count_read((count > 0) ? (uint64_t)count : 0);
+    if (count < 0) {
+      DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not read disk image: %s", strerror(errno));
+      ret = DFS_ERROR_FAILED;
+      break;
+    }
+
+    /* A short last track reads as zeros */
+    if ((size_t)count < length) {
+      memset(buffer + count, 0, length - (size_t)count);
+    }
+
+    for (int t = 0; t < chunk_tracks; t++) {
+      for (int side = 0; side < DFS_DSD_NUM_OF_SIDES; side++) {
+        iov[side][t].iov_base = buffer + ((size_t)((t * DFS_DSD_NUM_OF_SIDES) + side) * DFS_TRACK_SIZE);
+        iov[side][t].iov_len = DFS_TRACK_SIZE;
+      }
+    }
+
+    for (int side = 0; side < DFS_DSD_NUM_OF_SIDES; side++) {
+      count = pwritev(side_fds[side], iov[side], chunk_tracks, (off_t)track * DFS_TRACK_SIZE);
+      dfs_stats_count_write((count > 0) ? (uint64_t)count : 0);
+      if (count < 0 || (size_t)count != (size_t)chunk_tracks * DFS_TRACK_SIZE) {
+        DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not write side %d: %s", side, strerror(errno));
+        ret = DFS_ERROR_FAILED;
+        break;
+      }
+    }
+  }
+
+  free(buffer);
+  return ret;
+}
+
+/**
+ * \brief Joins two single sided images into a double sided interleaved image
+ *
+ * Each side is read a large chunk at a time with a single scattered read,
+ * straight into place in the interleaved chunk, which is then written in
+ * one go.
+ *
+ * \param side0file the file reference for side 0
+ * \param side1file the file reference for side 1
+ * \param dsdfile the double sided image file reference
+ * \return 0 on success or an error
+ */
+int dfs_dsd_join(FILE * side0file, FILE * side1file, FILE * dsdfile) {
+  struct iovec iov[DFS_DSD_TRACKS_PER_CHUNK];
+  int side_fds[DFS_DSD_NUM_OF_SIDES];
+  int side_tracks[DFS_DSD_NUM_OF_SIDES];
+  uint8_t * buffer;
+  int num_of_tracks;
+  int ret;
+
+  if (dsdfile == NULL || side0file == NULL || side1file == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  if (fflush(dsdfile) != 0) {
+    return DFS_ERROR_FAILED;
+  }
+
+  side_fds[0] = fileno(side0file);
+  side_fds[1] = fileno(side1file);
+
+  for (int side = 0; side < DFS_DSD_NUM_OF_SIDES; side++) {
+    ret = get_num_of_tracks(side_fds[side], 1, &(side_tracks[side]));
+    if (ret != DFS_ERROR_NONE) {
+      return ret;
+    }
+  }
+
+  num_of_tracks = (side_tracks[0] > side_tracks[1]) ? side_tracks[0] : side_tracks[1];
+
+  buffer = (uint8_t *)malloc((size_t)DFS_DSD_TRACKS_PER_CHUNK * DFS_DSD_NUM_OF_SIDES * DFS_TRACK_SIZE);
+  dfs_stats_count(DFS_STATS_ALLOCS, 1);
+  if (buffer == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  for (int track = 0; track < num_of_tracks && ret == DFS_ERROR_NONE; track += DFS_DSD_TRACKS_PER_CHUNK) {
+    int chunk_tracks = num_of_tracks - track;
+    size_t length;
+    ssize_t count;
+
+    if (chunk_tracks > DFS_DSD_TRACKS_PER_CHUNK) {
+      chunk_tracks = DFS_DSD_TRACKS_PER_CHUNK;
+    }
+
+    length = (size_t)chunk_tracks * DFS_DSD_NUM_OF_SIDES * DFS_TRACK_SIZE;
+
+    /* The shorter side and any short track are padded with zeros */
+    memset(buffer, 0, length);
+
+    for (int side = 0; side < DFS_DSD_NUM_OF_SIDES; side++) {
+      for (int t = 0; t < chunk_tracks; t++) {
+        iov[t].iov_base = buffer + ((size_t)((t * DFS_DSD_NUM_OF_SIDES) + side) * DFS_TRACK_SIZE);
+        iov[t].iov_len = DFS_TRACK_SIZE;
+      }
+
+      count = preadv(side_fds[side], iov, chunk_tracks, (off_t)track * DFS_TRACK_SIZE);
+      dfs_stats_count_read((count > 0) ? (uint64_t)count : 0);
+      if (count < 0) {
+        DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not read side %d: %s", side, strerror(errno));
+        ret = DFS_ERROR_FAILED;
+        break;
+      }
+    }
+
+    if (ret != DFS_ERROR_NONE) {
+      break;
+    }
+
+    count = pwrite(fileno(dsdfile), buffer, length, (off_t)track * DFS_DSD_NUM_OF_SIDES * DFS_TRACK_SIZE);
+    dfs_stats_count_write((count > 0) ? (uint64_t)count : 0);
+    if (count < 0 || (size_t)count != length) {
+      DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not write disk image: %s", strerror(errno));
+      ret = DFS_ERROR_FAILED;
+    }
+  }
+
+  free(buffer);
+  return ret;
+}
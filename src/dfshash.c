@@ -0,0 +1,131 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include "dfshash.h"
+
+/* This is XXH64, which takes 32 bytes at a time in four lanes */
+#define PRIME64_1 UINT64_C(0x9e3779b185ebca87)
+#define PRIME64_2 UINT64_C(0xc2b2ae3d27d4eb4f)
+#define PRIME64_3 UINT64_C(0x165667b19e3779f9)
+#define PRIME64_4 UINT64_C(0x85ebca77c2b2ae63)
+#define PRIME64_5 UINT64_C(0x27d4eb2f165667c5)
+
+static inline uint64_t rotl64(uint64_t value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+/* Unaligned little endian reads */
+static inline uint64_t read64(const uint8_t * p) {
+  uint64_t value;
+
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static inline uint32_t read32(const uint8_t * p) {
+  uint32_t value;
+
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input) {
+  acc += input * PRIME64_2;
+  acc = rotl64(acc, 31);
+  return acc * PRIME64_1;
+}
+
+static inline uint64_t merge64(uint64_t acc, uint64_t lane) {
+  acc ^= round64(0, lane);
+  return (acc * PRIME64_1) + PRIME64_4;
+}
+
+/**
+ * \brief Hashes a block of memory
+ *
+ * \param data the data
+ * \param length the length of the data in bytes
+ * \param seed the seed, giving a different hash for the same data
+ * \return the hash
+ */
+uint64_t dfs_hash64(const void * data, size_t length, uint64_t seed) {
+  const uint8_t * p = (const uint8_t *)data;
+  const uint8_t * end = p + length;
+  uint64_t hash;
+
+  if (length >= 32) {
+    const uint8_t * limit = end - 32;
+    uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+    uint64_t v2 = seed + PRIME64_2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - PRIME64_1;
+
+    do {
+      v1 = round64(v1, read64(p));
+      v2 = round64(v2, read64(p + 8));
+      v3 = round64(v3, read64(p + 16));
+      v4 = round64(v4, read64(p + 24));
+      p += 32;
+    } while (p <= limit);
+
+    hash = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+    hash = merge64(hash, v1);
+    hash = merge64(hash, v2);
+    hash = merge64(hash, v3);
+    hash = merge64(hash, v4);
+  } else {
+    hash = seed + PRIME64_5;
+  }
+
+  hash += (uint64_t)length;
+
+  while (p + 8 <= end) {
+    hash ^= round64(0, read64(p));
+    hash = (rotl64(hash, 27) * PRIME64_1) + PRIME64_4;
+    p += 8;
+  }
+
+  if (p + 4 <= end) {
+    hash ^= (uint64_t)read32(p) * PRIME64_1;
+    hash = (rotl64(hash, 23) * PRIME64_2) + PRIME64_3;
+    p += 4;
+  }
+
+  while (p < end) {
+    hash ^= (uint64_t)(*p) * PRIME64_5;
+    hash = rotl64(hash, 11) * PRIME64_1;
+    p++;
+  }
+
+  /* Avalanche so every input bit affects every output bit */
+  hash ^= hash >> 33;
+  hash *= PRIME64_2;
+  hash ^= hash >> 29;
+  hash *= PRIME64_3;
+  hash ^= hash >> 32;
+
+  return hash;
+}
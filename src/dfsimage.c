@@ -0,0 +1,993 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include "acornfs.h"
+#include "dfs.h"
+#include "dfsalloc.h"
+#include "dfsimage.h"
+#include "dfsindex.h"
+#include "dfsmmb.h"
+#include "dfsstats.h"
+#include "debug.h"
+
+struct _tag_DFS_IMAGE {
+  FILE * diskfile;              /* NULL when opened on a caller's I/O */
+  DFS_IO io;                    /* Positional I/O on the diskfile */
+  DFS_IO * iop;                 /* Where the image is read and written */
+  int flags;
+  int alloc_policy;
+  ACORN_DIRECTORY * acorn_dirp; /* Cached catalogue, NULL until first read */
+  DFS_NAME_INDEX name_index;    /* Names in the cached catalogue */
+  const uint8_t * map;          /* Whole disk when opened with DFS_IMAGE_MMAP */
+  size_t map_size;
+  size_t map_lead;              /* Bytes mapped before the disk to page align it */
+  DFS_GEOMETRY geometry;        /* Where the disk's sectors are in the file */
+  size_t disk_size;             /* Size of a disk in a container, 0 for a whole file */
+};
+
+static void unmap_image(DFS_IMAGE * imagep) {
+  if (imagep->map != NULL) {
+    munmap((void *)(imagep->map - imagep->map_lead), imagep->map_size + imagep->map_lead);
+    imagep->map = NULL;
+    imagep->map_size = 0;
+    imagep->map_lead = 0;
+  }
+}
+
+static int map_image(DFS_IMAGE * imagep) {
+  struct stat st;
+  size_t size;
+  size_t lead;
+  void * map;
+
+  /* A side of an interleaved image is not contiguous so is not mapped */
+  if (!(imagep->flags & DFS_IMAGE_MMAP) || imagep->geometry.num_of_sides > 1 || imagep->diskfile == NULL) {
+    return DFS_ERROR_NONE;
+  }
+
+  if (fstat(fileno(imagep->diskfile), &st) == -1) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not stat disk image: %s", strerror(errno));
+    return DFS_ERROR_FAILED;
+  }
+
+  /* Only the disk itself is mapped, which for a container is a single slot */
+  size = (st.st_size > imagep->geometry.disk_offset) ? (size_t)(st.st_size - imagep->geometry.disk_offset) : 0;
+  if (imagep->disk_size != 0 && size > imagep->disk_size) {
+    size = imagep->disk_size;
+  }
+
+  /* Nothing to do if the image has not changed size since it was mapped */
+  if (imagep->map != NULL && imagep->map_size == size) {
+    return DFS_ERROR_NONE;
+  }
+
+  unmap_image(imagep);
+
+  /* A newly created image is mapped once it has been formatted */
+  if (size == 0) {
+    return DFS_ERROR_NONE;
+  }
+
+  /* The mapping is shared so writes made through the file are visible in it.
+     An MMB slot is only page aligned with small pages, so the mapping
+     starts at the page holding the start of the disk */
+  lead = (size_t)(imagep->geometry.disk_offset % sysconf(_SC_PAGESIZE));
+  map = mmap(NULL, size + lead, PROT_READ, MAP_SHARED, fileno(imagep->diskfile), imagep->geometry.disk_offset - (off_t)lead);
+  dfs_stats_count(DFS_STATS_SYSCALLS, 1);
+  if (map == MAP_FAILED) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not map disk image: %s", strerror(errno));
+    return DFS_ERROR_FAILED;
+  }
+
+  imagep->map = (const uint8_t *)map + lead;
+  imagep->map_size = size;
+  imagep->map_lead = lead;
+
+  return DFS_ERROR_NONE;
+}
+
+static void invalidate_catalogue(DFS_IMAGE * imagep) {
+  if (imagep->acorn_dirp != NULL) {
+    acornfs_free_directory(imagep->acorn_dirp);
+    imagep->acorn_dirp = NULL;
+  }
+}
+
+/* Indexes the names in a newly read catalogue */
+static void index_catalogue(DFS_IMAGE * imagep) {
+  const ACORN_DIRECTORY * acorn_dirp = imagep->acorn_dirp;
+
+  dfs_name_index_init(&(imagep->name_index));
+
+  for (int i = 0; i < acorn_dirp->num_of_files; i++) {
+    DFS_NAME_KEY key;
+
+    /* A name that cannot be looked up is left out.  Of any duplicates the
+       first is kept, as a lookup on the disk would */
+    if (dfs_name_key_from_string(acorn_dirp->files[i].name, &key) == DFS_ERROR_NONE) {
+      dfs_name_index_insert(&(imagep->name_index), key, i);
+    }
+  }
+}
+
+/* Prepares the image for an operation that modifies it */
+static int begin_update(DFS_IMAGE * imagep) {
+  if (!(imagep->flags & DFS_IMAGE_WRITE)) {
+    return DFS_ERROR_READ_ONLY;
+  }
+
+  /* Any cached catalogue is stale once the image has been written to */
+  invalidate_catalogue(imagep);
+
+  return DFS_ERROR_NONE;
+}
+
+/* Completes an operation that modified the image */
+static int end_update(DFS_IMAGE * imagep) {
+  return map_image(imagep);
+}
+
+/* All access to an image file is made with positional I/O on its descriptor */
+static void init_image_io(DFS_IMAGE * imagep) {
+  dfs_io_init_fd(&(imagep->io), fileno(imagep->diskfile));
+  imagep->iop = &(imagep->io);
+}
+
+static bool is_dsd_name(const char * path) {
+  const char * ext = strrchr(path, '.');
+
+  return (ext != NULL) && (strcasecmp(ext, ".dsd") == 0);
+}
+
+/* An MMB file is known by its name, or else by having an index that parses */
+static bool is_mmb_file(const char * path) {
+  const char * ext = strrchr(path, '.');
+  DFS_MMB_INDEX index;
+  FILE * mmbfile;
+  bool valid;
+
+  if ((ext != NULL) && (strcasecmp(ext, ".mmb") == 0)) {
+    return true;
+  }
+
+  mmbfile = fopen(path, "rb");
+  if (mmbfile == NULL) {
+    return false;
+  }
+
+  valid = (dfs_mmb_read_index(mmbfile, &index) == DFS_ERROR_NONE);
+  fclose(mmbfile);
+
+  return valid;
+}
+
+/**
+ * \brief Opens a DFS disk image
+ *
+ * A path of the form file.mmb:slot opens a slot of an MMB file, as
+ * dfs_image_open_slot() does.  A double sided image, file.dsd, opens side
+ * 0 and file.dsd:1 opens side 1.  A path is only split like this when no
+ * file has the whole path as its name, and the part before the colon is a
+ * double sided image or an MMB file.
+ * A double sided image cannot be opened with DFS_IMAGE_CREATE.
+ *
+ * \param path the disk image file name
+ * \param flags combination of DFS_IMAGE_READ, DFS_IMAGE_WRITE and DFS_IMAGE_CREATE
+ * \param imagepp pointer in which to return the image handle
+ * \return 0 on success or an error
+ */
+int dfs_image_open(const char * path, int flags, DFS_IMAGE ** imagepp) {
+  DFS_IMAGE * imagep;
+  const char * mode;
+  char * container_path;
+  struct stat st;
+  int saved_errno;
+  int num_of_sides = 1;
+  int side = 0;
+  int slot;
+  int ret;
+
+  if (path == NULL || imagepp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  /* A file named with a colon and digits is still opened as itself */
+  if (stat(path, &st) == -1 && errno == ENOENT && dfs_mmb_split_path(path, &container_path, &slot)) {
+    bool is_dsd = is_dsd_name(container_path);
+
+    if (is_dsd || is_mmb_file(container_path)) {
+      ret = is_dsd ?
+        dfs_image_open_side(container_path, slot, flags, imagepp) :
+        dfs_image_open_slot(container_path, slot, flags, imagepp);
+
+      saved_errno = errno;
+      free(container_path);
+      errno = saved_errno;
+
+      return ret;
+    }
+
+    free(container_path);
+  }
+
+  /* Double sided images are made by joining two single sided ones, so one
+     is never created here, which would truncate it */
+  if (is_dsd_name(path)) {
+    if (flags & DFS_IMAGE_CREATE) {
+      errno = EINVAL;
+      return DFS_ERROR_OPEN_FAILED;
+    }
+
+    num_of_sides = DFS_DSD_NUM_OF_SIDES;
+  }
+
+  if (flags & DFS_IMAGE_CREATE) {
+    mode = "wb+";
+  } else if (flags & DFS_IMAGE_WRITE) {
+    mode = "rb+";
+  } else {
+    mode = "rb";
+  }
+
+  imagep = (DFS_IMAGE *)calloc(1, sizeof(DFS_IMAGE));
+  dfs_stats_count(DFS_STATS_ALLOCS, 1);
+  if (imagep == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  imagep->flags = flags;
+  imagep->alloc_policy = DFS_ALLOC_FIRST_FIT;
+  dfs_geometry_init(&(imagep->geometry), 0, num_of_sides, side);
+  imagep->diskfile = fopen(path, mode);
+  if (imagep->diskfile == NULL) {
+    saved_errno = errno;
+    free(imagep);
+    errno = saved_errno;
+
+    return (saved_errno == ENOENT) ? DFS_ERROR_IMAGE_NOT_FOUND : DFS_ERROR_OPEN_FAILED;
+  }
+
+  init_image_io(imagep);
+
+  ret = map_image(imagep);
+  if (ret != DFS_ERROR_NONE) {
+    fclose(imagep->diskfile);
+    free(imagep);
+    return ret;
+  }
+
+  *imagepp = imagep;
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Opens one side of a double sided interleaved DFS disk image
+ *
+ * \param path the disk image file name
+ * \param side the side, 0 or 1
+ * \param flags combination of DFS_IMAGE_READ, DFS_IMAGE_WRITE and DFS_IMAGE_MMAP
+ * \param imagepp pointer in which to return the image handle
+ * \return 0 on success or an error
+ */
+int dfs_image_open_side(const char * path, int side, int flags, DFS_IMAGE ** imagepp) {
+  DFS_IMAGE * imagep;
+  int saved_errno;
+
+  if (path == NULL || imagepp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  if (side < 0 || side >= DFS_DSD_NUM_OF_SIDES || (flags & DFS_IMAGE_CREATE)) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Invalid side: %d", side);
+    errno = EINVAL;
+    return DFS_ERROR_FAILED;
+  }
+
+  imagep = (DFS_IMAGE *)calloc(1, sizeof(DFS_IMAGE));
+  dfs_stats_count(DFS_STATS_ALLOCS, 1);
+  if (imagep == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  imagep->flags = flags;
+  imagep->alloc_policy = DFS_ALLOC_FIRST_FIT;
+  dfs_geometry_init(&(imagep->geometry), 0, DFS_DSD_NUM_OF_SIDES, side);
+  imagep->diskfile = fopen(path, (flags & DFS_IMAGE_WRITE) ? "rb+" : "rb");
+  if (imagep->diskfile == NULL) {
+    saved_errno = errno;
+    free(imagep);
+    errno = saved_errno;
+
+    return (saved_errno == ENOENT) ? DFS_ERROR_IMAGE_NOT_FOUND : DFS_ERROR_OPEN_FAILED;
+  }
+
+  init_image_io(imagep);
+
+  /* Interleaved images are never mapped so there is nothing more to do */
+  *imagepp = imagep;
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Opens a DFS disk image held in a slot of an MMB file
+ *
+ * The slot is used in place.  The geometry, and the mapping of a mapped
+ * image, cover just the slot.
+ *
+ * \param path the MMB file name
+ * \param slot the slot number, from 0
+ * \param flags combination of DFS_IMAGE_READ, DFS_IMAGE_WRITE and DFS_IMAGE_MMAP
+ * \param imagepp pointer in which to return the image handle
+ * \return 0 on success or an error
+ */
+int dfs_image_open_slot(const char * path, int slot, int flags, DFS_IMAGE ** imagepp) {
+  DFS_IMAGE * imagep;
+  DFS_MMB_INDEX * mmbp;
+  int saved_errno;
+  int ret;
+
+  if (path == NULL || imagepp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  /* Slots are formatted in the MMB, not created */
+  if (flags & DFS_IMAGE_CREATE) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Cannot create an MMB slot");
+    errno = EINVAL;
+    return DFS_ERROR_FAILED;
+  }
+
+  imagep = (DFS_IMAGE *)calloc(1, sizeof(DFS_IMAGE));
+  mmbp = (DFS_MMB_INDEX *)malloc(sizeof(DFS_MMB_INDEX));
+  dfs_stats_count(DFS_STATS_ALLOCS, 2);
+  if (imagep == NULL || mmbp == NULL) {
+    free(imagep);
+    free(mmbp);
+    return DFS_ERROR_FAILED;
+  }
+
+  imagep->flags = flags;
+  imagep->alloc_policy = DFS_ALLOC_FIRST_FIT;
+  imagep->diskfile = fopen(path, (flags & DFS_IMAGE_WRITE) ? "rb+" : "rb");
+  if (imagep->diskfile == NULL) {
+    saved_errno = errno;
+    free(imagep);
+    free(mmbp);
+    errno = saved_errno;
+
+    return (saved_errno == ENOENT) ? DFS_ERROR_IMAGE_NOT_FOUND : DFS_ERROR_OPEN_FAILED;
+  }
+
+  init_image_io(imagep);
+
+  ret = dfs_mmb_read_index(imagep->diskfile, mmbp);
+  if (ret == DFS_ERROR_NONE && !dfs_mmb_slot_is_formatted(mmbp, slot)) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "No disk in MMB slot %d", slot);
+    ret = DFS_ERROR_INVALID_SLOT;
+  }
+
+  if (ret == DFS_ERROR_NONE && (flags & DFS_IMAGE_WRITE) && mmbp->slots[slot].status == DFS_MMB_STATUS_LOCKED) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "MMB slot %d is locked", slot);
+    ret = DFS_ERROR_READ_ONLY;
+  }
+
+  free(mmbp);
+
+  if (ret == DFS_ERROR_NONE) {
+    dfs_geometry_init(&(imagep->geometry), dfs_mmb_slot_offset(slot), 1, 0);
+    imagep->disk_size = DFS_MMB_SLOT_SIZE;
+
+    ret = map_image(imagep);
+  }
+
+  if (ret != DFS_ERROR_NONE) {
+    unmap_image(imagep);
+    fclose(imagep->diskfile);
+    free(imagep);
+    return ret;
+  }
+
+  *imagepp = imagep;
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Opens a DFS disk image through an I/O backend
+ *
+ * The image is a single sided disk starting at the start of the I/O.  It
+ * is never mapped.
+ *
+ * \param iop pointer to the I/O, which must outlive the image handle
+ * \param flags combination of DFS_IMAGE_READ, DFS_IMAGE_WRITE and DFS_IMAGE_CREATE
+ * \param imagepp pointer in which to return the image handle
+ * \return 0 on success or an error
+ */
+int dfs_image_open_io(DFS_IO * iop, int flags, DFS_IMAGE ** imagepp) {
+  DFS_IMAGE * imagep;
+
+  if (iop == NULL || imagepp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  imagep = (DFS_IMAGE *)calloc(1, sizeof(DFS_IMAGE));
+  dfs_stats_count(DFS_STATS_ALLOCS, 1);
+  if (imagep == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  imagep->flags = flags & ~DFS_IMAGE_MMAP;
+  imagep->alloc_policy = DFS_ALLOC_FIRST_FIT;
+  imagep->iop = iop;
+  dfs_geometry_init(&(imagep->geometry), 0, 1, 0);
+
+  *imagepp = imagep;
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Closes a DFS disk image and frees the handle
+ *
+ * \param imagep the image handle
+ * \return 0 on success or an error
+ */
+int dfs_image_close(DFS_IMAGE * imagep) {
+  int ret = DFS_ERROR_NONE;
+
+  if (imagep == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  invalidate_catalogue(imagep);
+  unmap_image(imagep);
+
+  if (imagep->diskfile != NULL && fclose(imagep->diskfile) != 0) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not close disk image: %s", strerror(errno));
+    ret = DFS_ERROR_FAILED;
+  }
+
+  free(imagep);
+  return ret;
+}
+
+/**
+ * \brief Sets how space is allocated for files added to an open DFS disk image
+ *
+ * \param imagep the image handle
+ * \param alloc_policy one of the DFS_ALLOC_ policies
+ * \return 0 on success or an error
+ */
+int dfs_image_set_alloc_policy(DFS_IMAGE * imagep, int alloc_policy) {
+  if (imagep == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  if (alloc_policy != DFS_ALLOC_FIRST_FIT && alloc_policy != DFS_ALLOC_BEST_FIT && alloc_policy != DFS_ALLOC_APPEND) {
+    return DFS_ERROR_FAILED;
+  }
+
+  imagep->alloc_policy = alloc_policy;
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Formats an open DFS disk image
+ *
+ * \param imagep the image handle
+ * \param num_of_sectors this should be 400 or 800 for 40 or 80 track disks
+ * \param name the disk name
+ * \return 0 on success or an error
+ */
+int dfs_image_format(DFS_IMAGE * imagep, int num_of_sectors, const char * name) {
+  int ret;
+
+  if (imagep == NULL || name == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  if (!(imagep->flags & (DFS_IMAGE_WRITE | DFS_IMAGE_CREATE))) {
+    return DFS_ERROR_READ_ONLY;
+  }
+
+  /* The MMB index would need updating too */
+  if (imagep->disk_size != 0) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Cannot format an MMB slot");
+    return DFS_ERROR_FAILED;
+  }
+
+  /* Format single sided images and join them with dfs_dsd_join() */
+  if (imagep->geometry.num_of_sides > 1) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Cannot format a double sided image");
+    return DFS_ERROR_FAILED;
+  }
+
+  invalidate_catalogue(imagep);
+
+  ret = dfs_format_io(imagep->iop, &(imagep->geometry), num_of_sectors, name);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  return map_image(imagep);
+}
+
+/**
+ * \brief Formats an open DFS disk image by cloning a template disk image
+ *
+ * \param imagep the image handle
+ * \param template_path the path of the template disk image
+ * \param name the disk name
+ * \return 0 on success or an error
+ */
+int dfs_image_format_from_template(DFS_IMAGE * imagep, const char * template_path, const char * name) {
+  FILE * template_file;
+  int ret;
+
+  if (imagep == NULL || template_path == NULL || name == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  if (!(imagep->flags & (DFS_IMAGE_WRITE | DFS_IMAGE_CREATE))) {
+    return DFS_ERROR_READ_ONLY;
+  }
+
+  if (imagep->disk_size != 0 || imagep->geometry.num_of_sides > 1 || imagep->diskfile == NULL) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Can only clone a template to a single sided image file");
+    return DFS_ERROR_FAILED;
+  }
+
+  template_file = fopen(template_path, "rb");
+  if (template_file == NULL) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not open template: %s (%s)", template_path, strerror(errno));
+    return (errno == ENOENT) ? DFS_ERROR_IMAGE_NOT_FOUND : DFS_ERROR_OPEN_FAILED;
+  }
+
+  invalidate_catalogue(imagep);
+  unmap_image(imagep);
+
+  ret = dfs_format_from_template(template_file, name, imagep->diskfile);
+  fclose(template_file);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  return map_image(imagep);
+}
+
+/**
+ * \brief Gets the catalogue of an open DFS disk image
+ *
+ * \param imagep the image handle
+ * \param acorn_dirpp pointer in which to return the acorn directory
+ * \return 0 on success or an error
+ */
+int dfs_image_get_catalogue(DFS_IMAGE * imagep, const ACORN_DIRECTORY ** acorn_dirpp) {
+  int ret;
+
+  if (imagep == NULL || acorn_dirpp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  if (imagep->acorn_dirp == NULL && imagep->map != NULL) {
+    if (imagep->map_size < 2 * DFS_SECTOR_SIZE) {
+      DEBUG_LOG(DEBUG_LEVEL_ERROR, "Disk image too small for a catalogue");
+      return DFS_ERROR_NOT_A_DFS_DISK;
+    }
+
+    ret = dfs_parse_catalogue(imagep->map, imagep->map + DFS_SECTOR_SIZE, &(imagep->acorn_dirp));
+    if (ret != DFS_ERROR_NONE) {
+      imagep->acorn_dirp = NULL;
+      return ret;
+    }
+
+    index_catalogue(imagep);
+  } else if (imagep->acorn_dirp == NULL) {
+    ret = dfs_read_catalogue_io(imagep->iop, &(imagep->geometry), &(imagep->acorn_dirp));
+    if (ret != DFS_ERROR_NONE) {
+      imagep->acorn_dirp = NULL;
+      return ret;
+    }
+
+    index_catalogue(imagep);
+  }
+
+  *acorn_dirpp = imagep->acorn_dirp;
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Gets the catalogue cycle number of an open DFS disk image
+ *
+ * \param imagep the image handle
+ * \param cycle_numberp pointer in which to return the cycle number
+ * \return 0 on success or an error
+ */
+int dfs_image_get_cycle_number(DFS_IMAGE * imagep, uint8_t * cycle_numberp) {
+  size_t offset = DFS_SECTOR_SIZE + offsetof(DFS_SECTOR_1, disk_name_1.cycle_number);
+  size_t count;
+  int ret;
+
+  if (imagep == NULL || cycle_numberp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  if (imagep->map != NULL) {
+    if (imagep->map_size <= offset) {
+      return DFS_ERROR_NOT_A_DFS_DISK;
+    }
+
+    *cycle_numberp = imagep->map[offset];
+    return DFS_ERROR_NONE;
+  }
+
+  /* Just the byte is read */
+  ret = dfs_io_read(imagep->iop, dfs_geometry_sector_offset(&(imagep->geometry), 1) + (off_t)(offset - DFS_SECTOR_SIZE), cycle_numberp, 1, &count);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  return (count == 1) ? DFS_ERROR_NONE : DFS_ERROR_NOT_A_DFS_DISK;
+}
+
+/**
+ * \brief Finds a file in the catalogue of an open DFS disk image
+ *
+ * Names are compared without regard to case, as DFS does, using an index
+ * built when the catalogue is read.
+ *
+ * \param imagep the image handle
+ * \param name the file name as listed in the catalogue
+ * \param acorn_filepp pointer in which to return the file meta data
+ * \return 0 on success or an error
+ */
+int dfs_image_find_file(DFS_IMAGE * imagep, const char * name, const ACORN_FILE ** acorn_filepp) {
+  const ACORN_DIRECTORY * acorn_dirp;
+  DFS_NAME_KEY key;
+  int index;
+  int ret;
+
+  if (name == NULL || acorn_filepp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  ret = dfs_image_get_catalogue(imagep, &acorn_dirp);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  if (dfs_name_key_from_string(name, &key) != DFS_ERROR_NONE ||
+      dfs_name_index_find(&(imagep->name_index), key, &index) != DFS_ERROR_NONE) {
+    return DFS_ERROR_FILE_NOT_FOUND;
+  }
+
+  *acorn_filepp = &(acorn_dirp->files[index]);
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Gets a view of a file's contents in a memory mapped DFS disk image
+ *
+ * \param imagep the image handle
+ * \param acorn_filep pointer to the file meta data
+ * \param datap pointer in which to return the start of the file's data
+ * \param lengthp pointer in which to return the length of the file's data
+ * \return 0 on success or an error
+ */
+int dfs_image_get_file_data(DFS_IMAGE * imagep, const ACORN_FILE * acorn_filep, const uint8_t ** datap, size_t * lengthp) {
+  size_t offset;
+
+  if (imagep == NULL || acorn_filep == NULL || datap == NULL || lengthp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  if (imagep->map == NULL) {
+    return DFS_ERROR_NOT_MAPPED;
+  }
+
+  offset = (size_t)acorn_filep->start_sector * DFS_SECTOR_SIZE;
+  if (offset > imagep->map_size || acorn_filep->length > imagep->map_size - offset) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "File extends beyond the disk image: %s", acorn_filep->name);
+    return DFS_ERROR_BAD_EXTENT;
+  }
+
+  *datap = imagep->map + offset;
+  *lengthp = acorn_filep->length;
+
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Reads a file's contents from an open DFS disk image into memory
+ *
+ * \param imagep the image handle
+ * \param acorn_filep pointer to the file meta data
+ * \param datap pointer in which to return the contents, which must be freed
+ * \return 0 on success or an error
+ */
+int dfs_image_read_file_data(DFS_IMAGE * imagep, const ACORN_FILE * acorn_filep, uint8_t ** datap) {
+  const uint8_t * data;
+  size_t length;
+  uint8_t * buffer;
+  int num_of_sectors;
+  int ret;
+
+  if (imagep == NULL || acorn_filep == NULL || datap == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  if (imagep->map != NULL) {
+    ret = dfs_image_get_file_data(imagep, acorn_filep, &data, &length);
+    if (ret != DFS_ERROR_NONE) {
+      return ret;
+    }
+
+    buffer = (uint8_t *)malloc(length + 1);
+    dfs_stats_count(DFS_STATS_ALLOCS, 1);
+    if (buffer == NULL) {
+      return DFS_ERROR_FAILED;
+    }
+
+    memcpy(buffer, data, length);
+    dfs_stats_count(DFS_STATS_SECTORS_READ, (length + DFS_SECTOR_SIZE - 1) / DFS_SECTOR_SIZE);
+    *datap = buffer;
+    return DFS_ERROR_NONE;
+  }
+
+  /* Whole sectors are read, which may be spread over the sides of the file */
+  num_of_sectors = (int)((acorn_filep->length + DFS_SECTOR_SIZE - 1) / DFS_SECTOR_SIZE);
+  buffer = (uint8_t *)malloc((size_t)num_of_sectors * DFS_SECTOR_SIZE + 1);
+  dfs_stats_count(DFS_STATS_ALLOCS, 1);
+  if (buffer == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  ret = dfs_io_read_sectors(imagep->iop, &(imagep->geometry), (int)acorn_filep->start_sector, num_of_sectors, buffer);
+  if (ret != DFS_ERROR_NONE) {
+    free(buffer);
+    return ret;
+  }
+
+  *datap = buffer;
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Extracts a file from an open DFS disk image
+ *
+ * \param imagep the image handle
+ * \param acorn_filep pointer to the file meta data
+ * \param file the local file reference
+ * \return 0 on success or an error
+ */
+int dfs_image_extract_file(DFS_IMAGE * imagep, const ACORN_FILE * acorn_filep, FILE * file) {
+  const uint8_t * data;
+  size_t length;
+  int ret;
+
+  if (imagep == NULL || acorn_filep == NULL || file == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  /* A mapped image can be range checked up front.  The copy itself is done
+     in the kernel rather than through the mapping */
+  if (imagep->map != NULL) {
+    ret = dfs_image_get_file_data(imagep, acorn_filep, &data, &length);
+    if (ret != DFS_ERROR_NONE) {
+      return ret;
+    }
+  }
+
+  return dfs_extract_file_io(imagep->iop, &(imagep->geometry), acorn_filep, file);
+}
+
+/**
+ * \brief Checks that a file's contents are all in an open DFS disk image
+ *
+ * \param imagep the image handle
+ * \param acorn_filep pointer to the file meta data
+ * \return 0 if the file is all there, DFS_ERROR_BAD_EXTENT if not, or an error
+ */
+int dfs_image_check_file(DFS_IMAGE * imagep, const ACORN_FILE * acorn_filep) {
+  const uint8_t * data;
+  size_t length;
+  int ret;
+
+  if (imagep == NULL || acorn_filep == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  /* A file must not run out of a disk inside a container */
+  if (imagep->map != NULL) {
+    ret = dfs_image_get_file_data(imagep, acorn_filep, &data, &length);
+    if (ret != DFS_ERROR_NONE) {
+      return ret;
+    }
+  }
+
+  return dfs_check_file_io(imagep->iop, &(imagep->geometry), acorn_filep);
+}
+
+/**
+ * \brief Extracts a number of files from an open DFS disk image
+ *
+ * \param imagep the image handle
+ * \param acorn_files array of pointers to the file meta data
+ * \param files array of local file references
+ * \param num_of_files the number of files to extract
+ * \return 0 on success or an error
+ */
+int dfs_image_extract_files(DFS_IMAGE * imagep, const ACORN_FILE ** acorn_files, FILE ** files, int num_of_files) {
+  const uint8_t * data;
+  size_t length;
+  int ret;
+
+  if (imagep == NULL || acorn_files == NULL || files == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  /* A file must not run out of a disk inside a container */
+  if (imagep->map != NULL) {
+    for (int i = 0; i < num_of_files; i++) {
+      ret = dfs_image_get_file_data(imagep, acorn_files[i], &data, &length);
+      if (ret != DFS_ERROR_NONE) {
+        return ret;
+      }
+    }
+  }
+
+  return dfs_extract_files_io(imagep->iop, &(imagep->geometry), acorn_files, files, num_of_files);
+}
+
+/**
+ * \brief Adds a file to an open DFS disk image
+ *
+ * \param imagep the image handle
+ * \param acorn_filep pointer to the file meta data
+ * \param file the local file reference
+ * \return 0 on success or an error
+ */
+int dfs_image_add_file(DFS_IMAGE * imagep, ACORN_FILE * acorn_filep, FILE * file) {
+  return dfs_image_add_files(imagep, acorn_filep, &file, 1);
+}
+
+/**
+ * \brief Adds a number of files to an open DFS disk image
+ *
+ * \param imagep the image handle
+ * \param acorn_files array of file meta data, the start sectors are filled in
+ * \param files array of local file references
+ * \param num_of_files the number of files to add
+ * \return 0 on success or an error
+ */
+int dfs_image_add_files(DFS_IMAGE * imagep, ACORN_FILE * acorn_files, FILE ** files, int num_of_files) {
+  int ret;
+
+  if (imagep == NULL || acorn_files == NULL || files == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  ret = begin_update(imagep);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  ret = dfs_add_files_io(imagep->iop, &(imagep->geometry), acorn_files, files, num_of_files, imagep->alloc_policy);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  return end_update(imagep);
+}
+
+/**
+ * \brief Compacts an open DFS disk image
+ *
+ * \param imagep the image handle
+ * \param statsp pointer in which to return what was moved, may be NULL
+ * \return 0 on success or an error
+ */
+int dfs_image_compact(DFS_IMAGE * imagep, DFS_COMPACT_STATS * statsp) {
+  int ret;
+
+  if (imagep == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  ret = begin_update(imagep);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  ret = dfs_compact_io(imagep->iop, &(imagep->geometry), statsp);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  return end_update(imagep);
+}
+
+/**
+ * \brief Removes files from an open DFS disk image
+ *
+ * \param imagep the image handle
+ * \param names array of the names of the files to remove
+ * \param num_of_names the number of names
+ * \return 0 on success or an error
+ */
+int dfs_image_remove_files(DFS_IMAGE * imagep, const char ** names, int num_of_names) {
+  int ret;
+
+  if (imagep == NULL || names == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  ret = begin_update(imagep);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  ret = dfs_remove_files_io(imagep->iop, &(imagep->geometry), names, num_of_names);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  return end_update(imagep);
+}
+
+/**
+ * \brief Updates the meta data of a file in an open DFS disk image
+ *
+ * \param imagep the image handle
+ * \param acorn_filep pointer to the file name and new meta data
+ * \return 0 on success or an error
+ */
+int dfs_image_update_file(DFS_IMAGE * imagep, const ACORN_FILE * acorn_filep) {
+  int ret;
+
+  if (imagep == NULL || acorn_filep == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  ret = begin_update(imagep);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  ret = dfs_update_file_io(imagep->iop, &(imagep->geometry), acorn_filep);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  return end_update(imagep);
+}
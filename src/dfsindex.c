@@ -0,0 +1,198 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "dfs.h"
+#include "dfsindex.h"
+#include "debug.h"
+
+/* log2 of DFS_NAME_INDEX_SIZE */
+#define DFS_NAME_INDEX_BITS 6
+
+/* DFS compares names without regard to case */
+static uint8_t fold_case(uint8_t ch) {
+  return (ch >= 'a' && ch <= 'z') ? (uint8_t)(ch - 'a' + 'A') : ch;
+}
+
+static DFS_NAME_KEY pack_key(const uint8_t * name, size_t name_len, uint8_t directory) {
+  DFS_NAME_KEY key = 0;
+
+  /* Short names are padded with spaces as in the catalogue */
+  for (size_t i = 0; i < DFS_MAX_FILE_NAME_LEN; i++) {
+    uint8_t ch = (i < name_len) ? fold_case(name[i]) : ' ';
+    key |= (DFS_NAME_KEY)ch << (8 * i);
+  }
+
+  key |= (DFS_NAME_KEY)fold_case(directory & DFS_DIR_NAME_MASK) << (8 * DFS_MAX_FILE_NAME_LEN);
+
+  return key;
+}
+
+/* Fibonacci hashing of the key down to a slot */
+static int key_slot(DFS_NAME_KEY key) {
+  return (int)((key * UINT64_C(0x9e3779b97f4a7c15)) >> (64 - DFS_NAME_INDEX_BITS));
+}
+
+/**
+ * \brief Gets the key of a catalogue file name
+ *
+ * \param filenamep pointer to the catalogue file name
+ * \return the key
+ */
+DFS_NAME_KEY dfs_name_key(const DFS_FILE_NAME * filenamep) {
+  size_t name_len = DFS_MAX_FILE_NAME_LEN;
+
+  /* Names on the disk are space padded but may also be zero padded */
+  while (name_len > 0 &&
+         (filenamep->filename[name_len - 1] == ' ' || filenamep->filename[name_len - 1] == '\0')) {
+    name_len--;
+  }
+
+  return pack_key((const uint8_t *)filenamep->filename, name_len, (uint8_t)filenamep->directory);
+}
+
+/**
+ * \brief Gets the key of a host file name
+ *
+ * \param file_name the file name
+ * \param keyp pointer in which to return the key
+ * \return 0 on success or an error
+ */
+int dfs_name_key_from_string(const char * file_name, DFS_NAME_KEY * keyp) {
+  const char * separator;
+  size_t name_len;
+  uint8_t directory = '$';
+
+  if (file_name == NULL || keyp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  separator = strchr(file_name, '.');
+  if (separator != NULL) {
+    if (strlen(separator + 1) > DFS_MAX_DIR_NAME_LEN) {
+      return DFS_ERROR_INVALID_FILE_NAME;
+    }
+
+    if (separator[1]) {
+      directory = (uint8_t)separator[1];
+    }
+
+    name_len = (size_t)(separator - file_name);
+  } else {
+    name_len = strlen(file_name);
+  }
+
+  if (name_len == 0 || name_len > DFS_MAX_FILE_NAME_LEN) {
+    return DFS_ERROR_INVALID_FILE_NAME;
+  }
+
+  *keyp = pack_key((const uint8_t *)file_name, name_len, directory);
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Empties a name index
+ *
+ * \param indexp pointer to the index
+ */
+void dfs_name_index_init(DFS_NAME_INDEX * indexp) {
+  memset(indexp->entries, 0, sizeof(indexp->entries));
+}
+
+/**
+ * \brief Adds a name to a name index
+ *
+ * \param indexp pointer to the index
+ * \param key the key of the name
+ * \param entry the catalogue index of the file
+ * \return 0 on success or an error
+ */
+int dfs_name_index_insert(DFS_NAME_INDEX * indexp, DFS_NAME_KEY key, int entry) {
+  int slot = key_slot(key);
+
+  if (entry < 0 || entry >= DFS_NAME_INDEX_SIZE / 2) {
+    return DFS_ERROR_FAILED;
+  }
+
+  /* Linear probing.  The table is never more than half full so this ends */
+  while (indexp->entries[slot] != 0) {
+    if (indexp->keys[slot] == key) {
+      return DFS_ERROR_FILE_EXISTS;
+    }
+
+    slot = (slot + 1) & (DFS_NAME_INDEX_SIZE - 1);
+  }
+
+  indexp->keys[slot] = key;
+  indexp->entries[slot] = (int8_t)(entry + 1);
+
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Looks up a name in a name index
+ *
+ * \param indexp pointer to the index
+ * \param key the key of the name
+ * \param entryp pointer in which to return the catalogue index of the file
+ * \return 0 on success or an error
+ */
+int dfs_name_index_find(const DFS_NAME_INDEX * indexp, DFS_NAME_KEY key, int * entryp) {
+  int slot = key_slot(key);
+
+  while (indexp->entries[slot] != 0) {
+    if (indexp->keys[slot] == key) {
+      *entryp = indexp->entries[slot] - 1;
+      return DFS_ERROR_NONE;
+    }
+
+    slot = (slot + 1) & (DFS_NAME_INDEX_SIZE - 1);
+  }
+
+  return DFS_ERROR_FILE_NOT_FOUND;
+}
+
+/**
+ * \brief Builds a name index over the names in a catalogue
+ *
+ * \param indexp pointer to the index
+ * \param filenames the catalogue file names
+ * \param num_of_files the number of files in the catalogue
+ * \return 0 on success or an error
+ */
+int dfs_name_index_build(DFS_NAME_INDEX * indexp, const DFS_FILE_NAME * filenames, int num_of_files) {
+  dfs_name_index_init(indexp);
+
+  for (int i = 0; i < num_of_files; i++) {
+    int ret = dfs_name_index_insert(indexp, dfs_name_key(&(filenames[i])), i);
+
+    /* Keep the first of any duplicates, as a lookup on the disk would */
+    if (ret != DFS_ERROR_NONE && ret != DFS_ERROR_FILE_EXISTS) {
+      return ret;
+    }
+  }
+
+  return DFS_ERROR_NONE;
+}
@@ -0,0 +1,445 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "dfs.h"
+#include "dfscopy.h"
+#include "dfserr.h"
+#include "dfsio.h"
+#include "dfsstats.h"
+#include "debug.h"
+
+/* Copies between an image and a local file without a descriptor on both
+   sides go through a buffer of this size */
+#define DFS_IO_BUFFER_SIZE (64 * 1024)
+
+static ssize_t fd_read(DFS_IO * iop, void * buffer, size_t length, off_t offset) {
+  ssize_t count = pread(iop->fd, buffer, length, offset);
+
+  dfs_stats_count_read((count > 0) ? (uint64_t)count : 0);
+  return count;
+}
+
+static ssize_t fd_write(DFS_IO * iop, const void * buffer, size_t length, off_t offset) {
+  ssize_t count = pwrite(iop->fd, buffer, length, offset);
+
+  dfs_stats_count_write((count > 0) ? (uint64_t)count : 0);
+  return count;
+}
+
+static int fd_get_size(DFS_IO * iop, off_t * sizep) {
+  struct stat st;
+
+  dfs_stats_count(DFS_STATS_SYSCALLS, 1);
+  if (fstat(iop->fd, &st) == -1) {
+    return -1;
+  }
+
+  *sizep = st.st_size;
+  return 0;
+}
+
+static int fd_set_size(DFS_IO * iop, off_t size) {
+  dfs_stats_count(DFS_STATS_SYSCALLS, 1);
+  return ftruncate(iop->fd, size);
+}
+
+static const DFS_IO_OPS fd_ops = { fd_read, fd_write, fd_get_size, fd_set_size };
+
+static ssize_t memory_read(DFS_IO * iop, void * buffer, size_t length, off_t offset) {
+  if (offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if ((size_t)offset >= iop->size) {
+    return 0;
+  }
+
+  if (length > iop->size - (size_t)offset) {
+    length = iop->size - (size_t)offset;
+  }
+
+  memcpy(buffer, iop->data + offset, length);
+  return (ssize_t)length;
+}
+
+static int memory_set_size(DFS_IO * iop, off_t size) {
+  if (size < 0 || (size_t)size > iop->capacity) {
+    errno = (size < 0) ? EINVAL : ENOSPC;
+    return -1;
+  }
+
+  if ((size_t)size > iop->size) {
+    memset(iop->data + iop->size, 0, (size_t)size - iop->size);
+  }
+
+  iop->size = (size_t)size;
+  return 0;
+}
+
+static ssize_t memory_write(DFS_IO * iop, const void * buffer, size_t length, off_t offset) {
+  if (offset < 0 || (size_t)offset > iop->capacity || length > iop->capacity - (size_t)offset) {
+    errno = (offset < 0) ? EINVAL : ENOSPC;
+    return -1;
+  }
+
+  /* Writing past the end leaves a gap of zeros, as a file would */
+  if ((size_t)offset + length > iop->size) {
+    memory_set_size(iop, (off_t)((size_t)offset + length));
+  }
+
+  memcpy(iop->data + offset, buffer, length);
+  return (ssize_t)length;
+}
+
+static int memory_get_size(DFS_IO * iop, off_t * sizep) {
+  *sizep = (off_t)iop->size;
+  return 0;
+}
+
+static const DFS_IO_OPS memory_ops = { memory_read, memory_write, memory_get_size, memory_set_size };
+
+/**
+ * \brief Sets up I/O on a file descriptor
+ *
+ * \param iop pointer to the I/O
+ * \param fd the file descriptor
+ */
+void dfs_io_init_fd(DFS_IO * iop, int fd) {
+  memset(iop, 0, sizeof(DFS_IO));
+  iop->opsp = &fd_ops;
+  iop->fd = fd;
+}
+
+/**
+ * \brief Sets up I/O on a memory buffer
+ *
+ * \param iop pointer to the I/O
+ * \param data the buffer
+ * \param size the size of the image in the buffer
+ * \param capacity the size of the buffer
+ */
+void dfs_io_init_memory(DFS_IO * iop, uint8_t * data, size_t size, size_t capacity) {
+  memset(iop, 0, sizeof(DFS_IO));
+  iop->opsp = &memory_ops;
+  iop->fd = -1;
+  iop->data = data;
+  iop->size = size;
+  iop->capacity = (capacity > size) ? capacity : size;
+}
+
+/**
+ * \brief Sets up I/O on another backend
+ *
+ * \param iop pointer to the I/O
+ * \param opsp the backend's calls
+ * \param context passed to the backend's calls in iop->context
+ */
+void dfs_io_init(DFS_IO * iop, const DFS_IO_OPS * opsp, void * context) {
+  memset(iop, 0, sizeof(DFS_IO));
+  iop->opsp = opsp;
+  iop->fd = -1;
+  iop->context = context;
+}
+
+/**
+ * \brief Reads from an image, stopping early only at its end
+ *
+ * \param iop pointer to the I/O
+ * \param offset where to read from
+ * \param buffer where to put the data
+ * \param length the number of bytes wanted
+ * \param countp pointer in which to return the number of bytes read
+ * \return 0 on success or an error
+ */
+int dfs_io_read(DFS_IO * iop, off_t offset, void * buffer, size_t length, size_t * countp) {
+  size_t done = 0;
+
+  while (done < length) {
+    ssize_t count = iop->opsp->read(iop, (uint8_t *)buffer + done, length - done, offset + (off_t)done);
+
+    if (count == -1 && errno == EINTR) {
+      continue;
+    }
+
+    if (count < 0) {
+      DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not read disk image: %s", strerror(errno));
+      return DFS_ERROR_FAILED;
+    }
+
+    if (count == 0) {
+      break;
+    }
+
+    done += (size_t)count;
+  }
+
+  *countp = done;
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Writes all of a buffer to an image
+ *
+ * \param iop pointer to the I/O
+ * \param offset where to write to
+ * \param buffer the data
+ * \param length the number of bytes
+ * \return 0 on success or an error
+ */
+int dfs_io_write(DFS_IO * iop, off_t offset, const void * buffer, size_t length) {
+  size_t done = 0;
+
+  while (done < length) {
+    ssize_t count = iop->opsp->write(iop, (const uint8_t *)buffer + done, length - done, offset + (off_t)done);
+
+    if (count == -1 && errno == EINTR) {
+      continue;
+    }
+
+    if (count <= 0) {
+      DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not write disk image: %s", (count < 0) ? strerror(errno) : "no space");
+      return DFS_ERROR_FAILED;
+    }
+
+    done += (size_t)count;
+  }
+
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Gets the size of an image
+ *
+ * \param iop pointer to the I/O
+ * \param sizep pointer in which to return the size
+ * \return 0 on success or an error
+ */
+int dfs_io_get_size(DFS_IO * iop, off_t * sizep) {
+  if (iop->opsp->get_size(iop, sizep) == -1) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not get disk image size: %s", strerror(errno));
+    return DFS_ERROR_FAILED;
+  }
+
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Cuts back or extends an image, new space reading as zeros
+ *
+ * \param iop pointer to the I/O
+ * \param size the new size
+ * \return 0 on success or an error
+ */
+int dfs_io_set_size(DFS_IO * iop, off_t size) {
+  if (iop->opsp->set_size == NULL) {
+    errno = ENOTSUP;
+    return DFS_ERROR_FAILED;
+  }
+
+  if (iop->opsp->set_size(iop, size) == -1) {
+    return DFS_ERROR_FAILED;
+  }
+
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Reads sectors of a disk
+ *
+ * \param iop pointer to the I/O
+ * \param geometryp pointer to the geometry
+ * \param sector the first logical sector
+ * \param num_of_sectors the number of sectors
+ * \param buffer where to put the sectors
+ * \return 0 on success or an error
+ */
+int dfs_io_read_sectors(DFS_IO * iop, const DFS_GEOMETRY * geometryp, int sector, int num_of_sectors, uint8_t * buffer) {
+  while (num_of_sectors > 0) {
+    int run = dfs_geometry_run_length(geometryp, sector, num_of_sectors);
+    size_t length = (size_t)run * DFS_SECTOR_SIZE;
+    size_t count;
+
+    if (dfs_io_read(iop, dfs_geometry_sector_offset(geometryp, sector), buffer, length, &count) != DFS_ERROR_NONE) {
+      return DFS_ERROR_FAILED;
+    }
+
+    if (count < length) {
+      memset(buffer + count, 0, length - count);
+    }
+
+    dfs_stats_count(DFS_STATS_SECTORS_READ, (uint64_t)run);
+    buffer += length;
+    sector += run;
+    num_of_sectors -= run;
+  }
+
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Writes sectors of a disk
+ *
+ * \param iop pointer to the I/O
+ * \param geometryp pointer to the geometry
+ * \param sector the first logical sector
+ * \param num_of_sectors the number of sectors
+ * \param buffer the sectors
+ * \return 0 on success or an error
+ */
+int dfs_io_write_sectors(DFS_IO * iop, const DFS_GEOMETRY * geometryp, int sector, int num_of_sectors, const uint8_t * buffer) {
+  while (num_of_sectors > 0) {
+    int run = dfs_geometry_run_length(geometryp, sector, num_of_sectors);
+    size_t length = (size_t)run * DFS_SECTOR_SIZE;
+
+    if (dfs_io_write(iop, dfs_geometry_sector_offset(geometryp, sector), buffer, length) != DFS_ERROR_NONE) {
+      return DFS_ERROR_FAILED;
+    }
+
+    dfs_stats_count(DFS_STATS_SECTORS_WRITTEN, (uint64_t)run);
+    buffer += length;
+    sector += run;
+    num_of_sectors -= run;
+  }
+
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Copies data from an image to the current position of a local file
+ *
+ * \param iop pointer to the I/O
+ * \param offset where the data is in the image
+ * \param length the number of bytes
+ * \param file the local file reference
+ * \return 0 on success or an error
+ */
+int dfs_io_copy_to_file(DFS_IO * iop, off_t offset, size_t length, FILE * file) {
+  uint8_t * buffer;
+  int ret = DFS_ERROR_NONE;
+
+  /* A memory image is already in memory */
+  if (iop->opsp == &memory_ops) {
+    if (offset < 0 || (size_t)offset > iop->size || length > iop->size - (size_t)offset) {
+      return DFS_ERROR_BAD_EXTENT;
+    }
+
+    return (fwrite(iop->data + offset, 1, length, file) == length) ? DFS_ERROR_NONE : DFS_ERROR_FAILED;
+  }
+
+  if (iop->fd != -1) {
+    /* The copy goes straight to the descriptor so anything buffered must go first */
+    if (fflush(file) != 0) {
+      DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not write target file: %s", strerror(errno));
+      return DFS_ERROR_FAILED;
+    }
+
+    ret = dfs_copy_range(iop->fd, offset, fileno(file), DFS_COPY_CURRENT_OFFSET, length);
+
+    /* Resynchronise the stream with the descriptor, which fails harmlessly for pipes */
+    fseeko(file, 0, SEEK_CUR);
+    dfs_stats_count(DFS_STATS_SEEKS, 1);
+    return ret;
+  }
+
+  buffer = (uint8_t *)malloc((length < DFS_IO_BUFFER_SIZE) ? length + 1 : DFS_IO_BUFFER_SIZE);
+  dfs_stats_count(DFS_STATS_ALLOCS, 1);
+  if (buffer == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  while (length > 0 && ret == DFS_ERROR_NONE) {
+    size_t chunk = (length < DFS_IO_BUFFER_SIZE) ? length : DFS_IO_BUFFER_SIZE;
+    size_t count;
+
+    ret = dfs_io_read(iop, offset, buffer, chunk, &count);
+    if (ret == DFS_ERROR_NONE && count < chunk) {
+      ret = DFS_ERROR_BAD_EXTENT;
+    } else if (ret == DFS_ERROR_NONE && fwrite(buffer, 1, chunk, file) != chunk) {
+      DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not write target file: %s", strerror(errno));
+      ret = DFS_ERROR_FAILED;
+    }
+
+    offset += (off_t)chunk;
+    length -= chunk;
+  }
+
+  free(buffer);
+  return ret;
+}
+
+/**
+ * \brief Copies data from a local file into an image
+ *
+ * \param iop pointer to the I/O
+ * \param offset where the data goes in the image
+ * \param file the local file reference
+ * \param file_offset where the data is in the local file
+ * \param length the number of bytes
+ * \return 0 on success or an error
+ */
+int dfs_io_copy_from_file(DFS_IO * iop, off_t offset, FILE * file, off_t file_offset, size_t length) {
+  uint8_t * buffer;
+  int ret = DFS_ERROR_NONE;
+
+  if (iop->fd != -1) {
+    return dfs_copy_range(fileno(file), file_offset, iop->fd, offset, length);
+  }
+
+  buffer = (uint8_t *)malloc((length < DFS_IO_BUFFER_SIZE) ? length + 1 : DFS_IO_BUFFER_SIZE);
+  dfs_stats_count(DFS_STATS_ALLOCS, 1);
+  if (buffer == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  while (length > 0 && ret == DFS_ERROR_NONE) {
+    size_t chunk = (length < DFS_IO_BUFFER_SIZE) ? length : DFS_IO_BUFFER_SIZE;
+    ssize_t count = pread(fileno(file), buffer, chunk, file_offset);
+
+    dfs_stats_count_read((count > 0) ? (uint64_t)count : 0);
+    if (count == -1 && errno == EINTR) {
+      continue;
+    }
+
+    if (count <= 0) {
+      DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not read local file: %s", (count < 0) ? strerror(errno) : "too short");
+      ret = DFS_ERROR_FAILED;
+      break;
+    }
+
+    ret = dfs_io_write(iop, offset, buffer, (size_t)count);
+    offset += count;
+    file_offset += count;
+    length -= (size_t)count;
+  }
+
+  free(buffer);
+  return ret;
+}
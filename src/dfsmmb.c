@@ -0,0 +1,431 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "acornfs.h"
+#include "dfs.h"
+#include "dfsmmb.h"
+#include "dfsstats.h"
+#include "debug.h"
+
+/* Offset of the status byte within an index entry */
+#define DFS_MMB_STATUS_OFFSET 15
+
+struct _tag_DFS_MMB {
+  FILE * mmbfile;
+  const uint8_t * map;
+  size_t map_size;
+  DFS_MMB_INDEX index;
+};
+
+/**
+ * \brief Decodes an MMB index
+ *
+ * The first entry of the index is a header holding the slot in each drive
+ * at power on.  It is followed by one entry per slot.
+ *
+ * \param index pointer to the DFS_MMB_INDEX_SIZE bytes of the index
+ * \param file_size the size of the MMB file, used to tell which slots exist
+ * \param mmbp pointer to the index to fill in
+ * \return 0 on success or an error
+ */
+int dfs_mmb_parse_index(const uint8_t * index, off_t file_size, DFS_MMB_INDEX * mmbp) {
+  off_t num_of_slots;
+
+  if (index == NULL || mmbp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  if (file_size < DFS_MMB_INDEX_SIZE) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Too small for an MMB index");
+    return DFS_ERROR_NOT_AN_MMB;
+  }
+
+  /* Boot slots are split into low bytes then high bytes */
+  for (int d = 0; d < DFS_MMB_BOOT_DRIVES; d++) {
+    mmbp->boot_slots[d] = (uint16_t)(index[d] + (index[d + DFS_MMB_BOOT_DRIVES] * 0x100));
+  }
+
+  for (int i = 0; i < DFS_MMB_MAX_SLOTS; i++) {
+    const uint8_t * entryp = index + ((size_t)(i + 1) * DFS_MMB_ENTRY_SIZE);
+    DFS_MMB_SLOT * slotp = &(mmbp->slots[i]);
+
+    slotp->status = entryp[DFS_MMB_STATUS_OFFSET];
+    if (slotp->status != DFS_MMB_STATUS_LOCKED && slotp->status != DFS_MMB_STATUS_UNLOCKED &&
+        slotp->status != DFS_MMB_STATUS_UNFORMATTED && slotp->status != DFS_MMB_STATUS_INVALID) {
+      DEBUG_LOG(DEBUG_LEVEL_ERROR, "Invalid status 0x%02x for MMB slot %d", slotp->status, i);
+      return DFS_ERROR_NOT_AN_MMB;
+    }
+
+    /* Titles are padded with spaces or zeros */
+    memcpy(slotp->title, entryp, DFS_MMB_TITLE_LEN);
+    slotp->title[DFS_MMB_TITLE_LEN] = '\0';
+    for (int c = DFS_MMB_TITLE_LEN - 1; c >= 0 && (slotp->title[c] == ' ' || slotp->title[c] == '\0'); c--) {
+      slotp->title[c] = '\0';
+    }
+  }
+
+  /* A file cut short holds only the slots that are wholly present */
+  num_of_slots = (file_size - DFS_MMB_INDEX_SIZE) / DFS_MMB_SLOT_SIZE;
+  mmbp->num_of_slots = (num_of_slots > DFS_MMB_MAX_SLOTS) ? DFS_MMB_MAX_SLOTS : (int)num_of_slots;
+
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Reads the index of an MMB file
+ *
+ * \param mmbfile the MMB file reference
+ * \param mmbp pointer to the index to fill in
+ * \return 0 on success or an error
+ */
+int dfs_mmb_read_index(FILE * mmbfile, DFS_MMB_INDEX * mmbp) {
+  uint8_t index[DFS_MMB_INDEX_SIZE];
+  struct stat st;
+  ssize_t count;
+
+  if (mmbfile == NULL || mmbp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  if (fstat(fileno(mmbfile), &st) == -1) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not stat MMB file: %s", strerror(errno));
+    return DFS_ERROR_FAILED;
+  }
+
+  count = pread(fileno(mmbfile), index, sizeof(index), 0);
+  dfs_stats_count_read((count > 0) ? (uint64_t)count : 0);
+  if (count != (ssize_t)sizeof(index)) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not read MMB index");
+    return DFS_ERROR_NOT_AN_MMB;
+  }
+
+  return dfs_mmb_parse_index(index, st.st_size, mmbp);
+}
+
+/**
+ * \brief Gets the position of a slot in an MMB file
+ *
+ * \param slot the slot number, from 0
+ * \return the offset of the slot's first sector
+ */
+off_t dfs_mmb_slot_offset(int slot) {
+  return DFS_MMB_INDEX_SIZE + ((off_t)slot * DFS_MMB_SLOT_SIZE);
+}
+
+/**
+ * \brief Checks whether a slot of an MMB file holds a disk
+ *
+ * \param mmbp pointer to the index
+ * \param slot the slot number
+ * \return true if the slot exists and is formatted
+ */
+bool dfs_mmb_slot_is_formatted(const DFS_MMB_INDEX * mmbp, int slot) {
+  if (slot < 0 || slot >= mmbp->num_of_slots) {
+    return false;
+  }
+
+  return
+    mmbp->slots[slot].status == DFS_MMB_STATUS_LOCKED ||
+    mmbp->slots[slot].status == DFS_MMB_STATUS_UNLOCKED;
+}
+
+/**
+ * \brief Splits a path of the form file.mmb:slot
+ *
+ * \param path the path
+ * \param container_pathp pointer in which to return the container path,
+ *        which must be freed
+ * \param slotp pointer in which to return the slot number
+ * \return true if the path names a slot
+ */
+bool dfs_mmb_split_path(const char * path, char ** container_pathp, int * slotp) {
+  const char * separator = strrchr(path, ':');
+  char * endptr;
+  long slot;
+
+  if (separator == NULL || separator == path || separator[1] == '\0') {
+    return false;
+  }
+
+  /* Slot numbers are only digits.  Whether the slot exists is checked on open */
+  if (separator[1] < '0' || separator[1] > '9') {
+    return false;
+  }
+
+  errno = 0;
+  slot = strtol(separator + 1, &endptr, 10);
+  if (*endptr || errno == ERANGE || slot > INT_MAX) {
+    return false;
+  }
+
+  *container_pathp = strndup(path, (size_t)(separator - path));
+  if (*container_pathp == NULL) {
+    return false;
+  }
+
+  *slotp = (int)slot;
+  return true;
+}
+
+/**
+ * \brief Opens an MMB file for reading
+ *
+ * \param path the MMB file name
+ * \param mmbpp pointer in which to return the MMB handle
+ * \return 0 on success or an error
+ */
+int dfs_mmb_open(const char * path, DFS_MMB ** mmbpp) {
+  DFS_MMB * mmbp;
+  struct stat st;
+  void * map;
+  int saved_errno;
+  int ret;
+
+  if (path == NULL || mmbpp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  mmbp = (DFS_MMB *)calloc(1, sizeof(DFS_MMB));
+  dfs_stats_count(DFS_STATS_ALLOCS, 1);
+  if (mmbp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  mmbp->mmbfile = fopen(path, "rb");
+  if (mmbp->mmbfile == NULL) {
+    saved_errno = errno;
+    free(mmbp);
+    errno = saved_errno;
+
+    return (saved_errno == ENOENT) ? DFS_ERROR_IMAGE_NOT_FOUND : DFS_ERROR_OPEN_FAILED;
+  }
+
+  if (fstat(fileno(mmbp->mmbfile), &st) == -1 || st.st_size < DFS_MMB_INDEX_SIZE) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Not an MMB file: %s", path);
+    fclose(mmbp->mmbfile);
+    free(mmbp);
+    return DFS_ERROR_NOT_AN_MMB;
+  }
+
+  map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fileno(mmbp->mmbfile), 0);
+  dfs_stats_count(DFS_STATS_SYSCALLS, 1);
+  if (map == MAP_FAILED) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not map MMB file: %s", strerror(errno));
+    fclose(mmbp->mmbfile);
+    free(mmbp);
+    return DFS_ERROR_FAILED;
+  }
+
+  mmbp->map = (const uint8_t *)map;
+  mmbp->map_size = (size_t)st.st_size;
+
+  /* Slots are worked through in order so ask for aggressive read ahead */
+  posix_fadvise(fileno(mmbp->mmbfile), 0, 0, POSIX_FADV_SEQUENTIAL);
+  madvise(map, mmbp->map_size, MADV_SEQUENTIAL);
+
+  ret = dfs_mmb_parse_index(mmbp->map, st.st_size, &(mmbp->index));
+  if (ret != DFS_ERROR_NONE) {
+    dfs_mmb_close(mmbp);
+    return ret;
+  }
+
+  *mmbpp = mmbp;
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Closes an MMB file and frees the handle
+ *
+ * \param mmbp the MMB handle
+ * \return 0 on success or an error
+ */
+int dfs_mmb_close(DFS_MMB * mmbp) {
+  int ret = DFS_ERROR_NONE;
+
+  if (mmbp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  munmap((void *)mmbp->map, mmbp->map_size);
+
+  if (fclose(mmbp->mmbfile) != 0) {
+    ret = DFS_ERROR_FAILED;
+  }
+
+  free(mmbp);
+  return ret;
+}
+
+/**
+ * \brief Gets the index of an open MMB file
+ *
+ * \param mmbp the MMB handle
+ * \return the index, owned by the handle
+ */
+const DFS_MMB_INDEX * dfs_mmb_get_index(const DFS_MMB * mmbp) {
+  return &(mmbp->index);
+}
+
+/**
+ * \brief Decodes the catalogue of a slot of an open MMB file
+ *
+ * \param mmbp the MMB handle
+ * \param slot the slot number
+ * \param acorn_dirpp pointer in which to return the acorn directory
+ * \return 0 on success or an error
+ */
+int dfs_mmb_get_catalogue(const DFS_MMB * mmbp, int slot, ACORN_DIRECTORY ** acorn_dirpp) {
+  const uint8_t * diskp;
+
+  if (mmbp == NULL || acorn_dirpp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  if (!dfs_mmb_slot_is_formatted(&(mmbp->index), slot)) {
+    return DFS_ERROR_INVALID_SLOT;
+  }
+
+  diskp = mmbp->map + dfs_mmb_slot_offset(slot);
+
+  return dfs_parse_catalogue(diskp, diskp + DFS_SECTOR_SIZE, acorn_dirpp);
+}
+
+/* A file must not run out of its slot into the next */
+static int check_slot_extent(int slot, const ACORN_FILE * acorn_filep) {
+  size_t offset = (size_t)acorn_filep->start_sector * DFS_SECTOR_SIZE;
+
+  if (offset > DFS_MMB_SLOT_SIZE || acorn_filep->length > DFS_MMB_SLOT_SIZE - offset) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "File extends beyond MMB slot %d: %s", slot, acorn_filep->name);
+    return DFS_ERROR_BAD_EXTENT;
+  }
+
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Checks that a file's contents are all in a slot of an open MMB file
+ *
+ * \param mmbp the MMB handle
+ * \param slot the slot number
+ * \param acorn_filep pointer to the file meta data
+ * \return 0 if the file is all there, DFS_ERROR_BAD_EXTENT if not, or an error
+ */
+int dfs_mmb_check_file(const DFS_MMB * mmbp, int slot, const ACORN_FILE * acorn_filep) {
+  DFS_GEOMETRY geometry;
+  DFS_IO io;
+  int ret;
+
+  if (mmbp == NULL || acorn_filep == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  if (!dfs_mmb_slot_is_formatted(&(mmbp->index), slot)) {
+    return DFS_ERROR_INVALID_SLOT;
+  }
+
+  ret = check_slot_extent(slot, acorn_filep);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  /* The file may be cut short within the slot */
+  dfs_geometry_init(&geometry, dfs_mmb_slot_offset(slot), 1, 0);
+  dfs_io_init_fd(&io, fileno(mmbp->mmbfile));
+
+  return dfs_check_file_io(&io, &geometry, acorn_filep);
+}
+
+/**
+ * \brief Extracts a file from a slot of an open MMB file
+ *
+ * \param mmbp the MMB handle
+ * \param slot the slot number
+ * \param acorn_filep pointer to the file meta data
+ * \param file the local file reference
+ * \return 0 on success or an error
+ */
+int dfs_mmb_extract_file(const DFS_MMB * mmbp, int slot, const ACORN_FILE * acorn_filep, FILE * file) {
+  DFS_GEOMETRY geometry;
+  int ret;
+
+  if (mmbp == NULL || acorn_filep == NULL || file == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  if (!dfs_mmb_slot_is_formatted(&(mmbp->index), slot)) {
+    return DFS_ERROR_INVALID_SLOT;
+  }
+
+  ret = check_slot_extent(slot, acorn_filep);
+  if (ret != DFS_ERROR_NONE) {
+    return ret;
+  }
+
+  dfs_geometry_init(&geometry, dfs_mmb_slot_offset(slot), 1, 0);
+
+  return dfs_extract_file_at(mmbp->mmbfile, &geometry, acorn_filep, file);
+}
+
+/**
+ * \brief Extracts a number of files from a slot of an open MMB file
+ *
+ * \param mmbp the MMB handle
+ * \param slot the slot number
+ * \param acorn_files array of pointers to the file meta data
+ * \param files array of local file references
+ * \param num_of_files the number of files to extract
+ * \return 0 on success or an error
+ */
+int dfs_mmb_extract_files(const DFS_MMB * mmbp, int slot, const ACORN_FILE ** acorn_files, FILE ** files, int num_of_files) {
+  DFS_GEOMETRY geometry;
+  int ret;
+
+  if (mmbp == NULL || acorn_files == NULL || files == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  if (!dfs_mmb_slot_is_formatted(&(mmbp->index), slot)) {
+    return DFS_ERROR_INVALID_SLOT;
+  }
+
+  for (int i = 0; i < num_of_files; i++) {
+    ret = check_slot_extent(slot, acorn_files[i]);
+    if (ret != DFS_ERROR_NONE) {
+      return ret;
+    }
+  }
+
+  dfs_geometry_init(&geometry, dfs_mmb_slot_offset(slot), 1, 0);
+
+  return dfs_extract_files_at(mmbp->mmbfile, &geometry, acorn_files, files, num_of_files);
+}
@@ -0,0 +1,850 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "dfs.h"
+#include "dfscopy.h"
+#include "dfserr.h"
+#include "dfshash.h"
+#include "dfspack.h"
+#include "debug.h"
+
+/* The blocks start on a page boundary so that no block spans two pages */
+#define DFS_PACK_BLOCKS_OFFSET 4096
+
+/* New blocks are written out this many at a time */
+#define DFS_PACK_WRITE_BLOCKS 1024
+
+/* Images are read this many sectors at a time */
+#define DFS_PACK_READ_SECTORS 64
+
+#define DFS_PACK_INITIAL_SLOTS 4096
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_of_images;
+  uint32_t num_of_blocks;
+  uint32_t paths_size;
+  uint64_t num_of_entries;
+  uint64_t images_offset;    /* Of the image table, after the blocks */
+  uint32_t reserved[6];
+} DFS_PACK_HEADER;
+
+typedef struct {
+  uint64_t first_entry;      /* Of its block list */
+  uint64_t size;             /* In bytes */
+  uint32_t path_offset;      /* Into the path table */
+  uint32_t reserved;
+} DFS_PACK_IMAGE;
+
+/* Where each table starts in the pack file */
+typedef struct {
+  size_t blocks;             /* DFS_SECTOR_SIZE bytes per block */
+  size_t images;             /* DFS_PACK_IMAGE per image */
+  size_t entries;            /* uint32_t block number per sector */
+  size_t paths;
+  size_t size;
+} DFS_PACK_LAYOUT;
+
+/* A stored block, found by the hash of its contents */
+typedef struct {
+  uint64_t hash;
+  uint32_t block;            /* 0 if the slot is empty */
+  uint32_t reserved;
+} DFS_PACK_SLOT;
+
+typedef struct {
+  char * path;
+  uint64_t first_entry;
+  uint64_t size;
+} DFS_PACK_WRITER_IMAGE;
+
+struct _tag_DFS_PACK_WRITER {
+  char path[PATH_MAX + 1];
+  char tmp_path[PATH_MAX + 1];
+  int fd;
+  FILE * entriesfile;        /* Block lists, until the blocks are all written */
+  uint64_t num_of_entries;
+  DFS_PACK_SLOT * slots;
+  size_t num_of_slots;       /* A power of two */
+  uint32_t num_of_blocks;
+  uint32_t num_of_flushed;   /* Blocks in the file, the rest are buffered */
+  uint8_t * buffer;
+  DFS_PACK_WRITER_IMAGE * images;
+  size_t num_of_images;
+  size_t images_capacity;
+  size_t paths_size;
+};
+
+struct _tag_DFS_PACK {
+  const uint8_t * map;
+  size_t map_size;
+  uint32_t num_of_images;
+  uint32_t num_of_blocks;
+  uint64_t num_of_entries;
+  const uint8_t * blocks;
+  const DFS_PACK_IMAGE * images;
+  const uint32_t * entries;
+  const char * paths;
+};
+
+static const uint8_t zero_sector[DFS_SECTOR_SIZE];
+
+static void get_layout(uint32_t num_of_images, uint32_t num_of_blocks, uint64_t num_of_entries, uint32_t paths_size, DFS_PACK_LAYOUT * layoutp) {
+  layoutp->blocks = DFS_PACK_BLOCKS_OFFSET;
+  layoutp->images = layoutp->blocks + ((size_t)num_of_blocks * DFS_SECTOR_SIZE);
+  layoutp->entries = layoutp->images + ((size_t)num_of_images * sizeof(DFS_PACK_IMAGE));
+  layoutp->paths = layoutp->entries + ((size_t)num_of_entries * sizeof(uint32_t));
+  layoutp->size = layoutp->paths + paths_size;
+}
+
+static uint64_t sectors_in(uint64_t size) {
+  return (size + DFS_SECTOR_SIZE - 1) / DFS_SECTOR_SIZE;
+}
+
+static int write_at(int fd, const void * data, size_t length, off_t offset) {
+  const uint8_t * p = (const uint8_t *)data;
+
+  while (length > 0) {
+    ssize_t written = pwrite(fd, p, length, offset);
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return DFS_ERROR_FAILED;
+    }
+
+    p += written;
+    offset += written;
+    length -= (size_t)written;
+  }
+
+  return DFS_ERROR_NONE;
+}
+
+static int flush_blocks(DFS_PACK_WRITER * writerp) {
+  int ret = write_at(
+    writerp->fd,
+    writerp->buffer,
+    (size_t)(writerp->num_of_blocks - writerp->num_of_flushed) * DFS_SECTOR_SIZE,
+    DFS_PACK_BLOCKS_OFFSET + ((off_t)writerp->num_of_flushed * DFS_SECTOR_SIZE));
+
+  if (ret == DFS_ERROR_NONE) {
+    writerp->num_of_flushed = writerp->num_of_blocks;
+  }
+
+  return ret;
+}
+
+/* Gets the contents of a stored block, from the buffer if it has not been
+   written out yet */
+static const uint8_t * get_block(DFS_PACK_WRITER * writerp, uint32_t block, uint8_t * sector) {
+  uint32_t index = block - 1;
+
+  if (index >= writerp->num_of_flushed) {
+    return writerp->buffer + ((size_t)(index - writerp->num_of_flushed) * DFS_SECTOR_SIZE);
+  }
+
+  if (pread(writerp->fd, sector, DFS_SECTOR_SIZE, DFS_PACK_BLOCKS_OFFSET + ((off_t)index * DFS_SECTOR_SIZE)) != DFS_SECTOR_SIZE) {
+    return NULL;
+  }
+
+  return sector;
+}
+
+static int grow_slots(DFS_PACK_WRITER * writerp) {
+  size_t num_of_slots = writerp->num_of_slots * 2;
+  size_t mask = num_of_slots - 1;
+  DFS_PACK_SLOT * slots = (DFS_PACK_SLOT *)calloc(num_of_slots, sizeof(DFS_PACK_SLOT));
+
+  if (slots == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  for (size_t i = 0; i < writerp->num_of_slots; i++) {
+    const DFS_PACK_SLOT * slotp = &(writerp->slots[i]);
+    size_t s;
+
+    if (slotp->block == 0) {
+      continue;
+    }
+
+    for (s = (size_t)slotp->hash & mask; slots[s].block != 0; s = (s + 1) & mask) {
+    }
+    slots[s] = *slotp;
+  }
+
+  free(writerp->slots);
+  writerp->slots = slots;
+  writerp->num_of_slots = num_of_slots;
+
+  return DFS_ERROR_NONE;
+}
+
+/* Gets the block holding a sector, storing the sector if it is new.  Blocks
+   with the same hash are compared, so a hash collision cannot lose data */
+static int store_sector(DFS_PACK_WRITER * writerp, const uint8_t * sector, uint32_t * blockp) {
+  uint8_t stored[DFS_SECTOR_SIZE];
+  uint64_t hash;
+  size_t mask = writerp->num_of_slots - 1;
+  size_t s;
+
+  if (memcmp(sector, zero_sector, DFS_SECTOR_SIZE) == 0) {
+    *blockp = DFS_PACK_ZERO_BLOCK;
+    return DFS_ERROR_NONE;
+  }
+
+  hash = dfs_hash64(sector, DFS_SECTOR_SIZE, 0);
+
+  for (s = (size_t)hash & mask; writerp->slots[s].block != 0; s = (s + 1) & mask) {
+    if (writerp->slots[s].hash == hash) {
+      const uint8_t * data = get_block(writerp, writerp->slots[s].block, stored);
+
+      if (data == NULL) {
+        return DFS_ERROR_FAILED;
+      }
+
+      if (memcmp(data, sector, DFS_SECTOR_SIZE) == 0) {
+        *blockp = writerp->slots[s].block;
+        return DFS_ERROR_NONE;
+      }
+    }
+  }
+
+  if (writerp->num_of_blocks == UINT32_MAX) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Too many blocks for a pack file");
+    return DFS_ERROR_FAILED;
+  }
+
+  if (writerp->num_of_blocks - writerp->num_of_flushed == DFS_PACK_WRITE_BLOCKS && flush_blocks(writerp) != DFS_ERROR_NONE) {
+    return DFS_ERROR_FAILED;
+  }
+
+  memcpy(writerp->buffer + ((size_t)(writerp->num_of_blocks - writerp->num_of_flushed) * DFS_SECTOR_SIZE), sector, DFS_SECTOR_SIZE);
+  writerp->num_of_blocks++;
+  writerp->slots[s].hash = hash;
+  writerp->slots[s].block = writerp->num_of_blocks;
+  *blockp = writerp->num_of_blocks;
+
+  /* Keep the table at most half full */
+  if ((size_t)writerp->num_of_blocks * 2 > writerp->num_of_slots) {
+    return grow_slots(writerp);
+  }
+
+  return DFS_ERROR_NONE;
+}
+
+static void free_writer(DFS_PACK_WRITER * writerp) {
+  for (size_t i = 0; i < writerp->num_of_images; i++) {
+    free(writerp->images[i].path);
+  }
+
+  if (writerp->entriesfile != NULL) {
+    fclose(writerp->entriesfile);
+  }
+
+  if (writerp->fd != -1) {
+    close(writerp->fd);
+  }
+
+  free(writerp->images);
+  free(writerp->buffer);
+  free(writerp->slots);
+  free(writerp);
+}
+
+/**
+ * \brief Starts writing a pack file
+ *
+ * \param path the pack file name
+ * \param writerpp pointer in which to return the writer
+ * \return 0 on success or an error
+ */
+int dfs_pack_create(const char * path, DFS_PACK_WRITER ** writerpp) {
+  DFS_PACK_WRITER * writerp;
+
+  if (path == NULL || writerpp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  writerp = (DFS_PACK_WRITER *)calloc(1, sizeof(DFS_PACK_WRITER));
+  if (writerp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  writerp->fd = -1;
+
+  if (snprintf(writerp->path, sizeof(writerp->path), "%s", path) >= (int)sizeof(writerp->path) ||
+      snprintf(writerp->tmp_path, sizeof(writerp->tmp_path), "%s.tmp", path) >= (int)sizeof(writerp->tmp_path)) {
+    free_writer(writerp);
+    return DFS_ERROR_FAILED;
+  }
+
+  writerp->num_of_slots = DFS_PACK_INITIAL_SLOTS;
+  writerp->slots = (DFS_PACK_SLOT *)calloc(writerp->num_of_slots, sizeof(DFS_PACK_SLOT));
+  writerp->buffer = (uint8_t *)malloc((size_t)DFS_PACK_WRITE_BLOCKS * DFS_SECTOR_SIZE);
+  writerp->entriesfile = tmpfile();
+  if (writerp->slots == NULL || writerp->buffer == NULL || writerp->entriesfile == NULL) {
+    free_writer(writerp);
+    return DFS_ERROR_FAILED;
+  }
+
+  writerp->fd = open(writerp->tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (writerp->fd == -1) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not create pack file: %s", strerror(errno));
+    free_writer(writerp);
+    return DFS_ERROR_OPEN_FAILED;
+  }
+
+  *writerpp = writerp;
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Adds a disk image to a pack file
+ *
+ * The block list is written to a temporary file, as it is only copied into
+ * the pack after the last block.  If the image cannot be read its entries
+ * are dropped and the blocks it added are kept for later images.
+ *
+ * \param writerp the writer
+ * \param image_path the path to record for the image
+ * \param imagefile the image, read from its current position
+ * \return 0 on success or an error
+ */
+int dfs_pack_add_image(DFS_PACK_WRITER * writerp, const char * image_path, FILE * imagefile) {
+  uint8_t sectors[DFS_PACK_READ_SECTORS * DFS_SECTOR_SIZE];
+  uint32_t blocks[DFS_PACK_READ_SECTORS];
+  DFS_PACK_WRITER_IMAGE * imagep;
+  uint64_t first_entry;
+  uint64_t size = 0;
+  size_t path_len;
+  size_t length;
+  int ret = DFS_ERROR_NONE;
+
+  if (writerp == NULL || image_path == NULL || imagefile == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  path_len = strlen(image_path) + 1;
+  if (writerp->num_of_images == UINT32_MAX || writerp->paths_size + path_len > UINT32_MAX) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Too many images for a pack file");
+    return DFS_ERROR_FAILED;
+  }
+
+  if (writerp->num_of_images == writerp->images_capacity) {
+    size_t capacity = writerp->images_capacity ? writerp->images_capacity * 2 : 64;
+    DFS_PACK_WRITER_IMAGE * images = (DFS_PACK_WRITER_IMAGE *)realloc(writerp->images, capacity * sizeof(DFS_PACK_WRITER_IMAGE));
+
+    if (images == NULL) {
+      return DFS_ERROR_FAILED;
+    }
+
+    writerp->images = images;
+    writerp->images_capacity = capacity;
+  }
+
+  first_entry = writerp->num_of_entries;
+
+  while (ret == DFS_ERROR_NONE && (length = fread(sectors, 1, sizeof(sectors), imagefile)) > 0) {
+    size_t num_of_sectors = (length + DFS_SECTOR_SIZE - 1) / DFS_SECTOR_SIZE;
+
+    /* A short last sector is stored padded with zeros */
+    memset(sectors + length, 0, (num_of_sectors * DFS_SECTOR_SIZE) - length);
+
+    for (size_t i = 0; i < num_of_sectors && ret == DFS_ERROR_NONE; i++) {
+      ret = store_sector(writerp, sectors + (i * DFS_SECTOR_SIZE), &(blocks[i]));
+    }
+
+    if (ret == DFS_ERROR_NONE && fwrite(blocks, sizeof(uint32_t), num_of_sectors, writerp->entriesfile) != num_of_sectors) {
+      ret = DFS_ERROR_FAILED;
+    }
+
+    writerp->num_of_entries += num_of_sectors;
+    size += length;
+  }
+
+  if (ret == DFS_ERROR_NONE && ferror(imagefile)) {
+    ret = DFS_ERROR_FAILED;
+  }
+
+  if (ret == DFS_ERROR_NONE) {
+    imagep = &(writerp->images[writerp->num_of_images]);
+    imagep->path = strdup(image_path);
+    if (imagep->path == NULL) {
+      ret = DFS_ERROR_FAILED;
+    }
+  }
+
+  if (ret != DFS_ERROR_NONE) {
+    writerp->num_of_entries = first_entry;
+    if (fseeko(writerp->entriesfile, (off_t)(first_entry * sizeof(uint32_t)), SEEK_SET) != 0) {
+      return DFS_ERROR_FAILED;
+    }
+    return ret;
+  }
+
+  imagep->first_entry = first_entry;
+  imagep->size = size;
+  writerp->num_of_images++;
+  writerp->paths_size += path_len;
+
+  return DFS_ERROR_NONE;
+}
+
+static int compare_images(const void * a, const void * b) {
+  return strcmp(((const DFS_PACK_WRITER_IMAGE *)a)->path, ((const DFS_PACK_WRITER_IMAGE *)b)->path);
+}
+
+/**
+ * \brief Finishes writing a pack file and frees the writer
+ *
+ * \param writerp the writer
+ * \return 0 on success or an error
+ */
+int dfs_pack_finish(DFS_PACK_WRITER * writerp) {
+  DFS_PACK_HEADER header;
+  DFS_PACK_LAYOUT layout;
+  DFS_PACK_IMAGE * images;
+  char * paths;
+  uint32_t path_offset = 0;
+  int ret;
+
+  if (writerp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  get_layout((uint32_t)writerp->num_of_images, writerp->num_of_blocks, writerp->num_of_entries, (uint32_t)writerp->paths_size, &layout);
+
+  /* Images are found by binary search on their paths */
+  qsort(writerp->images, writerp->num_of_images, sizeof(DFS_PACK_WRITER_IMAGE), compare_images);
+
+  images = (DFS_PACK_IMAGE *)calloc(writerp->num_of_images + 1, sizeof(DFS_PACK_IMAGE));
+  paths = (char *)malloc(writerp->paths_size + 1);
+  if (images == NULL || paths == NULL) {
+    free(images);
+    free(paths);
+    return dfs_pack_abort(writerp);
+  }
+
+  for (size_t i = 0; i < writerp->num_of_images; i++) {
+    size_t path_len = strlen(writerp->images[i].path) + 1;
+
+    images[i].first_entry = writerp->images[i].first_entry;
+    images[i].size = writerp->images[i].size;
+    images[i].path_offset = path_offset;
+    memcpy(paths + path_offset, writerp->images[i].path, path_len);
+    path_offset += (uint32_t)path_len;
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, DFS_PACK_MAGIC, sizeof(header.magic));
+  header.version = DFS_PACK_VERSION;
+  header.num_of_images = (uint32_t)writerp->num_of_images;
+  header.num_of_blocks = writerp->num_of_blocks;
+  header.paths_size = (uint32_t)writerp->paths_size;
+  header.num_of_entries = writerp->num_of_entries;
+  header.images_offset = layout.images;
+
+  ret = flush_blocks(writerp);
+
+  if (ret == DFS_ERROR_NONE) {
+    ret = write_at(writerp->fd, images, writerp->num_of_images * sizeof(DFS_PACK_IMAGE), (off_t)layout.images);
+  }
+
+  if (ret == DFS_ERROR_NONE && writerp->num_of_entries > 0) {
+    ret = (fflush(writerp->entriesfile) == 0) ?
+      dfs_copy_range(fileno(writerp->entriesfile), 0, writerp->fd, (off_t)layout.entries, (size_t)writerp->num_of_entries * sizeof(uint32_t)) :
+      DFS_ERROR_FAILED;
+  }
+
+  if (ret == DFS_ERROR_NONE) {
+    ret = write_at(writerp->fd, paths, writerp->paths_size, (off_t)layout.paths);
+  }
+
+  /* An empty pack still has room for its header */
+  if (ret == DFS_ERROR_NONE && ftruncate(writerp->fd, (off_t)layout.size) == -1) {
+    ret = DFS_ERROR_FAILED;
+  }
+
+  /* The header goes last, so a pack that was not finished is never valid */
+  if (ret == DFS_ERROR_NONE) {
+    ret = write_at(writerp->fd, &header, sizeof(header), 0);
+  }
+
+  free(images);
+  free(paths);
+
+  if (ret == DFS_ERROR_NONE) {
+    ret = (close(writerp->fd) == 0) ? DFS_ERROR_NONE : DFS_ERROR_FAILED;
+    writerp->fd = -1;
+  }
+
+  if (ret == DFS_ERROR_NONE && rename(writerp->tmp_path, writerp->path) == -1) {
+    ret = DFS_ERROR_FAILED;
+  }
+
+  if (ret != DFS_ERROR_NONE) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not write pack file: %s", strerror(errno));
+    dfs_pack_abort(writerp);
+    return ret;
+  }
+
+  free_writer(writerp);
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Abandons writing a pack file and frees the writer
+ *
+ * \param writerp the writer
+ * \return 0 on success or an error
+ */
+int dfs_pack_abort(DFS_PACK_WRITER * writerp) {
+  if (writerp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  unlink(writerp->tmp_path);
+  free_writer(writerp);
+
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Opens a pack file
+ *
+ * The block lists are checked as they are used rather than here, so that
+ * opening a pack to read one image does not read the lists of every image.
+ *
+ * \param path the pack file name
+ * \param packpp pointer in which to return the pack handle
+ * \return 0 on success or an error
+ */
+int dfs_pack_open(const char * path, DFS_PACK ** packpp) {
+  const DFS_PACK_HEADER * headerp;
+  const DFS_PACK_IMAGE * images;
+  DFS_PACK_LAYOUT layout;
+  DFS_PACK * packp;
+  struct stat st;
+  bool valid;
+  void * map;
+  int saved_errno;
+  int fd;
+
+  if (path == NULL || packpp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return (errno == ENOENT) ? DFS_ERROR_IMAGE_NOT_FOUND : DFS_ERROR_OPEN_FAILED;
+  }
+
+  if (fstat(fd, &st) == -1 || st.st_size < DFS_PACK_BLOCKS_OFFSET) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Not a pack file: %s", path);
+    close(fd);
+    return DFS_ERROR_FAILED;
+  }
+
+  map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  saved_errno = errno;
+  close(fd);
+  if (map == MAP_FAILED) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Could not map pack file: %s", strerror(saved_errno));
+    return DFS_ERROR_FAILED;
+  }
+
+  headerp = (const DFS_PACK_HEADER *)map;
+  get_layout(headerp->num_of_images, headerp->num_of_blocks, headerp->num_of_entries, headerp->paths_size, &layout);
+  images = (const DFS_PACK_IMAGE *)((const uint8_t *)map + layout.images);
+
+  valid = memcmp(headerp->magic, DFS_PACK_MAGIC, sizeof(headerp->magic)) == 0 &&
+    headerp->version == DFS_PACK_VERSION &&
+    headerp->num_of_entries <= ((uint64_t)st.st_size / sizeof(uint32_t)) &&
+    headerp->images_offset == layout.images &&
+    layout.size == (size_t)st.st_size &&
+    (headerp->paths_size == 0 || ((const char *)map)[layout.size - 1] == '\0');
+
+  for (uint32_t i = 0; valid && i < headerp->num_of_images; i++) {
+    valid = images[i].path_offset < headerp->paths_size &&
+      images[i].first_entry <= headerp->num_of_entries &&
+      sectors_in(images[i].size) <= headerp->num_of_entries - images[i].first_entry;
+  }
+
+  if (!valid) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Not a pack file: %s", path);
+    munmap(map, (size_t)st.st_size);
+    return DFS_ERROR_FAILED;
+  }
+
+  packp = (DFS_PACK *)calloc(1, sizeof(DFS_PACK));
+  if (packp == NULL) {
+    munmap(map, (size_t)st.st_size);
+    return DFS_ERROR_FAILED;
+  }
+
+  /* Images are read a block at a time from all over the pack, so reading
+     ahead would only fill the page cache with other images */
+  madvise(map, (size_t)st.st_size, MADV_RANDOM);
+
+  packp->map = (const uint8_t *)map;
+  packp->map_size = (size_t)st.st_size;
+  packp->num_of_images = headerp->num_of_images;
+  packp->num_of_blocks = headerp->num_of_blocks;
+  packp->num_of_entries = headerp->num_of_entries;
+  packp->blocks = packp->map + layout.blocks;
+  packp->images = images;
+  packp->entries = (const uint32_t *)(packp->map + layout.entries);
+  packp->paths = (const char *)(packp->map + layout.paths);
+
+  *packpp = packp;
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Closes a pack file
+ *
+ * \param packp the pack handle
+ * \return 0 on success or an error
+ */
+int dfs_pack_close(DFS_PACK * packp) {
+  if (packp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  munmap((void *)packp->map, packp->map_size);
+  free(packp);
+
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Gets the number of images, sectors and distinct blocks in a pack
+ *
+ * \param packp the pack handle
+ * \param num_of_imagesp pointer in which to return the number of images
+ * \param num_of_sectorsp pointer in which to return the number of sectors
+ *        in all of the images
+ * \param num_of_blocksp pointer in which to return the number of blocks
+ *        stored, not counting the zero block
+ * \return 0 on success or an error
+ */
+int dfs_pack_get_size(const DFS_PACK * packp, size_t * num_of_imagesp, size_t * num_of_sectorsp, size_t * num_of_blocksp) {
+  if (packp == NULL || num_of_imagesp == NULL || num_of_sectorsp == NULL || num_of_blocksp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  *num_of_imagesp = packp->num_of_images;
+  *num_of_sectorsp = (size_t)packp->num_of_entries;
+  *num_of_blocksp = packp->num_of_blocks;
+
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Gets an image in a pack
+ *
+ * \param packp the pack handle
+ * \param index the image, from 0, in path order
+ * \param image_pathp pointer in which to return the path of the image,
+ *        which points into the pack
+ * \param sizep pointer in which to return the size of the image in bytes
+ * \return 0 on success or an error
+ */
+int dfs_pack_get_image(const DFS_PACK * packp, size_t index, const char ** image_pathp, uint64_t * sizep) {
+  if (packp == NULL || image_pathp == NULL || sizep == NULL || index >= packp->num_of_images) {
+    return DFS_ERROR_FAILED;
+  }
+
+  *image_pathp = packp->paths + packp->images[index].path_offset;
+  *sizep = packp->images[index].size;
+
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Finds an image in a pack by its path
+ *
+ * \param packp the pack handle
+ * \param image_path the path recorded for the image
+ * \param indexp pointer in which to return the image
+ * \return 0 on success or an error
+ */
+int dfs_pack_find_image(const DFS_PACK * packp, const char * image_path, size_t * indexp) {
+  size_t low = 0;
+  size_t high;
+
+  if (packp == NULL || image_path == NULL || indexp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  /* Find the first image with the path, should it have been added twice */
+  high = packp->num_of_images;
+  while (low < high) {
+    size_t mid = low + ((high - low) / 2);
+
+    if (strcmp(packp->paths + packp->images[mid].path_offset, image_path) < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  if (low == packp->num_of_images || strcmp(packp->paths + packp->images[low].path_offset, image_path) != 0) {
+    return DFS_ERROR_IMAGE_NOT_FOUND;
+  }
+
+  *indexp = low;
+  return DFS_ERROR_NONE;
+}
+
+/* Gets a sector of an image, NULL if its block list is corrupt */
+static const uint8_t * get_sector(const DFS_PACK * packp, const DFS_PACK_IMAGE * imagep, uint64_t sector) {
+  uint32_t block = packp->entries[imagep->first_entry + sector];
+
+  if (block == DFS_PACK_ZERO_BLOCK) {
+    return zero_sector;
+  }
+
+  if (block > packp->num_of_blocks) {
+    return NULL;
+  }
+
+  return packp->blocks + ((size_t)(block - 1) * DFS_SECTOR_SIZE);
+}
+
+/**
+ * \brief Reads part of an image in a pack
+ *
+ * \param packp the pack handle
+ * \param index the image
+ * \param offset the offset in the image
+ * \param buffer the buffer to read into
+ * \param length the number of bytes to read, which must lie in the image
+ * \return 0 on success or an error
+ */
+int dfs_pack_read(const DFS_PACK * packp, size_t index, uint64_t offset, void * buffer, size_t length) {
+  const DFS_PACK_IMAGE * imagep;
+  uint8_t * p = (uint8_t *)buffer;
+
+  if (packp == NULL || buffer == NULL || index >= packp->num_of_images) {
+    return DFS_ERROR_FAILED;
+  }
+
+  imagep = &(packp->images[index]);
+  if (offset > imagep->size || length > imagep->size - offset) {
+    return DFS_ERROR_BAD_EXTENT;
+  }
+
+  while (length > 0) {
+    const uint8_t * sector = get_sector(packp, imagep, offset / DFS_SECTOR_SIZE);
+    size_t within = (size_t)(offset % DFS_SECTOR_SIZE);
+    size_t count = DFS_SECTOR_SIZE - within;
+
+    if (sector == NULL) {
+      return DFS_ERROR_BAD_EXTENT;
+    }
+
+    if (count > length) {
+      count = length;
+    }
+
+    memcpy(p, sector + within, count);
+    p += count;
+    offset += count;
+    length -= count;
+  }
+
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Writes out a whole image in a pack
+ *
+ * \param packp the pack handle
+ * \param index the image
+ * \param outfile the file to write to, from its start
+ * \return 0 on success or an error
+ */
+int dfs_pack_write_image(const DFS_PACK * packp, size_t index, FILE * outfile) {
+  const DFS_PACK_IMAGE * imagep;
+  uint64_t num_of_sectors;
+  off_t skipped = 0;
+
+  if (packp == NULL || outfile == NULL || index >= packp->num_of_images) {
+    return DFS_ERROR_FAILED;
+  }
+
+  imagep = &(packp->images[index]);
+  num_of_sectors = sectors_in(imagep->size);
+
+  if (fseeko(outfile, 0, SEEK_SET) != 0) {
+    return DFS_ERROR_FAILED;
+  }
+
+  for (uint64_t s = 0; s < num_of_sectors; s++) {
+    const uint8_t * sector = get_sector(packp, imagep, s);
+    size_t length = DFS_SECTOR_SIZE;
+
+    if (sector == NULL) {
+      return DFS_ERROR_BAD_EXTENT;
+    }
+
+    if (s == num_of_sectors - 1 && (imagep->size % DFS_SECTOR_SIZE) != 0) {
+      length = (size_t)(imagep->size % DFS_SECTOR_SIZE);
+    }
+
+    if (sector == zero_sector) {
+      skipped += (off_t)length;
+      continue;
+    }
+
+    if (skipped > 0 && fseeko(outfile, skipped, SEEK_CUR) != 0) {
+      return DFS_ERROR_FAILED;
+    }
+    skipped = 0;
+
+    if (fwrite(sector, 1, length, outfile) != length) {
+      return DFS_ERROR_FAILED;
+    }
+  }
+
+  /* Zeros at the end are left as a hole by setting the file size */
+  if (fflush(outfile) != 0 || ftruncate(fileno(outfile), (off_t)imagep->size) == -1) {
+    return DFS_ERROR_FAILED;
+  }
+
+  return DFS_ERROR_NONE;
+}
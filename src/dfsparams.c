@@ -0,0 +1,266 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "dfs.h"
+#include "dfsparams.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DFS_PARAMS_X86
+#include <immintrin.h>
+#endif
+
+/* The vector kernels load each 8 byte entry as two little endian words.
+   The first holds the low 16 bits of the load and exec addresses, the
+   second the low 16 bits of the length, the packed byte of top bits and
+   the low byte of the start sector */
+#define PACKED_SHIFT   16
+#define HIGH_BITS      (0x03 << 16)
+#define IO_ADDRESS     0xffff0000
+
+/* Decodes a single entry, the reference for the vector kernels */
+static void decode_entry(const DFS_FILE_PARAMS * fileparamsp, DFS_FILE_PARAMS_TABLE * tablep, int i) {
+  uint8_t high = fileparamsp->start_sector_high;
+
+  tablep->load_addresses[i] =
+    (uint32_t)fileparamsp->load_address_low +
+    ((uint32_t)fileparamsp->load_address_high * 0x100) +
+    ((uint32_t)((high & DFS_LOAD_ADDRESS_BIT_17_18_MASK) >> DFS_LOAD_ADDRESS_SHIFT) * 0x10000);
+
+  /* If load address has bits 17 and 18 set then OR with 0xffff0000 (IO memory) */
+  if ((high & DFS_LOAD_ADDRESS_BIT_17_18_MASK) == DFS_LOAD_ADDRESS_BIT_17_18_MASK) {
+    tablep->load_addresses[i] |= IO_ADDRESS;
+  }
+
+  tablep->exec_addresses[i] =
+    (uint32_t)fileparamsp->exec_address_low +
+    ((uint32_t)fileparamsp->exec_address_high * 0x100) +
+    ((uint32_t)((high & DFS_EXEC_ADDRESS_BIT_17_18_MASK) >> DFS_EXEC_ADDRESS_SHIFT) * 0x10000);
+
+  /* If exec address has bits 17 and 18 set then OR with 0xffff0000 (IO memory) */
+  if ((high & DFS_EXEC_ADDRESS_BIT_17_18_MASK) == DFS_EXEC_ADDRESS_BIT_17_18_MASK) {
+    tablep->exec_addresses[i] |= IO_ADDRESS;
+  }
+
+  tablep->lengths[i] =
+    (uint32_t)fileparamsp->length_low +
+    ((uint32_t)fileparamsp->length_high * 0x100) +
+    ((uint32_t)((high & DFS_FILE_LENGTH_BIT_17_18_MASK) >> DFS_FILE_LENGTH_SHIFT) * 0x10000);
+
+  tablep->start_sectors[i] =
+    (uint32_t)fileparamsp->start_sector_low +
+    (((uint32_t)high & DFS_START_SECTOR_HIGH_MASK) * 0x100);
+}
+
+static void decode_scalar(const DFS_FILE_PARAMS * fileparams, int first, int num_of_files, DFS_FILE_PARAMS_TABLE * tablep) {
+  for (int i = first; i < num_of_files; i++) {
+    decode_entry(&(fileparams[i]), tablep, i);
+  }
+}
+
+#ifdef DFS_PARAMS_X86
+
+/* Four entries at a time */
+__attribute__((target("sse2")))
+static void decode_sse2(const DFS_FILE_PARAMS * fileparams, int num_of_files, DFS_FILE_PARAMS_TABLE * tablep) {
+  const __m128i low_mask = _mm_set1_epi32(0xffff);
+  const __m128i high_mask = _mm_set1_epi32(HIGH_BITS);
+  const __m128i start_mask = _mm_set1_epi32(DFS_START_SECTOR_HIGH_MASK << 8);
+  const __m128i load_io = _mm_set1_epi32(DFS_LOAD_ADDRESS_BIT_17_18_MASK << PACKED_SHIFT);
+  const __m128i exec_io = _mm_set1_epi32(DFS_EXEC_ADDRESS_BIT_17_18_MASK << PACKED_SHIFT);
+  const __m128i io_address = _mm_set1_epi32((int)IO_ADDRESS);
+  int i = 0;
+
+  for (; i + 4 <= num_of_files; i += 4) {
+    __m128 a = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)&(fileparams[i])));
+    __m128 b = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)&(fileparams[i + 2])));
+    __m128i w0 = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+    __m128i w1 = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    __m128i load;
+    __m128i exec;
+    __m128i length;
+    __m128i start;
+
+    load = _mm_or_si128(
+      _mm_and_si128(w0, low_mask),
+      _mm_and_si128(_mm_srli_epi32(w1, DFS_LOAD_ADDRESS_SHIFT), high_mask));
+    load = _mm_or_si128(load,
+      _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(w1, load_io), load_io), io_address));
+
+    exec = _mm_or_si128(
+      _mm_srli_epi32(w0, 16),
+      _mm_and_si128(_mm_srli_epi32(w1, DFS_EXEC_ADDRESS_SHIFT), high_mask));
+    exec = _mm_or_si128(exec,
+      _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(w1, exec_io), exec_io), io_address));
+
+    length = _mm_or_si128(
+      _mm_and_si128(w1, low_mask),
+      _mm_and_si128(_mm_srli_epi32(w1, DFS_FILE_LENGTH_SHIFT), high_mask));
+
+    start = _mm_or_si128(
+      _mm_srli_epi32(w1, 24),
+      _mm_and_si128(_mm_srli_epi32(w1, PACKED_SHIFT - 8), start_mask));
+
+    _mm_storeu_si128((__m128i *)&(tablep->load_addresses[i]), load);
+    _mm_storeu_si128((__m128i *)&(tablep->exec_addresses[i]), exec);
+    _mm_storeu_si128((__m128i *)&(tablep->lengths[i]), length);
+    _mm_storeu_si128((__m128i *)&(tablep->start_sectors[i]), start);
+  }
+
+  decode_scalar(fileparams, i, num_of_files, tablep);
+}
+
+/* Eight entries at a time */
+__attribute__((target("avx2")))
+static void decode_avx2(const DFS_FILE_PARAMS * fileparams, int num_of_files, DFS_FILE_PARAMS_TABLE * tablep) {
+  const __m256i low_mask = _mm256_set1_epi32(0xffff);
+  const __m256i high_mask = _mm256_set1_epi32(HIGH_BITS);
+  const __m256i start_mask = _mm256_set1_epi32(DFS_START_SECTOR_HIGH_MASK << 8);
+  const __m256i load_io = _mm256_set1_epi32(DFS_LOAD_ADDRESS_BIT_17_18_MASK << PACKED_SHIFT);
+  const __m256i exec_io = _mm256_set1_epi32(DFS_EXEC_ADDRESS_BIT_17_18_MASK << PACKED_SHIFT);
+  const __m256i io_address = _mm256_set1_epi32((int)IO_ADDRESS);
+  int i = 0;
+
+  for (; i + 8 <= num_of_files; i += 8) {
+    __m256 a = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *)&(fileparams[i])));
+    __m256 b = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *)&(fileparams[i + 4])));
+    __m256i w0;
+    __m256i w1;
+    __m256i load;
+    __m256i exec;
+    __m256i length;
+    __m256i start;
+
+    /* The shuffle works within each 128 bit lane, leaving the entries in
+       the order 0 1 4 5 2 3 6 7, which the permute puts right */
+    w0 = _mm256_castps_si256(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+    w1 = _mm256_castps_si256(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    w0 = _mm256_permute4x64_epi64(w0, _MM_SHUFFLE(3, 1, 2, 0));
+    w1 = _mm256_permute4x64_epi64(w1, _MM_SHUFFLE(3, 1, 2, 0));
+
+    load = _mm256_or_si256(
+      _mm256_and_si256(w0, low_mask),
+      _mm256_and_si256(_mm256_srli_epi32(w1, DFS_LOAD_ADDRESS_SHIFT), high_mask));
+    load = _mm256_or_si256(load,
+      _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_and_si256(w1, load_io), load_io), io_address));
+
+    exec = _mm256_or_si256(
+      _mm256_srli_epi32(w0, 16),
+      _mm256_and_si256(_mm256_srli_epi32(w1, DFS_EXEC_ADDRESS_SHIFT), high_mask));
+    exec = _mm256_or_si256(exec,
+      _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_and_si256(w1, exec_io), exec_io), io_address));
+
+    length = _mm256_or_si256(
+      _mm256_and_si256(w1, low_mask),
+      _mm256_and_si256(_mm256_srli_epi32(w1, DFS_FILE_LENGTH_SHIFT), high_mask));
+
+    start = _mm256_or_si256(
+      _mm256_srli_epi32(w1, 24),
+      _mm256_and_si256(_mm256_srli_epi32(w1, PACKED_SHIFT - 8), start_mask));
+
+    _mm256_storeu_si256((__m256i *)&(tablep->load_addresses[i]), load);
+    _mm256_storeu_si256((__m256i *)&(tablep->exec_addresses[i]), exec);
+    _mm256_storeu_si256((__m256i *)&(tablep->lengths[i]), length);
+    _mm256_storeu_si256((__m256i *)&(tablep->start_sectors[i]), start);
+  }
+
+  decode_scalar(fileparams, i, num_of_files, tablep);
+}
+
+#endif /* DFS_PARAMS_X86 */
+
+static bool kernel_supported(DFS_PARAMS_KERNEL kernel) {
+  switch (kernel) {
+    case DFS_PARAMS_KERNEL_SCALAR:
+      return true;
+#ifdef DFS_PARAMS_X86
+    case DFS_PARAMS_KERNEL_SSE2:
+      return __builtin_cpu_supports("sse2");
+    case DFS_PARAMS_KERNEL_AVX2:
+      return __builtin_cpu_supports("avx2");
+#endif
+    default:
+      return false;
+  }
+}
+
+/**
+ * \brief Decodes the file parameters of a catalogue with a given kernel
+ *
+ * \param kernel the kernel
+ * \param fileparams the file parameters in sector 1 of the catalogue
+ * \param num_of_files the number of files in the catalogue
+ * \param tablep pointer to the table to fill in
+ * \return 0 on success, DFS_ERROR_FAILED if the kernel is not supported,
+ *         or another error
+ */
+int dfs_decode_file_params_with(DFS_PARAMS_KERNEL kernel, const DFS_FILE_PARAMS * fileparams, int num_of_files, DFS_FILE_PARAMS_TABLE * tablep) {
+  if (fileparams == NULL || tablep == NULL || num_of_files < 0 || num_of_files > DFS_MAX_FILES) {
+    return DFS_ERROR_FAILED;
+  }
+
+  /* The fastest supported, checked on each call as it costs a load */
+  if (kernel == DFS_PARAMS_KERNEL_AUTO) {
+    if (kernel_supported(DFS_PARAMS_KERNEL_AVX2)) {
+      kernel = DFS_PARAMS_KERNEL_AVX2;
+    } else if (kernel_supported(DFS_PARAMS_KERNEL_SSE2)) {
+      kernel = DFS_PARAMS_KERNEL_SSE2;
+    } else {
+      kernel = DFS_PARAMS_KERNEL_SCALAR;
+    }
+  }
+
+  if (!kernel_supported(kernel)) {
+    return DFS_ERROR_FAILED;
+  }
+
+  switch (kernel) {
+#ifdef DFS_PARAMS_X86
+    case DFS_PARAMS_KERNEL_SSE2:
+      decode_sse2(fileparams, num_of_files, tablep);
+      break;
+    case DFS_PARAMS_KERNEL_AVX2:
+      decode_avx2(fileparams, num_of_files, tablep);
+      break;
+#endif
+    default:
+      decode_scalar(fileparams, 0, num_of_files, tablep);
+      break;
+  }
+
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Decodes the file parameters of a catalogue
+ *
+ * \param fileparams the file parameters in sector 1 of the catalogue
+ * \param num_of_files the number of files in the catalogue
+ * \param tablep pointer to the table to fill in
+ * \return 0 on success or an error
+ */
+int dfs_decode_file_params(const DFS_FILE_PARAMS * fileparams, int num_of_files, DFS_FILE_PARAMS_TABLE * tablep) {
+  return dfs_decode_file_params_with(DFS_PARAMS_KERNEL_AUTO, fileparams, num_of_files, tablep);
+}
@@ -0,0 +1,267 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "dfserr.h"
+#include "dfsstats.h"
+
+typedef struct {
+  atomic_uint_least64_t count;
+  atomic_uint_least64_t total_ns;
+  atomic_uint_least64_t max_ns;
+  atomic_uint_least64_t buckets[DFS_STATS_NUM_OF_BUCKETS];
+  atomic_uint_least64_t counters[DFS_STATS_NUM_OF_COUNTERS];
+} DFS_STATS_SLOT;
+
+static atomic_bool enabled;
+static DFS_STATS_SLOT slots[DFS_STATS_NUM_OF_OPS];
+
+/* The operation running on this thread, which counts are charged to */
+static _Thread_local DFS_STATS_OP current_op = DFS_STATS_OTHER;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+}
+
+static int get_bucket(uint64_t ns) {
+  int bucket = (ns > 1) ? 63 - __builtin_clzll(ns) : 0;
+
+  return (bucket < DFS_STATS_NUM_OF_BUCKETS) ? bucket : DFS_STATS_NUM_OF_BUCKETS - 1;
+}
+
+/**
+ * \brief Turns collection on or off
+ *
+ * \param enable true to collect
+ */
+void dfs_stats_enable(bool enable) {
+  atomic_store(&enabled, enable);
+}
+
+/**
+ * \brief Sets every counter and histogram back to zero
+ */
+void dfs_stats_reset(void) {
+  for (int op = 0; op < DFS_STATS_NUM_OF_OPS; op++) {
+    DFS_STATS_SLOT * slotp = &(slots[op]);
+
+    atomic_store_explicit(&(slotp->count), 0, memory_order_relaxed);
+    atomic_store_explicit(&(slotp->total_ns), 0, memory_order_relaxed);
+    atomic_store_explicit(&(slotp->max_ns), 0, memory_order_relaxed);
+
+    for (int b = 0; b < DFS_STATS_NUM_OF_BUCKETS; b++) {
+      atomic_store_explicit(&(slotp->buckets[b]), 0, memory_order_relaxed);
+    }
+
+    for (int c = 0; c < DFS_STATS_NUM_OF_COUNTERS; c++) {
+      atomic_store_explicit(&(slotp->counters[c]), 0, memory_order_relaxed);
+    }
+  }
+}
+
+/**
+ * \brief Gets a copy of the counters and histograms
+ *
+ * \param statsp pointer to the stats to fill in
+ * \return 0 on success or an error
+ */
+int dfs_stats_get(DFS_STATS * statsp) {
+  if (statsp == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  for (int op = 0; op < DFS_STATS_NUM_OF_OPS; op++) {
+    DFS_STATS_SLOT * slotp = &(slots[op]);
+    DFS_STATS_OP_STATS * op_statsp = &(statsp->ops[op]);
+
+    op_statsp->count = atomic_load_explicit(&(slotp->count), memory_order_relaxed);
+    op_statsp->total_ns = atomic_load_explicit(&(slotp->total_ns), memory_order_relaxed);
+    op_statsp->max_ns = atomic_load_explicit(&(slotp->max_ns), memory_order_relaxed);
+
+    for (int b = 0; b < DFS_STATS_NUM_OF_BUCKETS; b++) {
+      op_statsp->buckets[b] = atomic_load_explicit(&(slotp->buckets[b]), memory_order_relaxed);
+    }
+
+    for (int c = 0; c < DFS_STATS_NUM_OF_COUNTERS; c++) {
+      op_statsp->counters[c] = atomic_load_explicit(&(slotp->counters[c]), memory_order_relaxed);
+    }
+  }
+
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Gets an upper bound on a percentile of the latency of an operation
+ *
+ * \param op_statsp the stats of the operation
+ * \param fraction the percentile as a fraction, for example 0.99
+ * \return the top of the histogram bucket holding the percentile in ns, or
+ *         0 if the operation was never run
+ */
+uint64_t dfs_stats_percentile(const DFS_STATS_OP_STATS * op_statsp, double fraction) {
+  uint64_t total = 0;
+  uint64_t target;
+
+  if (op_statsp == NULL || op_statsp->count == 0) {
+    return 0;
+  }
+
+  /* The buckets may not quite add up to the count while operations run */
+  for (int b = 0; b < DFS_STATS_NUM_OF_BUCKETS; b++) {
+    total += op_statsp->buckets[b];
+  }
+
+  target = (uint64_t)(fraction * (double)total);
+  if (target >= total) {
+    target = total - 1;
+  }
+
+  for (int b = 0; b < DFS_STATS_NUM_OF_BUCKETS - 1; b++) {
+    if (target < op_statsp->buckets[b]) {
+      uint64_t top = 2ULL << b;
+      return (top < op_statsp->max_ns) ? top : op_statsp->max_ns;
+    }
+    target -= op_statsp->buckets[b];
+  }
+
+  return op_statsp->max_ns;
+}
+
+/**
+ * \brief Gets the name of an operation
+ *
+ * \param op the operation
+ * \return the name
+ */
+const char * dfs_stats_op_name(DFS_STATS_OP op) {
+  static const char * const names[DFS_STATS_NUM_OF_OPS] = {
+    "catalogue", "extract", "add", "format", "other"
+  };
+
+  return ((unsigned)op < DFS_STATS_NUM_OF_OPS) ? names[op] : "unknown";
+}
+
+/**
+ * \brief Gets the name of a counter
+ *
+ * \param counter the counter
+ * \return the name
+ */
+const char * dfs_stats_counter_name(DFS_STATS_COUNTER counter) {
+  static const char * const names[DFS_STATS_NUM_OF_COUNTERS] = {
+    "syscalls", "bytes read", "bytes written", "seeks", "sectors read", "sectors written", "allocs"
+  };
+
+  return ((unsigned)counter < DFS_STATS_NUM_OF_COUNTERS) ? names[counter] : "unknown";
+}
+
+/**
+ * \brief Marks the start of an operation
+ *
+ * An operation started while another is running on the same thread, such
+ * as the decode done by a catalogue read, is part of the outer one and is
+ * neither timed nor counted on its own.
+ *
+ * \param op the operation
+ * \return the start time to give to dfs_stats_end(), 0 if not timed
+ */
+uint64_t dfs_stats_begin(DFS_STATS_OP op) {
+  if (!atomic_load_explicit(&enabled, memory_order_relaxed) || current_op != DFS_STATS_OTHER) {
+    return 0;
+  }
+
+  current_op = op;
+  return now_ns();
+}
+
+/**
+ * \brief Marks the end of an operation
+ *
+ * \param op the operation
+ * \param start the time returned by dfs_stats_begin()
+ */
+void dfs_stats_end(DFS_STATS_OP op, uint64_t start) {
+  DFS_STATS_SLOT * slotp = &(slots[op]);
+  uint64_t elapsed;
+  uint64_t max_ns;
+
+  /* Collection may have been turned on during the operation */
+  if (start == 0) {
+    return;
+  }
+
+  elapsed = now_ns() - start;
+  current_op = DFS_STATS_OTHER;
+
+  atomic_fetch_add_explicit(&(slotp->count), 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&(slotp->total_ns), elapsed, memory_order_relaxed);
+  atomic_fetch_add_explicit(&(slotp->buckets[get_bucket(elapsed)]), 1, memory_order_relaxed);
+
+  max_ns = atomic_load_explicit(&(slotp->max_ns), memory_order_relaxed);
+  while (elapsed > max_ns && !atomic_compare_exchange_weak_explicit(&(slotp->max_ns), &max_ns, elapsed, memory_order_relaxed, memory_order_relaxed)) {
+  }
+}
+
+/**
+ * \brief Adds to a counter
+ *
+ * \param counter the counter
+ * \param n the amount to add
+ */
+void dfs_stats_count(DFS_STATS_COUNTER counter, uint64_t n) {
+  if (atomic_load_explicit(&enabled, memory_order_relaxed)) {
+    atomic_fetch_add_explicit(&(slots[current_op].counters[counter]), n, memory_order_relaxed);
+  }
+}
+
+/**
+ * \brief Counts a system call that read data
+ *
+ * \param bytes the number of bytes read
+ */
+void dfs_stats_count_read(uint64_t bytes) {
+  if (atomic_load_explicit(&enabled, memory_order_relaxed)) {
+    atomic_fetch_add_explicit(&(slots[current_op].counters[DFS_STATS_SYSCALLS]), 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&(slots[current_op].counters[DFS_STATS_BYTES_READ]), bytes, memory_order_relaxed);
+  }
+}
+
+/**
+ * \brief Counts a system call that wrote data
+ *
+ * \param bytes the number of bytes written
+ */
+void dfs_stats_count_write(uint64_t bytes) {
+  if (atomic_load_explicit(&enabled, memory_order_relaxed)) {
+    atomic_fetch_add_explicit(&(slots[current_op].counters[DFS_STATS_SYSCALLS]), 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&(slots[current_op].counters[DFS_STATS_BYTES_WRITTEN]), bytes, memory_order_relaxed);
+  }
+}
@@ -0,0 +1,223 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "acornfs.h"
+#include "dfserr.h"
+#include "dfstar.h"
+#include "debug.h"
+
+#define TAR_BLOCK_SIZE 512
+
+/* Room for the records of one extended header */
+#define TAR_PAX_SIZE 1024
+
+typedef struct {
+  char name[100];
+  char mode[8];
+  char uid[8];
+  char gid[8];
+  char size[12];
+  char mtime[12];
+  char checksum[8];
+  char typeflag;
+  char linkname[100];
+  char magic[6];
+  char version[2];
+  char uname[32];
+  char gname[32];
+  char devmajor[8];
+  char devminor[8];
+  char prefix[155];
+  char pad[12];
+} TAR_HEADER;
+
+static const uint8_t zero_block[TAR_BLOCK_SIZE];
+
+/* Puts a value in a field as octal digits followed by a NUL, failing if
+   there are not enough digits for it */
+static bool put_octal(char * field, size_t size, unsigned long long value) {
+  int digits = (int)size - 1;
+
+  if (digits < (int)(sizeof(value) * 8 + 2) / 3 && (value >> (digits * 3)) != 0) {
+    return false;
+  }
+
+  return snprintf(field, size, "%.*llo", digits, value) == digits;
+}
+
+/* Fills in a ustar header.  A name that does not fit is cut short, as the
+   whole name is also given in the extended header */
+static bool fill_header(TAR_HEADER * headerp, const char * name, char typeflag, unsigned mode, uint64_t size, time_t mtime) {
+  size_t name_length = strlen(name);
+  unsigned checksum = 0;
+
+  memset(headerp, 0, sizeof(TAR_HEADER));
+  memcpy(headerp->name, name, (name_length < sizeof(headerp->name)) ? name_length : sizeof(headerp->name));
+  if (!put_octal(headerp->mode, sizeof(headerp->mode), mode) ||
+      !put_octal(headerp->uid, sizeof(headerp->uid), 0) ||
+      !put_octal(headerp->gid, sizeof(headerp->gid), 0) ||
+      !put_octal(headerp->size, sizeof(headerp->size), size) ||
+      !put_octal(headerp->mtime, sizeof(headerp->mtime), (mtime > 0) ? (unsigned long long)mtime : 0)) {
+    return false;
+  }
+  headerp->typeflag = typeflag;
+  memcpy(headerp->magic, "ustar", 6);
+  memcpy(headerp->version, "00", 2);
+
+  /* The checksum is summed with its own field as spaces */
+  memset(headerp->checksum, ' ', sizeof(headerp->checksum));
+  for (size_t i = 0; i < sizeof(TAR_HEADER); i++) {
+    checksum += ((const uint8_t *)headerp)[i];
+  }
+  snprintf(headerp->checksum, sizeof(headerp->checksum), "%06o", checksum);
+
+  return true;
+}
+
+/* Adds a "length keyword=value\n" record, where the length counts itself */
+static bool add_record(char * records, size_t * lengthp, const char * keyword, const char * value) {
+  size_t length = strlen(keyword) + strlen(value) + 3;
+  size_t digits = (size_t)snprintf(NULL, 0, "%zu", length);
+
+  if ((size_t)snprintf(NULL, 0, "%zu", length + digits) > digits) {
+    digits++;
+  }
+  length += digits;
+
+  if (*lengthp + length >= TAR_PAX_SIZE) {
+    return false;
+  }
+
+  snprintf(records + *lengthp, TAR_PAX_SIZE - *lengthp, "%zu %s=%s\n", length, keyword, value);
+  *lengthp += length;
+
+  return true;
+}
+
+/* Writes data followed by zeros to the end of its last block */
+static int write_padded(FILE * tarfile, const void * data, size_t length) {
+  size_t padding = (TAR_BLOCK_SIZE - (length % TAR_BLOCK_SIZE)) % TAR_BLOCK_SIZE;
+
+  if ((length > 0 && fwrite(data, 1, length, tarfile) != length) ||
+      (padding > 0 && fwrite(zero_block, 1, padding, tarfile) != padding)) {
+    return DFS_ERROR_FAILED;
+  }
+
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Writes a file to a tar archive
+ *
+ * Each file is an extended header, named as GNU tar names them, followed
+ * by the file itself.
+ *
+ * \param tarfile the archive
+ * \param name the name of the file in the archive
+ * \param acorn_filep the file meta data
+ * \param data the contents of the file, of its length
+ * \param mtime the modification time to give the file
+ * \return 0 on success or an error
+ */
+int dfs_tar_write_file(FILE * tarfile, const char * name, const ACORN_FILE * acorn_filep, const uint8_t * data, time_t mtime) {
+  char records[TAR_PAX_SIZE];
+  char pax_name[sizeof(((TAR_HEADER *)NULL)->name) + 1];
+  char value[16];
+  const char * base;
+  size_t length = 0;
+  unsigned mode;
+  TAR_HEADER header;
+  bool ok = true;
+
+  if (tarfile == NULL || name == NULL || acorn_filep == NULL || (data == NULL && acorn_filep->length > 0)) {
+    return DFS_ERROR_FAILED;
+  }
+
+  if (strlen(name) > sizeof(header.name)) {
+    ok = add_record(records, &length, "path", name);
+  }
+
+  snprintf(value, sizeof(value), "0x%08x", acorn_filep->load_address);
+  ok = ok && add_record(records, &length, DFS_TAR_LOAD_KEYWORD, value);
+  snprintf(value, sizeof(value), "0x%08x", acorn_filep->exec_address);
+  ok = ok && add_record(records, &length, DFS_TAR_EXEC_KEYWORD, value);
+  ok = ok && add_record(records, &length, DFS_TAR_LOCKED_KEYWORD, (acorn_filep->attributes & LOCKED) ? "1" : "0");
+
+  if (!ok) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Name too long for a tar archive: %s", name);
+    return DFS_ERROR_FAILED;
+  }
+
+  base = strrchr(name, '/');
+  if (base != NULL) {
+    snprintf(pax_name, sizeof(pax_name), "%.*s/PaxHeaders/%s", (int)(base - name), name, base + 1);
+  } else {
+    snprintf(pax_name, sizeof(pax_name), "PaxHeaders/%s", name);
+  }
+
+  mode = (acorn_filep->attributes & LOCKED) ? 0444 : 0644;
+
+  if (!fill_header(&header, pax_name, 'x', 0644, length, mtime)) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Header field too small for a tar archive: %s", name);
+    return DFS_ERROR_FAILED;
+  }
+
+  if (fwrite(&header, sizeof(header), 1, tarfile) != 1 || write_padded(tarfile, records, length) != DFS_ERROR_NONE) {
+    return DFS_ERROR_FAILED;
+  }
+
+  if (!fill_header(&header, name, '0', mode, acorn_filep->length, mtime)) {
+    DEBUG_LOG(DEBUG_LEVEL_ERROR, "Header field too small for a tar archive: %s", name);
+    return DFS_ERROR_FAILED;
+  }
+
+  if (fwrite(&header, sizeof(header), 1, tarfile) != 1 || write_padded(tarfile, data, acorn_filep->length) != DFS_ERROR_NONE) {
+    return DFS_ERROR_FAILED;
+  }
+
+  return DFS_ERROR_NONE;
+}
+
+/**
+ * \brief Ends a tar archive
+ *
+ * An archive ends with two blocks of zeros.
+ *
+ * \param tarfile the archive
+ * \return 0 on success or an error
+ */
+int dfs_tar_finish(FILE * tarfile) {
+  if (tarfile == NULL ||
+      fwrite(zero_block, 1, sizeof(zero_block), tarfile) != sizeof(zero_block) ||
+      fwrite(zero_block, 1, sizeof(zero_block), tarfile) != sizeof(zero_block) ||
+      fflush(tarfile) != 0) {
+    return DFS_ERROR_FAILED;
+  }
+
+  return DFS_ERROR_NONE;
+}
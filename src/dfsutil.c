@@ -31,9 +31,24 @@ SOFTWARE.
 #include <unistd.h>
 #include <errno.h>
 #include <limits.h>
+#include <dirent.h>
+#include <strings.h>
+#include <inttypes.h>
 
 #include "dfs.h"
+#include "dfsalloc.h"
+#include "dfscache.h"
+#include "dfscorpus.h"
+#include "dfsdedupe.h"
+#include "dfshash.h"
+#include "dfsgeom.h"
+#include "dfsimage.h"
+#include "dfsmmb.h"
+#include "dfspack.h"
+#include "dfsstats.h"
+#include "dfstar.h"
 #include "acornfs.h"
+#include "threadpool.h"
 #include "debug.h"
 
 #ifndef PATH_MAX
@@ -50,15 +65,51 @@ SOFTWARE.
 
 static int tracks = 80;
 static char * target_dir = NULL;
+static int num_of_jobs = 0;
+static char * manifest_path = NULL;
+static int alloc_policy = DFS_ALLOC_FIRST_FIT;
+static char * template_path = NULL;
+static char * cache_path = NULL;
+static char * index_path = NULL;
+static char * pack_path = NULL;
+static int exit_status = EXIT_SUCCESS;
+
+/* Long options without a short equivalent */
+#define OPTION_ALLOC 0x100
+#define OPTION_TEMPLATE 0x101
+#define OPTION_SPLIT    0x102
+#define OPTION_JOIN     0x103
+#define OPTION_CACHE    0x104
+#define OPTION_INDEX    0x105
+#define OPTION_QUERY    0x106
+#define OPTION_DEDUPE   0x107
+#define OPTION_PACK     0x108
+#define OPTION_UNPACK   0x109
+#define OPTION_TAR      0x10a
+#define OPTION_STATS    0x10b
 
 static void short_help(void) {
   fprintf(stderr,
     "dfsutils - Acorn DFS disk image utilities\n\n"
     "Usage: dfsutils diskfile\n"
-    "   or: dfsutils --add [option] diskfile file load_address exec_address [locked]\n"
+    "   or: dfsutils [--cache cachefile] diskfile|dir|- [diskfile|dir|-]...\n"
+    "   or: dfsutils --add [option] diskfile file load_address exec_address [locked] [file...]\n"
+    "   or: dfsutils --add --manifest manifest [option] diskfile\n"
+    "   or: dfsutils --compact [option] diskfile [diskfile]...\n"
+    "   or: dfsutils --dedupe [option] diskfile|dir|- [diskfile|dir|-]...\n"
     "   or: dfsutils --extract [option] diskfile [file [file]...]\n"
+    "   or: dfsutils --extract --batch [option] diskfile|dir|- [diskfile|dir|-]...\n"
+    "   or: dfsutils --extract --tar [option] diskfile [file [file]...] > archive.tar\n"
+    "   or: dfsutils --extract --batch --tar [option] diskfile|dir|- [diskfile|dir|-]... > archive.tar\n"
     "   or: dfsutils --format [option] diskfile diskname\n"
+    "   or: dfsutils --format --template template [option] diskfile diskname\n"
+    "   or: dfsutils --index indexfile [option] diskfile|dir|- [diskfile|dir|-]...\n"
+    "   or: dfsutils --join side0file side1file dsdfile\n"
+    "   or: dfsutils --pack packfile diskfile|dir|- [diskfile|dir|-]...\n"
+    "   or: dfsutils --query indexfile [option] [predicate]...\n"
     "   or: dfsutils --remove [option] diskfile file [file [file]...]\n"
+    "   or: dfsutils --split dsdfile side0file side1file\n"
+    "   or: dfsutils --unpack packfile [option] [diskfile]...\n"
     "   or: dfsutils --update [option] diskfile file load_address exec_address [locked]\n"
   );
 }
@@ -69,10 +120,26 @@ static void help(void) {
     "\nOptions:\n"
     "       --40           Simulate 40 track disk\n"
     "       --80           Simulate 80 track disk (default)\n"
+    "       --alloc        Where to put added files: first (default), best or append\n"
+    "       --cache        Catalogue cache used when listing many disk images\n"
+    "       --dedupe       Report files with the same contents on many disk images\n"
+    "       --index        Index the files on many disk images\n"
+    "       --join         Join two single sided images into a double sided image\n"
+    "       --pack         Store many disk images with each distinct sector kept once\n"
+    "       --query        Find files in an index, e.g. load=0x1900 length>10K name=!BOOT\n"
+    "       --split        Split a double sided image into two single sided images\n"
+    "       --stats        Report counters and latencies for each operation on exit\n"
+    "       --tar          Write extracted files to stdout as a tar archive\n"
+    "       --template     Disk image to clone when formatting\n"
+    "       --unpack       Rebuild disk images from a pack file\n"
     "   -a, --add          Add a file to the disk image\n"
+    "   -b, --batch        Extract each of many disk images to its own directory\n"
+    "   -c, --compact      Move files together so all free space is at the end\n"
     "   -d, --dir          Target directory\n"
     "   -f, --format       Creates a disk image (overwrites any existing file)\n"
     "   -h, --help         Display help\n"
+    "   -j, --jobs         Number of worker threads for batch and extract operations\n"
+    "   -m, --manifest     File listing files to add, one per line\n"
     "   -r, --remove       Remove a file from the disk image\n"
     "   -u, --update       Update the properties of a file\n"
     "   -v, --verbose      Raise the verbosity (can be used more than once)\n"
@@ -86,6 +153,12 @@ static int dfs_error_to_exit_status(int dfserr) {
       return EXIT_SUCCESS;
     case DFS_ERROR_NOT_A_DFS_DISK:
       return DFSUTILS_NOT_A_DFSDISK;
+    case DFS_ERROR_IMAGE_NOT_FOUND:
+      return DFSUTILS_DISKFILE_NOT_FOUND;
+    case DFS_ERROR_OPEN_FAILED:
+      return DFSUTILS_OPEN_FAILED;
+    case DFS_ERROR_FILE_NOT_FOUND:
+      return DFSUTILS_FILE_NOT_FOUND;
     case DFS_ERROR_FAILED:
       /* Drop through */
     default:
@@ -93,95 +166,2031 @@ static int dfs_error_to_exit_status(int dfserr) {
   }
 }
 
-static int list_diskfile(int argc, char * argv[]) {
-  static char * optionstr[] = {
-    "None",
-    "Load",
-    "Run",
-    "Exec"
-  };
+static int open_diskfile(const char * path, int flags, DFS_IMAGE ** imagepp) {
+  int ret = dfs_image_open(path, flags, imagepp);
+
+  if (ret == DFS_ERROR_IMAGE_NOT_FOUND) {
+    fprintf(stderr, "File not found: %s\n", path);
+    return DFSUTILS_DISKFILE_NOT_FOUND;
+  }
+
+  if (ret == DFS_ERROR_NOT_AN_MMB) {
+    fprintf(stderr, "Not an MMB file: %s\n", path);
+    return DFSUTILS_NOT_A_DFSDISK;
+  }
+
+  if (ret == DFS_ERROR_INVALID_SLOT) {
+    fprintf(stderr, "No disk in MMB slot: %s\n", path);
+    return DFSUTILS_NOT_A_DFSDISK;
+  }
+
+  if (ret == DFS_ERROR_READ_ONLY) {
+    fprintf(stderr, "MMB slot is locked: %s\n", path);
+    return DFSUTILS_OPEN_FAILED;
+  }
+
+  if (ret != DFS_ERROR_NONE) {
+    fprintf(stderr, "Could not open: %s (%s)\n", path, strerror(errno));
+    return DFSUTILS_OPEN_FAILED;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+static void print_catalogue(const ACORN_DIRECTORY * acorn_dirp) {
+  static char * optionstr[] = {
+    "None",
+    "Load",
+    "Run",
+    "Exec"
+  };
+
+  printf("Name   : %s\n", acorn_dirp->name);
+  printf("Options: %d (%s)\n", acorn_dirp->options, optionstr[acorn_dirp->options]);
+  printf("----------------------------------------------------------------\n");
+
+  if (acorn_dirp->num_of_files) {
+    const ACORN_FILE * acorn_filep = &(acorn_dirp->files[0]);
+
+    for (int i = 0; i < acorn_dirp->num_of_files; i++) {
+      printf("  %-16s 0x%08x 0x%08x %10u %10u\n",
+        acorn_filep->name,
+        acorn_filep->load_address,
+        acorn_filep->exec_address,
+        acorn_filep->length,
+        acorn_filep->start_sector);
+      acorn_filep++;
+    }
+
+    printf("----------------------------------------------------------------\n");
+  }
+
+  printf("%d files\n", acorn_dirp->num_of_files);
+}
+
+static bool is_mmb_name(const char * name) {
+  const char * ext = strrchr(name, '.');
+
+  return (ext != NULL) && (strcasecmp(ext, ".mmb") == 0);
+}
+
+static bool is_dsd_name(const char * name) {
+  const char * ext = strrchr(name, '.');
+
+  return (ext != NULL) && (strcasecmp(ext, ".dsd") == 0);
+}
+
+/* Gets the side of a file.dsd:side name */
+static bool is_dsd_side_name(const char * name, int * sidep) {
+  char dsd_path[PATH_MAX + 1];
+  const char * colon = strrchr(name, ':');
+
+  if (colon == NULL || (size_t)(colon - name) >= sizeof(dsd_path)) {
+    return false;
+  }
+
+  memcpy(dsd_path, name, (size_t)(colon - name));
+  dsd_path[colon - name] = '\0';
+
+  *sidep = atoi(colon + 1);
+  return is_dsd_name(dsd_path);
+}
+
+typedef struct {
+  const DFS_MMB * mmbp;
+  int slot;
+  ACORN_DIRECTORY * acorn_dirp;
+  char output_dir[PATH_MAX + 1];
+  int file_count;
+  int status;
+} MMB_JOB;
+
+/* Sets up a job for each disk in an MMB file, in slot order */
+static int open_mmb(const char * path, DFS_MMB ** mmbpp, MMB_JOB ** jobsp, int * num_of_disksp) {
+  const DFS_MMB_INDEX * indexp;
+  MMB_JOB * jobs;
+  int num_of_disks = 0;
+  int ret;
+
+  ret = dfs_mmb_open(path, mmbpp);
+  if (ret != DFS_ERROR_NONE) {
+    if (ret == DFS_ERROR_IMAGE_NOT_FOUND) {
+      fprintf(stderr, "File not found: %s\n", path);
+    } else if (ret == DFS_ERROR_NOT_AN_MMB) {
+      fprintf(stderr, "Not an MMB file: %s\n", path);
+    } else {
+      fprintf(stderr, "Could not open: %s (%s)\n", path, strerror(errno));
+    }
+    return dfs_error_to_exit_status(ret);
+  }
+
+  indexp = dfs_mmb_get_index(*mmbpp);
+
+  jobs = (MMB_JOB *)calloc(DFS_MMB_MAX_SLOTS, sizeof(MMB_JOB));
+  if (jobs == NULL) {
+    dfs_mmb_close(*mmbpp);
+    return DFSUTILS_ERROR_FAILED;
+  }
+
+  for (int slot = 0; slot < indexp->num_of_slots; slot++) {
+    if (dfs_mmb_slot_is_formatted(indexp, slot)) {
+      jobs[num_of_disks].mmbp = *mmbpp;
+      jobs[num_of_disks].slot = slot;
+      num_of_disks++;
+    }
+  }
+
+  *jobsp = jobs;
+  *num_of_disksp = num_of_disks;
+  return EXIT_SUCCESS;
+}
+
+static void close_mmb(DFS_MMB * mmbp, MMB_JOB * jobs, int num_of_disks) {
+  for (int i = 0; i < num_of_disks; i++) {
+    if (jobs[i].acorn_dirp != NULL) {
+      acornfs_free_directory(jobs[i].acorn_dirp);
+    }
+  }
+
+  free(jobs);
+  dfs_mmb_close(mmbp);
+}
+
+static void list_mmb_job(void * context, size_t index) {
+  MMB_JOB * jobp = &(((MMB_JOB *)context)[index]);
+
+  jobp->status = dfs_error_to_exit_status(dfs_mmb_get_catalogue(jobp->mmbp, jobp->slot, &(jobp->acorn_dirp)));
+}
+
+/* Lists every disk in an MMB file.  The catalogues are decoded in parallel
+   then printed in slot order */
+static int list_mmb(const char * path) {
+  DFS_MMB * mmbp;
+  MMB_JOB * jobs;
+  int num_of_disks;
+  int ret;
+
+  ret = open_mmb(path, &mmbp, &jobs, &num_of_disks);
+  if (ret != EXIT_SUCCESS) {
+    return ret;
+  }
+
+  threadpool_run(
+    num_of_jobs > 0 ? num_of_jobs : threadpool_default_threads(),
+    (size_t)num_of_disks,
+    list_mmb_job,
+    jobs);
+
+  for (int i = 0; i < num_of_disks; i++) {
+    printf("Slot   : %d\n", jobs[i].slot);
+
+    if (jobs[i].status != EXIT_SUCCESS) {
+      printf("Not a DFS disk\n\n");
+      if (ret == EXIT_SUCCESS) {
+        ret = jobs[i].status;
+      }
+      continue;
+    }
+
+    print_catalogue(jobs[i].acorn_dirp);
+    printf("\n");
+  }
+
+  printf("%d disks\n", num_of_disks);
+  close_mmb(mmbp, jobs, num_of_disks);
+
+  return ret;
+}
+
+static int list_diskfile(int argc, char * argv[]) {
+  const ACORN_DIRECTORY * acorn_dirp;
+  DFS_IMAGE * imagep;
+  int ret;
+
+  /* A whole MMB file rather than one of its slots */
+  if (is_mmb_name(argv[0])) {
+    return list_mmb(argv[0]);
+  }
+
+  ret = open_diskfile(argv[0], DFS_IMAGE_READ | DFS_IMAGE_MMAP, &imagep);
+  if (ret != EXIT_SUCCESS) {
+    return ret;
+  }
+
+  ret = dfs_image_get_catalogue(imagep, &acorn_dirp);
+  if (ret != DFS_ERROR_NONE) {
+    dfs_image_close(imagep);
+    return dfs_error_to_exit_status(ret);
+  }
+
+  print_catalogue(acorn_dirp);
+  dfs_image_close(imagep);
+
+  return EXIT_SUCCESS;
+}
+
+static FILE * create_output_file(const char * dirname, const ACORN_FILE * acorn_filep, bool verbose) {
+  char path[PATH_MAX + 1];
+  FILE * file;
+
+  if ((size_t)snprintf(path, sizeof(path), "%s/%s", dirname, acorn_filep->name) >= sizeof(path)) {
+    fprintf(stderr, "Path too long: %s/%s\n", dirname, acorn_filep->name);
+    errno = ENAMETOOLONG;
+    return NULL;
+  }
+
+  if (verbose) {
+    printf("Extracting: %s\n", path);
+  }
+
+  file = fopen(path, "wb");
+  if (file == NULL) {
+    fprintf(stderr, "File error: %s\n", strerror(errno));
+  }
+
+  return file;
+}
+
+/* Closes output files, which writes out whatever stdio still holds */
+static int close_output_files(FILE ** files, int num_of_files) {
+  int ret = EXIT_SUCCESS;
+
+  for (int i = 0; i < num_of_files; i++) {
+    if (fclose(files[i]) != 0) {
+      fprintf(stderr, "File error: %s\n", strerror(errno));
+      ret = DFSUTILS_ERROR_FAILED;
+    }
+  }
+
+  return ret;
+}
+
+/* Removes output files that were created but could not all be written */
+static void remove_output_files(const char * dirname, const ACORN_FILE ** acorn_files, int num_of_files) {
+  char path[PATH_MAX + 1];
+
+  for (int i = 0; i < num_of_files; i++) {
+    if ((size_t)snprintf(path, sizeof(path), "%s/%s", dirname, acorn_files[i]->name) < sizeof(path)) {
+      unlink(path);
+    }
+  }
+}
+
+/* Creates the output files for a number of disk files, all or none */
+static int create_output_files(const char * dirname, const ACORN_FILE ** acorn_files, int num_of_files, bool verbose, FILE ** files) {
+  for (int i = 0; i < num_of_files; i++) {
+    files[i] = create_output_file(dirname, acorn_files[i], verbose);
+    if (files[i] == NULL) {
+      close_output_files(files, i);
+      remove_output_files(dirname, acorn_files, i);
+      return DFSUTILS_OPEN_FAILED;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/* Leaves out the files whose contents are not all on their disk, an image
+   or else a slot of an MMB file, so no output is created for them and the
+   rest can still be extracted.  Returns the status of the first left out */
+static int keep_whole_files(DFS_IMAGE * imagep, const DFS_MMB * mmbp, int slot, const ACORN_FILE ** acorn_files, int * num_of_filesp) {
+  int ret = EXIT_SUCCESS;
+  int num_of_kept = 0;
+
+  for (int i = 0; i < *num_of_filesp; i++) {
+    int dfserr = (imagep != NULL) ?
+      dfs_image_check_file(imagep, acorn_files[i]) :
+      dfs_mmb_check_file(mmbp, slot, acorn_files[i]);
+
+    if (dfserr == DFS_ERROR_NONE) {
+      acorn_files[num_of_kept++] = acorn_files[i];
+    } else {
+      fprintf(stderr, "Could not extract: %s%s\n", acorn_files[i]->name, (dfserr == DFS_ERROR_BAD_EXTENT) ? " (runs off the end of the disk)" : "");
+      if (ret == EXIT_SUCCESS) {
+        ret = dfs_error_to_exit_status(dfserr);
+      }
+    }
+  }
+
+  *num_of_filesp = num_of_kept;
+  return ret;
+}
+
+/* Extracts files from a disk image, or a slot of an MMB file when there is
+   no image, reading them in disk order.  Files that are not all on the disk
+   are left out of the array.  If the rest cannot all be written none are
+   kept */
+static int extract_files(DFS_IMAGE * imagep, const DFS_MMB * mmbp, int slot, const char * dirname, const ACORN_FILE ** acorn_files, int num_of_files, bool verbose, int * file_countp) {
+  FILE ** files;
+  int ret;
+  int status;
+
+  *file_countp = 0;
+
+  ret = keep_whole_files(imagep, mmbp, slot, acorn_files, &num_of_files);
+  if (num_of_files == 0) {
+    return ret;
+  }
+
+  files = (FILE **)calloc((size_t)num_of_files + 1, sizeof(FILE *));
+  if (files == NULL) {
+    return DFSUTILS_ERROR_FAILED;
+  }
+
+  status = create_output_files(dirname, acorn_files, num_of_files, verbose, files);
+  if (status == EXIT_SUCCESS) {
+    int dfserr = (imagep != NULL) ?
+      dfs_image_extract_files(imagep, acorn_files, files, num_of_files) :
+      dfs_mmb_extract_files(mmbp, slot, acorn_files, files, num_of_files);
+
+    status = close_output_files(files, num_of_files);
+    if (dfserr != DFS_ERROR_NONE) {
+      status = dfs_error_to_exit_status(dfserr);
+    }
+
+    if (status == EXIT_SUCCESS) {
+      *file_countp = num_of_files;
+    } else {
+      remove_output_files(dirname, acorn_files, num_of_files);
+    }
+  }
+
+  free(files);
+  return (ret != EXIT_SUCCESS) ? ret : status;
+}
+
+typedef struct {
+  DFS_IMAGE * imagep;
+  const ACORN_FILE ** acorn_files;
+  FILE ** files;
+  int * errors;
+} EXTRACT_JOB;
+
+static void extract_file_job(void * context, size_t index) {
+  EXTRACT_JOB * jobp = (EXTRACT_JOB *)context;
+
+  jobp->errors[index] = dfs_image_extract_file(jobp->imagep, jobp->acorn_files[index], jobp->files[index]);
+}
+
+/* Extracts the files of one image a file per job.  The image is only read
+   at an offset so the jobs share it.  Files that are not all on the disk
+   are left out of the array, and any that cannot be written are removed */
+static int extract_files_parallel(DFS_IMAGE * imagep, const char * dirname, const ACORN_FILE ** acorn_files, int num_of_files, bool verbose, int * file_countp) {
+  EXTRACT_JOB job;
+  int ret;
+  int status;
+
+  *file_countp = 0;
+
+  ret = keep_whole_files(imagep, NULL, 0, acorn_files, &num_of_files);
+  if (num_of_files == 0) {
+    return ret;
+  }
+
+  job.imagep = imagep;
+  job.acorn_files = acorn_files;
+  job.files = (FILE **)calloc((size_t)num_of_files + 1, sizeof(FILE *));
+  job.errors = (int *)calloc((size_t)num_of_files + 1, sizeof(int));
+  if (job.files == NULL || job.errors == NULL) {
+    free(job.files);
+    free(job.errors);
+    return DFSUTILS_ERROR_FAILED;
+  }
+
+  status = create_output_files(dirname, acorn_files, num_of_files, verbose, job.files);
+  if (status == EXIT_SUCCESS) {
+    threadpool_run(num_of_jobs, (size_t)num_of_files, extract_file_job, &job);
+
+    status = close_output_files(job.files, num_of_files);
+    for (int i = 0; i < num_of_files; i++) {
+      if (status != EXIT_SUCCESS) {
+        remove_output_files(dirname, &(acorn_files[i]), 1);
+      } else if (job.errors[i] != DFS_ERROR_NONE) {
+        fprintf(stderr, "Could not extract: %s\n", acorn_files[i]->name);
+        remove_output_files(dirname, &(acorn_files[i]), 1);
+        if (ret == EXIT_SUCCESS) {
+          ret = dfs_error_to_exit_status(job.errors[i]);
+        }
+      } else {
+        (*file_countp)++;
+      }
+    }
+
+    if (status != EXIT_SUCCESS) {
+      *file_countp = 0;
+    }
+  }
+
+  free(job.files);
+  free(job.errors);
+  return (ret != EXIT_SUCCESS) ? ret : status;
+}
+
+/* Output directory for an image is its file name without the extension */
+static void batch_output_dir(const char * image_path, const char * parent, char * dirname, size_t size) {
+  const char * base = strrchr(image_path, '/');
+  const char * ext;
+  int base_len;
+
+  base = (base != NULL) ? base + 1 : image_path;
+  ext = strrchr(base, '.');
+  base_len = (ext != NULL && ext != base) ? (int)(ext - base) : (int)strlen(base);
+
+  snprintf(dirname, size, "%s/%.*s", parent, base_len, base);
+}
+
+static void extract_mmb_job(void * context, size_t index) {
+  MMB_JOB * jobp = &(((MMB_JOB *)context)[index]);
+  const ACORN_FILE * acorn_files[DFS_MAX_FILES];
+  int ret;
+
+  ret = dfs_mmb_get_catalogue(jobp->mmbp, jobp->slot, &(jobp->acorn_dirp));
+  if (ret != DFS_ERROR_NONE) {
+    fprintf(stderr, "Could not read catalogue: slot %d\n", jobp->slot);
+    jobp->status = dfs_error_to_exit_status(ret);
+    return;
+  }
+
+  if (mkdir(jobp->output_dir, 0777) == -1) {
+    fprintf(stderr, "Could not create: %s (%s)\n", jobp->output_dir, strerror(errno));
+    jobp->status = DFSUTILS_OPEN_FAILED;
+    return;
+  }
+
+  for (int i = 0; i < jobp->acorn_dirp->num_of_files; i++) {
+    acorn_files[i] = &(jobp->acorn_dirp->files[i]);
+  }
+
+  jobp->status = extract_files(NULL, jobp->mmbp, jobp->slot, jobp->output_dir, acorn_files, jobp->acorn_dirp->num_of_files, verbosity >= DEBUG_LEVEL_INFO, &(jobp->file_count));
+
+  printf("Slot %d: %d files extracted to %s\n", jobp->slot, jobp->file_count, jobp->output_dir);
+}
+
+/* Extracts every disk in an MMB file, each to its own directory named
+   after its slot.  The slots are handed out in order so the MMB file is
+   read from front to back however many threads there are */
+static int extract_mmb(const char * path, const char * dirname, int * num_of_disksp, int * num_of_failedp) {
+  DFS_MMB * mmbp;
+  MMB_JOB * jobs;
+  int num_of_disks;
+  int ret;
+
+  ret = open_mmb(path, &mmbp, &jobs, &num_of_disks);
+  if (ret != EXIT_SUCCESS) {
+    return ret;
+  }
+
+  if (mkdir(dirname, 0777) == -1 && errno != EEXIST) {
+    fprintf(stderr, "Could not create: %s (%s)\n", dirname, strerror(errno));
+    close_mmb(mmbp, jobs, num_of_disks);
+    return DFSUTILS_OPEN_FAILED;
+  }
+
+  for (int i = 0; i < num_of_disks; i++) {
+    snprintf(jobs[i].output_dir, sizeof(jobs[i].output_dir), "%s/%03d", dirname, jobs[i].slot);
+  }
+
+  threadpool_run(
+    num_of_jobs > 0 ? num_of_jobs : threadpool_default_threads(),
+    (size_t)num_of_disks,
+    extract_mmb_job,
+    jobs);
+
+  for (int i = 0; i < num_of_disks; i++) {
+    if (jobs[i].status != EXIT_SUCCESS) {
+      if (ret == EXIT_SUCCESS) {
+        ret = jobs[i].status;
+      }
+      (*num_of_failedp)++;
+    }
+  }
+
+  *num_of_disksp += num_of_disks;
+  close_mmb(mmbp, jobs, num_of_disks);
+
+  return ret;
+}
+
+static int extract_diskfile(int argc, char * argv[]) {
+  const ACORN_DIRECTORY * acorn_dirp;
+  const ACORN_FILE ** acorn_files;
+  DFS_IMAGE * imagep;
+  const char * dirname;
+  int num_of_files;
+  int ret;
+  int file_count = 0;
+
+  /* Every disk of a whole MMB file */
+  if (is_mmb_name(argv[0])) {
+    char mmb_dirname[PATH_MAX + 1];
+    int num_of_disks = 0;
+    int num_of_failed = 0;
+
+    if (argc > 1) {
+      fprintf(stderr, "Give a slot to extract files from one disk: %s:slot\n", argv[0]);
+      return DFSUTILS_ERROR_FAILED;
+    }
+
+    if (target_dir != NULL) {
+      snprintf(mmb_dirname, sizeof(mmb_dirname), "%s", target_dir);
+    } else {
+      batch_output_dir(argv[0], ".", mmb_dirname, sizeof(mmb_dirname));
+    }
+
+    printf("Output dir: %s\n", mmb_dirname);
+    ret = extract_mmb(argv[0], mmb_dirname, &num_of_disks, &num_of_failed);
+    printf("%d disks extracted, %d failed\n", num_of_disks - num_of_failed, num_of_failed);
+
+    return ret;
+  }
+
+  ret = open_diskfile(argv[0], DFS_IMAGE_READ | DFS_IMAGE_MMAP, &imagep);
+  if (ret != EXIT_SUCCESS) {
+    return ret;
+  }
+
+  ret = dfs_image_get_catalogue(imagep, &acorn_dirp);
+  if (ret != DFS_ERROR_NONE) {
+    dfs_image_close(imagep);
+    return dfs_error_to_exit_status(ret);
+  }
+
+  if (acorn_dirp->num_of_files == 0) {
+    printf("Disk image empty! Nothing to extract.\n");
+    dfs_image_close(imagep);
+    return 0;
+  }
+
+  if (target_dir != NULL) {
+    dirname = target_dir;
+  } else {
+    dirname = acorn_dirp->name;
+  }
+
+  ret = mkdir(dirname, 0777);
+  if (ret == -1) {
+    fprintf(stderr, "Could not create: %s (%s)\n", dirname, strerror(errno));
+    dfs_image_close(imagep);
+    return DFSUTILS_OPEN_FAILED;
+  }
+
+  printf("Output dir: %s\n", dirname);
+
+  argc --;
+  argv ++;
+
+  /* Every file is found before any is extracted */
+  num_of_files = (argc > 0) ? argc : acorn_dirp->num_of_files;
+  acorn_files = (const ACORN_FILE **)malloc((size_t)num_of_files * sizeof(ACORN_FILE *));
+  if (acorn_files == NULL) {
+    dfs_image_close(imagep);
+    return DFSUTILS_ERROR_FAILED;
+  }
+
+  ret = EXIT_SUCCESS;
+  for (int i = 0; i < num_of_files; i++) {
+    if (argc == 0) {
+      acorn_files[i] = &(acorn_dirp->files[i]);
+    } else if (dfs_image_find_file(imagep, argv[i], &(acorn_files[i])) != DFS_ERROR_NONE) {
+      fprintf(stderr, "File not found: %s\n", argv[i]);
+      ret = DFSUTILS_FILE_NOT_FOUND;
+      break;
+    }
+  }
+
+  /* With more than one job the files are extracted side by side, otherwise
+     in a single sweep of the disk */
+  if (ret == EXIT_SUCCESS && num_of_jobs > 1) {
+    ret = extract_files_parallel(imagep, dirname, acorn_files, num_of_files, true, &file_count);
+  } else if (ret == EXIT_SUCCESS) {
+    ret = extract_files(imagep, NULL, 0, dirname, acorn_files, num_of_files, true, &file_count);
+  }
+
+  free(acorn_files);
+
+  printf("%d files extracted\n", file_count);
+  dfs_image_close(imagep);
+
+  return ret;
+}
+
+typedef struct {
+  char ** paths;
+  size_t num_of_paths;
+  size_t capacity;
+} PATH_LIST;
+
+typedef struct {
+  const char * image_path;
+  char output_dir[PATH_MAX + 1];
+  int file_count;
+  int status;
+} BATCH_JOB;
+
+static int path_list_add(PATH_LIST * listp, const char * path) {
+  if (listp->num_of_paths == listp->capacity) {
+    size_t capacity = listp->capacity ? listp->capacity * 2 : 64;
+    char ** paths = (char **)realloc(listp->paths, capacity * sizeof(char *));
+    if (paths == NULL) {
+      return DFSUTILS_ERROR_FAILED;
+    }
+
+    listp->paths = paths;
+    listp->capacity = capacity;
+  }
+
+  listp->paths[listp->num_of_paths] = strdup(path);
+  if (listp->paths[listp->num_of_paths] == NULL) {
+    return DFSUTILS_ERROR_FAILED;
+  }
+
+  listp->num_of_paths++;
+  return EXIT_SUCCESS;
+}
+
+static void path_list_free(PATH_LIST * listp) {
+  for (size_t i = 0; i < listp->num_of_paths; i++) {
+    free(listp->paths[i]);
+  }
+
+  free(listp->paths);
+}
+
+static int compare_paths(const void * a, const void * b) {
+  return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static bool is_disk_image_name(const char * name) {
+  const char * ext = strrchr(name, '.');
+
+  return (ext != NULL) && (strcasecmp(ext, ".ssd") == 0 || strcasecmp(ext, ".dsd") == 0 || strcasecmp(ext, ".mmb") == 0);
+}
+
+static bool is_directory(const char * path) {
+  struct stat st;
+
+  return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/* Adds the disk images in a directory, in name order */
+static int collect_directory(PATH_LIST * listp, const char * dirname) {
+  char path[PATH_MAX + 1];
+  struct dirent * entryp;
+  size_t first = listp->num_of_paths;
+  DIR * dirp = opendir(dirname);
+
+  if (dirp == NULL) {
+    fprintf(stderr, "Could not open: %s (%s)\n", dirname, strerror(errno));
+    return DFSUTILS_OPEN_FAILED;
+  }
+
+  while ((entryp = readdir(dirp)) != NULL) {
+    if (entryp->d_name[0] == '.' || !is_disk_image_name(entryp->d_name)) {
+      continue;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", dirname, entryp->d_name);
+    if (path_list_add(listp, path) != EXIT_SUCCESS) {
+      closedir(dirp);
+      return DFSUTILS_ERROR_FAILED;
+    }
+  }
+
+  closedir(dirp);
+
+  qsort(listp->paths + first, listp->num_of_paths - first, sizeof(char *), compare_paths);
+  return EXIT_SUCCESS;
+}
+
+/* Adds disk image names read one per line from stdin */
+static int collect_stdin(PATH_LIST * listp) {
+  char * line = NULL;
+  size_t line_size = 0;
+  ssize_t len;
+  int ret = EXIT_SUCCESS;
+
+  while ((len = getline(&line, &line_size, stdin)) != -1) {
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+      line[--len] = '\0';
+    }
+
+    if (len == 0) {
+      continue;
+    }
+
+    ret = path_list_add(listp, line);
+    if (ret != EXIT_SUCCESS) {
+      break;
+    }
+  }
+
+  free(line);
+  return ret;
+}
+
+static int collect_images(PATH_LIST * listp, int argc, char * argv[]) {
+  int ret;
+
+  for (int i = 0; i < argc; i++) {
+    if (strcmp(argv[i], "-") == 0) {
+      ret = collect_stdin(listp);
+    } else if (is_directory(argv[i])) {
+      ret = collect_directory(listp, argv[i]);
+    } else {
+      ret = path_list_add(listp, argv[i]);
+    }
+
+    if (ret != EXIT_SUCCESS) {
+      return ret;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/* Adds each disk of a whole MMB file as file.mmb:slot, so that the disks
+   are cached one by one.  Only the index of the MMB file is read */
+static int expand_mmb(PATH_LIST * listp, const char * path) {
+  char slot_path[PATH_MAX + 1];
+  DFS_MMB_INDEX * indexp;
+  FILE * mmbfile;
+  int ret;
+
+  indexp = (DFS_MMB_INDEX *)malloc(sizeof(DFS_MMB_INDEX));
+  if (indexp == NULL) {
+    return DFSUTILS_ERROR_FAILED;
+  }
+
+  /* A file that cannot be read as an MMB is listed as it is, and fails */
+  mmbfile = fopen(path, "rb");
+  if (mmbfile == NULL || dfs_mmb_read_index(mmbfile, indexp) != DFS_ERROR_NONE) {
+    if (mmbfile != NULL) {
+      fclose(mmbfile);
+    }
+    free(indexp);
+    return path_list_add(listp, path);
+  }
+
+  fclose(mmbfile);
+
+  ret = EXIT_SUCCESS;
+  for (int slot = 0; slot < indexp->num_of_slots && ret == EXIT_SUCCESS; slot++) {
+    if (dfs_mmb_slot_is_formatted(indexp, slot)) {
+      snprintf(slot_path, sizeof(slot_path), "%s:%d", path, slot);
+      ret = path_list_add(listp, slot_path);
+    }
+  }
+
+  free(indexp);
+  return ret;
+}
+
+/* Adds both sides of a double sided image as file.dsd:side */
+static int expand_dsd(PATH_LIST * listp, const char * path) {
+  char side_path[PATH_MAX + 1];
+  int ret = EXIT_SUCCESS;
+
+  for (int side = 0; side < DFS_DSD_NUM_OF_SIDES && ret == EXIT_SUCCESS; side++) {
+    snprintf(side_path, sizeof(side_path), "%s:%d", path, side);
+    ret = path_list_add(listp, side_path);
+  }
+
+  return ret;
+}
+
+/* Collects disk images as collect_images() does, but with each disk of a
+   whole MMB file and each side of a double sided image as a separate
+   image.  On failure the list is freed */
+static int collect_disks(PATH_LIST * listp, int argc, char * argv[]) {
+  PATH_LIST images = { NULL, 0, 0 };
+  int ret;
+
+  memset(listp, 0, sizeof(PATH_LIST));
+
+  ret = collect_images(&images, argc, argv);
+  for (size_t i = 0; i < images.num_of_paths && ret == EXIT_SUCCESS; i++) {
+    if (is_mmb_name(images.paths[i])) {
+      ret = expand_mmb(listp, images.paths[i]);
+    } else if (is_dsd_name(images.paths[i])) {
+      ret = expand_dsd(listp, images.paths[i]);
+    } else {
+      ret = path_list_add(listp, images.paths[i]);
+    }
+  }
+
+  path_list_free(&images);
+  if (ret != EXIT_SUCCESS) {
+    path_list_free(listp);
+  }
+
+  return ret;
+}
+
+typedef struct {
+  const char * image_path;
+  DFS_CACHE_KEY key;
+  ACORN_DIRECTORY * acorn_dirp;
+  bool cached;
+  int status;
+} LIST_JOB;
+
+/* Copies a catalogue so that it outlives its image */
+static ACORN_DIRECTORY * copy_catalogue(const ACORN_DIRECTORY * acorn_dirp) {
+  ACORN_DIRECTORY * copyp = acornfs_alloc_directory(acorn_dirp->num_of_files, DFS_DISK_NAME_SIZE, DFS_FILE_NAME_SIZE);
+
+  if (copyp == NULL) {
+    return NULL;
+  }
+
+  strcpy(copyp->name, acorn_dirp->name);
+  copyp->options = acorn_dirp->options;
+
+  for (int i = 0; i < acorn_dirp->num_of_files; i++) {
+    char * name = copyp->files[i].name;
+
+    copyp->files[i] = acorn_dirp->files[i];
+    copyp->files[i].name = strcpy(name, acorn_dirp->files[i].name);
+  }
+
+  return copyp;
+}
+
+/* Reads the catalogue of an image that is not in the cache */
+static void list_image_job(void * context, size_t index) {
+  LIST_JOB * jobp = &(((LIST_JOB *)context)[index]);
+  const ACORN_DIRECTORY * acorn_dirp;
+  DFS_IMAGE * imagep;
+  int ret;
+
+  if (jobp->cached || jobp->status != EXIT_SUCCESS) {
+    return;
+  }
+
+  ret = dfs_image_open(jobp->image_path, DFS_IMAGE_READ | DFS_IMAGE_MMAP, &imagep);
+  if (ret != DFS_ERROR_NONE) {
+    jobp->status = dfs_error_to_exit_status(ret);
+    return;
+  }
+
+  ret = dfs_image_get_catalogue(imagep, &acorn_dirp);
+  if (ret == DFS_ERROR_NONE) {
+    ret = dfs_image_get_cycle_number(imagep, &(jobp->key.cycle_number));
+  }
+
+  /* The catalogue belongs to the image so a copy is kept for printing */
+  if (ret == DFS_ERROR_NONE) {
+    jobp->acorn_dirp = copy_catalogue(acorn_dirp);
+    if (jobp->acorn_dirp == NULL) {
+      ret = DFS_ERROR_FAILED;
+    }
+  }
+
+  dfs_image_close(imagep);
+  jobp->status = dfs_error_to_exit_status(ret);
+}
+
+static void free_catalogues(PATH_LIST * listp, LIST_JOB * jobs) {
+  for (size_t i = 0; i < listp->num_of_paths; i++) {
+    if (jobs[i].acorn_dirp != NULL) {
+      acornfs_free_directory(jobs[i].acorn_dirp);
+    }
+  }
+
+  free(jobs);
+  path_list_free(listp);
+}
+
+/* Gets the catalogues of many disk images.  With a cache only the images
+   that have changed since they were last read are read, in parallel, and
+   the other catalogues come from the cache.  Unless no jobs are returned
+   they must be freed with free_catalogues() */
+static int read_catalogues(int argc, char * argv[], PATH_LIST * listp, LIST_JOB ** jobsp, int * num_of_readp) {
+  DFS_CACHE * cachep = NULL;
+  LIST_JOB * jobs;
+  int num_of_read = 0;
+  int ret;
+
+  *jobsp = NULL;
+
+  ret = collect_disks(listp, argc, argv);
+  if (ret != EXIT_SUCCESS) {
+    return ret;
+  }
+
+  if (cache_path != NULL) {
+    ret = dfs_cache_open(cache_path, &cachep);
+    if (ret != DFS_ERROR_NONE) {
+      fprintf(stderr, "Could not open: %s (%s)\n", cache_path, strerror(errno));
+      path_list_free(listp);
+      return dfs_error_to_exit_status(ret);
+    }
+  }
+
+  jobs = (LIST_JOB *)calloc(listp->num_of_paths + 1, sizeof(LIST_JOB));
+  if (jobs == NULL) {
+    if (cachep != NULL) {
+      dfs_cache_close(cachep);
+    }
+    path_list_free(listp);
+    return DFSUTILS_ERROR_FAILED;
+  }
+
+  /* Each key is taken before the image is read, so a change made while it
+     is being read is seen next time */
+  for (size_t i = 0; i < listp->num_of_paths; i++) {
+    LIST_JOB * jobp = &(jobs[i]);
+
+    jobp->image_path = listp->paths[i];
+    if (cachep == NULL) {
+      continue;
+    }
+
+    ret = dfs_cache_get_key(jobp->image_path, &(jobp->key));
+    if (ret != DFS_ERROR_NONE) {
+      jobp->status = dfs_error_to_exit_status(ret);
+      continue;
+    }
+
+    jobp->cached = (dfs_cache_lookup(cachep, jobp->image_path, &(jobp->key), &(jobp->acorn_dirp)) == DFS_ERROR_NONE);
+  }
+
+  threadpool_run(
+    num_of_jobs > 0 ? num_of_jobs : threadpool_default_threads(),
+    listp->num_of_paths,
+    list_image_job,
+    jobs);
+
+  ret = EXIT_SUCCESS;
+  for (size_t i = 0; i < listp->num_of_paths; i++) {
+    LIST_JOB * jobp = &(jobs[i]);
+
+    if (jobp->status != EXIT_SUCCESS || jobp->cached) {
+      continue;
+    }
+
+    num_of_read++;
+    if (cachep != NULL && dfs_cache_store(cachep, jobp->image_path, &(jobp->key), jobp->acorn_dirp) != DFS_ERROR_NONE) {
+      fprintf(stderr, "Could not cache: %s\n", jobp->image_path);
+    }
+  }
+
+  if (cachep != NULL) {
+    if (dfs_cache_save(cachep) != DFS_ERROR_NONE) {
+      fprintf(stderr, "Could not write: %s (%s)\n", cache_path, strerror(errno));
+      ret = DFSUTILS_ERROR_FAILED;
+    }
+    dfs_cache_close(cachep);
+  }
+
+  *jobsp = jobs;
+  *num_of_readp = num_of_read;
+  return ret;
+}
+
+/* Lists the catalogues of many disk images, each headed by its name */
+static int list_images(int argc, char * argv[]) {
+  PATH_LIST list;
+  LIST_JOB * jobs;
+  int num_of_read;
+  int ret;
+
+  ret = read_catalogues(argc, argv, &list, &jobs, &num_of_read);
+  if (jobs == NULL) {
+    return ret;
+  }
+
+  for (size_t i = 0; i < list.num_of_paths; i++) {
+    LIST_JOB * jobp = &(jobs[i]);
+
+    printf("Image  : %s\n", jobp->image_path);
+
+    if (jobp->status != EXIT_SUCCESS) {
+      printf("Not a DFS disk\n\n");
+      if (ret == EXIT_SUCCESS) {
+        ret = jobp->status;
+      }
+      continue;
+    }
+
+    print_catalogue(jobp->acorn_dirp);
+    printf("\n");
+  }
+
+  printf("%zu disk images, %d read\n", list.num_of_paths, num_of_read);
+  free_catalogues(&list, jobs);
+
+  return ret;
+}
+
+/* Indexes the files on many disk images for --query */
+static int build_index(int argc, char * argv[]) {
+  const ACORN_DIRECTORY ** acorn_dirps;
+  PATH_LIST list;
+  LIST_JOB * jobs;
+  int num_of_read;
+  int num_of_failed = 0;
+  int ret;
+
+  ret = read_catalogues(argc, argv, &list, &jobs, &num_of_read);
+  if (jobs == NULL) {
+    return ret;
+  }
+
+  acorn_dirps = (const ACORN_DIRECTORY **)calloc(list.num_of_paths + 1, sizeof(ACORN_DIRECTORY *));
+  if (acorn_dirps == NULL) {
+    free_catalogues(&list, jobs);
+    return DFSUTILS_ERROR_FAILED;
+  }
+
+  /* Images that could not be read are reported and left out */
+  for (size_t i = 0; i < list.num_of_paths; i++) {
+    if (jobs[i].status == EXIT_SUCCESS) {
+      acorn_dirps[i] = jobs[i].acorn_dirp;
+    } else {
+      fprintf(stderr, "Not a DFS disk: %s\n", jobs[i].image_path);
+      num_of_failed++;
+    }
+  }
+
+  printf("Writing: %s\n", index_path);
+  if (dfs_corpus_write(index_path, (const char * const *)list.paths, acorn_dirps, list.num_of_paths) != DFS_ERROR_NONE) {
+    fprintf(stderr, "Could not write: %s (%s)\n", index_path, strerror(errno));
+    ret = DFSUTILS_ERROR_FAILED;
+  }
+
+  printf("%zu disk images indexed, %d failed\n", list.num_of_paths - (size_t)num_of_failed, num_of_failed);
+
+  free(acorn_dirps);
+  free_catalogues(&list, jobs);
+
+  if (ret == EXIT_SUCCESS && num_of_failed > 0) {
+    ret = DFSUTILS_NOT_A_DFSDISK;
+  }
+
+  return ret;
+}
+
+/* Prints the files in an index that pass every predicate */
+static int query_index(int argc, char * argv[]) {
+  DFS_CORPUS_PREDICATE * predicates;
+  DFS_CORPUS * corpusp;
+  size_t num_of_images;
+  size_t num_of_files;
+  size_t num_of_rows;
+  uint32_t * rows;
+  int ret;
+
+  predicates = (DFS_CORPUS_PREDICATE *)calloc((size_t)argc + 1, sizeof(DFS_CORPUS_PREDICATE));
+  if (predicates == NULL) {
+    return DFSUTILS_ERROR_FAILED;
+  }
+
+  for (int i = 0; i < argc; i++) {
+    if (dfs_corpus_parse_predicate(argv[i], &(predicates[i])) != DFS_ERROR_NONE) {
+      fprintf(stderr, "Invalid predicate: %s\n", argv[i]);
+      free(predicates);
+      return DFSUTILS_ERROR_FAILED;
+    }
+  }
+
+  ret = dfs_corpus_open(index_path, &corpusp);
+  if (ret != DFS_ERROR_NONE) {
+    if (ret == DFS_ERROR_IMAGE_NOT_FOUND) {
+      fprintf(stderr, "File not found: %s\n", index_path);
+    } else {
+      fprintf(stderr, "Could not open index: %s\n", index_path);
+    }
+    free(predicates);
+    return dfs_error_to_exit_status(ret);
+  }
+
+  ret = dfs_corpus_query(
+    corpusp,
+    predicates,
+    argc,
+    num_of_jobs > 0 ? num_of_jobs : threadpool_default_threads(),
+    &rows,
+    &num_of_rows);
+  free(predicates);
+
+  if (ret != DFS_ERROR_NONE) {
+    dfs_corpus_close(corpusp);
+    return dfs_error_to_exit_status(ret);
+  }
+
+  for (size_t i = 0; i < num_of_rows; i++) {
+    ACORN_FILE acorn_file;
+    const char * image_path;
+
+    if (dfs_corpus_get_file(corpusp, rows[i], &image_path, &acorn_file) != DFS_ERROR_NONE) {
+      continue;
+    }
+
+    printf("  %-16s 0x%08x 0x%08x %10u %10u  %s\n",
+      acorn_file.name,
+      acorn_file.load_address,
+      acorn_file.exec_address,
+      acorn_file.length,
+      acorn_file.start_sector,
+      image_path);
+  }
+
+  dfs_corpus_get_size(corpusp, &num_of_images, &num_of_files);
+  printf("%zu of %zu files on %zu disk images\n", num_of_rows, num_of_files, num_of_images);
+
+  free(rows);
+  dfs_corpus_close(corpusp);
+
+  return EXIT_SUCCESS;
+}
+
+/* A file is tagged with its image and its place in the catalogue */
+#define DEDUPE_FILE_BITS 5
+
+typedef struct {
+  const char * image_path;
+  DFS_DEDUPE * dedupep;
+  ACORN_DIRECTORY * acorn_dirp;
+  int status;
+} DEDUPE_JOB;
+
+/* Gets a file's contents, from the mapping where the image is mapped or
+   else read into memory, which must then be freed */
+static int get_file_data(DFS_IMAGE * imagep, const ACORN_FILE * acorn_filep, const uint8_t ** datap, uint8_t ** bufferp) {
+  size_t length;
+  int ret;
+
+  *bufferp = NULL;
+
+  ret = dfs_image_get_file_data(imagep, acorn_filep, datap, &length);
+  if (ret != DFS_ERROR_NOT_MAPPED) {
+    return ret;
+  }
+
+  ret = dfs_image_read_file_data(imagep, acorn_filep, bufferp);
+  *datap = *bufferp;
+
+  return ret;
+}
+
+/* Hashes every file on an image, straight from its mapping */
+static void dedupe_image_job(void * context, size_t index) {
+  DEDUPE_JOB * jobp = &(((DEDUPE_JOB *)context)[index]);
+  const ACORN_DIRECTORY * acorn_dirp;
+  DFS_IMAGE * imagep;
+  int ret;
+
+  ret = dfs_image_open(jobp->image_path, DFS_IMAGE_READ | DFS_IMAGE_MMAP, &imagep);
+  if (ret != DFS_ERROR_NONE) {
+    jobp->status = dfs_error_to_exit_status(ret);
+    return;
+  }
+
+  ret = dfs_image_get_catalogue(imagep, &acorn_dirp);
+  if (ret == DFS_ERROR_NONE) {
+    jobp->acorn_dirp = copy_catalogue(acorn_dirp);
+    if (jobp->acorn_dirp == NULL) {
+      ret = DFS_ERROR_FAILED;
+    }
+  }
+
+  for (int i = 0; ret == DFS_ERROR_NONE && i < acorn_dirp->num_of_files; i++) {
+    const ACORN_FILE * acorn_filep = &(acorn_dirp->files[i]);
+    const uint8_t * data;
+    uint8_t * buffer;
+
+    /* Empty files take no space so are not worth reporting */
+    if (acorn_filep->length == 0) {
+      continue;
+    }
+
+    /* A file that runs off the end of its image is left out */
+    if (get_file_data(imagep, acorn_filep, &data, &buffer) != DFS_ERROR_NONE) {
+      fprintf(stderr, "Could not read: %s in %s\n", acorn_filep->name, jobp->image_path);
+      continue;
+    }
+
+    ret = dfs_dedupe_add(
+      jobp->dedupep,
+      dfs_hash64(data, acorn_filep->length, 0),
+      acorn_filep->length,
+      ((uint64_t)index << DEDUPE_FILE_BITS) | (uint64_t)i);
+    free(buffer);
+  }
+
+  dfs_image_close(imagep);
+  jobp->status = dfs_error_to_exit_status(ret);
+}
+
+/* Reads the contents of a file found by its tag, which must be freed */
+static int read_tagged_file(const DEDUPE_JOB * jobs, uint64_t tag, uint8_t ** datap) {
+  const DEDUPE_JOB * jobp = &(jobs[tag >> DEDUPE_FILE_BITS]);
+  int file = (int)(tag & ((1 << DEDUPE_FILE_BITS) - 1));
+  DFS_IMAGE * imagep;
+  int ret;
+
+  ret = dfs_image_open(jobp->image_path, DFS_IMAGE_READ, &imagep);
+  if (ret == DFS_ERROR_NONE) {
+    ret = dfs_image_read_file_data(imagep, &(jobp->acorn_dirp->files[file]), datap);
+    dfs_image_close(imagep);
+  }
+
+  if (ret != DFS_ERROR_NONE) {
+    fprintf(stderr, "Could not read: %s in %s\n", jobp->acorn_dirp->files[file].name, jobp->image_path);
+  }
+
+  return ret;
+}
+
+/* Reports the files of a group with the same hash and length whose
+   contents really are the same.  The first file left is compared byte for
+   byte with each of the others and those that match are reported together,
+   until fewer than two are left, so a hash collision is never reported as
+   a duplicate.  Returns the space reclaimable, adding to the groups found */
+static uint64_t report_group(const DEDUPE_JOB * jobs, const DFS_DEDUPE_GROUP * groupp, size_t * num_of_groupsp) {
+  uint64_t * pending = (uint64_t *)malloc(groupp->num_of_copies * sizeof(uint64_t));
+  uint64_t * same = (uint64_t *)malloc(groupp->num_of_copies * sizeof(uint64_t));
+  size_t num_of_pending = groupp->num_of_copies;
+  uint64_t reclaimable = 0;
+
+  if (pending == NULL || same == NULL) {
+    free(pending);
+    free(same);
+    return 0;
+  }
+
+  memcpy(pending, groupp->tags, num_of_pending * sizeof(uint64_t));
+
+  while (num_of_pending > 1) {
+    size_t num_of_same = 0;
+    size_t num_of_rest = 0;
+    uint8_t * first;
+
+    /* The tags are in ascending order and stay so, as do those left over */
+    if (read_tagged_file(jobs, pending[0], &first) != DFS_ERROR_NONE) {
+      num_of_pending--;
+      memmove(pending, pending + 1, num_of_pending * sizeof(uint64_t));
+      continue;
+    }
+
+    same[num_of_same++] = pending[0];
+    for (size_t c = 1; c < num_of_pending; c++) {
+      uint8_t * data;
+
+      if (read_tagged_file(jobs, pending[c], &data) != DFS_ERROR_NONE) {
+        continue;
+      }
+
+      if (memcmp(first, data, groupp->length) == 0) {
+        same[num_of_same++] = pending[c];
+      } else {
+        pending[num_of_rest++] = pending[c];
+      }
+
+      free(data);
+    }
+
+    free(first);
+    num_of_pending = num_of_rest;
+
+    if (num_of_same < 2) {
+      continue;
+    }
+
+    printf("Hash   : %016llx, %zu copies of %u bytes\n",
+      (unsigned long long)groupp->hash,
+      num_of_same,
+      groupp->length);
+
+    for (size_t c = 0; c < num_of_same; c++) {
+      const DEDUPE_JOB * jobp = &(jobs[same[c] >> DEDUPE_FILE_BITS]);
+      int file = (int)(same[c] & ((1 << DEDUPE_FILE_BITS) - 1));
+
+      printf("  %-16s %s\n", jobp->acorn_dirp->files[file].name, jobp->image_path);
+    }
+
+    printf("\n");
+    reclaimable += (uint64_t)groupp->length * (num_of_same - 1);
+    (*num_of_groupsp)++;
+  }
+
+  free(pending);
+  free(same);
+
+  return reclaimable;
+}
+
+/* Reports the files that have the same contents as others, and how much
+   space keeping only one copy of each would reclaim */
+static int dedupe_images(int argc, char * argv[]) {
+  DFS_DEDUPE_GROUP * groups;
+  DFS_DEDUPE * dedupep;
+  DEDUPE_JOB * jobs;
+  PATH_LIST list;
+  size_t num_of_groups;
+  size_t num_of_duplicates = 0;
+  uint64_t reclaimable = 0;
+  int ret;
+
+  ret = collect_disks(&list, argc, argv);
+  if (ret != EXIT_SUCCESS) {
+    return ret;
+  }
+
+  jobs = (DEDUPE_JOB *)calloc(list.num_of_paths + 1, sizeof(DEDUPE_JOB));
+  if (jobs == NULL || dfs_dedupe_create(&dedupep) != DFS_ERROR_NONE) {
+    free(jobs);
+    path_list_free(&list);
+    return DFSUTILS_ERROR_FAILED;
+  }
+
+  for (size_t i = 0; i < list.num_of_paths; i++) {
+    jobs[i].image_path = list.paths[i];
+    jobs[i].dedupep = dedupep;
+  }
+
+  threadpool_run(
+    num_of_jobs > 0 ? num_of_jobs : threadpool_default_threads(),
+    list.num_of_paths,
+    dedupe_image_job,
+    jobs);
+
+  for (size_t i = 0; i < list.num_of_paths; i++) {
+    if (jobs[i].status != EXIT_SUCCESS) {
+      fprintf(stderr, "Not a DFS disk: %s\n", jobs[i].image_path);
+      if (ret == EXIT_SUCCESS) {
+        ret = jobs[i].status;
+      }
+    }
+  }
+
+  if (dfs_dedupe_get_groups(dedupep, &groups, &num_of_groups) == DFS_ERROR_NONE) {
+    for (size_t g = 0; g < num_of_groups; g++) {
+      reclaimable += report_group(jobs, &(groups[g]), &num_of_duplicates);
+    }
+
+    printf("%zu disk images, %zu groups of duplicates, %llu bytes reclaimable\n",
+      list.num_of_paths,
+      num_of_duplicates,
+      (unsigned long long)reclaimable);
+    free(groups);
+  } else {
+    ret = DFSUTILS_ERROR_FAILED;
+  }
+
+  for (size_t i = 0; i < list.num_of_paths; i++) {
+    if (jobs[i].acorn_dirp != NULL) {
+      acornfs_free_directory(jobs[i].acorn_dirp);
+    }
+  }
+
+  dfs_dedupe_free(dedupep);
+  free(jobs);
+  path_list_free(&list);
+
+  return ret;
+}
+
+/* Packs whole disk image files, so MMB files and double sided images are
+   packed as they are */
+static int pack_images(int argc, char * argv[]) {
+  DFS_PACK_WRITER * writerp;
+  DFS_PACK * packp;
+  PATH_LIST list = { NULL, 0, 0 };
+  size_t num_of_images;
+  size_t num_of_sectors;
+  size_t num_of_blocks;
+  int num_of_failed = 0;
+  int ret;
+
+  ret = collect_images(&list, argc, argv);
+  if (ret != EXIT_SUCCESS) {
+    path_list_free(&list);
+    return ret;
+  }
+
+  ret = dfs_pack_create(pack_path, &writerp);
+  if (ret != DFS_ERROR_NONE) {
+    fprintf(stderr, "Could not create: %s (%s)\n", pack_path, strerror(errno));
+    path_list_free(&list);
+    return dfs_error_to_exit_status(ret);
+  }
+
+  /* Images that cannot be read are reported and left out */
+  for (size_t i = 0; i < list.num_of_paths; i++) {
+    FILE * imagefile = fopen(list.paths[i], "rb");
+
+    if (imagefile == NULL) {
+      fprintf(stderr, "Could not open: %s (%s)\n", list.paths[i], strerror(errno));
+      num_of_failed++;
+      continue;
+    }
+
+    if (dfs_pack_add_image(writerp, list.paths[i], imagefile) != DFS_ERROR_NONE) {
+      fprintf(stderr, "Could not pack: %s\n", list.paths[i]);
+      num_of_failed++;
+    }
+
+    fclose(imagefile);
+  }
+
+  printf("Writing: %s\n", pack_path);
+  ret = dfs_pack_finish(writerp);
+  if (ret != DFS_ERROR_NONE) {
+    fprintf(stderr, "Could not write: %s (%s)\n", pack_path, strerror(errno));
+    path_list_free(&list);
+    return DFSUTILS_ERROR_FAILED;
+  }
+
+  if (dfs_pack_open(pack_path, &packp) == DFS_ERROR_NONE) {
+    dfs_pack_get_size(packp, &num_of_images, &num_of_sectors, &num_of_blocks);
+    printf("%zu disk images packed, %d failed, %zu sectors stored in %zu blocks\n",
+      num_of_images,
+      num_of_failed,
+      num_of_sectors,
+      num_of_blocks);
+    dfs_pack_close(packp);
+  }
+
+  path_list_free(&list);
+
+  return (num_of_failed > 0) ? DFSUTILS_OPEN_FAILED : EXIT_SUCCESS;
+}
+
+/* Output path for an image from a pack.  The path it was packed with is
+   kept under the target directory, less any leading '/', and paths that
+   could lead out of the target directory are refused */
+static int unpack_output_path(const char * image_path, char * path, size_t size) {
+  const char * p = image_path;
+
+  while (*p == '/') {
+    p++;
+  }
+
+  for (const char * q = p; *q != '\0'; q++) {
+    if ((q == p || q[-1] == '/') && q[0] == '.' && q[1] == '.' && (q[2] == '/' || q[2] == '\0')) {
+      return DFSUTILS_ERROR_FAILED;
+    }
+  }
+
+  if (*p == '\0' || snprintf(path, size, "%s/%s", (target_dir != NULL) ? target_dir : ".", p) >= (int)size) {
+    return DFSUTILS_ERROR_FAILED;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/* Creates the directories leading to a file */
+static int make_parent_dirs(char * path) {
+  for (char * p = strchr(path + 1, '/'); p != NULL; p = strchr(p + 1, '/')) {
+    *p = '\0';
+    if (mkdir(path, 0777) == -1 && errno != EEXIST) {
+      fprintf(stderr, "Could not create: %s (%s)\n", path, strerror(errno));
+      *p = '/';
+      return DFSUTILS_OPEN_FAILED;
+    }
+    *p = '/';
+  }
+
+  return EXIT_SUCCESS;
+}
+
+static int unpack_image(const DFS_PACK * packp, size_t index) {
+  char path[PATH_MAX + 1];
+  const char * image_path;
+  uint64_t size;
+  FILE * outfile;
+  int ret;
+
+  dfs_pack_get_image(packp, index, &image_path, &size);
+
+  if (unpack_output_path(image_path, path, sizeof(path)) != EXIT_SUCCESS) {
+    fprintf(stderr, "Invalid image path: %s\n", image_path);
+    return DFSUTILS_INVALID_VALUE;
+  }
+
+  ret = make_parent_dirs(path);
+  if (ret != EXIT_SUCCESS) {
+    return ret;
+  }
+
+  printf("Writing: %s\n", path);
+
+  outfile = fopen(path, "wb");
+  if (outfile == NULL) {
+    fprintf(stderr, "Could not create: %s (%s)\n", path, strerror(errno));
+    return DFSUTILS_OPEN_FAILED;
+  }
+
+  ret = dfs_pack_write_image(packp, index, outfile);
+  if (fclose(outfile) != 0 && ret == DFS_ERROR_NONE) {
+    ret = DFS_ERROR_FAILED;
+  }
+
+  if (ret != DFS_ERROR_NONE) {
+    fprintf(stderr, "Could not write: %s\n", path);
+  }
+
+  return dfs_error_to_exit_status(ret);
+}
+
+/* Unpacks the named images from a pack, or all of them if none are named */
+static int unpack_images(int argc, char * argv[]) {
+  DFS_PACK * packp;
+  size_t num_of_images;
+  size_t num_of_sectors;
+  size_t num_of_blocks;
+  size_t num_of_unpacked = 0;
+  int ret;
+
+  ret = dfs_pack_open(pack_path, &packp);
+  if (ret != DFS_ERROR_NONE) {
+    fprintf(stderr, "Could not open: %s\n", pack_path);
+    return dfs_error_to_exit_status(ret);
+  }
+
+  dfs_pack_get_size(packp, &num_of_images, &num_of_sectors, &num_of_blocks);
+  ret = EXIT_SUCCESS;
+
+  for (size_t i = 0; i < ((argc > 0) ? (size_t)argc : num_of_images); i++) {
+    size_t index = i;
+    int status;
+
+    if (argc > 0 && dfs_pack_find_image(packp, argv[i], &index) != DFS_ERROR_NONE) {
+      fprintf(stderr, "Image not found: %s\n", argv[i]);
+      ret = DFSUTILS_DISKFILE_NOT_FOUND;
+      continue;
+    }
+
+    status = unpack_image(packp, index);
+    if (status == EXIT_SUCCESS) {
+      num_of_unpacked++;
+    } else if (ret == EXIT_SUCCESS) {
+      ret = status;
+    }
+  }
+
+  printf("%zu disk images unpacked\n", num_of_unpacked);
+  dfs_pack_close(packp);
+
+  return ret;
+}
+
+/* Directory in a tar archive for the files of an image, as --batch would
+   extract them.  The disks of an MMB file go in directories named after
+   their slots */
+static void tar_image_dir(const char * image_path, char * dirname, size_t size) {
+  char mmb_path[PATH_MAX + 1];
+  const char * colon = strrchr(image_path, ':');
+  size_t used;
+
+  snprintf(mmb_path, sizeof(mmb_path), "%s", image_path);
+  if (colon != NULL) {
+    mmb_path[colon - image_path] = '\0';
+  }
+
+  if (colon == NULL || !(is_mmb_name(mmb_path) || is_dsd_name(mmb_path))) {
+    colon = NULL;
+  }
+
+  batch_output_dir(mmb_path, (target_dir != NULL) ? target_dir : ".", dirname, size);
+  if (target_dir == NULL) {
+    memmove(dirname, dirname + 2, strlen(dirname + 2) + 1);
+  }
+
+  used = strlen(dirname);
+  if (colon != NULL && used < size) {
+    snprintf(dirname + used, size - used, is_mmb_name(mmb_path) ? "/%03d" : "/%d", atoi(colon + 1));
+  }
+}
+
+static int tar_file(DFS_IMAGE * imagep, const char * dirname, const ACORN_FILE * acorn_filep, time_t mtime) {
+  char name[PATH_MAX + 1];
+  const uint8_t * data;
+  uint8_t * buffer;
+  int ret;
+
+  ret = get_file_data(imagep, acorn_filep, &data, &buffer);
+  if (ret != DFS_ERROR_NONE) {
+    fprintf(stderr, "Could not read: %s/%s\n", dirname, acorn_filep->name);
+    return dfs_error_to_exit_status(ret);
+  }
+
+  snprintf(name, sizeof(name), "%s/%s", dirname, acorn_filep->name);
+  ret = dfs_tar_write_file(stdout, name, acorn_filep, data, mtime);
+  free(buffer);
+
+  if (ret != DFS_ERROR_NONE) {
+    fprintf(stderr, "Could not write archive: %s\n", strerror(errno));
+    return DFSUTILS_ERROR_FAILED;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/* Streams files to stdout as a tar archive rather than creating them.  The
+   files go under the directories extracting them would create: the named
+   files of one image under its disk name, or with --batch every file of
+   every image under a directory named after the image */
+static int extract_tar(int argc, char * argv[], bool batch) {
+  static char stdout_buffer[1 << 20];
+  PATH_LIST list = { NULL, 0, 0 };
+  time_t mtime = time(NULL);
+  int num_of_files = 0;
+  int num_of_failed = 0;
+  int ret;
+
+  if (isatty(STDOUT_FILENO)) {
+    fprintf(stderr, "Not writing a tar archive to a terminal\n");
+    return DFSUTILS_ERROR_FAILED;
+  }
+
+  if (!batch && is_mmb_name(argv[0])) {
+    fprintf(stderr, "Give a slot, or use --batch for every disk: %s\n", argv[0]);
+    return DFSUTILS_ERROR_FAILED;
+  }
+
+  if (batch) {
+    ret = collect_disks(&list, argc, argv);
+  } else {
+    ret = path_list_add(&list, argv[0]);
+  }
+
+  if (ret != EXIT_SUCCESS) {
+    path_list_free(&list);
+    return ret;
+  }
+
+  setvbuf(stdout, stdout_buffer, _IOFBF, sizeof(stdout_buffer));
+
+  for (size_t i = 0; i < list.num_of_paths; i++) {
+    char dirname[PATH_MAX + 1];
+    const ACORN_DIRECTORY * acorn_dirp;
+    const ACORN_FILE * acorn_filep;
+    DFS_IMAGE * imagep;
+    int status;
+
+    status = open_diskfile(list.paths[i], DFS_IMAGE_READ | DFS_IMAGE_MMAP, &imagep);
+    if (status != EXIT_SUCCESS) {
+      num_of_failed++;
+      ret = (ret == EXIT_SUCCESS) ? status : ret;
+      continue;
+    }
+
+    status = dfs_error_to_exit_status(dfs_image_get_catalogue(imagep, &acorn_dirp));
+    if (status != EXIT_SUCCESS) {
+      fprintf(stderr, "Not a DFS disk: %s\n", list.paths[i]);
+      dfs_image_close(imagep);
+      num_of_failed++;
+      ret = (ret == EXIT_SUCCESS) ? status : ret;
+      continue;
+    }
+
+    if (batch) {
+      tar_image_dir(list.paths[i], dirname, sizeof(dirname));
+    } else {
+      snprintf(dirname, sizeof(dirname), "%s", (target_dir != NULL) ? target_dir : acorn_dirp->name);
+    }
+
+    if (batch || argc == 1) {
+      for (int f = 0; f < acorn_dirp->num_of_files && status == EXIT_SUCCESS; f++) {
+        status = tar_file(imagep, dirname, &(acorn_dirp->files[f]), mtime);
+        num_of_files += (status == EXIT_SUCCESS) ? 1 : 0;
+      }
+    } else {
+      for (int f = 1; f < argc && status == EXIT_SUCCESS; f++) {
+        status = dfs_error_to_exit_status(dfs_image_find_file(imagep, argv[f], &acorn_filep));
+        if (status != EXIT_SUCCESS) {
+          fprintf(stderr, "File not found: %s\n", argv[f]);
+          break;
+        }
+
+        status = tar_file(imagep, dirname, acorn_filep, mtime);
+        num_of_files += (status == EXIT_SUCCESS) ? 1 : 0;
+      }
+    }
+
+    dfs_image_close(imagep);
+
+    /* There is no going on once the archive cannot be written */
+    if (status != EXIT_SUCCESS) {
+      num_of_failed++;
+      ret = (ret == EXIT_SUCCESS) ? status : ret;
+      if (ferror(stdout)) {
+        break;
+      }
+    }
+  }
+
+  if (dfs_tar_finish(stdout) != DFS_ERROR_NONE && ret == EXIT_SUCCESS) {
+    fprintf(stderr, "Could not write archive: %s\n", strerror(errno));
+    ret = DFSUTILS_ERROR_FAILED;
+  }
+
+  fprintf(stderr, "%d files archived from %zu disk images, %d failed\n", num_of_files, list.num_of_paths, num_of_failed);
+  path_list_free(&list);
+
+  return ret;
+}
+
+static void extract_batch_job(void * context, size_t index) {
+  BATCH_JOB * jobp = &(((BATCH_JOB *)context)[index]);
+  const ACORN_DIRECTORY * acorn_dirp;
+  const ACORN_FILE * acorn_files[DFS_MAX_FILES];
+  DFS_IMAGE * imagep;
+  int ret;
+
+  jobp->status = open_diskfile(jobp->image_path, DFS_IMAGE_READ | DFS_IMAGE_MMAP, &imagep);
+  if (jobp->status != EXIT_SUCCESS) {
+    return;
+  }
+
+  ret = dfs_image_get_catalogue(imagep, &acorn_dirp);
+  if (ret != DFS_ERROR_NONE) {
+    fprintf(stderr, "Could not read catalogue: %s\n", jobp->image_path);
+    jobp->status = dfs_error_to_exit_status(ret);
+    dfs_image_close(imagep);
+    return;
+  }
+
+  if (mkdir(jobp->output_dir, 0777) == -1) {
+    fprintf(stderr, "Could not create: %s (%s)\n", jobp->output_dir, strerror(errno));
+    jobp->status = DFSUTILS_OPEN_FAILED;
+    dfs_image_close(imagep);
+    return;
+  }
+
+  for (int i = 0; i < acorn_dirp->num_of_files; i++) {
+    acorn_files[i] = &(acorn_dirp->files[i]);
+  }
+
+  jobp->status = extract_files(imagep, NULL, 0, jobp->output_dir, acorn_files, acorn_dirp->num_of_files, verbosity >= DEBUG_LEVEL_INFO, &(jobp->file_count));
+
+  printf("%s: %d files extracted to %s\n", jobp->image_path, jobp->file_count, jobp->output_dir);
+  dfs_image_close(imagep);
+}
+
+static int extract_batch(int argc, char * argv[]) {
+  PATH_LIST found = { NULL, 0, 0 };
+  PATH_LIST images = { NULL, 0, 0 };
+  BATCH_JOB * jobs;
+  const char * parent = (target_dir != NULL) ? target_dir : ".";
+  size_t num_of_images = 0;
+  int num_of_disks = 0;
+  int num_of_failed = 0;
+  int ret;
+
+  /* Each side of a double sided image is extracted as an image of its own */
+  ret = collect_images(&found, argc, argv);
+  for (size_t i = 0; i < found.num_of_paths && ret == EXIT_SUCCESS; i++) {
+    if (is_dsd_name(found.paths[i])) {
+      ret = expand_dsd(&images, found.paths[i]);
+    } else {
+      ret = path_list_add(&images, found.paths[i]);
+    }
+  }
+
+  path_list_free(&found);
+  if (ret != EXIT_SUCCESS) {
+    path_list_free(&images);
+    return ret;
+  }
+
+  if (images.num_of_paths == 0) {
+    printf("No disk images to extract.\n");
+    path_list_free(&images);
+    return EXIT_SUCCESS;
+  }
+
+  if (mkdir(parent, 0777) == -1 && errno != EEXIST) {
+    fprintf(stderr, "Could not create: %s (%s)\n", parent, strerror(errno));
+    path_list_free(&images);
+    return DFSUTILS_OPEN_FAILED;
+  }
+
+  jobs = (BATCH_JOB *)calloc(images.num_of_paths, sizeof(BATCH_JOB));
+  if (jobs == NULL) {
+    path_list_free(&images);
+    return DFSUTILS_ERROR_FAILED;
+  }
+
+  ret = EXIT_SUCCESS;
+
+  /* MMB files are spread over the threads a slot at a time, one file after
+     another, and the other disk images an image at a time */
+  for (size_t i = 0; i < images.num_of_paths; i++) {
+    int side;
+
+    if (is_mmb_name(images.paths[i])) {
+      char mmb_dirname[PATH_MAX + 1];
+      int mmb_ret;
+
+      batch_output_dir(images.paths[i], parent, mmb_dirname, sizeof(mmb_dirname));
+      mmb_ret = extract_mmb(images.paths[i], mmb_dirname, &num_of_disks, &num_of_failed);
+      if (mmb_ret != EXIT_SUCCESS && ret == EXIT_SUCCESS) {
+        ret = mmb_ret;
+      }
+      continue;
+    }
+
+    jobs[num_of_images].image_path = images.paths[i];
+    batch_output_dir(images.paths[i], parent, jobs[num_of_images].output_dir, sizeof(jobs[num_of_images].output_dir));
+
+    /* The sides go in directories named after them, inside one named after the image */
+    if (is_dsd_side_name(images.paths[i], &side)) {
+      char * output_dir = jobs[num_of_images].output_dir;
+      size_t used = strlen(output_dir);
+
+      if (mkdir(output_dir, 0777) == -1 && errno != EEXIST) {
+        fprintf(stderr, "Could not create: %s (%s)\n", output_dir, strerror(errno));
+      }
+
+      snprintf(output_dir + used, sizeof(jobs[num_of_images].output_dir) - used, "/%d", side);
+    }
+
+    num_of_images++;
+  }
+
+  threadpool_run(
+    num_of_jobs > 0 ? num_of_jobs : threadpool_default_threads(),
+    num_of_images,
+    extract_batch_job,
+    jobs);
+
+  for (size_t i = 0; i < num_of_images; i++) {
+    if (jobs[i].status != EXIT_SUCCESS) {
+      if (ret == EXIT_SUCCESS) {
+        ret = jobs[i].status;
+      }
+      num_of_failed++;
+    }
+  }
+
+  num_of_disks += (int)num_of_images;
+
+  printf("%d disk images extracted, %d failed\n", num_of_disks - num_of_failed, num_of_failed);
+
+  free(jobs);
+  path_list_free(&images);
+
+  return ret;
+}
+
+typedef struct {
+  const char * image_path;
+  DFS_COMPACT_STATS stats;
+  int status;
+} COMPACT_JOB;
 
-  ACORN_DIRECTORY * acorn_dirp;
+static void compact_job(void * context, size_t index) {
+  COMPACT_JOB * jobp = &(((COMPACT_JOB *)context)[index]);
+  DFS_IMAGE * imagep;
   int ret;
 
-  FILE * diskfile = fopen(argv[0], "rb");
-  if (diskfile == NULL) {
-    if (errno == ENOENT) {
-      fprintf(stderr, "File not found: %s\n", argv[0]);
-      return DFSUTILS_DISKFILE_NOT_FOUND;
-    }
-
-    fprintf(stderr, "Could not open: %s (%s)\n", argv[0], strerror(errno));
-    return DFSUTILS_OPEN_FAILED;
+  jobp->status = open_diskfile(jobp->image_path, DFS_IMAGE_READ | DFS_IMAGE_WRITE, &imagep);
+  if (jobp->status != EXIT_SUCCESS) {
+    return;
   }
 
-  ret = dfs_read_catalogue(diskfile, &acorn_dirp);
+  ret = dfs_image_compact(imagep, &(jobp->stats));
+  dfs_image_close(imagep);
+
   if (ret != DFS_ERROR_NONE) {
-    fclose(diskfile);
-    return dfs_error_to_exit_status(ret);
+    fprintf(stderr, "Could not compact: %s\n", jobp->image_path);
+    jobp->status = dfs_error_to_exit_status(ret);
+    return;
   }
 
-  fclose(diskfile);
-
-  printf("Name   : %s\n", acorn_dirp->name);
-  printf("Options: %d (%s)\n", acorn_dirp->options, optionstr[acorn_dirp->options]);
-  printf("----------------------------------------------------------------\n");
+  printf("%s: %d files moved, %u bytes moved, %d sectors free\n",
+    jobp->image_path,
+    jobp->stats.files_moved,
+    jobp->stats.bytes_moved,
+    jobp->stats.free_sectors);
+}
 
-  if (acorn_dirp->num_of_files) {
-    ACORN_FILE * acorn_filep = &(acorn_dirp->files[0]);
+static int compact_diskfiles(int argc, char * argv[]) {
+  COMPACT_JOB * jobs;
+  int ret = EXIT_SUCCESS;
 
-    for (int i = 0; i < acorn_dirp->num_of_files; i++) {
-      printf("  %-16s 0x%08x 0x%08x %10u %10u\n",
-        acorn_filep->name,
-        acorn_filep->load_address,
-        acorn_filep->exec_address,
-        acorn_filep->length,
-        acorn_filep->start_sector);
-      acorn_filep++;
-    }
+  jobs = (COMPACT_JOB *)calloc((size_t)argc, sizeof(COMPACT_JOB));
+  if (jobs == NULL) {
+    return DFSUTILS_ERROR_FAILED;
+  }
 
-    printf("----------------------------------------------------------------\n");
+  for (int i = 0; i < argc; i++) {
+    jobs[i].image_path = argv[i];
   }
 
-  printf("%d files\n", acorn_dirp->num_of_files);
-  acornfs_free_directory(acorn_dirp);
+  threadpool_run(
+    num_of_jobs > 0 ? num_of_jobs : threadpool_default_threads(),
+    (size_t)argc,
+    compact_job,
+    jobs);
 
-  return EXIT_SUCCESS;
+  for (int i = 0; i < argc; i++) {
+    if (jobs[i].status != EXIT_SUCCESS) {
+      ret = jobs[i].status;
+      break;
+    }
+  }
+
+  free(jobs);
+  return ret;
 }
 
-static int extract_file(FILE* diskfile, const char * dirname, const ACORN_FILE * acorn_filep) {
-  static char path[PATH_MAX + 1];
-  FILE * file;
+static int format_diskfile(int argc, char * argv[]) {
+  DFS_IMAGE * imagep;
   int ret;
 
-  snprintf(path, sizeof(path), "%s/%s", dirname, acorn_filep->name);
-  printf("Extracting: %s\n", path);
+  if (argc < 2) {
+    short_help();
+    return DFSUTILS_ERROR_FAILED;
+  }
+
+  if (strlen(argv[1]) > 12) {
+    fprintf(stderr, "Diskname too long. Max 12 characters!");
+    return DFSUTILS_NAME_TOO_LONG;
+  }
 
-  file = fopen(path, "wb");
-  if (file == NULL) {
-    fprintf(stderr, "File error: %s\n", strerror(errno));
-    return DFSUTILS_OPEN_FAILED;
+  printf("Writing: %s\n", argv[1]);
+  ret = open_diskfile(argv[0], DFS_IMAGE_WRITE | DFS_IMAGE_CREATE, &imagep);
+  if (ret != EXIT_SUCCESS) {
+    return ret;
+  }
+
+  if (template_path != NULL) {
+    ret = dfs_image_format_from_template(imagep, template_path, argv[1]);
+    if (ret == DFS_ERROR_IMAGE_NOT_FOUND) {
+      fprintf(stderr, "File not found: %s\n", template_path);
+    }
+  } else {
+    ret = dfs_image_format(imagep, tracks * DFS_SECTORS_PER_TRACK, argv[1]);
   }
 
-  ret = dfs_extract_file(diskfile, acorn_filep, file);
+  dfs_image_close(imagep);
+
   if (ret != DFS_ERROR_NONE) {
-    fclose(file);
     return dfs_error_to_exit_status(ret);
   }
 
-  fclose(file);
   return EXIT_SUCCESS;
 }
 
-static int extract_diskfile(int argc, char * argv[]) {
-  ACORN_DIRECTORY * acorn_dirp;
+typedef struct {
+  ACORN_FILE acorn_files[DFS_MAX_FILES];
+  FILE * files[DFS_MAX_FILES];
+  int num_of_files;
+} ADD_BATCH;
+
+static void add_batch_free(ADD_BATCH * batchp) {
+  for (int i = 0; i < batchp->num_of_files; i++) {
+    free(batchp->acorn_files[i].name);
+    fclose(batchp->files[i]);
+  }
+
+  batchp->num_of_files = 0;
+}
+
+/* Parses "file load_address exec_address [locked]" into the batch */
+static int parse_add_spec(ADD_BATCH * batchp, int argc, char * argv[], int * usedp) {
   ACORN_FILE * acorn_filep;
-  char * dirname;
-  int ret;
-  int file_count = 0;
+  const char * name;
+  FILE * file;
+  char * endptr;
+
+  if (argc < 3) {
+    short_help();
+    return DFSUTILS_ERROR_FAILED;
+  }
+
+  if (batchp->num_of_files == DFS_MAX_FILES) {
+    fprintf(stderr, "Too many files. Max %d files!\n", DFS_MAX_FILES);
+    return DFSUTILS_ERROR_FAILED;
+  }
+
+  acorn_filep = &(batchp->acorn_files[batchp->num_of_files]);
+  memset(acorn_filep, 0, sizeof(ACORN_FILE));
+
+  acorn_filep->load_address = strtol(argv[1], &endptr, 0);
+  if (*endptr) {
+    fprintf(stderr, "Invalid load address: %s\n", argv[1]);
+    return DFSUTILS_INVALID_VALUE;
+  }
+
+  acorn_filep->exec_address = strtol(argv[2], &endptr, 0);
+  if (*endptr) {
+    fprintf(stderr, "Invalid exec address: %s\n", argv[2]);
+    return DFSUTILS_INVALID_VALUE;
+  }
+
+  *usedp = 3;
+  if (argc > 3 && strcmp(argv[3], "locked") == 0) {
+    acorn_filep->attributes = LOCKED;
+    *usedp = 4;
+  }
 
-  FILE * diskfile = fopen(argv[0], "rb");
-  if (diskfile == NULL) {
+  file = fopen(argv[0], "rb");
+  if (file == NULL) {
     if (errno == ENOENT) {
       fprintf(stderr, "File not found: %s\n", argv[0]);
       return DFSUTILS_DISKFILE_NOT_FOUND;
@@ -191,112 +2200,118 @@ static int extract_diskfile(int argc, char * argv[]) {
     return DFSUTILS_OPEN_FAILED;
   }
 
-  ret = dfs_read_catalogue(diskfile, &acorn_dirp);
-  if (ret != DFS_ERROR_NONE) {
-    fclose(diskfile);
-    return dfs_error_to_exit_status(ret);
+  if (fseek(file, 0, SEEK_END) == -1) {
+    fprintf(stderr, "Could not calculate file size: (%s)\n", strerror(errno));
+    fclose(file);
+    return DFSUTILS_ERROR_FAILED;
   }
 
-  if (acorn_dirp->num_of_files == 0) {
-    printf("Disk image empty! Nothing to extract.\n");
-    fclose(diskfile);
-    return 0;
-  }
+  /* The DFS name comes from the host file name without any leading path */
+  name = strrchr(argv[0], '/');
+  name = (name != NULL) ? name + 1 : argv[0];
 
-  if (target_dir != NULL) {
-    dirname = target_dir;
-  } else {
-    dirname = acorn_dirp->name;
-  }
+  acorn_filep->name = strdup(name);
+  acorn_filep->length = ftell(file);
 
-  ret = mkdir(dirname, 0777);
-  if (ret == -1) {
-    fprintf(stderr, "Could not create: %s (%s)\n", dirname, strerror(errno));
-    fclose(diskfile);
-    return DFSUTILS_OPEN_FAILED;
-  }
+  batchp->files[batchp->num_of_files] = file;
+  batchp->num_of_files++;
 
-  printf("Output dir: %s\n", dirname);
+  return EXIT_SUCCESS;
+}
 
-  argc --;
-  argv ++;
+/* Reads add specs from a manifest, one "file load_address exec_address [locked]" per line */
+static int parse_add_manifest(ADD_BATCH * batchp, const char * manifest_path) {
+  char * line = NULL;
+  size_t line_size = 0;
+  int line_num = 0;
+  int ret = EXIT_SUCCESS;
+  FILE * manifest = fopen(manifest_path, "r");
+
+  if (manifest == NULL) {
+    fprintf(stderr, "Could not open: %s (%s)\n", manifest_path, strerror(errno));
+    return (errno == ENOENT) ? DFSUTILS_FILE_NOT_FOUND : DFSUTILS_OPEN_FAILED;
+  }
 
-  ret = 0;
-  if (argc) {
-    while (argc) {
-      int found = false;
-      for (int i = 0; i < acorn_dirp->num_of_files; i++) {
-        if (!strcmp(acorn_dirp->files[i].name, argv[0])) {
-          found = true;
-          acorn_filep = &(acorn_dirp->files[i]);
-          break;
-        }
-      }
+  while (getline(&line, &line_size, manifest) != -1) {
+    char * tokens[5];
+    char * savep;
+    int num_of_tokens = 0;
+    int used;
 
-      if (!found) {
-        fprintf(stderr, "File not found: %s\n", argv[0]);
-        ret = DFSUTILS_FILE_NOT_FOUND;
-        break;
-      }
+    line_num++;
 
-      ret = extract_file(diskfile, dirname, acorn_filep);
-      if (ret != EXIT_SUCCESS) {
-        break;
-      }
+    for (char * tok = strtok_r(line, " \t\r\n", &savep);
+         tok != NULL && tok[0] != '#' && num_of_tokens < 5;
+         tok = strtok_r(NULL, " \t\r\n", &savep)) {
+      tokens[num_of_tokens++] = tok;
+    }
 
-      argc--;
-      argv++;
-      file_count++;
+    if (num_of_tokens == 0) {
+      continue;
     }
-  } else {
-    acorn_filep = acorn_dirp->files;
 
-    for (int i = 0; i < acorn_dirp->num_of_files; i++) {
-      ret = extract_file(diskfile, dirname, acorn_filep);
-      if (ret != EXIT_SUCCESS) {
-        break;
-      }
+    ret = parse_add_spec(batchp, num_of_tokens, tokens, &used);
+    if (ret == EXIT_SUCCESS && used != num_of_tokens) {
+      ret = DFSUTILS_INVALID_VALUE;
+    }
 
-      acorn_filep++;
-      file_count++;
+    if (ret != EXIT_SUCCESS) {
+      fprintf(stderr, "%s:%d: invalid manifest entry\n", manifest_path, line_num);
+      break;
     }
   }
 
-  printf("%d files extracted\n", file_count);
-  fclose(diskfile);
+  free(line);
+  fclose(manifest);
 
   return ret;
 }
 
-static int format_diskfile(int argc, char * argv[]) {
-  FILE * diskfile = NULL;
+static int add_file(int argc, char * argv[]) {
+  ADD_BATCH batch;
+  DFS_IMAGE * imagep = NULL;
+  const char * diskfile_path = argv[0];
+  int used;
   int ret;
 
-  if (argc < 2) {
+  batch.num_of_files = 0;
+
+  if (manifest_path != NULL) {
+    ret = parse_add_manifest(&batch, manifest_path);
+    if (ret != EXIT_SUCCESS) {
+      add_batch_free(&batch);
+      return ret;
+    }
+  } else if (argc < 4) {
     short_help();
     return DFSUTILS_ERROR_FAILED;
   }
 
-  if (strlen(argv[1]) > 12) {
-    fprintf(stderr, "Diskname too long. Max 12 characters!");
-    return DFSUTILS_NAME_TOO_LONG;
-  }
+  argc--;
+  argv++;
 
-  printf("Writing: %s\n", argv[1]);
-  diskfile = fopen(argv[0], "wb");
-  if (diskfile == NULL) {
-    if (errno == ENOENT) {
-      fprintf(stderr, "File not found: %s\n", argv[0]);
-      return DFSUTILS_DISKFILE_NOT_FOUND;
+  while (argc > 0) {
+    ret = parse_add_spec(&batch, argc, argv, &used);
+    if (ret != EXIT_SUCCESS) {
+      add_batch_free(&batch);
+      return ret;
     }
 
-    fprintf(stderr, "Could not open: %s (%s)\n", argv[0], strerror(errno));
-    return DFSUTILS_OPEN_FAILED;
+    argc -= used;
+    argv += used;
   }
 
-  ret = dfs_format_diskfile(tracks * DFS_SECTORS_PER_TRACK, argv[1], diskfile);
+  ret = open_diskfile(diskfile_path, DFS_IMAGE_READ | DFS_IMAGE_WRITE, &imagep);
+  if (ret != EXIT_SUCCESS) {
+    add_batch_free(&batch);
+    return ret;
+  }
+
+  dfs_image_set_alloc_policy(imagep, alloc_policy);
+  ret = dfs_image_add_files(imagep, batch.acorn_files, batch.files, batch.num_of_files);
 
-  fclose(diskfile);
+  dfs_image_close(imagep);
+  add_batch_free(&batch);
 
   if (ret != DFS_ERROR_NONE) {
     return dfs_error_to_exit_status(ret);
@@ -305,12 +2320,36 @@ static int format_diskfile(int argc, char * argv[]) {
   return EXIT_SUCCESS;
 }
 
-static int add_file(int argc, char * argv[]) {
+static int remove_files(int argc, char * argv[]) {
+  DFS_IMAGE * imagep;
+  int ret;
+
+  if (argc < 2) {
+    short_help();
+    return DFSUTILS_ERROR_FAILED;
+  }
+
+  ret = open_diskfile(argv[0], DFS_IMAGE_READ | DFS_IMAGE_WRITE, &imagep);
+  if (ret != EXIT_SUCCESS) {
+    return ret;
+  }
+
+  ret = dfs_image_remove_files(imagep, (const char **)&(argv[1]), argc - 1);
+  dfs_image_close(imagep);
+
+  if (ret == DFS_ERROR_FILE_NOT_FOUND) {
+    fprintf(stderr, "File not found! Nothing removed.\n");
+  } else if (ret == DFS_ERROR_FILE_LOCKED) {
+    fprintf(stderr, "File locked! Nothing removed.\n");
+  }
+
+  return dfs_error_to_exit_status(ret);
+}
+
+static int update_file(int argc, char * argv[]) {
   ACORN_FILE acorn_file;
-  FILE * diskfile = NULL;
-  FILE * file = NULL;
+  DFS_IMAGE * imagep;
   char * endptr;
-  size_t count;
   int ret;
 
   if (argc < 4) {
@@ -318,6 +2357,9 @@ static int add_file(int argc, char * argv[]) {
     return DFSUTILS_ERROR_FAILED;
   }
 
+  memset(&acorn_file, 0, sizeof(acorn_file));
+  acorn_file.name = argv[1];
+
   acorn_file.load_address = strtol(argv[2], &endptr, 0);
   if (*endptr) {
     fprintf(stderr, "Invalid load address: %s\n", argv[2]);
@@ -326,93 +2368,244 @@ static int add_file(int argc, char * argv[]) {
 
   acorn_file.exec_address = strtol(argv[3], &endptr, 0);
   if (*endptr) {
-    fprintf(stderr, "Invalid exec address: %s\n", argv[2]);
+    fprintf(stderr, "Invalid exec address: %s\n", argv[3]);
     return DFSUTILS_INVALID_VALUE;
   }
 
-  if (argc > 4) {
-    if (strcmp(argv[4], "locked") == 0) {
-      acorn_file.attributes = LOCKED;
-    }
+  if (argc > 4 && strcmp(argv[4], "locked") == 0) {
+    acorn_file.attributes = LOCKED;
   }
 
-  diskfile = fopen(argv[0], "rb+");
-  if (diskfile == NULL) {
-    if (errno == ENOENT) {
-      fprintf(stderr, "File not found: %s\n", argv[0]);
-      return DFSUTILS_DISKFILE_NOT_FOUND;
+  ret = open_diskfile(argv[0], DFS_IMAGE_READ | DFS_IMAGE_WRITE, &imagep);
+  if (ret != EXIT_SUCCESS) {
+    return ret;
+  }
+
+  ret = dfs_image_update_file(imagep, &acorn_file);
+  dfs_image_close(imagep);
+
+  if (ret == DFS_ERROR_FILE_NOT_FOUND) {
+    fprintf(stderr, "File not found: %s\n", argv[1]);
+  }
+
+  return dfs_error_to_exit_status(ret);
+}
+
+static int split_join_diskfiles(int argc, char * argv[], bool split) {
+  FILE * files[3];
+  int ret;
+
+  if (argc < 3) {
+    short_help();
+    return DFSUTILS_ERROR_FAILED;
+  }
+
+  /* Split reads the first file and writes the other two.  Join reads the
+     first two and writes the last */
+  for (int i = 0; i < 3; i++) {
+    bool output = split ? (i > 0) : (i == 2);
+
+    files[i] = fopen(argv[i], output ? "wb" : "rb");
+    if (files[i] == NULL) {
+      fprintf(stderr, "Could not open: %s (%s)\n", argv[i], strerror(errno));
+      ret = (errno == ENOENT) ? DFSUTILS_DISKFILE_NOT_FOUND : DFSUTILS_OPEN_FAILED;
+
+      while (i-- > 0) {
+        fclose(files[i]);
+      }
+      return ret;
     }
+  }
 
-    fprintf(stderr, "Could not open: %s (%s)\n", argv[0], strerror(errno));
-    return DFSUTILS_OPEN_FAILED;
+  if (split) {
+    printf("Splitting: %s\n", argv[0]);
+    ret = dfs_dsd_split(files[0], files[1], files[2]);
+  } else {
+    printf("Joining: %s\n", argv[2]);
+    ret = dfs_dsd_join(files[0], files[1], files[2]);
   }
 
-  file = fopen(argv[1], "rb");
-  if (file == NULL) {
-    if (errno == ENOENT) {
-      fprintf(stderr, "File not found: %s\n", argv[1]);
-      return DFSUTILS_DISKFILE_NOT_FOUND;
+  for (int i = 0; i < 3; i++) {
+    if (fclose(files[i]) != 0 && ret == DFS_ERROR_NONE) {
+      ret = DFS_ERROR_FAILED;
     }
+  }
 
-    fprintf(stderr, "Could not open: %s (%s)\n", argv[1], strerror(errno));
-    return DFSUTILS_OPEN_FAILED;
+  return dfs_error_to_exit_status(ret);
+}
+
+/* Shows what the library recorded, after the normal output.  A failed
+   command shows the errors behind it, -v shows everything */
+static void dump_trace(void) {
+  fflush(stdout);
+  if (verbosity > 0) {
+    debug_dump(stderr);
+  } else if (exit_status != EXIT_SUCCESS) {
+    debug_dump_level(stderr, DEBUG_LEVEL_ERROR);
   }
+}
 
+/* Reports what the library did, on stderr so it stays out of any output */
+static void print_stats(void) {
+  DFS_STATS stats;
 
-  ret = fseek(file, 0, SEEK_END);
-  if (ret == -1) {
-    fprintf(stderr, "Could not calculate file size: (%s)\n", strerror(errno));
-    return DFSUTILS_ERROR_FAILED;
+  if (dfs_stats_get(&stats) != DFS_ERROR_NONE) {
+    return;
   }
 
-  acorn_file.name = strdup(argv[1]);
-  acorn_file.length = ftell(file);
+  fprintf(stderr, "\n%-10s %10s %12s %10s %10s %10s %10s\n", "operation", "count", "total ms", "mean us", "p50 us", "p99 us", "max us");
 
-  ret = dfs_add_file(diskfile, &acorn_file, file);
+  for (int op = 0; op < DFS_STATS_NUM_OF_OPS; op++) {
+    const DFS_STATS_OP_STATS * op_statsp = &(stats.ops[op]);
+    double mean = (op_statsp->count > 0) ? (double)op_statsp->total_ns / (double)op_statsp->count : 0.0;
 
-  free(acorn_file.name);
-  fclose(diskfile);
-  fclose(file);
+    fprintf(stderr, "%-10s %10" PRIu64 " %12.3f %10.1f %10.1f %10.1f %10.1f\n",
+      dfs_stats_op_name((DFS_STATS_OP)op),
+      op_statsp->count,
+      (double)op_statsp->total_ns / 1e6,
+      mean / 1e3,
+      (double)dfs_stats_percentile(op_statsp, 0.5) / 1e3,
+      (double)dfs_stats_percentile(op_statsp, 0.99) / 1e3,
+      (double)op_statsp->max_ns / 1e3);
+  }
 
-  if (ret != DFS_ERROR_NONE) {
-    return dfs_error_to_exit_status(ret);
+  fprintf(stderr, "\n%-10s", "operation");
+  for (int c = 0; c < DFS_STATS_NUM_OF_COUNTERS; c++) {
+    fprintf(stderr, " %15s", dfs_stats_counter_name((DFS_STATS_COUNTER)c));
   }
+  fprintf(stderr, "\n");
 
-  return EXIT_SUCCESS;
+  for (int op = 0; op < DFS_STATS_NUM_OF_OPS; op++) {
+    fprintf(stderr, "%-10s", dfs_stats_op_name((DFS_STATS_OP)op));
+    for (int c = 0; c < DFS_STATS_NUM_OF_COUNTERS; c++) {
+      fprintf(stderr, " %15" PRIu64, stats.ops[op].counters[c]);
+    }
+    fprintf(stderr, "\n");
+  }
 }
 
 int main(int argc, char * argv[]) {
-  FILE * diskfile = NULL;
   int ch;
   bool do_add = false;
+  bool do_compact = false;
   bool do_format = false;
   bool do_extract = false;
   bool do_remove = false;
   bool do_update = false;
+  bool do_batch = false;
+  bool do_split = false;
+  bool do_join = false;
+  bool do_index = false;
+  bool do_query = false;
+  bool do_dedupe = false;
+  bool do_pack = false;
+  bool do_unpack = false;
+  bool do_tar = false;
+  bool do_stats = false;
+  char * endptr;
   int actions = 0;
 
   static struct option longopts[] = {
     { "40",        no_argument,       &tracks,    40},
     { "80",        no_argument,       &tracks,    80},
     { "add",       no_argument,       NULL,       'a'},
+    { "alloc",     required_argument, NULL,       OPTION_ALLOC},
+    { "batch",     no_argument,       NULL,       'b'},
+    { "cache",     required_argument, NULL,       OPTION_CACHE},
+    { "compact",   no_argument,       NULL,       'c'},
+    { "dedupe",    no_argument,       NULL,       OPTION_DEDUPE},
     { "dir",       required_argument, NULL,       'd'},
     { "extract",   no_argument,       NULL,       'x'},
     { "format",    no_argument,       NULL,       'f'},
     { "help",      no_argument,       NULL,       'h'},
+    { "index",     required_argument, NULL,       OPTION_INDEX},
+    { "jobs",      required_argument, NULL,       'j'},
+    { "join",      no_argument,       NULL,       OPTION_JOIN},
+    { "manifest",  required_argument, NULL,       'm'},
+    { "pack",      required_argument, NULL,       OPTION_PACK},
+    { "query",     required_argument, NULL,       OPTION_QUERY},
     { "remove",    no_argument,       NULL,       'r'},
+    { "split",     no_argument,       NULL,       OPTION_SPLIT},
+    { "stats",     no_argument,       NULL,       OPTION_STATS},
+    { "tar",       no_argument,       NULL,       OPTION_TAR},
+    { "template",  required_argument, NULL,       OPTION_TEMPLATE},
+    { "unpack",    required_argument, NULL,       OPTION_UNPACK},
     { "update",    no_argument,       NULL,       'u'},
     { "verbose",   no_argument,       NULL,       'v'},
     { NULL,        0,                 NULL,       0  }
   };
 
-  while ((ch = getopt_long(argc, argv, "ad:fhruvx", longopts, NULL)) != -1) {
+  while ((ch = getopt_long(argc, argv, "abcd:fhj:m:ruvx", longopts, NULL)) != -1) {
     switch(ch) {
       case 0: /* Track values */
         break;
+      case OPTION_ALLOC: /* Allocation policy */
+        if (strcmp(optarg, "first") == 0) {
+          alloc_policy = DFS_ALLOC_FIRST_FIT;
+        } else if (strcmp(optarg, "best") == 0) {
+          alloc_policy = DFS_ALLOC_BEST_FIT;
+        } else if (strcmp(optarg, "append") == 0) {
+          alloc_policy = DFS_ALLOC_APPEND;
+        } else {
+          fprintf(stderr, "Invalid allocation policy: %s\n", optarg);
+          exit(DFSUTILS_INVALID_VALUE);
+        }
+        break;
+      case OPTION_TEMPLATE: /* Format template */
+        template_path = strdup(optarg);
+        break;
+      case OPTION_CACHE: /* Catalogue cache */
+        cache_path = strdup(optarg);
+        break;
+      case OPTION_INDEX: /* Build corpus index */
+        index_path = strdup(optarg);
+        do_index = true;
+        actions++;
+        break;
+      case OPTION_QUERY: /* Query corpus index */
+        index_path = strdup(optarg);
+        do_query = true;
+        actions++;
+        break;
+      case OPTION_DEDUPE: /* Find duplicate files */
+        do_dedupe = true;
+        actions++;
+        break;
+      case OPTION_PACK: /* Pack disk images */
+        pack_path = strdup(optarg);
+        do_pack = true;
+        actions++;
+        break;
+      case OPTION_UNPACK: /* Unpack disk images */
+        pack_path = strdup(optarg);
+        do_unpack = true;
+        actions++;
+        break;
+      case OPTION_TAR: /* Extract to a tar archive */
+        do_tar = true;
+        break;
+      case OPTION_STATS: /* Report library statistics */
+        do_stats = true;
+        break;
+      case OPTION_SPLIT: /* Split double sided image */
+        do_split = true;
+        actions++;
+        break;
+      case OPTION_JOIN: /* Join into double sided image */
+        do_join = true;
+        actions++;
+        break;
       case 'a': /* Add */
         do_add = true;
         actions++;
         break;
+      case 'b': /* Batch of disk images */
+        do_batch = true;
+        break;
+      case 'c': /* Compact */
+        do_compact = true;
+        actions++;
+        break;
       case 'd': /* Target directory */
         target_dir = strdup(optarg);
         break;
@@ -424,7 +2617,17 @@ int main(int argc, char * argv[]) {
         help();
         exit(EXIT_SUCCESS);
         break;
-      case 'r': /* Help */
+      case 'j': /* Worker threads */
+        num_of_jobs = strtol(optarg, &endptr, 0);
+        if (*endptr || num_of_jobs < 1) {
+          fprintf(stderr, "Invalid number of jobs: %s\n", optarg);
+          exit(DFSUTILS_INVALID_VALUE);
+        }
+        break;
+      case 'm': /* Add manifest */
+        manifest_path = strdup(optarg);
+        break;
+      case 'r': /* Remove */
         do_remove = true;
         actions++;
         break;
@@ -448,36 +2651,59 @@ int main(int argc, char * argv[]) {
   argc -= optind;
   argv += optind;
 
+  /* The command reports its own failures, the trace adds the errors the
+     library recorded when it fails and everything else with -v */
+  atexit(dump_trace);
+
+  if (do_stats) {
+    dfs_stats_enable(true);
+    atexit(print_stats);
+  }
+
   /* Check we're not trying to do two things at once */
   if (actions > 1) {
     help();
     exit(DFSUTILS_ERROR_FAILED);
   }
 
-  if (argc < 1) {
+  /* With no predicates a query finds every file, and with no disk images
+     named every image is unpacked */
+  if (do_query) {
+    exit_status = query_index(argc, argv);
+  } else if (do_unpack) {
+    exit_status = unpack_images(argc, argv);
+  } else if (argc < 1) {
     short_help();
-    exit(DFSUTILS_ERROR_FAILED);
-  }
-
-  if (do_add) {
-    return add_file(argc, argv);
-  }
-
-  if (do_extract) {
-    return extract_diskfile(argc, argv);
-  }
-
-  if (do_format) {
-    return format_diskfile(argc, argv);
-  }
-
-  if (do_remove) {
-    return 0;
-  }
-
-  if (do_update) {
-    return 0;
+    exit_status = DFSUTILS_ERROR_FAILED;
+  } else if (do_add) {
+    exit_status = add_file(argc, argv);
+  } else if (do_compact) {
+    exit_status = compact_diskfiles(argc, argv);
+  } else if (do_extract && do_tar) {
+    exit_status = extract_tar(argc, argv, do_batch);
+  } else if (do_extract && do_batch) {
+    exit_status = extract_batch(argc, argv);
+  } else if (do_extract) {
+    exit_status = extract_diskfile(argc, argv);
+  } else if (do_format) {
+    exit_status = format_diskfile(argc, argv);
+  } else if (do_remove) {
+    exit_status = remove_files(argc, argv);
+  } else if (do_update) {
+    exit_status = update_file(argc, argv);
+  } else if (do_index) {
+    exit_status = build_index(argc, argv);
+  } else if (do_dedupe) {
+    exit_status = dedupe_images(argc, argv);
+  } else if (do_pack) {
+    exit_status = pack_images(argc, argv);
+  } else if (do_split || do_join) {
+    exit_status = split_join_diskfiles(argc, argv, do_split);
+  } else if (argc > 1 || cache_path != NULL || strcmp(argv[0], "-") == 0 || is_directory(argv[0])) {
+    exit_status = list_images(argc, argv);
+  } else {
+    exit_status = list_diskfile(argc, argv);
   }
 
-  return list_diskfile(argc, argv);
+  return exit_status;
 }
@@ -0,0 +1,124 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "threadpool.h"
+#include "dfserr.h"
+#include "debug.h"
+
+typedef struct {
+  THREADPOOL_FN fn;
+  void * context;
+  size_t num_of_items;
+  atomic_size_t next_item;
+} THREADPOOL_RUN;
+
+static void * threadpool_worker(void * arg) {
+  THREADPOOL_RUN * runp = (THREADPOOL_RUN *)arg;
+
+  for (;;) {
+    size_t index = atomic_fetch_add_explicit(&(runp->next_item), 1, memory_order_relaxed);
+    if (index >= runp->num_of_items) {
+      break;
+    }
+
+    runp->fn(runp->context, index);
+  }
+
+  return NULL;
+}
+
+/**
+ * \brief Gets the default number of worker threads
+ *
+ * \return the number of online processors, or 1 if that is not known
+ */
+int threadpool_default_threads(void) {
+  long num_of_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  return (num_of_cpus > 0) ? (int)num_of_cpus : 1;
+}
+
+/**
+ * \brief Runs a function over a range of items on a pool of threads
+ *
+ * \param num_of_threads the number of threads to use
+ * \param num_of_items the number of items
+ * \param fn the work function
+ * \param context pointer passed to the work function
+ * \return 0 on success or an error
+ */
+int threadpool_run(int num_of_threads, size_t num_of_items, THREADPOOL_FN fn, void * context) {
+  THREADPOOL_RUN run;
+  pthread_t * threads;
+  int num_of_started = 0;
+
+  if (fn == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  if (num_of_threads < 1) {
+    num_of_threads = 1;
+  }
+
+  if ((size_t)num_of_threads > num_of_items) {
+    num_of_threads = (num_of_items > 0) ? (int)num_of_items : 1;
+  }
+
+  run.fn = fn;
+  run.context = context;
+  run.num_of_items = num_of_items;
+  atomic_init(&(run.next_item), 0);
+
+  threads = (pthread_t *)calloc((size_t)num_of_threads, sizeof(pthread_t));
+  if (threads == NULL) {
+    return DFS_ERROR_FAILED;
+  }
+
+  /* The calling thread is the first worker */
+  for (int i = 1; i < num_of_threads; i++) {
+    int err = pthread_create(&(threads[num_of_started]), NULL, threadpool_worker, &run);
+    if (err != 0) {
+      /* Carry on with the threads we have */
+      DEBUG_LOG(DEBUG_LEVEL_WARNING, "Could not start worker thread: %s", strerror(err));
+      break;
+    }
+
+    num_of_started++;
+  }
+
+  threadpool_worker(&run);
+
+  for (int i = 0; i < num_of_started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  free(threads);
+  return DFS_ERROR_NONE;
+}
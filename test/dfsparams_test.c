@@ -0,0 +1,180 @@
+/*
+MIT License
+
+Copyright (c) 2022 Cyberspice cyberspice@cyberspice.org.uk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Checks the vector kernels of dfs_decode_file_params_with() against the
+   scalar kernel, over random tables of every length */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dfs.h"
+#include "dfsparams.h"
+
+#define TABLES_PER_LENGTH 1000
+
+/* Anything a kernel leaves alone keeps this */
+#define UNTOUCHED 0xa5
+
+typedef struct {
+  DFS_PARAMS_KERNEL kernel;
+  const char * name;
+} KERNEL;
+
+static const KERNEL vector_kernels[] = {
+  { DFS_PARAMS_KERNEL_SSE2, "SSE2" },
+  { DFS_PARAMS_KERNEL_AVX2, "AVX2" }
+};
+
+#define NUM_OF_VECTOR_KERNELS (sizeof(vector_kernels) / sizeof(vector_kernels[0]))
+
+/* xorshift64* */
+static uint64_t next_random(uint64_t * statep) {
+  *statep ^= *statep >> 12;
+  *statep ^= *statep << 25;
+  *statep ^= *statep >> 27;
+  return *statep * 0x2545f4914f6cdd1dULL;
+}
+
+/* Processors without a kernel skip it rather than fail */
+static bool kernel_present(DFS_PARAMS_KERNEL kernel) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  switch (kernel) {
+    case DFS_PARAMS_KERNEL_SSE2:
+      return __builtin_cpu_supports("sse2");
+    case DFS_PARAMS_KERNEL_AVX2:
+      return __builtin_cpu_supports("avx2");
+    default:
+      return true;
+  }
+#else
+  return kernel == DFS_PARAMS_KERNEL_SCALAR;
+#endif
+}
+
+static bool decode(DFS_PARAMS_KERNEL kernel, const DFS_FILE_PARAMS * fileparams, int num_of_files, DFS_FILE_PARAMS_TABLE * tablep) {
+  memset(tablep, UNTOUCHED, sizeof(DFS_FILE_PARAMS_TABLE));
+  return dfs_decode_file_params_with(kernel, fileparams, num_of_files, tablep) == DFS_ERROR_NONE;
+}
+
+/* Every kernel must give the same table as the scalar kernel, and leave
+   the entries past the last file alone */
+static int compare_random_tables(const KERNEL * kernelp) {
+  uint64_t state = 1;
+  int failures = 0;
+
+  for (int num_of_files = 0; num_of_files <= DFS_MAX_FILES; num_of_files++) {
+    for (int t = 0; t < TABLES_PER_LENGTH; t++) {
+      DFS_FILE_PARAMS fileparams[DFS_MAX_FILES];
+      DFS_FILE_PARAMS_TABLE expected;
+      DFS_FILE_PARAMS_TABLE actual;
+      uint8_t * bytes = (uint8_t *)fileparams;
+
+      for (size_t b = 0; b < sizeof(fileparams); b++) {
+        bytes[b] = (uint8_t)next_random(&state);
+      }
+
+      if (!decode(DFS_PARAMS_KERNEL_SCALAR, fileparams, num_of_files, &expected) ||
+          !decode(kernelp->kernel, fileparams, num_of_files, &actual)) {
+        fprintf(stderr, "%s: could not decode %d files\n", kernelp->name, num_of_files);
+        return 1;
+      }
+
+      if (memcmp(&expected, &actual, sizeof(expected)) != 0) {
+        fprintf(stderr, "%s: differs from the scalar kernel for %d files, table %d\n", kernelp->name, num_of_files, t);
+        failures++;
+        break;
+      }
+    }
+  }
+
+  return failures;
+}
+
+/* The top two bits of the exec address are bits 6 and 7 of the packed byte.
+   An address with only one of them set was once shifted as if it were a
+   load address */
+static int check_exec_high_bits(const KERNEL * kernelp) {
+  static const struct {
+    uint8_t packed;
+    uint32_t exec_address;
+  } cases[] = {
+    { 0x40, 0x00011234 },
+    { 0x80, 0x00021234 },
+    { 0xc0, 0xffff1234 }
+  };
+  int failures = 0;
+
+  for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+    DFS_FILE_PARAMS fileparams[DFS_MAX_FILES];
+    DFS_FILE_PARAMS_TABLE table;
+
+    memset(fileparams, 0, sizeof(fileparams));
+    for (int i = 0; i < DFS_MAX_FILES; i++) {
+      fileparams[i].exec_address_low = 0x34;
+      fileparams[i].exec_address_high = 0x12;
+      fileparams[i].start_sector_high = cases[c].packed;
+    }
+
+    if (!decode(kernelp->kernel, fileparams, DFS_MAX_FILES, &table)) {
+      fprintf(stderr, "%s: could not decode %d files\n", kernelp->name, DFS_MAX_FILES);
+      return 1;
+    }
+
+    for (int i = 0; i < DFS_MAX_FILES; i++) {
+      if (table.exec_addresses[i] != cases[c].exec_address || table.load_addresses[i] != 0 || table.lengths[i] != 0) {
+        fprintf(stderr, "%s: packed byte 0x%02x gave exec address 0x%08x, expected 0x%08x\n",
+          kernelp->name,
+          cases[c].packed,
+          table.exec_addresses[i],
+          cases[c].exec_address);
+        failures++;
+        break;
+      }
+    }
+  }
+
+  return failures;
+}
+
+int main(void) {
+  const KERNEL scalar = { DFS_PARAMS_KERNEL_SCALAR, "scalar" };
+  int failures = check_exec_high_bits(&scalar);
+
+  for (size_t k = 0; k < NUM_OF_VECTOR_KERNELS; k++) {
+    const KERNEL * kernelp = &(vector_kernels[k]);
+
+    if (!kernel_present(kernelp->kernel)) {
+      printf("%s: not supported by this processor, skipped\n", kernelp->name);
+      continue;
+    }
+
+    failures += compare_random_tables(kernelp);
+    failures += check_exec_high_bits(kernelp);
+    printf("%s: checked\n", kernelp->name);
+  }
+
+  return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}